@@ -366,6 +366,65 @@ ngx_buffer_cache_fetch(
 	return result;
 }
 
+// fetches several keys while holding the lock once, buffers that are already set (data != NULL) are skipped,
+// returns the number of keys that were fetched
+ngx_uint_t
+ngx_buffer_cache_fetch_batch(
+	ngx_buffer_cache_t* cache,
+	u_char** keys,
+	ngx_str_t* buffers,
+	ngx_uint_t count)
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_uint_t result = 0;
+	ngx_uint_t i;
+	uint32_t hash;
+
+	ngx_shmtx_lock(&cache->shpool->mutex);
+
+	if (!sh->reset)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (buffers[i].data != NULL)
+			{
+				continue;
+			}
+
+			hash = ngx_crc32_short(keys[i], BUFFER_CACHE_KEY_SIZE);
+
+			entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, keys[i], hash);
+			if (entry != NULL && entry->state == CES_READY &&
+				(cache->expiration == 0 || ngx_time() < (time_t)(entry->write_time + cache->expiration)))
+			{
+				result++;
+
+				// update stats
+				sh->stats.fetch_hit++;
+				sh->stats.fetch_bytes += entry->buffer_size;
+
+				// copy buffer pointer and size
+				buffers[i].data = entry->start_offset;
+				buffers[i].len = entry->buffer_size;
+
+				// Note: setting the access time of the entry and cache to prevent it 
+				//		from being freed while the caller uses the buffer
+				sh->access_time = entry->access_time = ngx_time();
+			}
+			else
+			{
+				// update stats
+				sh->stats.fetch_miss++;
+			}
+		}
+	}
+
+	ngx_shmtx_unlock(&cache->shpool->mutex);
+
+	return result;
+}
+
 ngx_flag_t
 ngx_buffer_cache_store_gather(
 	ngx_buffer_cache_t* cache, 
@@ -34,6 +34,12 @@ ngx_flag_t ngx_buffer_cache_fetch(
 	u_char* key,
 	ngx_str_t* buffer);
 
+ngx_uint_t ngx_buffer_cache_fetch_batch(
+	ngx_buffer_cache_t* cache,
+	u_char** keys,
+	ngx_str_t* buffers,
+	ngx_uint_t count);
+
 ngx_flag_t ngx_buffer_cache_store(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
@@ -113,6 +113,17 @@ ngx_child_request_wev_handler(ngx_http_request_t *r)
 		return;
 	}
 
+	// Note: when several parallel child requests complete before the parent runs, their contexts are 
+	//		stacked on the parent, post the parent again so that the next completion gets handled as well
+	if (r->write_event_handler == ngx_child_request_wev_handler)
+	{
+#if defined(nginx_version) && nginx_version >= 8012
+		ngx_http_post_request(r, NULL);
+#else
+		ngx_http_post_request(r);
+#endif
+	}
+
 	// code taken from echo-nginx-module to work around nginx subrequest issues
 	if (r == r->connection->data && r->postponed) {
 
@@ -191,7 +191,8 @@ ngx_file_reader_init_async(
 	state->callback_context = callback_context;
 #endif // NGX_HAVE_FILE_AIO
 
-	open_context = *context;
+	// Note: when context is null, a new open context is allocated, this is used for running several opens concurrently
+	open_context = context != NULL ? *context : NULL;
 
 	if (open_context == NULL)
 	{
@@ -205,7 +206,10 @@ ngx_file_reader_init_async(
 
 		open_context->task = NULL;		// all other fields explicitly set below
 
-		*context = open_context;
+		if (context != NULL)
+		{
+			*context = open_context;
+		}
 	}
 
 	open_context->state = state;
@@ -322,6 +326,306 @@ ngx_file_reader_enable_directio(ngx_file_reader_state_t* state)
 	return NGX_OK;
 }
 
+void
+ngx_file_reader_prefetch(void* context, off_t offset, size_t size)
+{
+#if (NGX_HAVE_POSIX_FADVISE)
+	ngx_file_reader_state_t* state = context;
+	ngx_err_t err;
+
+	if (offset >= state->file_size)
+	{
+		return;
+	}
+
+	// Note: posix_fadvise returns the error code, it does not set errno
+	err = posix_fadvise(state->file.fd, offset, ngx_min((off_t)size, state->file_size - offset), POSIX_FADV_WILLNEED);
+	if (err != 0)
+	{
+		ngx_log_error(NGX_LOG_WARN, state->log, err,
+			"ngx_file_reader_prefetch: posix_fadvise \"%s\" failed", state->file.name.data);
+	}
+#endif // NGX_HAVE_POSIX_FADVISE
+}
+
+typedef struct {
+	u_char* addr;
+	size_t size;
+	ngx_log_t* log;
+} ngx_file_reader_map_cleanup_t;
+
+static void
+ngx_file_reader_unmap(void* data)
+{
+	ngx_file_reader_map_cleanup_t* cln = data;
+
+	if (munmap(cln->addr, cln->size) == -1)
+	{
+		ngx_log_error(NGX_LOG_ALERT, cln->log, ngx_errno,
+			"ngx_file_reader_unmap: munmap(%uz) failed", cln->size);
+	}
+}
+
+ngx_int_t
+ngx_file_reader_map(void* context, off_t start, off_t end, u_char** data, size_t* size)
+{
+	ngx_file_reader_state_t* state = context;
+	ngx_file_reader_map_cleanup_t* map_cln;
+	ngx_pool_cleanup_t* cln;
+	u_char* addr;
+	off_t aligned_start;
+	size_t map_size;
+
+	if (state->file_size <= 0 || end > state->file_size || start >= end)
+	{
+		return NGX_DECLINED;
+	}
+
+	cln = ngx_pool_cleanup_add(state->r->pool, sizeof(*map_cln));
+	if (cln == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
+			"ngx_file_reader_map: ngx_pool_cleanup_add failed");
+		return NGX_ERROR;
+	}
+
+	// map only the requested range, the offset of mmap must be page aligned
+	aligned_start = start & ~((off_t)ngx_pagesize - 1);
+	map_size = end - aligned_start;
+
+	// Note: the mapping is private and writable, since some filters (e.g. encryption) modify the frames in place,
+	//		the modified pages are copied on write and the file itself is never changed
+	addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, state->file.fd, aligned_start);
+	if (addr == MAP_FAILED)
+	{
+		ngx_log_error(NGX_LOG_ERR, state->log, ngx_errno,
+			"ngx_file_reader_map: mmap \"%s\" failed", state->file.name.data);
+		return NGX_DECLINED;
+	}
+
+	map_cln = cln->data;
+	map_cln->addr = addr;
+	map_cln->size = map_size;
+	map_cln->log = state->log;
+	cln->handler = ngx_file_reader_unmap;
+
+	// ask the kernel to read ahead the mapped range
+	if (madvise(addr, map_size, MADV_WILLNEED) == -1)
+	{
+		ngx_log_error(NGX_LOG_WARN, state->log, ngx_errno,
+			"ngx_file_reader_map: madvise \"%s\" failed", state->file.name.data);
+	}
+
+	*data = addr + (start - aligned_start);
+	*size = end - start;
+
+	return NGX_OK;
+}
+
+ngx_int_t
+ngx_file_reader_map_file_no_pool(ngx_file_reader_mapping_t* mapping)
+{
+	ngx_file_info_t fi;
+	ngx_fd_t fd;
+	u_char* addr;
+	off_t size;
+
+	fd = ngx_open_file(mapping->path, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+	if (fd == NGX_INVALID_FILE)
+	{
+		if (ngx_errno != NGX_ENOENT)
+		{
+			ngx_log_error(NGX_LOG_ERR, mapping->log, ngx_errno,
+				"ngx_file_reader_map_file_no_pool: " ngx_open_file_n " \"%s\" failed", mapping->path);
+		}
+		return NGX_DECLINED;
+	}
+
+	if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR)
+	{
+		ngx_log_error(NGX_LOG_ERR, mapping->log, ngx_errno,
+			"ngx_file_reader_map_file_no_pool: " ngx_fd_info_n " \"%s\" failed", mapping->path);
+		goto failed;
+	}
+
+	size = ngx_file_size(&fi);
+	if (size <= 0)
+	{
+		goto failed;
+	}
+
+	addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		ngx_log_error(NGX_LOG_ERR, mapping->log, ngx_errno,
+			"ngx_file_reader_map_file_no_pool: mmap \"%s\" failed", mapping->path);
+		goto failed;
+	}
+
+	// Note: the mapping remains valid after the file is closed
+	ngx_close_file(fd);
+
+	mapping->addr = addr;
+	mapping->size = size;
+	mapping->mtime = ngx_file_mtime(&fi);
+
+	return NGX_OK;
+
+failed:
+
+	ngx_close_file(fd);
+	return NGX_DECLINED;
+}
+
+ngx_int_t
+ngx_file_reader_mapping_add_cleanup(ngx_http_request_t* r, ngx_file_reader_mapping_t* mapping)
+{
+	ngx_file_reader_map_cleanup_t* map_cln;
+	ngx_pool_cleanup_t* cln;
+
+	cln = ngx_pool_cleanup_add(r->pool, sizeof(*map_cln));
+	if (cln == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_file_reader_mapping_add_cleanup: ngx_pool_cleanup_add failed");
+		munmap(mapping->addr, mapping->size);
+		return NGX_ERROR;
+	}
+
+	map_cln = cln->data;
+	map_cln->addr = mapping->addr;
+	map_cln->size = mapping->size;
+	map_cln->log = r->connection->log;
+	cln->handler = ngx_file_reader_unmap;
+
+	return NGX_OK;
+}
+
+ngx_int_t
+ngx_file_reader_map_file(ngx_http_request_t* r, u_char* path, ngx_str_t* data, time_t* mtime)
+{
+	ngx_file_reader_mapping_t mapping;
+	ngx_int_t rc;
+
+	mapping.path = path;
+	mapping.log = r->connection->log;
+
+	rc = ngx_file_reader_map_file_no_pool(&mapping);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	rc = ngx_file_reader_mapping_add_cleanup(r, &mapping);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	data->data = mapping.addr;
+	data->len = mapping.size;
+
+	if (mtime != NULL)
+	{
+		*mtime = mapping.mtime;
+	}
+
+	return NGX_OK;
+}
+
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_request_t* r;
+	ngx_file_reader_mapping_t mapping;
+	ngx_file_reader_map_callback_t callback;
+	void* callback_context;
+	ngx_int_t rc;
+} ngx_file_reader_map_file_task_ctx_t;
+
+static void
+ngx_file_reader_map_file_thread_handler(void *data, ngx_log_t *log)
+{
+	ngx_file_reader_map_file_task_ctx_t* task_ctx = data;
+
+	task_ctx->rc = ngx_file_reader_map_file_no_pool(&task_ctx->mapping);
+}
+
+static void
+ngx_file_reader_map_file_task_event_handler(ngx_event_t *ev)
+{
+	ngx_file_reader_map_file_task_ctx_t* task_ctx = ev->data;
+	ngx_http_request_t* r = task_ctx->r;
+	ngx_str_t data;
+	ngx_int_t rc;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	rc = task_ctx->rc;
+	if (rc == NGX_OK)
+	{
+		rc = ngx_file_reader_mapping_add_cleanup(r, &task_ctx->mapping);
+	}
+
+	if (rc == NGX_OK)
+	{
+		data.data = task_ctx->mapping.addr;
+		data.len = task_ctx->mapping.size;
+	}
+	else
+	{
+		data.data = NULL;
+		data.len = 0;
+	}
+
+	task_ctx->callback(task_ctx->callback_context, rc, &data, task_ctx->mapping.mtime);
+}
+
+ngx_int_t
+ngx_file_reader_map_file_async(
+	ngx_http_request_t* r,
+	ngx_thread_pool_t* thread_pool,
+	u_char* path,
+	ngx_file_reader_map_callback_t callback,
+	void* callback_context)
+{
+	ngx_file_reader_map_file_task_ctx_t* task_ctx;
+	ngx_thread_task_t* task;
+
+	task = ngx_thread_task_alloc(r->pool, sizeof(*task_ctx));
+	if (task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_file_reader_map_file_async: ngx_thread_task_alloc failed");
+		return NGX_ERROR;
+	}
+
+	task_ctx = task->ctx;
+	task_ctx->r = r;
+	task_ctx->mapping.path = path;
+	task_ctx->mapping.log = r->connection->log;
+	task_ctx->mapping.mtime = 0;
+	task_ctx->callback = callback;
+	task_ctx->callback_context = callback_context;
+
+	task->handler = ngx_file_reader_map_file_thread_handler;
+	task->event.data = task_ctx;
+	task->event.handler = ngx_file_reader_map_file_task_event_handler;
+
+	if (ngx_thread_task_post(thread_pool, task) != NGX_OK)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_file_reader_map_file_async: ngx_thread_task_post failed");
+		return NGX_DECLINED;
+	}
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	return NGX_AGAIN;
+}
+#endif // NGX_THREADS
+
 size_t 
 ngx_file_reader_get_size(void* context)
 {
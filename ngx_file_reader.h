@@ -16,6 +16,7 @@
 
 // typedefs
 typedef void (*ngx_async_read_callback_t)(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
+typedef void (*ngx_file_reader_map_callback_t)(void* context, ngx_int_t rc, ngx_str_t* data, time_t mtime);
 
 typedef struct {
 	ngx_http_request_t *r;
@@ -32,6 +33,14 @@ typedef struct {
 #endif // NGX_HAVE_FILE_AIO
 } ngx_file_reader_state_t;
 
+typedef struct {
+	u_char* path;
+	ngx_log_t* log;
+	u_char* addr;
+	off_t size;
+	time_t mtime;
+} ngx_file_reader_mapping_t;
+
 // functions
 ngx_int_t ngx_file_reader_init(
 	ngx_file_reader_state_t* state,
@@ -66,4 +75,29 @@ ngx_int_t ngx_async_file_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, si
 
 ngx_int_t ngx_file_reader_enable_directio(ngx_file_reader_state_t* state);
 
+void ngx_file_reader_prefetch(void* context, off_t offset, size_t size);
+
+// maps the range [start, end) of the file, data points to offset start
+ngx_int_t ngx_file_reader_map(void* context, off_t start, off_t end, u_char** data, size_t* size);
+
+// maps a whole file for reading, returns NGX_DECLINED when the file does not exist or could not be mapped
+ngx_int_t ngx_file_reader_map_file(ngx_http_request_t* r, u_char* path, ngx_str_t* data, time_t* mtime);
+
+// same as ngx_file_reader_map_file, without using the request pool, so that it can run on a thread pool.
+// on success, ngx_file_reader_mapping_add_cleanup must be called on the event loop to unmap the file with the request
+ngx_int_t ngx_file_reader_map_file_no_pool(ngx_file_reader_mapping_t* mapping);
+
+ngx_int_t ngx_file_reader_mapping_add_cleanup(ngx_http_request_t* r, ngx_file_reader_mapping_t* mapping);
+
+#if (NGX_THREADS)
+// maps a whole file on a thread pool, returns NGX_AGAIN when the task was posted, the callback is called on completion.
+// returns NGX_DECLINED when the task could not be posted, the caller should use ngx_file_reader_map_file instead
+ngx_int_t ngx_file_reader_map_file_async(
+	ngx_http_request_t* r,
+	ngx_thread_pool_t* thread_pool,
+	u_char* path,
+	ngx_file_reader_map_callback_t callback,
+	void* callback_context);
+#endif // NGX_THREADS
+
 #endif // _NGX_FILE_READER_H_INCLUDED_
@@ -5,6 +5,7 @@
 #include "ngx_http_vod_module.h"
 #include "ngx_http_vod_status.h"
 #include "ngx_perf_counters.h"
+#include "ngx_read_predictor.h"
 #include "ngx_buffer_cache.h"
 #include "vod/media_set_parser.h"
 #include "vod/buffer_pool.h"
@@ -81,16 +82,23 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->segmenter.gop_look_behind = NGX_CONF_UNSET_UINT;
 	conf->force_playlist_type_vod = NGX_CONF_UNSET;
 	conf->force_continuous_timestamps = NGX_CONF_UNSET;
+	conf->chunked_segments = NGX_CONF_UNSET;
 	conf->initial_read_size = NGX_CONF_UNSET_SIZE;
 	conf->max_metadata_size = NGX_CONF_UNSET_SIZE;
 	conf->max_frames_size = NGX_CONF_UNSET_SIZE;
 	conf->cache_buffer_size = NGX_CONF_UNSET_SIZE;
+	conf->mmap_sources = NGX_CONF_UNSET;
+	conf->index_sidecar = NGX_CONF_UNSET;
 	conf->max_upstream_headers_size = NGX_CONF_UNSET_SIZE;
 	conf->ignore_edit_list = NGX_CONF_UNSET;
 	conf->parse_hdlr_name = NGX_CONF_UNSET;
 	conf->max_mapping_response_size = NGX_CONF_UNSET_SIZE;
+	conf->max_mapping_concurrency = NGX_CONF_UNSET_UINT;
 
 	conf->metadata_cache = NGX_CONF_UNSET_PTR;
+	conf->generated_cache = NGX_CONF_UNSET_PTR;
+	conf->generated_cache_file_expiration = NGX_CONF_UNSET;
+	conf->filtered_audio_cache = NGX_CONF_UNSET_PTR;
 	conf->dynamic_mapping_cache = NGX_CONF_UNSET_PTR;
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
 	{
@@ -113,6 +121,10 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 
 #if (NGX_THREADS)
 	conf->open_file_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->processing_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->audio_filter_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->parse_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->parse_thread_min_size = NGX_CONF_UNSET_SIZE;
 #endif // NGX_THREADS
 
 	// submodules
@@ -163,6 +175,7 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_uint_value(conf->segmenter.gop_look_behind, prev->segmenter.gop_look_behind, 10000);
 	ngx_conf_merge_value(conf->force_playlist_type_vod, prev->force_playlist_type_vod, 0);
 	ngx_conf_merge_value(conf->force_continuous_timestamps, prev->force_continuous_timestamps, 0);
+	ngx_conf_merge_value(conf->chunked_segments, prev->chunked_segments, 0);
 
 	if (conf->secret_key == NULL)
 	{
@@ -185,6 +198,15 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	}
 
 	ngx_conf_merge_ptr_value(conf->metadata_cache, prev->metadata_cache, NULL);
+	ngx_conf_merge_ptr_value(conf->generated_cache, prev->generated_cache, NULL);
+	if (conf->generated_cache_path.data == NULL)
+	{
+		conf->generated_cache_path = prev->generated_cache_path;
+		conf->generated_cache_file_expiration = prev->generated_cache_file_expiration;
+	}
+	ngx_conf_merge_str_value(conf->generated_cache_path, prev->generated_cache_path, "");
+	ngx_conf_merge_sec_value(conf->generated_cache_file_expiration, prev->generated_cache_file_expiration, 0);
+	ngx_conf_merge_ptr_value(conf->filtered_audio_cache, prev->filtered_audio_cache, NULL);
 	ngx_conf_merge_ptr_value(conf->dynamic_mapping_cache, prev->dynamic_mapping_cache, NULL);
 
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
@@ -202,6 +224,8 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_size_value(conf->max_metadata_size, prev->max_metadata_size, 128 * 1024 * 1024);
 	ngx_conf_merge_size_value(conf->max_frames_size, prev->max_frames_size, 16 * 1024 * 1024);
 	ngx_conf_merge_size_value(conf->cache_buffer_size, prev->cache_buffer_size, 256 * 1024);
+	ngx_conf_merge_value(conf->mmap_sources, prev->mmap_sources, 0);
+	ngx_conf_merge_value(conf->index_sidecar, prev->index_sidecar, 0);
 	ngx_conf_merge_size_value(conf->max_upstream_headers_size, prev->max_upstream_headers_size, 4 * 1024);
 	
 	if (conf->output_buffer_pool == NULL)
@@ -230,6 +254,7 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_str_value(conf->path_response_prefix, prev->path_response_prefix, "{\"sequences\":[{\"clips\":[{\"type\":\"source\",\"path\":\"");
 	ngx_conf_merge_str_value(conf->path_response_postfix, prev->path_response_postfix, "\"}]}]}");
 	ngx_conf_merge_size_value(conf->max_mapping_response_size, prev->max_mapping_response_size, 1024);
+	ngx_conf_merge_uint_value(conf->max_mapping_concurrency, prev->max_mapping_concurrency, 1);
 	if (conf->notification_uri == NULL)
 	{
 		conf->notification_uri = prev->notification_uri;
@@ -299,8 +324,17 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 		conf->perf_counters_zone = prev->perf_counters_zone;
 	}
 
+	if (conf->read_predictor_zone == NULL)
+	{
+		conf->read_predictor_zone = prev->read_predictor_zone;
+	}
+
 #if (NGX_THREADS)
 	ngx_conf_merge_ptr_value(conf->open_file_thread_pool, prev->open_file_thread_pool, NULL);
+	ngx_conf_merge_ptr_value(conf->processing_thread_pool, prev->processing_thread_pool, NULL);
+	ngx_conf_merge_ptr_value(conf->audio_filter_thread_pool, prev->audio_filter_thread_pool, NULL);
+	ngx_conf_merge_ptr_value(conf->parse_thread_pool, prev->parse_thread_pool, NULL);
+	ngx_conf_merge_size_value(conf->parse_thread_min_size, prev->parse_thread_min_size, 256 * 1024);
 #endif // NGX_THREADS
 
 	// validate vod_upstream / vod_upstream_host_header used when needed
@@ -609,11 +643,15 @@ ngx_http_vod_manifest_segment_durations_mode_command(ngx_conf_t *cf, ngx_command
 	{
 		vod_conf->segmenter.get_segment_durations = segmenter_get_segment_durations_accurate;
 	}
+	else if (ngx_strcasecmp(value[1].data, (u_char *) "key_frames") == 0)
+	{
+		vod_conf->segmenter.get_segment_durations = segmenter_get_segment_durations_key_frames;
+	}
 	else
 	{
 		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
 			"invalid value \"%s\" in \"%s\" directive, "
-			"it must be \"estimate\" or \"accurate\"",
+			"it must be \"estimate\", \"accurate\" or \"key_frames\"",
 			value[1].data, cmd->name.data);
 		return NGX_CONF_ERROR;
 	}
@@ -683,6 +721,39 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 	return NGX_CONF_OK;
 }
 
+static char *
+ngx_http_vod_generated_cache_path_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+	ngx_http_vod_loc_conf_t *vod_conf = conf;
+	ngx_str_t  *value;
+
+	value = cf->args->elts;
+
+	if (vod_conf->generated_cache_path.data != NULL)
+	{
+		return "is duplicate";
+	}
+
+	vod_conf->generated_cache_path = value[1];
+
+	if (cf->args->nelts > 2)
+	{
+		vod_conf->generated_cache_file_expiration = ngx_parse_time(&value[2], 1);
+		if (vod_conf->generated_cache_file_expiration == (time_t)NGX_ERROR)
+		{
+			ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+				"invalid expiration %V", &value[2]);
+			return NGX_CONF_ERROR;
+		}
+	}
+	else
+	{
+		vod_conf->generated_cache_file_expiration = 0;
+	}
+
+	return NGX_CONF_OK;
+}
+
 static char *
 ngx_http_vod_perf_counters_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -713,6 +784,36 @@ ngx_http_vod_perf_counters_command(ngx_conf_t *cf, ngx_command_t *cmd, void *con
 	return NGX_CONF_OK;
 }
 
+static char *
+ngx_http_vod_read_predictor_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+	ngx_shm_zone_t **zone = (ngx_shm_zone_t **)((u_char*)conf + cmd->offset);
+	ngx_str_t  *value;
+
+	value = cf->args->elts;
+
+	if (*zone != NULL)
+	{
+		return "is duplicate";
+	}
+
+	if (ngx_strcmp(value[1].data, "off") == 0)
+	{
+		*zone = NULL;
+		return NGX_CONF_OK;
+	}
+
+	*zone = ngx_read_predictor_create_zone(cf, &value[1], &ngx_http_vod_module);
+	if (*zone == NULL)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"failed to create read predictor zone");
+		return NGX_CONF_ERROR;
+	}
+
+	return NGX_CONF_OK;
+}
+
 static char*
 ngx_http_vod_buffer_pool_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -943,6 +1044,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, force_continuous_timestamps),
 	NULL },
 
+	{ ngx_string("vod_chunked_segments"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, chunked_segments),
+	NULL },
+
 	{ ngx_string("vod_secret_key"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_http_set_complex_value_slot,
@@ -993,6 +1101,27 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, response_cache[CACHE_TYPE_LIVE]),
 	NULL },
 
+	{ ngx_string("vod_generated_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, generated_cache),
+	NULL },
+
+	{ ngx_string("vod_generated_cache_path"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE12,
+	ngx_http_vod_generated_cache_path_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	0,
+	NULL },
+
+	{ ngx_string("vod_filtered_audio_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, filtered_audio_cache),
+	NULL },
+
 	{ ngx_string("vod_initial_read_size"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_size_slot,
@@ -1021,6 +1150,20 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, cache_buffer_size),
 	NULL },
 
+	{ ngx_string("vod_mmap_sources"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, mmap_sources),
+	NULL },
+
+	{ ngx_string("vod_index_sidecar"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, index_sidecar),
+	NULL },
+
 	{ ngx_string("vod_ignore_edit_list"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_flag_slot,
@@ -1107,6 +1250,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, max_mapping_response_size),
 	NULL },
 
+	{ ngx_string("vod_max_mapping_concurrency"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, max_mapping_concurrency),
+	NULL },
+
 	{ ngx_string("vod_notification_uri"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_http_set_complex_value_slot,
@@ -1324,6 +1474,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, perf_counters_zone),
 	NULL },
 
+	{ ngx_string("vod_read_predictor"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_http_vod_read_predictor_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, read_predictor_zone),
+	NULL },
+
 	{ ngx_string("vod_output_buffer_pool"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE2,
 	ngx_http_vod_buffer_pool_command,
@@ -1338,6 +1495,34 @@ ngx_command_t ngx_http_vod_commands[] = {
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, open_file_thread_pool),
 	NULL },
+
+	{ ngx_string("vod_processing_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, processing_thread_pool),
+	NULL },
+
+	{ ngx_string("vod_audio_filter_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, audio_filter_thread_pool),
+	NULL },
+
+	{ ngx_string("vod_parse_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, parse_thread_pool),
+	NULL },
+
+	{ ngx_string("vod_parse_thread_min_size"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_size_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, parse_thread_min_size),
+	NULL },
 #endif // NGX_THREADS
 
 #include "ngx_http_vod_dash_commands.h"
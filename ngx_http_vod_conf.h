@@ -48,10 +48,16 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_http_complex_value_t *segments_base_url;
 	ngx_buffer_cache_t* metadata_cache;
 	ngx_buffer_cache_t* response_cache[CACHE_TYPE_COUNT];
+	ngx_buffer_cache_t* generated_cache;
+	ngx_str_t generated_cache_path;
+	time_t generated_cache_file_expiration;
+	ngx_buffer_cache_t* filtered_audio_cache;
 	size_t initial_read_size;
 	size_t max_metadata_size;
 	size_t max_frames_size;
 	size_t cache_buffer_size;
+	ngx_flag_t mmap_sources;
+	ngx_flag_t index_sidecar;
 	buffer_pool_t* output_buffer_pool;
 	size_t max_upstream_headers_size;
 	ngx_flag_t ignore_edit_list;
@@ -63,6 +69,7 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_str_t path_response_prefix;
 	ngx_str_t path_response_postfix;
 	size_t max_mapping_response_size;
+	ngx_uint_t max_mapping_concurrency;
 	ngx_http_complex_value_t* notification_uri;
 	ngx_http_complex_value_t* dynamic_clip_map_uri;
 	ngx_http_complex_value_t* source_clip_map_uri;
@@ -74,6 +81,7 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_table_elt_t proxy_header;
 	ngx_flag_t force_playlist_type_vod;
 	ngx_flag_t force_continuous_timestamps;
+	ngx_flag_t chunked_segments;
 
 	time_t expires[EXPIRES_TYPE_COUNT];
 	time_t last_modified_time;
@@ -97,9 +105,14 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_str_t lang_param_name;
 
 	ngx_shm_zone_t* perf_counters_zone;
+	ngx_shm_zone_t* read_predictor_zone;
 
 #if (NGX_THREADS)
 	ngx_thread_pool_t *open_file_thread_pool;
+	ngx_thread_pool_t *processing_thread_pool;
+	ngx_thread_pool_t *audio_filter_thread_pool;
+	ngx_thread_pool_t *parse_thread_pool;
+	size_t parse_thread_min_size;
 #endif // NGX_THREADS
 
 	// derived fields
@@ -405,7 +405,7 @@ ngx_http_vod_dash_handle_vtt_file(
 }
 
 static const ngx_http_vod_request_t dash_manifest_request = {
-	REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE,
+	REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE | REQUEST_FLAG_PER_CLIP_MEDIA_INFO,
 	PARSE_FLAG_DURATION_LIMITS_AND_TOTAL_SIZE | PARSE_FLAG_INITIAL_PTS_DELAY | PARSE_FLAG_CODEC_NAME,
 	REQUEST_CLASS_MANIFEST,
 	SUPPORTED_CODECS | VOD_CODEC_FLAG(WEBVTT),
@@ -3,6 +3,7 @@
 #include "ngx_http_vod_submodule.h"
 #include "ngx_http_vod_utils.h"
 #include "vod/subtitle/webvtt_builder.h"
+#include "vod/manifest_utils.h"
 #include "vod/hls/hls_muxer.h"
 #include "vod/mp4/mp4_muxer.h"
 #include "vod/mp4/mp4_fragment.h"
@@ -23,6 +24,18 @@
 	VOD_CODEC_FLAG(EAC3) | \
 	VOD_CODEC_FLAG(MP3))
 
+// typedefs
+typedef struct {
+	hls_mpegts_muxer_conf_t muxer_conf;
+	uint32_t encryption_type;
+} ngx_http_vod_hls_muxer_params_t;
+
+typedef struct {
+	ngx_http_vod_submodule_context_t* submodule_context;
+	ngx_str_t* uri;
+	ngx_str_t params;
+} ngx_http_vod_hls_iframes_cache_ctx_t;
+
 // content types
 static u_char m3u8_content_type[] = "application/vnd.apple.mpegurl";
 static u_char encryption_key_content_type[] = "application/octet-stream";
@@ -53,6 +66,13 @@ ngx_conf_enum_t  hls_container_formats[] = {
 	{ ngx_null_string, 0 }
 };
 
+ngx_conf_enum_t  hls_segment_size_modes[] = {
+	{ ngx_string("simulate"), HLS_SEGMENT_SIZE_SIMULATE },
+	{ ngx_string("cache"), HLS_SEGMENT_SIZE_CACHE },
+	{ ngx_string("none"), HLS_SEGMENT_SIZE_NONE },
+	{ ngx_null_string, 0 }
+};
+
 static ngx_uint_t
 ngx_http_vod_hls_get_container_format(
 	m3u8_config_t* conf,
@@ -246,41 +266,62 @@ ngx_http_vod_hls_init_segment_encryption(
 #endif // NGX_HAVE_OPENSSL_EVP
 
 static ngx_int_t
-ngx_http_vod_hls_handle_master_playlist(
+ngx_http_vod_hls_build_index_playlist(
 	ngx_http_vod_submodule_context_t* submodule_context,
-	ngx_str_t* response,
-	ngx_str_t* content_type)
+	ngx_str_t* uri,
+	hls_encryption_params_t* encryption_params,
+	ngx_uint_t container_format,
+	media_set_t* media_set,
+	ngx_str_t* response)
 {
 	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	ngx_str_t segments_base_url = ngx_null_string;
 	ngx_str_t base_url = ngx_null_string;
 	vod_status_t rc;
 
-	if (conf->hls.absolute_master_urls)
+	if (conf->hls.absolute_index_urls)
 	{
-		rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, &empty_string, &base_url);
+		rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, uri, &base_url);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
+
+		if (conf->segments_base_url != NULL)
+		{
+			rc = ngx_http_vod_get_base_url(
+				submodule_context->r,
+				conf->segments_base_url,
+				uri,
+				&segments_base_url);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+		}
+		else
+		{
+			segments_base_url = base_url;
+		}
 	}
 
-	rc = m3u8_builder_build_master_playlist(
+	rc = m3u8_builder_build_index_playlist(
 		&submodule_context->request_context,
 		&conf->hls.m3u8_config,
-		conf->hls.encryption_method,
 		&base_url,
-		&submodule_context->media_set,
+		&segments_base_url,
+		&submodule_context->request_params,
+		encryption_params,
+		container_format,
+		media_set,
 		response);
 	if (rc != VOD_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
-			"ngx_http_vod_hls_handle_master_playlist: m3u8_builder_build_master_playlist failed %i", rc);
+			"ngx_http_vod_hls_build_index_playlist: m3u8_builder_build_index_playlist failed %i", rc);
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
-	content_type->data = m3u8_content_type;
-	content_type->len = sizeof(m3u8_content_type) - 1;
-	
 	return NGX_OK;
 }
 
@@ -293,36 +334,8 @@ ngx_http_vod_hls_handle_index_playlist(
 	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
 	hls_encryption_params_t encryption_params;
 	ngx_uint_t container_format;
-	ngx_str_t segments_base_url = ngx_null_string;
-	ngx_str_t base_url = ngx_null_string;
 	vod_status_t rc;
 
-	if (conf->hls.absolute_index_urls)
-	{
-		rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, &submodule_context->r->uri, &base_url);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
-
-		if (conf->segments_base_url != NULL)
-		{
-			rc = ngx_http_vod_get_base_url(
-				submodule_context->r,
-				conf->segments_base_url,
-				&submodule_context->r->uri,
-				&segments_base_url);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-		}
-		else
-		{
-			segments_base_url = base_url;
-		}
-	}
-
 	container_format = ngx_http_vod_hls_get_container_format(
 		&conf->hls.m3u8_config, 
 		&submodule_context->media_set);
@@ -357,26 +370,114 @@ ngx_http_vod_hls_handle_index_playlist(
 	encryption_params.type = HLS_ENC_NONE;
 #endif // NGX_HAVE_OPENSSL_EVP
 
-	rc = m3u8_builder_build_index_playlist(
+	rc = ngx_http_vod_hls_build_index_playlist(
+		submodule_context,
+		&submodule_context->r->uri,
+		&encryption_params,
+		container_format,
+		&submodule_context->media_set,
+		response);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	content_type->data = m3u8_content_type;
+	content_type->len = sizeof(m3u8_content_type) - 1;
+	
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_hls_get_muxer_params(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	vod_uint_t encryption_type,
+	ngx_http_vod_hls_muxer_params_t* params,
+	ngx_str_t* result)
+{
+	ngx_memzero(params, sizeof(*params));
+	params->muxer_conf = submodule_context->conf->hls.mpegts_muxer_config;
+	params->encryption_type = encryption_type;
+
+	result->data = (u_char*)params;
+	result->len = sizeof(*params);
+}
+
+static bool_t
+ngx_http_vod_hls_iframes_cache_fetch(void* context, vod_str_t* buffer)
+{
+	ngx_http_vod_hls_iframes_cache_ctx_t* ctx = context;
+
+	return ngx_http_vod_related_metadata_fetch(ctx->submodule_context, ctx->uri, &ctx->params, buffer);
+}
+
+static void
+ngx_http_vod_hls_iframes_cache_store(void* context, vod_str_t* buffer)
+{
+	ngx_http_vod_hls_iframes_cache_ctx_t* ctx = context;
+
+	ngx_http_vod_related_metadata_store(ctx->submodule_context, ctx->uri, &ctx->params, buffer);
+}
+
+static ngx_int_t
+ngx_http_vod_hls_build_iframe_playlist(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	media_set_t* media_set,
+	ngx_str_t* response)
+{
+	ngx_http_vod_hls_iframes_cache_ctx_t cache_ctx;
+	ngx_http_vod_hls_muxer_params_t params_buf;
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	hls_iframes_cache_t cache;
+	ngx_str_t base_url = ngx_null_string;
+	vod_status_t rc;
+
+	// the iframe positions are cached per uri and file keys, since building them requires simulating the whole media set
+	if (conf->metadata_cache != NULL)
+	{
+		cache_ctx.submodule_context = submodule_context;
+		cache_ctx.uri = uri;
+		ngx_http_vod_hls_get_muxer_params(submodule_context, HLS_ENC_NONE, &params_buf, &cache_ctx.params);
+
+		cache.context = &cache_ctx;
+		cache.fetch = ngx_http_vod_hls_iframes_cache_fetch;
+		cache.store = ngx_http_vod_hls_iframes_cache_store;
+	}
+
+	if (conf->hls.absolute_iframe_urls)
+	{
+		if (submodule_context->offloaded && uri == &submodule_context->r->uri)
+		{
+			// running on a thread pool, use the base url that was evaluated on the event loop
+			base_url = submodule_context->uri_base_url;
+		}
+		else
+		{
+			rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, uri, &base_url);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+		}
+	}
+
+	rc = m3u8_builder_build_iframe_playlist(
 		&submodule_context->request_context,
 		&conf->hls.m3u8_config,
+		&conf->hls.mpegts_muxer_config,
 		&base_url,
-		&segments_base_url,
 		&submodule_context->request_params,
-		&encryption_params,
-		container_format,
-		&submodule_context->media_set,
+		media_set,
+		conf->metadata_cache != NULL ? &cache : NULL,
 		response);
 	if (rc != VOD_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
-			"ngx_http_vod_hls_handle_index_playlist: m3u8_builder_build_index_playlist failed %i", rc);
+			"ngx_http_vod_hls_build_iframe_playlist: m3u8_builder_build_iframe_playlist failed %i", rc);
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
-	content_type->data = m3u8_content_type;
-	content_type->len = sizeof(m3u8_content_type) - 1;
-	
 	return NGX_OK;
 }
 
@@ -387,7 +488,6 @@ ngx_http_vod_hls_handle_iframe_playlist(
 	ngx_str_t* content_type)
 {
 	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
-	ngx_str_t base_url = ngx_null_string;
 	vod_status_t rc;
 	
 	if (conf->hls.encryption_method != HLS_ENC_NONE)
@@ -404,36 +504,207 @@ ngx_http_vod_hls_handle_iframe_playlist(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_BAD_REQUEST);
 	}
 
-	if (conf->hls.absolute_iframe_urls)
+	if (ngx_http_vod_hls_get_container_format(
+		&conf->hls.m3u8_config,
+		&submodule_context->media_set) == HLS_CONTAINER_FMP4)
 	{
-		rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, &submodule_context->r->uri, &base_url);
+		ngx_log_error(NGX_LOG_ERR, submodule_context->request_context.log, 0,
+			"ngx_http_vod_hls_handle_iframe_playlist: iframes playlist not supported with fmp4 container");
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_BAD_REQUEST);
+	}
+
+	rc = ngx_http_vod_hls_build_iframe_playlist(
+		submodule_context,
+		&submodule_context->r->uri,
+		&submodule_context->media_set,
+		response);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	content_type->data = m3u8_content_type;
+	content_type->len = sizeof(m3u8_content_type) - 1;
+	
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_hls_prebuild_variant_playlist(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	m3u8_variant_t* variant,
+	ngx_uint_t container_format,
+	hls_encryption_params_t* encryption_params)
+{
+	media_set_t media_set;
+	ngx_str_t content_type;
+	ngx_str_t response;
+	vod_status_t rc;
+
+	rc = manifest_utils_get_tracks_media_set(
+		&submodule_context->request_context,
+		&submodule_context->media_set,
+		variant->tracks,
+		variant->has_multi_sequences,
+		&media_set);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_hls_prebuild_variant_playlist: manifest_utils_get_tracks_media_set failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
+	}
+
+	content_type.data = m3u8_content_type;
+	content_type.len = sizeof(m3u8_content_type) - 1;
+
+	// index playlist
+	rc = ngx_http_vod_hls_build_index_playlist(
+		submodule_context,
+		&variant->index_uri,
+		encryption_params,
+		container_format,
+		&media_set,
+		&response);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	rc = ngx_http_vod_store_related_response(
+		submodule_context,
+		&variant->index_uri,
+		&content_type,
+		&response);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	if (variant->iframes_uri.len == 0)
+	{
+		return NGX_OK;
+	}
+
+	// iframes playlist
+	rc = ngx_http_vod_hls_build_iframe_playlist(
+		submodule_context,
+		&variant->iframes_uri,
+		&media_set,
+		&response);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_store_related_response(
+		submodule_context,
+		&variant->iframes_uri,
+		&content_type,
+		&response);
+}
+
+static void
+ngx_http_vod_hls_prebuild_variant_playlists(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	bool_t absolute_urls)
+{
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	hls_encryption_params_t encryption_params;
+	media_set_t* media_set = &submodule_context->media_set;
+	m3u8_variant_t* cur_variant;
+	m3u8_variant_t* last_variant;
+	ngx_uint_t container_format;
+	vod_array_t variants;
+	vod_status_t rc;
+
+	// Note: the variant playlists are built from the tracks of the master media set, this is supported
+	//		only for single clip vod sets, since the playlists of other sets depend on the request
+	if (conf->response_cache[CACHE_TYPE_VOD] == NULL ||
+		media_set->original_type != MEDIA_SET_VOD ||
+		media_set->clip_count != 1 ||
+		media_set->timing.total_count > 1 ||
+		media_set->audio_filtering_needed ||
+		conf->hls.encryption_method != HLS_ENC_NONE)
+	{
+		return;
+	}
+
+	rc = m3u8_builder_get_variants(
+		&submodule_context->request_context,
+		&conf->hls.m3u8_config,
+		conf->hls.encryption_method,
+		absolute_urls,
+		media_set,
+		&variants);
+	if (rc != VOD_OK)
+	{
+		ngx_log_error(NGX_LOG_WARN, submodule_context->request_context.log, 0,
+			"ngx_http_vod_hls_prebuild_variant_playlists: m3u8_builder_get_variants failed %i", rc);
+		return;
+	}
+
+	container_format = ngx_http_vod_hls_get_container_format(
+		&conf->hls.m3u8_config,
+		media_set);
+
+	encryption_params.type = HLS_ENC_NONE;
+
+	cur_variant = variants.elts;
+	last_variant = cur_variant + variants.nelts;
+	for (; cur_variant < last_variant; cur_variant++)
+	{
+		rc = ngx_http_vod_hls_prebuild_variant_playlist(
+			submodule_context,
+			cur_variant,
+			container_format,
+			&encryption_params);
+		if (rc != NGX_OK)
+		{
+			ngx_log_error(NGX_LOG_WARN, submodule_context->request_context.log, 0,
+				"ngx_http_vod_hls_prebuild_variant_playlists: failed to prebuild %V, rc=%i", &cur_variant->index_uri, rc);
+			return;
+		}
+
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_hls_prebuild_variant_playlists: prebuilt %V", &cur_variant->index_uri);
+	}
+}
+
+static ngx_int_t
+ngx_http_vod_hls_handle_master_playlist(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
+{
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	ngx_str_t base_url = ngx_null_string;
+	vod_status_t rc;
+
+	if (conf->hls.absolute_master_urls)
+	{
+		rc = ngx_http_vod_get_base_url(submodule_context->r, conf->base_url, &empty_string, &base_url);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
 	}
 
-	if (ngx_http_vod_hls_get_container_format(
-		&conf->hls.m3u8_config,
-		&submodule_context->media_set) == HLS_CONTAINER_FMP4)
+	if (conf->hls.prebuild_variant_playlists)
 	{
-		ngx_log_error(NGX_LOG_ERR, submodule_context->request_context.log, 0,
-			"ngx_http_vod_hls_handle_iframe_playlist: iframes playlist not supported with fmp4 container");
-		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_BAD_REQUEST);
+		ngx_http_vod_hls_prebuild_variant_playlists(submodule_context, base_url.len != 0);
 	}
 
-	rc = m3u8_builder_build_iframe_playlist(
+	rc = m3u8_builder_build_master_playlist(
 		&submodule_context->request_context,
 		&conf->hls.m3u8_config,
-		&conf->hls.mpegts_muxer_config,
+		conf->hls.encryption_method,
 		&base_url,
-		&submodule_context->request_params,
 		&submodule_context->media_set,
 		response);
 	if (rc != VOD_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
-			"ngx_http_vod_hls_handle_iframe_playlist: m3u8_builder_build_iframe_playlist failed %i", rc);
+			"ngx_http_vod_hls_handle_master_playlist: m3u8_builder_build_master_playlist failed %i", rc);
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
@@ -470,6 +741,31 @@ ngx_http_vod_hls_handle_encryption_key(
 	return NGX_OK;
 }
 
+static ngx_flag_t
+ngx_http_vod_hls_segment_size_cache_fetch(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* params,
+	size_t* size)
+{
+	ngx_str_t buffer;
+
+	if (!ngx_http_vod_related_metadata_fetch(submodule_context, &submodule_context->r->uri, params, &buffer))
+	{
+		return 0;
+	}
+
+	if (buffer.len != sizeof(*size))
+	{
+		ngx_log_error(NGX_LOG_WARN, submodule_context->request_context.log, 0,
+			"ngx_http_vod_hls_segment_size_cache_fetch: invalid size %uz", buffer.len);
+		return 0;
+	}
+
+	ngx_memcpy(size, buffer.data, sizeof(*size));
+
+	return *size != 0;
+}
+
 static ngx_int_t
 ngx_http_vod_hls_init_ts_frame_processor(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -480,10 +776,15 @@ ngx_http_vod_hls_init_ts_frame_processor(
 	size_t* response_size,
 	ngx_str_t* content_type)
 {
+	ngx_http_vod_hls_muxer_params_t size_params_buf;
 	hls_encryption_params_t encryption_params;
 	hls_muxer_state_t* state;
+	ngx_str_t size_params;
+	ngx_str_t size_buffer;
 	vod_status_t rc;
 	bool_t reuse_output_buffers;
+	size_t* simulated_size;
+	ngx_uint_t segment_size_mode;
 
 #if (NGX_HAVE_OPENSSL_EVP)
 	rc = ngx_http_vod_hls_init_segment_encryption(
@@ -502,6 +803,29 @@ ngx_http_vod_hls_init_ts_frame_processor(
 	reuse_output_buffers = FALSE;
 #endif // NGX_HAVE_OPENSSL_EVP
 
+	// get the segment size, the muxer simulates the segment unless the size is already known / not needed
+	segment_size_mode = submodule_context->conf->hls.mpegts_segment_size;
+	simulated_size = response_size;
+	switch (segment_size_mode)
+	{
+	case HLS_SEGMENT_SIZE_CACHE:
+		ngx_http_vod_hls_get_muxer_params(
+			submodule_context,
+			encryption_params.type,
+			&size_params_buf,
+			&size_params);
+
+		if (ngx_http_vod_hls_segment_size_cache_fetch(submodule_context, &size_params, response_size))
+		{
+			simulated_size = NULL;
+		}
+		break;
+
+	case HLS_SEGMENT_SIZE_NONE:
+		simulated_size = NULL;
+		break;
+	}
+
 	rc = hls_muxer_init_segment(
 		&submodule_context->request_context,
 		&submodule_context->conf->hls.mpegts_muxer_config,
@@ -511,7 +835,7 @@ ngx_http_vod_hls_init_ts_frame_processor(
 		segment_writer->write_tail,
 		segment_writer->context,
 		reuse_output_buffers,
-		response_size, 
+		simulated_size,
 		output_buffer,
 		&state);
 	if (rc != VOD_OK)
@@ -521,6 +845,15 @@ ngx_http_vod_hls_init_ts_frame_processor(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
+	if (segment_size_mode == HLS_SEGMENT_SIZE_CACHE &&
+		simulated_size != NULL &&
+		*simulated_size != 0)
+	{
+		size_buffer.data = (u_char*)simulated_size;
+		size_buffer.len = sizeof(*simulated_size);
+		ngx_http_vod_related_metadata_store(submodule_context, &submodule_context->r->uri, &size_params, &size_buffer);
+	}
+
 	if (encryption_params.type == HLS_ENC_AES_128 && 
 		*response_size != 0)
 	{
@@ -805,6 +1138,18 @@ static const ngx_http_vod_request_t hls_master_request = {
 	NULL,
 };
 
+// Note: parsing the frames is required for building the iframe playlists and for accurate segment durations
+static const ngx_http_vod_request_t hls_master_prebuild_request = {
+	0,
+	PARSE_FLAG_DURATION_LIMITS_AND_TOTAL_SIZE | PARSE_FLAG_KEY_FRAME_BITRATE | PARSE_FLAG_CODEC_NAME | PARSE_FLAG_PARSED_EXTRA_DATA_SIZE |
+		PARSE_FLAG_FRAMES_ALL_EXCEPT_OFFSETS,
+	REQUEST_CLASS_OTHER,
+	SUPPORTED_CODECS | VOD_CODEC_FLAG(WEBVTT),
+	HLS_TIMESCALE,
+	ngx_http_vod_hls_handle_master_playlist,
+	NULL,
+};
+
 static const ngx_http_vod_request_t hls_index_request = {
 	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE,
 	PARSE_BASIC_METADATA_ONLY,
@@ -816,8 +1161,8 @@ static const ngx_http_vod_request_t hls_index_request = {
 };
 
 static const ngx_http_vod_request_t hls_iframes_request = {
-	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_PARSE_ALL_CLIPS,
-	PARSE_FLAG_FRAMES_ALL_EXCEPT_OFFSETS | PARSE_FLAG_PARSED_EXTRA_DATA_SIZE,
+	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_PARSE_ALL_CLIPS | REQUEST_FLAG_OFFLOAD_METADATA,
+	PARSE_FLAG_FRAMES_ALL_EXCEPT_OFFSETS | PARSE_FLAG_PARSED_EXTRA_DATA_SIZE | PARSE_FLAG_FRAMES_COMPACT,
 	REQUEST_CLASS_OTHER,
 	SUPPORTED_CODECS,
 	HLS_TIMESCALE,
@@ -836,8 +1181,8 @@ static const ngx_http_vod_request_t hls_enc_key_request = {
 };
 
 static const ngx_http_vod_request_t hls_ts_segment_request = {
-	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE,
-	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_PARSED_EXTRA_DATA,
+	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_CHUNKED_OUTPUT,
+	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_PARSED_EXTRA_DATA | PARSE_FLAG_FRAMES_COMPACT,
 	REQUEST_CLASS_SEGMENT,
 	SUPPORTED_CODECS,
 	HLS_TIMESCALE,
@@ -883,9 +1228,11 @@ ngx_http_vod_hls_create_loc_conf(
 	conf->absolute_master_urls = NGX_CONF_UNSET;
 	conf->absolute_index_urls = NGX_CONF_UNSET;
 	conf->absolute_iframe_urls = NGX_CONF_UNSET;
+	conf->prebuild_variant_playlists = NGX_CONF_UNSET;
 	conf->mpegts_muxer_config.interleave_frames = NGX_CONF_UNSET;
 	conf->mpegts_muxer_config.align_frames = NGX_CONF_UNSET;
 	conf->mpegts_muxer_config.output_id3_timestamps = NGX_CONF_UNSET;
+	conf->mpegts_segment_size = NGX_CONF_UNSET_UINT;
 	conf->encryption_method = NGX_CONF_UNSET_UINT;
 	conf->m3u8_config.force_unmuxed_segments = NGX_CONF_UNSET;
 	conf->m3u8_config.container_format = NGX_CONF_UNSET_UINT;
@@ -901,6 +1248,7 @@ ngx_http_vod_hls_merge_loc_conf(
 	ngx_conf_merge_value(conf->absolute_master_urls, prev->absolute_master_urls, 1);
 	ngx_conf_merge_value(conf->absolute_index_urls, prev->absolute_index_urls, 1);
 	ngx_conf_merge_value(conf->absolute_iframe_urls, prev->absolute_iframe_urls, 0);
+	ngx_conf_merge_value(conf->prebuild_variant_playlists, prev->prebuild_variant_playlists, 0);
 
 	ngx_conf_merge_str_value(conf->master_file_name_prefix, prev->master_file_name_prefix, "master");
 	ngx_conf_merge_str_value(conf->m3u8_config.index_file_name_prefix, prev->m3u8_config.index_file_name_prefix, "index");	
@@ -921,6 +1269,7 @@ ngx_http_vod_hls_merge_loc_conf(
 	ngx_conf_merge_value(conf->mpegts_muxer_config.interleave_frames, prev->mpegts_muxer_config.interleave_frames, 0);
 	ngx_conf_merge_value(conf->mpegts_muxer_config.align_frames, prev->mpegts_muxer_config.align_frames, 1);
 	ngx_conf_merge_value(conf->mpegts_muxer_config.output_id3_timestamps, prev->mpegts_muxer_config.output_id3_timestamps, 0);
+	ngx_conf_merge_uint_value(conf->mpegts_segment_size, prev->mpegts_segment_size, HLS_SEGMENT_SIZE_SIMULATE);
 	
 	ngx_conf_merge_uint_value(conf->encryption_method, prev->encryption_method, HLS_ENC_NONE);
 
@@ -1003,7 +1352,7 @@ ngx_http_vod_hls_parse_uri_file_name(
 		}
 		else if (ngx_http_vod_starts_with(start_pos, end_pos, &conf->hls.master_file_name_prefix))
 		{
-			*request = &hls_master_request;
+			*request = conf->hls.prebuild_variant_playlists ? &hls_master_prebuild_request : &hls_master_request;
 			start_pos += conf->hls.master_file_name_prefix.len;
 			flags = PARSE_FILE_NAME_MULTI_STREAMS_PER_TYPE;
 		}
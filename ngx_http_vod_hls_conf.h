@@ -5,14 +5,23 @@
 #include "vod/hls/m3u8_builder.h"
 #include "vod/hls/hls_muxer.h"
 
+// enums
+enum {
+	HLS_SEGMENT_SIZE_SIMULATE,
+	HLS_SEGMENT_SIZE_CACHE,
+	HLS_SEGMENT_SIZE_NONE,
+};
+
 // typedefs
 typedef struct
 {
 	ngx_flag_t absolute_master_urls;
 	ngx_flag_t absolute_index_urls;
 	ngx_flag_t absolute_iframe_urls;
+	ngx_flag_t prebuild_variant_playlists;
 	ngx_str_t master_file_name_prefix;
 	hls_mpegts_muxer_conf_t mpegts_muxer_config;
+	ngx_uint_t mpegts_segment_size;
 	vod_uint_t encryption_method;
 	ngx_http_complex_value_t* encryption_key_uri;
 
@@ -23,5 +32,6 @@ typedef struct
 // globals
 extern ngx_conf_enum_t  hls_encryption_methods[];
 extern ngx_conf_enum_t  hls_container_formats[];
+extern ngx_conf_enum_t  hls_segment_size_modes[];
 
 #endif // _NGX_HTTP_VOD_HLS_CONF_H_INCLUDED_
@@ -11,6 +11,7 @@
 #include "ngx_child_http_request.h"
 #include "ngx_http_vod_utils.h"
 #include "ngx_perf_counters.h"
+#include "ngx_read_predictor.h"
 #include "ngx_http_vod_conf.h"
 #include "ngx_file_reader.h"
 #include "ngx_buffer_cache.h"
@@ -19,6 +20,10 @@
 #include "vod/subtitle/webvtt_format.h"
 #include "vod/subtitle/cap_format.h"
 #include "vod/input/read_cache.h"
+#include "vod/input/frame_list.h"
+#include "vod/input/frames_source_cache.h"
+#include "vod/input/frames_source_mmap.h"
+#include "vod/input/index_file.h"
 #include "vod/filters/audio_filter.h"
 #include "vod/filters/dynamic_clip.h"
 #include "vod/filters/concat_clip.h"
@@ -51,6 +56,9 @@
 #define SEGMENT_REQUEST_MAX_FRAME_COUNT (64 * 1024)
 #define NON_SEGMENT_REQUEST_MAX_FRAME_COUNT (1024 * 1024)
 
+#define CLIP_INDEX_KEY_SUFFIX "clipidx"
+#define RELATED_METADATA_KEY_SUFFIX "related"
+
 enum {
 	// mapping state machine
 	STATE_MAP_INITIAL,
@@ -62,6 +70,8 @@ enum {
 	STATE_READ_METADATA_INITIAL,
 	STATE_READ_METADATA_OPEN_FILE,
 	STATE_READ_METADATA_READ,
+	STATE_PARSE_CACHED_METADATA,
+	STATE_PARSE_METADATA,
 	STATE_READ_FRAMES_OPEN_FILE,
 	STATE_READ_FRAMES_READ,
 	STATE_OPEN_FILE,
@@ -88,6 +98,7 @@ typedef ngx_int_t(*ngx_http_vod_dump_part_t)(void* context, off_t start, off_t e
 typedef size_t(*ngx_http_vod_get_size_t)(void* context);
 typedef void(*ngx_http_vod_get_path_t)(void* context, ngx_str_t* path);
 typedef ngx_int_t(*ngx_http_vod_enable_directio_t)(void* context);
+typedef ngx_int_t(*ngx_http_vod_map_t)(void* context, off_t start, off_t end, u_char** data, size_t* size);
 
 typedef ngx_int_t(*ngx_http_vod_dump_request_t)(void* context);
 typedef ngx_int_t(*ngx_http_vod_mapping_apply_t)(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, int* cache_index);
@@ -100,6 +111,7 @@ typedef struct {
 
 typedef struct {
 	size_t content_type_len;
+	size_t response_len;
 	uint32_t media_set_type;
 } response_cache_header_t;
 
@@ -108,6 +120,7 @@ typedef struct {
 	ngx_chain_t* chain_head;
 	ngx_chain_t* chain_end;
 	size_t total_size;
+	ngx_flag_t defer_output;		// when set, buffers are chained even if the headers were sent
 } ngx_http_vod_write_segment_context_t;
 
 typedef struct {
@@ -121,6 +134,23 @@ typedef struct {
 	size_t extra_size;
 } ngx_http_vod_alloc_params_t;
 
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	media_clip_t* clip;
+	ngx_str_t uri;
+	u_char cache_key[MEDIA_CLIP_KEY_SIZE];
+	void* reader_context;
+	ngx_buf_t read_buffer;
+} ngx_http_vod_mapping_request_t;
+
+typedef media_clip_t*(*ngx_http_vod_mapping_next_clip_t)(media_clip_t* clip);
+
+typedef struct {
+	media_sequence_t* sequence;
+	media_track_t* track;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+} ngx_http_vod_filtered_track_t;
+
 typedef struct {
 	u_char cache_key[MEDIA_CLIP_KEY_SIZE];
 	ngx_str_t* cache_key_prefix;
@@ -131,6 +161,12 @@ typedef struct {
 	size_t max_response_size;
 	ngx_http_vod_mapping_get_uri_t get_uri;
 	ngx_http_vod_mapping_apply_t apply;
+
+	// parallel mapping only
+	ngx_http_vod_mapping_request_t* next_request;
+	ngx_http_vod_mapping_request_t* requests_end;
+	ngx_uint_t pending_requests;
+	ngx_int_t requests_rc;
 } ngx_http_vod_mapping_context_t;
 
 typedef struct {
@@ -140,6 +176,7 @@ typedef struct {
 	ngx_http_vod_get_size_t get_size;
 	ngx_http_vod_get_path_t get_path;
 	ngx_http_vod_enable_directio_t enable_directio;
+	ngx_http_vod_map_t map;
 } ngx_http_vod_reader_t;
 
 struct ngx_http_vod_ctx_s {
@@ -177,6 +214,14 @@ struct ngx_http_vod_ctx_s {
 	void* metadata_reader_context;
 	ngx_str_t* metadata_parts;
 	size_t metadata_part_count;
+	size_t initial_read_size;
+
+	// read size prediction
+	ngx_read_predictor_t* read_predictor;
+	uint32_t read_predictor_key;
+	ngx_uint_t read_predictor_type;		// type of the last read of unknown size, NGX_READ_PREDICTOR_COUNT if none
+	off_t read_predictor_offset;
+	size_t read_predictor_size;
 
 	// read frames state
 	media_base_metadata_t* base_metadata;
@@ -185,6 +230,9 @@ struct ngx_http_vod_ctx_s {
 	// clipper
 	media_clipper_parse_result_t* clipper_parse_result;
 
+	// manifest requests only
+	segment_durations_cache_t segment_durations_cache;
+
 	// reading abstraction (over file / http)
 	ngx_http_vod_reader_t* reader;
 	ngx_http_vod_async_read_func_t read;
@@ -194,6 +242,10 @@ struct ngx_http_vod_ctx_s {
 #if (NGX_THREADS)
 	void* async_open_context;
 #endif // NGX_THREADS
+	ngx_flag_t sources_opened;
+	ngx_uint_t pending_opens;
+	ngx_int_t open_rc;
+	size_t prefetch_size;
 
 	// read state - http
 	ngx_str_t* file_key_prefix;
@@ -209,6 +261,26 @@ struct ngx_http_vod_ctx_s {
 	ngx_http_vod_write_segment_context_t write_segment_buffer_context;
 	media_notification_t* notification;
 	uint32_t frames_bytes_read;
+	u_char generated_cache_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_http_vod_filtered_track_t* filtered_tracks;		// tracks that should be saved to the filtered audio cache
+	ngx_http_vod_filtered_track_t* filtered_tracks_end;
+
+	// clip requests only
+	vod_str_t clip_index;
+	ngx_flag_t clip_index_fetched;
+
+#if (NGX_THREADS)
+	ngx_thread_task_t* parse_task;
+	ngx_flag_t parse_completed;
+	ngx_int_t parse_rc;
+
+	ngx_thread_task_t* index_task;
+	ngx_flag_t index_completed;
+
+	ngx_thread_task_t* processing_task;
+	ngx_flag_t processing_completed;
+	vod_status_t processing_rc;
+#endif // NGX_THREADS
 };
 
 // typedefs
@@ -221,6 +293,7 @@ typedef struct {
 // forward declarations
 static ngx_int_t ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_send_notification(ngx_http_vod_ctx_t *ctx);
+static ngx_int_t ngx_http_vod_start_reading_metadata(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_init_process(ngx_cycle_t *cycle);
 static void ngx_http_vod_exit_process();
 
@@ -271,6 +344,7 @@ static ngx_http_vod_reader_t reader_file_with_fallback = {
 	ngx_file_reader_get_size,
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
+	ngx_file_reader_map,
 };
 
 static ngx_http_vod_reader_t reader_file = {
@@ -280,6 +354,7 @@ static ngx_http_vod_reader_t reader_file = {
 	ngx_file_reader_get_size,
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
+	ngx_file_reader_map,
 };
 
 static ngx_http_vod_reader_t reader_http = {
@@ -289,6 +364,7 @@ static ngx_http_vod_reader_t reader_http = {
 	NULL,
 	ngx_http_vod_http_reader_get_path,
 	NULL,
+	NULL,
 };
 
 static const u_char wvm_file_magic[] = { 0x00, 0x00, 0x01, 0xba, 0x44, 0x00, 0x04, 0x00, 0x04, 0x01 };
@@ -741,6 +817,34 @@ ngx_buffer_cache_fetch_multi_perf(
 	return -1;
 }
 
+static void
+ngx_buffer_cache_fetch_batch_perf(
+	ngx_perf_counters_t* perf_counters,
+	ngx_buffer_cache_t** caches,
+	uint32_t cache_count,
+	u_char** keys,
+	ngx_str_t* buffers,
+	ngx_uint_t count)
+{
+	ngx_perf_counter_context(pcctx);
+	ngx_uint_t left = count;
+	uint32_t cache_index;
+
+	ngx_perf_counter_start(pcctx);
+
+	for (cache_index = 0; cache_index < cache_count && left > 0; cache_index++)
+	{
+		if (caches[cache_index] == NULL)
+		{
+			continue;
+		}
+
+		left -= ngx_buffer_cache_fetch_batch(caches[cache_index], keys, buffers, count);
+	}
+
+	ngx_perf_counter_end(perf_counters, pcctx, PC_FETCH_CACHE);
+}
+
 static int
 ngx_buffer_cache_fetch_copy_perf(
 	ngx_http_request_t* r,
@@ -1380,6 +1484,26 @@ ngx_http_vod_get_sequence_tracks_mask(
 	}
 }
 
+static bool_t
+ngx_http_vod_media_set_sources_only(media_set_t* media_set)
+{
+	media_sequence_t* sequence;
+	uint32_t clip_index;
+
+	for (sequence = media_set->sequences; sequence < media_set->sequences_end; sequence++)
+	{
+		for (clip_index = 0; clip_index < media_set->clip_count; clip_index++)
+		{
+			if (sequence->clips[clip_index]->type != MEDIA_CLIP_SOURCE)
+			{
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
 static void
 ngx_http_vod_init_parse_params_metadata(
 	ngx_http_vod_ctx_t *ctx,
@@ -1399,6 +1523,12 @@ ngx_http_vod_init_parse_params_metadata(
 		parse_params->parse_type |= segmenter->parse_type;
 	}
 	parse_params->parse_type |= ctx->submodule_context.conf->parse_flags;
+	if ((parse_params->parse_type & PARSE_FLAG_FRAMES_COMPACT) != 0 &&
+		!ngx_http_vod_media_set_sources_only(&ctx->submodule_context.media_set))
+	{
+		// filters access the frames arrays directly
+		parse_params->parse_type &= ~PARSE_FLAG_FRAMES_COMPACT;
+	}
 	parse_params->codecs_mask = request->codecs_mask;
 
 	request_tracks_mask = ctx->submodule_context.request_params.tracks_mask;
@@ -1521,6 +1651,7 @@ ngx_http_vod_init_parse_params_frames(
 	{
 		// thumbnail request
 		get_ranges_params.time = ctx->submodule_context.request_params.segment_time;
+		get_ranges_params.duration = ctx->submodule_context.request_params.sprite_duration;
 
 		rc = segmenter_get_start_end_ranges_gop(
 			&get_ranges_params,
@@ -1560,8 +1691,84 @@ ngx_http_vod_init_parse_params_frames(
 	return NGX_OK;
 }
 
+static void
+ngx_http_vod_get_clip_index_key(media_clip_source_t* cur_source, u_char* result)
+{
+	ngx_md5_t md5;
+
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, cur_source->file_key, sizeof(cur_source->file_key));
+	ngx_md5_update(&md5, CLIP_INDEX_KEY_SUFFIX, sizeof(CLIP_INDEX_KEY_SUFFIX) - 1);
+	ngx_md5_final(result, &md5);
+}
+
+static ngx_int_t
+ngx_http_vod_clip_index_fetch(ngx_http_vod_ctx_t *ctx, vod_str_t* clip_index)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t cache_buffer;
+
+	clip_index->len = 0;
+
+	ngx_http_vod_get_clip_index_key(ctx->cur_source, cache_key);
+
+	if (!ngx_buffer_cache_fetch_perf(
+		ctx->perf_counters,
+		conf->metadata_cache,
+		cache_key,
+		&cache_buffer))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_clip_index_fetch: clip index cache miss");
+		return NGX_OK;
+	}
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_clip_index_fetch: clip index cache hit");
+
+	// Note: copying the buffer since the index is accessed as an array of structs
+	clip_index->data = ngx_palloc(ctx->submodule_context.request_context.pool, cache_buffer.len);
+	if (clip_index->data == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_clip_index_fetch: ngx_palloc failed");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+	}
+
+	ngx_memcpy(clip_index->data, cache_buffer.data, cache_buffer.len);
+	clip_index->len = cache_buffer.len;
+
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_clip_index_store(ngx_http_vod_ctx_t *ctx, vod_str_t* clip_index)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+
+	ngx_http_vod_get_clip_index_key(ctx->cur_source, cache_key);
+
+	if (ngx_buffer_cache_store_perf(
+		ctx->perf_counters,
+		conf->metadata_cache,
+		cache_key,
+		clip_index->data,
+		clip_index->len))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_clip_index_store: stored clip index in cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_clip_index_store: failed to store clip index in cache");
+	}
+}
+
 static ngx_int_t 
-ngx_http_vod_parse_metadata(
+ngx_http_vod_parse_metadata_internal(
 	ngx_http_vod_ctx_t *ctx, 
 	ngx_flag_t fetched_from_cache)
 {
@@ -1609,6 +1816,16 @@ ngx_http_vod_parse_metadata(
 			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
 		}
 
+		// the clip index is saved in the metadata cache, next to the metadata of the file
+		if (ctx->submodule_context.conf->metadata_cache != NULL)
+		{
+			parse_params.clip_index = &ctx->clip_index;
+		}
+		else
+		{
+			parse_params.clip_index = NULL;
+		}
+
 		rc = ctx->format->clipper_parse(
 			request_context,
 			&parse_params,
@@ -1701,6 +1918,165 @@ ngx_http_vod_parse_metadata(
 	return rc;
 }
 
+static ngx_int_t
+ngx_http_vod_parse_metadata_completed(ngx_http_vod_ctx_t *ctx, ngx_int_t rc)
+{
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	if (ctx->request == NULL && !ctx->clip_index_fetched && ctx->clip_index.len > 0)
+	{
+		ngx_http_vod_clip_index_store(ctx, &ctx->clip_index);
+	}
+
+	return NGX_OK;
+}
+
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	ngx_flag_t fetched_from_cache;
+	ngx_int_t rc;
+} ngx_http_vod_parse_task_ctx_t;
+
+static void
+ngx_http_vod_parse_thread_handler(void *data, ngx_log_t *log)
+{
+	ngx_http_vod_parse_task_ctx_t* task_ctx = data;
+
+	task_ctx->rc = ngx_http_vod_parse_metadata_internal(task_ctx->ctx, task_ctx->fetched_from_cache);
+}
+
+static void
+ngx_http_vod_parse_task_event_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_parse_task_ctx_t* task_ctx = ev->data;
+	ngx_http_vod_ctx_t* ctx = task_ctx->ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_connection_t* c = r->connection;
+	ngx_int_t rc;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	ctx->parse_completed = 1;
+	ctx->parse_rc = task_ctx->rc;
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc != NGX_AGAIN)
+	{
+		ngx_http_vod_finalize_request(ctx, rc);
+	}
+
+	ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_http_vod_post_parse_task(ngx_http_vod_ctx_t *ctx, ngx_flag_t fetched_from_cache)
+{
+	ngx_http_vod_parse_task_ctx_t* task_ctx;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_thread_task_t* task;
+	size_t metadata_size;
+	uint32_t i;
+
+	// small metadata is parsed inline, the overhead of posting the task is not worth it
+	metadata_size = 0;
+	for (i = 0; i < ctx->metadata_part_count; i++)
+	{
+		metadata_size += ctx->metadata_parts[i].len;
+	}
+
+	if (metadata_size < conf->parse_thread_min_size)
+	{
+		return NGX_DECLINED;
+	}
+
+	task = ctx->parse_task;
+	if (task == NULL)
+	{
+		task = ngx_thread_task_alloc(r->pool, sizeof(*task_ctx));
+		if (task == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_post_parse_task: ngx_thread_task_alloc failed");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		}
+
+		task_ctx = task->ctx;
+		task_ctx->ctx = ctx;
+
+		task->handler = ngx_http_vod_parse_thread_handler;
+		task->event.data = task_ctx;
+		task->event.handler = ngx_http_vod_parse_task_event_handler;
+
+		ctx->parse_task = task;
+	}
+
+	task_ctx = task->ctx;
+	task_ctx->fetched_from_cache = fetched_from_cache;
+
+	if (ngx_thread_task_post(conf->parse_thread_pool, task) != NGX_OK)
+	{
+		return NGX_DECLINED;
+	}
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	return NGX_DONE;
+}
+#endif // NGX_THREADS
+
+// returns NGX_DONE when the parsing was posted to a thread, the state machine is resumed on completion
+static ngx_int_t
+ngx_http_vod_parse_metadata(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_flag_t fetched_from_cache)
+{
+	ngx_int_t rc;
+
+#if (NGX_THREADS)
+	if (ctx->parse_completed)
+	{
+		ctx->parse_completed = 0;
+		return ngx_http_vod_parse_metadata_completed(ctx, ctx->parse_rc);
+	}
+#endif // NGX_THREADS
+
+	ctx->clip_index.len = 0;
+	ctx->clip_index_fetched = 0;
+	if (ctx->request == NULL && ctx->submodule_context.conf->metadata_cache != NULL)
+	{
+		rc = ngx_http_vod_clip_index_fetch(ctx, &ctx->clip_index);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		ctx->clip_index_fetched = ctx->clip_index.len > 0;
+	}
+
+#if (NGX_THREADS)
+	if (ctx->submodule_context.conf->parse_thread_pool != NULL)
+	{
+		rc = ngx_http_vod_post_parse_task(ctx, fetched_from_cache);
+		if (rc != NGX_DECLINED)
+		{
+			return rc;
+		}
+	}
+#endif // NGX_THREADS
+
+	rc = ngx_http_vod_parse_metadata_internal(ctx, fetched_from_cache);
+
+	return ngx_http_vod_parse_metadata_completed(ctx, rc);
+}
+
 static ngx_int_t
 ngx_http_vod_identify_format(ngx_http_vod_ctx_t* ctx)
 {
@@ -1737,7 +2113,7 @@ ngx_http_vod_identify_format(ngx_http_vod_ctx_t* ctx)
 		rc = cur_format->init_metadata_reader(
 			&ctx->submodule_context.request_context,
 			&buffer,
-			ctx->submodule_context.conf->initial_read_size,
+			ctx->initial_read_size,
 			ctx->submodule_context.conf->max_metadata_size,
 			&ctx->metadata_reader_context);
 		if (rc == VOD_NOT_FOUND)
@@ -1787,57 +2163,158 @@ ngx_http_vod_init_format(ngx_http_vod_ctx_t* ctx, uint32_t format_id)
 	return NGX_OK;
 }
 
-static ngx_int_t
-ngx_http_vod_async_read(ngx_http_vod_ctx_t* ctx, media_format_read_request_t* read_req)
+static size_t
+ngx_http_vod_predict_read_size(ngx_http_vod_ctx_t* ctx, ngx_uint_t type, off_t offset)
 {
-	size_t prefix_size;
-	size_t buffer_size;
-	size_t read_size;
-	off_t read_offset;
-	ngx_int_t rc;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	size_t predicted_size;
+	size_t result;
 
-	// align the read size and offset
-	read_offset = read_req->read_offset & (~(ctx->alignment - 1));
-	if (read_req->read_size == 0)
-	{
-		read_size = ctx->submodule_context.conf->initial_read_size;
-	}
-	else
+	result = conf->initial_read_size;
+
+	if (ctx->read_predictor == NULL)
 	{
-		read_size = read_req->read_size + read_req->read_offset - read_offset;
+		return result;
 	}
 
-	read_size = (read_size + ctx->alignment - 1) & (~(ctx->alignment - 1));
-
-	// optimization for the case in which the current range is a prefix of the new range
-	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
-	prefix_size = 0;
-
-	if (read_offset >= ctx->read_offset && 
-		read_offset < (off_t)(ctx->read_offset + buffer_size) &&
-		ctx->read_buffer.start != NULL)
+	if (type == NGX_READ_PREDICTOR_HEAD)
 	{
-		prefix_size = ctx->read_offset + buffer_size - read_offset;
-		ctx->prefix_buffer = ctx->read_buffer;
-		ctx->prefix_buffer.pos = ctx->prefix_buffer.last - prefix_size;
-		ctx->read_buffer.start = NULL;
+		ctx->read_predictor_key = ngx_read_predictor_get_key(
+			&conf->upstream_location, 
+			&ctx->cur_source->mapped_uri);
 	}
-	else if ((read_req->flags & MEDIA_READ_FLAG_REALLOC_BUFFER) != 0)
+
+	predicted_size = ngx_read_predictor_get(ctx->read_predictor, ctx->read_predictor_key, type);
+	if (predicted_size > result)
 	{
-		ctx->read_buffer.start = NULL;
+		result = ngx_min(predicted_size, conf->max_metadata_size);
 	}
 
-	// allocate the read buffer
-	rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
-	if (rc != NGX_OK)
+	ctx->read_predictor_type = type;
+	ctx->read_predictor_offset = offset;
+	ctx->read_predictor_size = result;
+
+	return result;
+}
+
+static void
+ngx_http_vod_update_read_predictor(
+	ngx_http_vod_ctx_t* ctx, 
+	vod_str_t* read_buffer, 
+	vod_status_t rc, 
+	media_format_read_metadata_result_t* result)
+{
+	media_format_read_request_t* read_req;
+	vod_str_t* parts_end;
+	vod_str_t* cur_part;
+	u_char* buffer_end;
+	size_t size;
+
+	if (ctx->read_predictor_type >= NGX_READ_PREDICTOR_COUNT)
 	{
-		return rc;
+		return;
 	}
 
-	if (ctx->prefix_buffer.start != NULL)
+	if (rc == VOD_OK)
 	{
-		ctx->read_buffer.start += prefix_size;
-		ctx->read_buffer.pos = ctx->read_buffer.start;
+		if (ctx->requested_offset != ctx->read_predictor_offset)
+		{
+			// completed by a read of known size, the predictor was already updated
+			ctx->read_predictor_type = NGX_READ_PREDICTOR_COUNT;
+			return;
+		}
+
+		// the required size is the end of the last metadata part that points to the read buffer
+		size = 0;
+		buffer_end = read_buffer->data + read_buffer->len;
+		parts_end = result->parts + result->part_count;
+		for (cur_part = result->parts; cur_part < parts_end; cur_part++)
+		{
+			if (cur_part->data < read_buffer->data || cur_part->data + cur_part->len > buffer_end)
+			{
+				continue;
+			}
+
+			size = ngx_max(size, (size_t)(cur_part->data + cur_part->len - read_buffer->data));
+		}
+	}
+	else
+	{
+		// Note: reads that allow empty results are upper bounds (e.g. subtitles), not the required size
+		read_req = &result->read_req;
+		if (read_req->read_size == 0 ||
+			(read_req->flags & MEDIA_READ_FLAG_ALLOW_EMPTY_READ) != 0 ||
+			read_req->read_offset < (uint64_t)ctx->read_predictor_offset ||
+			read_req->read_offset > ctx->read_predictor_offset + ctx->read_predictor_size)
+		{
+			size = 0;
+		}
+		else
+		{
+			// the format requested the continuation of the predicted read
+			size = read_req->read_offset + read_req->read_size - ctx->read_predictor_offset;
+		}
+	}
+
+	if (size > 0)
+	{
+		ngx_read_predictor_update(ctx->read_predictor, ctx->read_predictor_key, ctx->read_predictor_type, size);
+	}
+
+	ctx->read_predictor_type = NGX_READ_PREDICTOR_COUNT;
+}
+
+static ngx_int_t
+ngx_http_vod_async_read(ngx_http_vod_ctx_t* ctx, media_format_read_request_t* read_req)
+{
+	size_t prefix_size;
+	size_t buffer_size;
+	size_t read_size;
+	off_t read_offset;
+	ngx_int_t rc;
+
+	// align the read size and offset
+	read_offset = read_req->read_offset & (~(ctx->alignment - 1));
+	if (read_req->read_size == 0)
+	{
+		read_size = ngx_http_vod_predict_read_size(ctx, NGX_READ_PREDICTOR_PROBE, read_req->read_offset);
+	}
+	else
+	{
+		read_size = read_req->read_size + read_req->read_offset - read_offset;
+	}
+
+	read_size = (read_size + ctx->alignment - 1) & (~(ctx->alignment - 1));
+
+	// optimization for the case in which the current range is a prefix of the new range
+	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
+	prefix_size = 0;
+
+	if (read_offset >= ctx->read_offset && 
+		read_offset < (off_t)(ctx->read_offset + buffer_size) &&
+		ctx->read_buffer.start != NULL)
+	{
+		prefix_size = ctx->read_offset + buffer_size - read_offset;
+		ctx->prefix_buffer = ctx->read_buffer;
+		ctx->prefix_buffer.pos = ctx->prefix_buffer.last - prefix_size;
+		ctx->read_buffer.start = NULL;
+	}
+	else if ((read_req->flags & MEDIA_READ_FLAG_REALLOC_BUFFER) != 0)
+	{
+		ctx->read_buffer.start = NULL;
+	}
+
+	// allocate the read buffer
+	rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	if (ctx->prefix_buffer.start != NULL)
+	{
+		ctx->read_buffer.start += prefix_size;
+		ctx->read_buffer.pos = ctx->read_buffer.start;
 		ctx->read_buffer.last = ctx->read_buffer.start;
 	}
 
@@ -1951,6 +2428,9 @@ ngx_http_vod_read_metadata(ngx_http_vod_ctx_t* ctx)
 			ctx->requested_offset,
 			&read_buffer,
 			&result);
+
+		ngx_http_vod_update_read_predictor(ctx, &read_buffer, rc, &result);
+
 		if (rc == VOD_OK)
 		{
 			ctx->metadata_parts = result.parts;
@@ -2027,209 +2507,457 @@ ngx_http_vod_read_frames(ngx_http_vod_ctx_t *ctx)
 	return NGX_OK;
 }
 
+static void
+ngx_http_vod_prefetch_sources(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
+
+	if (ctx->prefetch_size <= 0)
+	{
+		return;
+	}
+
+	for (cur_source = ctx->cur_source;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		if (cur_source->reader_context != NULL)
+		{
+			ngx_file_reader_prefetch(cur_source->reader_context, 0, ctx->prefetch_size);
+		}
+	}
+}
+
+// opens all the sources starting from cur_source, when the opens are performed on a thread pool, they all run
+// concurrently, and the state machine resumes once they all complete. if prefetch_size is non-zero, the kernel is
+// asked to read ahead the beginning of all files, so that the initial reads that are performed source by source are
+// served from the page cache
 static ngx_int_t
-ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_open_sources(ngx_http_vod_ctx_t *ctx, size_t prefetch_size)
 {
-	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
-	multipart_cache_header_t multipart_header;
 	media_clip_source_t* cur_source;
 	ngx_http_request_t* r = ctx->submodule_context.r;
 	ngx_int_t rc;
-	bool_t metadata_loaded;
 
-	if (ctx->cur_source == NULL)
+	if (ctx->sources_opened || ctx->reader != &reader_file)
 	{
 		return NGX_OK;
 	}
 
-	for (;;)
+	ctx->sources_opened = 1;
+	ctx->prefetch_size = prefetch_size;
+	ctx->open_rc = NGX_OK;
+	ctx->pending_opens = 1;		// prevent the completion callbacks from resuming the state machine
+
+	for (cur_source = ctx->cur_source;
+		cur_source != NULL;
+		cur_source = cur_source->next)
 	{
-		switch (ctx->state)
+		if (cur_source->reader_context != NULL ||
+			(cur_source->mapped_uri.len == empty_file_string.len &&
+			ngx_strncasecmp(cur_source->mapped_uri.data, empty_file_string.data, empty_file_string.len) == 0))
 		{
-		case STATE_READ_METADATA_INITIAL:
-			metadata_loaded = FALSE;
-			cur_source = ctx->cur_source;
+			continue;
+		}
 
-			if (cur_source->mapped_uri.len == empty_file_string.len &&
-				ngx_strncasecmp(cur_source->mapped_uri.data, empty_file_string.data, empty_file_string.len) == 0)
-			{
-				// the string "empty" identifies an empty srt file
-				ctx->metadata_parts = ngx_palloc(ctx->submodule_context.request_context.pool,
-					sizeof(*ctx->metadata_parts) + 1);
-				if (ctx->metadata_parts == NULL)
-				{
-					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: ngx_palloc failed");
-					return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
-				}
+		rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
+		if (rc == NGX_AGAIN)
+		{
+			ctx->pending_opens++;
+			continue;
+		}
 
-				ctx->metadata_parts[0].len = 0;
-				ctx->metadata_parts[0].data = (void*)(ctx->metadata_parts + 1);
-				ctx->metadata_parts[0].data[0] = '\0';
-				multipart_header.type = FORMAT_ID_WEBVTT;
-				metadata_loaded = TRUE;
-			}
-			else if (conf->metadata_cache != NULL)
-			{
-				// try to fetch from cache
-				if (ngx_buffer_cache_fetch_multipart_perf(
-					ctx,
-					conf->metadata_cache,
-					cur_source->file_key,
-					&multipart_header,
-					&ctx->metadata_parts))
-				{
-					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: metadata cache hit");
-					metadata_loaded = TRUE;
-				}
-				else
-				{
-					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: metadata cache miss");
-				}
-			}
+		if (rc != NGX_OK)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_open_sources: open_file failed %i", rc);
+			ctx->open_rc = rc;
+			break;
+		}
+	}
 
-			if (metadata_loaded)
-			{
-				// parse the metadata
-				rc = ngx_http_vod_init_format(ctx, multipart_header.type);
-				if (rc != NGX_OK)
-				{
-					return rc;
-				}
+	ctx->pending_opens--;
+	if (ctx->pending_opens > 0)
+	{
+		// Note: in case of an error, the pending opens are waited for before finalizing the request
+		return NGX_AGAIN;
+	}
 
-				rc = ngx_http_vod_parse_metadata(ctx, 1);
-				if (rc == NGX_OK)
-				{
-					ctx->cur_source = cur_source->next;
-					if (ctx->cur_source == NULL)
-					{
-						return NGX_OK;
-					}
-					break;
-				}
+	if (ctx->open_rc != NGX_OK)
+	{
+		return ctx->open_rc;
+	}
 
-				if (rc != NGX_AGAIN)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
-					return rc;
-				}
+	ngx_http_vod_prefetch_sources(ctx);
 
-				ctx->state = STATE_READ_FRAMES_OPEN_FILE;
-			}
-			else
-			{
-				ctx->state = STATE_READ_METADATA_OPEN_FILE;
-			}
+	return NGX_OK;
+}
 
-			// open the file
-			rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
-			if (rc != NGX_OK)
-			{
-				if (rc != NGX_AGAIN && rc != NGX_DONE)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: open_file failed %i", rc);
-				}
-				return rc;
-			}
-			break;
+static ngx_int_t
+ngx_http_vod_parse_index_file(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_file_reader_mapping_t* mapping,
+	ngx_file_info_t* fi,
+	multipart_cache_header_t* header)
+{
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	index_file_t index;
+	ngx_str_t buffer;
+	ngx_int_t rc;
 
-		case STATE_READ_METADATA_OPEN_FILE:
-			// allocate the initial read buffer
-			rc = ngx_http_vod_alloc_read_buffer(ctx, conf->initial_read_size, ctx->alloc_params_index);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
+	rc = ngx_file_reader_mapping_add_cleanup(r, mapping);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
 
-			// read the file header
-			r->connection->log->action = "reading media header";
-			ctx->state = STATE_READ_METADATA_READ;
-			ctx->metadata_reader_context = NULL;
+	buffer.data = mapping->addr;
+	buffer.len = mapping->size;
 
-			ctx->read_offset = 0;
-			ctx->requested_offset = 0;
-			ctx->read_flags = MEDIA_READ_FLAG_ALLOW_EMPTY_READ;
+	rc = index_file_parse(
+		&ctx->submodule_context.request_context,
+		&buffer,
+		ngx_file_size(fi),
+		ngx_file_mtime(fi),
+		&index);
+	switch (rc)
+	{
+	case VOD_OK:
+		break;
 
-			cur_source = ctx->cur_source;
+	case VOD_ALLOC_FAILED:
+		return ngx_http_vod_status_to_ngx_error(r, rc);
 
-			ngx_perf_counter_start(ctx->perf_counter_context);
+	case VOD_NOT_FOUND:
+		ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+			"ngx_http_vod_parse_index_file: ignoring outdated index \"%s\"", mapping->path);
+		return NGX_DECLINED;
 
-			rc = ctx->read(cur_source->reader_context, &ctx->read_buffer, conf->initial_read_size, 0);
-			if (rc != NGX_OK)
-			{
-				if (rc != NGX_AGAIN)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: async_read failed %i", rc);
-				}
-				return rc;
-			}
+	default:
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_parse_index_file: ignoring invalid index \"%s\"", mapping->path);
+		return NGX_DECLINED;
+	}
 
-			// read completed synchronously
-			ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
-			// fallthrough
+	header->type = index.format_id;
+	header->part_count = index.part_count;
+	ctx->metadata_parts = index.parts;
 
-		case STATE_READ_METADATA_READ:
-			// read the metadata
-			rc = ngx_http_vod_read_metadata(ctx);
-			if (rc != NGX_OK)
-			{
-				if (rc != NGX_AGAIN)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_read_metadata failed %i", rc);
-				}
-				return rc;
-			}
+	return NGX_OK;
+}
 
-			// parse the metadata
-			rc = ngx_http_vod_parse_metadata(ctx, 0);
-			if (rc != NGX_OK && rc != NGX_AGAIN)
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	u_char* media_path;
+	ngx_file_info_t fi;
+	ngx_file_reader_mapping_t mapping;
+	ngx_int_t rc;
+} ngx_http_vod_index_task_ctx_t;
+
+static void
+ngx_http_vod_index_thread_handler(void *data, ngx_log_t *log)
+{
+	ngx_http_vod_index_task_ctx_t* task_ctx = data;
+
+	// get the info of the media file, the index is used only if it matches the file
+	if (ngx_file_info(task_ctx->media_path, &task_ctx->fi) == NGX_FILE_ERROR)
+	{
+		task_ctx->rc = NGX_DECLINED;		// the error will be reported when the file is opened
+		return;
+	}
+
+	task_ctx->rc = ngx_file_reader_map_file_no_pool(&task_ctx->mapping);
+}
+
+static void
+ngx_http_vod_index_task_event_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_index_task_ctx_t* task_ctx = ev->data;
+	ngx_http_vod_ctx_t* ctx = task_ctx->ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_connection_t* c = r->connection;
+	ngx_int_t rc;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	ctx->index_completed = 1;
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc != NGX_AGAIN)
+	{
+		ngx_http_vod_finalize_request(ctx, rc);
+	}
+
+	ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_http_vod_post_index_task(ngx_http_vod_ctx_t *ctx, u_char* media_path, u_char* path)
+{
+	ngx_http_vod_index_task_ctx_t* task_ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_thread_task_t* task;
+
+	task = ctx->index_task;
+	if (task == NULL)
+	{
+		task = ngx_thread_task_alloc(r->pool, sizeof(*task_ctx));
+		if (task == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_post_index_task: ngx_thread_task_alloc failed");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		}
+
+		task_ctx = task->ctx;
+		task_ctx->ctx = ctx;
+
+		task->handler = ngx_http_vod_index_thread_handler;
+		task->event.data = task_ctx;
+		task->event.handler = ngx_http_vod_index_task_event_handler;
+
+		ctx->index_task = task;
+	}
+
+	task_ctx = task->ctx;
+	task_ctx->media_path = media_path;
+	task_ctx->mapping.path = path;
+	task_ctx->mapping.log = r->connection->log;
+
+	if (ngx_thread_task_post(ctx->submodule_context.conf->open_file_thread_pool, task) != NGX_OK)
+	{
+		return NGX_DECLINED;
+	}
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	return NGX_AGAIN;
+}
+#endif // NGX_THREADS
+
+// returns NGX_AGAIN when the index was posted to the open file thread pool, the state machine is resumed on completion
+static ngx_int_t
+ngx_http_vod_load_index_file(
+	ngx_http_vod_ctx_t *ctx, 
+	media_clip_source_t* source, 
+	multipart_cache_header_t* header)
+{
+	ngx_file_reader_mapping_t mapping;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_file_info_t fi;
+	ngx_int_t rc;
+	u_char* media_path;
+	u_char* path;
+	u_char* p;
+
+#if (NGX_THREADS)
+	ngx_http_vod_index_task_ctx_t* task_ctx;
+
+	if (ctx->index_completed)
+	{
+		ctx->index_completed = 0;
+
+		task_ctx = ctx->index_task->ctx;
+		if (task_ctx->rc != NGX_OK)
+		{
+			return task_ctx->rc;
+		}
+
+		return ngx_http_vod_parse_index_file(ctx, &task_ctx->mapping, &task_ctx->fi, header);
+	}
+#endif // NGX_THREADS
+
+	// build the paths of the media file and the index file
+	media_path = ngx_pnalloc(r->pool, source->mapped_uri.len * 2 + 1 + sizeof(INDEX_FILE_EXTENSION));
+	if (media_path == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_load_index_file: ngx_pnalloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
+
+	p = ngx_copy(media_path, source->mapped_uri.data, source->mapped_uri.len);
+	*p++ = '\0';
+
+	path = p;
+	p = ngx_copy(path, source->mapped_uri.data, source->mapped_uri.len);
+	ngx_memcpy(p, INDEX_FILE_EXTENSION, sizeof(INDEX_FILE_EXTENSION));
+
+#if (NGX_THREADS)
+	if (ctx->submodule_context.conf->open_file_thread_pool != NULL)
+	{
+		rc = ngx_http_vod_post_index_task(ctx, media_path, path);
+		if (rc != NGX_DECLINED)
+		{
+			return rc;
+		}
+
+		// failed to post the task, load the index synchronously
+	}
+#endif // NGX_THREADS
+
+	// get the info of the media file, the index is used only if it matches the file
+	if (ngx_file_info(media_path, &fi) == NGX_FILE_ERROR)
+	{
+		return NGX_DECLINED;		// the error will be reported when the file is opened
+	}
+
+	mapping.path = path;
+	mapping.log = r->connection->log;
+
+	rc = ngx_file_reader_map_file_no_pool(&mapping);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_parse_index_file(ctx, &mapping, &fi, header);
+}
+
+static ngx_int_t
+ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	multipart_cache_header_t multipart_header;
+	media_clip_source_t* cur_source;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_int_t rc;
+	bool_t metadata_loaded;
+
+	if (ctx->cur_source == NULL)
+	{
+		return NGX_OK;
+	}
+
+	for (;;)
+	{
+		switch (ctx->state)
+		{
+		case STATE_READ_METADATA_INITIAL:
+			if (ctx->request != NULL || conf->metadata_cache == NULL)
 			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
-				return rc;
+				// all the files are going to be read, open them all in advance
+				rc = ngx_http_vod_open_sources(
+					ctx, 
+					conf->metadata_cache == NULL ? conf->initial_read_size : 0);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
 			}
 
-			// save the metadata to cache
+			metadata_loaded = FALSE;
 			cur_source = ctx->cur_source;
 
-			if (conf->metadata_cache != NULL)
+			if (cur_source->mapped_uri.len == empty_file_string.len &&
+				ngx_strncasecmp(cur_source->mapped_uri.data, empty_file_string.data, empty_file_string.len) == 0)
 			{
-				multipart_header.type = ctx->format->id;
-				multipart_header.part_count = ctx->metadata_part_count;
+				// the string "empty" identifies an empty srt file
+				ctx->metadata_parts = ngx_palloc(ctx->submodule_context.request_context.pool,
+					sizeof(*ctx->metadata_parts) + 1);
+				if (ctx->metadata_parts == NULL)
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: ngx_palloc failed");
+					return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+				}
 
-				if (ngx_buffer_cache_store_multipart_perf(
+				ctx->metadata_parts[0].len = 0;
+				ctx->metadata_parts[0].data = (void*)(ctx->metadata_parts + 1);
+				ctx->metadata_parts[0].data[0] = '\0';
+				multipart_header.type = FORMAT_ID_WEBVTT;
+				metadata_loaded = TRUE;
+			}
+#if (NGX_THREADS)
+			else if (ctx->index_completed)
+			{
+				// the metadata cache was checked before the index task was posted
+			}
+#endif // NGX_THREADS
+			else if (conf->metadata_cache != NULL)
+			{
+				// try to fetch from cache
+				if (ngx_buffer_cache_fetch_multipart_perf(
 					ctx,
 					conf->metadata_cache,
 					cur_source->file_key,
 					&multipart_header,
-					ctx->metadata_parts))
+					&ctx->metadata_parts))
 				{
-					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: stored metadata in cache");
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: metadata cache hit");
+					metadata_loaded = TRUE;
 				}
 				else
 				{
-					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: failed to store metadata in cache");
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: metadata cache miss");
 				}
 			}
 
-			if (ctx->request != NULL)
+			if (!metadata_loaded && conf->index_sidecar && ctx->reader->map != NULL)
 			{
-				// no longer need the metadata buffer
-				ngx_pfree(ctx->submodule_context.r->pool, ctx->read_buffer.start);
-				ctx->read_buffer.start = NULL;
+				// try to load the metadata from a precomputed index file (local mode only)
+				rc = ngx_http_vod_load_index_file(ctx, cur_source, &multipart_header);
+				switch (rc)
+				{
+				case NGX_OK:
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: loaded metadata from index file");
+					metadata_loaded = TRUE;
+					break;
+
+				case NGX_DECLINED:
+					break;
+
+				default:
+					return rc;
+				}
+			}
+
+			if (metadata_loaded)
+			{
+				rc = ngx_http_vod_init_format(ctx, multipart_header.type);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+
+				ctx->state = STATE_PARSE_CACHED_METADATA;
+				break;
 			}
 
+			// open the file
+			ctx->state = STATE_READ_METADATA_OPEN_FILE;
+
+			if (cur_source->reader_context != NULL)
+			{
+				break;		// already opened
+			}
+
+			rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
+			if (rc != NGX_OK)
+			{
+				if (rc != NGX_AGAIN && rc != NGX_DONE)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: open_file failed %i (1)", rc);
+				}
+				return rc;
+			}
+			break;
+
+		case STATE_PARSE_CACHED_METADATA:
+			// parse the metadata
+			cur_source = ctx->cur_source;
+
+			rc = ngx_http_vod_parse_metadata(ctx, 1);
 			if (rc == NGX_OK)
 			{
-				// move to the next source
 				ctx->state = STATE_READ_METADATA_INITIAL;
 
 				ctx->cur_source = cur_source->next;
@@ -2239,42 +2967,189 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				}
 				break;
 			}
-			// fallthrough
-
-		case STATE_READ_FRAMES_OPEN_FILE:
-			ctx->state = STATE_READ_FRAMES_READ;
-			ctx->read_buffer.start = NULL;			// don't reuse buffers from the metadata phase
 
-			rc = ngx_http_vod_async_read(ctx, &ctx->frames_read_req);
-			if (rc != NGX_OK)
+			if (rc != NGX_AGAIN)
 			{
+				if (rc == NGX_DONE)
+				{
+					return NGX_AGAIN;		// parsing on a thread
+				}
+
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i (1)", rc);
 				return rc;
 			}
-			// fallthrough
 
-		case STATE_READ_FRAMES_READ:
-			rc = ngx_http_vod_read_frames(ctx);
+			// open the file
+			ctx->state = STATE_READ_FRAMES_OPEN_FILE;
+
+			if (cur_source->reader_context != NULL)
+			{
+				break;		// already opened
+			}
+
+			rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
 			if (rc != NGX_OK)
 			{
+				if (rc != NGX_AGAIN && rc != NGX_DONE)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: open_file failed %i (2)", rc);
+				}
 				return rc;
 			}
+			break;
 
-			// move to the next source
-			ctx->state = STATE_READ_METADATA_INITIAL;
+		case STATE_READ_METADATA_OPEN_FILE:
+			// allocate the initial read buffer
+			ctx->initial_read_size = ngx_http_vod_predict_read_size(ctx, NGX_READ_PREDICTOR_HEAD, 0);
+			ctx->initial_read_size = (ctx->initial_read_size + ctx->alignment - 1) & (~(ctx->alignment - 1));
 
-			ctx->cur_source = ctx->cur_source->next;
-			if (ctx->cur_source == NULL)
+			rc = ngx_http_vod_alloc_read_buffer(ctx, ctx->initial_read_size, ctx->alloc_params_index);
+			if (rc != NGX_OK)
 			{
-				return NGX_OK;
+				return rc;
 			}
-			break;
-
-		default:
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_state_machine_parse_metadata: invalid state %d", ctx->state);
-			return ngx_http_vod_status_to_ngx_error(r, VOD_UNEXPECTED);
-		}
-	}
+
+			// read the file header
+			r->connection->log->action = "reading media header";
+			ctx->state = STATE_READ_METADATA_READ;
+			ctx->metadata_reader_context = NULL;
+
+			ctx->read_offset = 0;
+			ctx->requested_offset = 0;
+			ctx->read_flags = MEDIA_READ_FLAG_ALLOW_EMPTY_READ;
+
+			cur_source = ctx->cur_source;
+
+			ngx_perf_counter_start(ctx->perf_counter_context);
+
+			rc = ctx->read(cur_source->reader_context, &ctx->read_buffer, ctx->initial_read_size, 0);
+			if (rc != NGX_OK)
+			{
+				if (rc != NGX_AGAIN)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: async_read failed %i", rc);
+				}
+				return rc;
+			}
+
+			// read completed synchronously
+			ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
+			// fallthrough
+
+		case STATE_READ_METADATA_READ:
+			// read the metadata
+			rc = ngx_http_vod_read_metadata(ctx);
+			if (rc != NGX_OK)
+			{
+				if (rc != NGX_AGAIN)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_read_metadata failed %i", rc);
+				}
+				return rc;
+			}
+
+			ctx->state = STATE_PARSE_METADATA;
+			// fallthrough
+
+		case STATE_PARSE_METADATA:
+			// parse the metadata
+			rc = ngx_http_vod_parse_metadata(ctx, 0);
+			if (rc != NGX_OK && rc != NGX_AGAIN)
+			{
+				if (rc == NGX_DONE)
+				{
+					return NGX_AGAIN;		// parsing on a thread
+				}
+
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i (2)", rc);
+				return rc;
+			}
+
+			// save the metadata to cache
+			cur_source = ctx->cur_source;
+
+			if (conf->metadata_cache != NULL)
+			{
+				multipart_header.type = ctx->format->id;
+				multipart_header.part_count = ctx->metadata_part_count;
+
+				if (ngx_buffer_cache_store_multipart_perf(
+					ctx,
+					conf->metadata_cache,
+					cur_source->file_key,
+					&multipart_header,
+					ctx->metadata_parts))
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: stored metadata in cache");
+				}
+				else
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: failed to store metadata in cache");
+				}
+			}
+
+			if (ctx->request != NULL)
+			{
+				// no longer need the metadata buffer
+				ngx_pfree(ctx->submodule_context.r->pool, ctx->read_buffer.start);
+				ctx->read_buffer.start = NULL;
+			}
+
+			if (rc == NGX_OK)
+			{
+				// move to the next source
+				ctx->state = STATE_READ_METADATA_INITIAL;
+
+				ctx->cur_source = cur_source->next;
+				if (ctx->cur_source == NULL)
+				{
+					return NGX_OK;
+				}
+				break;
+			}
+			// fallthrough
+
+		case STATE_READ_FRAMES_OPEN_FILE:
+			ctx->state = STATE_READ_FRAMES_READ;
+			ctx->read_buffer.start = NULL;			// don't reuse buffers from the metadata phase
+
+			rc = ngx_http_vod_async_read(ctx, &ctx->frames_read_req);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+			// fallthrough
+
+		case STATE_READ_FRAMES_READ:
+			rc = ngx_http_vod_read_frames(ctx);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			// move to the next source
+			ctx->state = STATE_READ_METADATA_INITIAL;
+
+			ctx->cur_source = ctx->cur_source->next;
+			if (ctx->cur_source == NULL)
+			{
+				return NGX_OK;
+			}
+			break;
+
+		default:
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_state_machine_parse_metadata: invalid state %d", ctx->state);
+			return ngx_http_vod_status_to_ngx_error(r, VOD_UNEXPECTED);
+		}
+	}
 
 	return NGX_OK;
 }
@@ -2377,6 +3252,17 @@ ngx_http_vod_update_track_timescale(
 
 	// initialize the first part
 	part = &track->frames;
+	if (part->compact != NULL)
+	{
+		// Note: compact lists are single part, the frames are converted while iterating
+		scaled_dts = frame_list_compact_set_timescale(
+			part->compact,
+			dts,
+			new_timescale,
+			pts_delay,
+			part->clip_to != UINT_MAX ? rescale_time(part->clip_to, 1000, new_timescale) : ULLONG_MAX);
+	}
+
 	cur_frame = part->first_frame;
 	last_frame = part->last_frame;
 	if (part->clip_to != UINT_MAX && cur_frame < last_frame)
@@ -2529,1862 +3415,3817 @@ ngx_http_vod_update_timescale(ngx_http_vod_ctx_t *ctx)
 
 ////// Metadata request handling
 
-static ngx_int_t
-ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
+static void
+ngx_http_vod_get_segment_durations_key(vod_str_t* key, u_char* result)
 {
-	ngx_http_vod_loc_conf_t* conf;
-	response_cache_header_t cache_header;
-	ngx_buffer_cache_t* cache;
-	ngx_str_t cache_buffers[3];
-	ngx_str_t content_type;
-	ngx_str_t response = ngx_null_string;
-	ngx_int_t rc;
-	int cache_type;
+	ngx_md5_t md5;
 
-	rc = ngx_http_vod_update_timescale(ctx);
-	if (rc != NGX_OK)
-	{
-		return rc;
-	}
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, key->data, key->len);
+	ngx_md5_final(result, &md5);
+}
 
-	ngx_perf_counter_start(ctx->perf_counter_context);
+static bool_t
+ngx_http_vod_segment_durations_cache_fetch(void* context, vod_str_t* key, vod_str_t* buffer)
+{
+	ngx_http_vod_ctx_t *ctx = context;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
 
-	rc = ctx->request->handle_metadata_request(
-		&ctx->submodule_context,
-		&response,
-		&content_type);
-	if (rc != NGX_OK)
+	ngx_http_vod_get_segment_durations_key(key, cache_key);
+
+	if (!ngx_buffer_cache_fetch_perf(
+		ctx->perf_counters,
+		ctx->submodule_context.conf->metadata_cache,
+		cache_key,
+		buffer))
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_handle_metadata_request: handle_metadata_request failed %i", rc);
-		return rc;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_segment_durations_cache_fetch: segment durations cache miss");
+		return FALSE;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_BUILD_MANIFEST);
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_segment_durations_cache_fetch: segment durations cache hit");
+	return TRUE;
+}
 
-	conf = ctx->submodule_context.conf;
-	if (ctx->submodule_context.media_set.original_type != MEDIA_SET_LIVE ||
-		(ctx->request->flags & REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE) == 0)
+static void
+ngx_http_vod_segment_durations_cache_store(void* context, vod_str_t* key, vod_str_t* buffer)
+{
+	ngx_http_vod_ctx_t *ctx = context;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+
+	ngx_http_vod_get_segment_durations_key(key, cache_key);
+
+	if (ngx_buffer_cache_store_perf(
+		ctx->perf_counters,
+		ctx->submodule_context.conf->metadata_cache,
+		cache_key,
+		buffer->data,
+		buffer->len))
 	{
-		cache_type = CACHE_TYPE_VOD;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_segment_durations_cache_store: stored segment durations in cache");
 	}
 	else
 	{
-		cache_type = CACHE_TYPE_LIVE;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_segment_durations_cache_store: failed to store segment durations in cache");
 	}
+}
 
-	cache = conf->response_cache[cache_type];
-	if (cache != NULL && response.data != NULL)
-	{
-		cache_header.content_type_len = content_type.len;
-		cache_header.media_set_type = ctx->submodule_context.media_set.type;
-		cache_buffers[0].data = (u_char*)&cache_header;
-		cache_buffers[0].len = sizeof(cache_header);
-		cache_buffers[1] = content_type;
-		cache_buffers[2] = response;
+static ngx_int_t
+ngx_http_vod_get_request_key(
+	ngx_http_request_t* r,
+	ngx_http_vod_loc_conf_t* conf,
+	ngx_str_t* uri,
+	u_char* request_key)
+{
+	ngx_md5_t md5;
+	ngx_str_t base_url;
+	ngx_int_t rc;
 
-		if (ngx_buffer_cache_store_gather_perf(ctx->perf_counters, cache, ctx->request_key, cache_buffers, 3))
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_metadata_request: stored in response cache");
-		}
-		else
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_metadata_request: failed to store response in cache");
-		}
-	}
+	ngx_md5_init(&md5);
 
-	rc = ngx_http_vod_send_header(
-		ctx->submodule_context.r, 
-		response.len, 
-		&content_type, 
-		ctx->submodule_context.media_set.type, 
-		ctx->request);
+	base_url.len = 0;
+	rc = ngx_http_vod_get_base_url(r, conf->base_url, &empty_string, &base_url);
 	if (rc != NGX_OK)
 	{
 		return rc;
 	}
-	
-	return ngx_http_vod_send_response(ctx->submodule_context.r, &response, NULL);
-}
-
-////// Segment request handling
-
-static ngx_int_t
-ngx_http_vod_state_machine_open_files(ngx_http_vod_ctx_t *ctx)
-{
-	media_clip_source_t* cur_source;
-	ngx_str_t* path;
-	ngx_int_t rc;
+	ngx_md5_update(&md5, base_url.data, base_url.len);
 
-	for (cur_source = ctx->cur_source;
-		cur_source != NULL;
-		cur_source = cur_source->next)
+	if (conf->segments_base_url != NULL)
 	{
-		// open the file if not already opened
-		if (cur_source->reader_context != NULL)
-		{
-			continue;
-		}
-
-		path = &cur_source->mapped_uri;
-
-		rc = ctx->reader->open(ctx->submodule_context.r, path, 0, &cur_source->reader_context);
+		base_url.len = 0;
+		rc = ngx_http_vod_get_base_url(r, conf->segments_base_url, &empty_string, &base_url);
 		if (rc != NGX_OK)
 		{
-			if (rc != NGX_AGAIN && rc != NGX_DONE)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_state_machine_open_files: open_file failed %i", rc);
-			}
-
-			ctx->cur_source = cur_source;
 			return rc;
 		}
+		ngx_md5_update(&md5, base_url.data, base_url.len);
 	}
 
-	ctx->cur_source = NULL;
+	ngx_md5_update(&md5, uri->data, uri->len);
+
+	ngx_md5_final(request_key, &md5);
+
 	return NGX_OK;
 }
 
 static void
-ngx_http_vod_enable_directio(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_store_response(
+	ngx_perf_counters_t* perf_counters,
+	ngx_buffer_cache_t* cache,
+	request_context_t* request_context,
+	u_char* request_key,
+	uint32_t media_set_type,
+	ngx_str_t* content_type,
+	ngx_str_t* response)
 {
-	media_clip_source_t* cur_source;
+	response_cache_header_t cache_header;
+	ngx_str_t cache_buffers[3];
 
-	for (cur_source = ctx->submodule_context.media_set.sources_head;
-		cur_source != NULL;
-		cur_source = cur_source->next)
+	cache_header.content_type_len = content_type->len;
+	cache_header.response_len = response->len;
+	cache_header.media_set_type = media_set_type;
+	cache_buffers[0].data = (u_char*)&cache_header;
+	cache_buffers[0].len = sizeof(cache_header);
+	cache_buffers[1] = *content_type;
+	cache_buffers[2] = *response;
+
+	if (ngx_buffer_cache_store_gather_perf(perf_counters, cache, request_key, cache_buffers, 3))
 	{
-		ngx_file_reader_enable_directio(cur_source->reader_context);
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_store_response: stored in response cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_store_response: failed to store response in cache");
 	}
 }
 
-static vod_status_t
-ngx_http_vod_write_segment_header_buffer(void* ctx, u_char* buffer, uint32_t size)
+////// Generated cache
+
+static ngx_flag_t
+ngx_http_vod_generated_cache_enabled(ngx_http_vod_ctx_t *ctx)
 {
-	ngx_http_vod_write_segment_context_t* context = (ngx_http_vod_write_segment_context_t*)ctx;
-	ngx_chain_t *chain_head;
-	ngx_chain_t *chain;
-	ngx_buf_t *b;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
 
-	if (context->r->header_sent)
-	{
-		ngx_log_error(NGX_LOG_ERR, context->r->connection->log, 0,
-			"ngx_http_vod_write_segment_header_buffer: called after the headers were already sent");
-		return VOD_UNEXPECTED;
-	}
+	return ctx->request != NULL &&
+		(ctx->request->flags & REQUEST_FLAG_CACHE_GENERATED) != 0 &&
+		(conf->generated_cache != NULL || conf->generated_cache_path.len > 0);
+}
 
-	b = ngx_calloc_buf(context->r->pool);
-	if (b == NULL)
+static ngx_int_t
+ngx_http_vod_init_generated_cache_key(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	media_clip_source_t* cur_source;
+	ngx_md5_t md5;
+	u_char request_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_int_t rc;
+
+	// the uri contains the request params (time / dimensions / interval), the file keys identify the sources
+	rc = ngx_http_vod_get_request_key(ctx->submodule_context.r, conf, &ctx->submodule_context.r->uri, request_key);
+	if (rc != NGX_OK)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-			"ngx_http_vod_write_segment_header_buffer: ngx_calloc_buf failed");
-		return VOD_ALLOC_FAILED;
+		return rc;
 	}
 
-	b->pos = buffer;
-	b->last = buffer + size;
-	b->temporary = 1;
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, request_key, sizeof(request_key));
 
-	chain = ngx_alloc_chain_link(context->r->pool);
-	if (chain == NULL)
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-			"ngx_http_vod_write_segment_header_buffer: ngx_alloc_chain_link failed");
-		return VOD_ALLOC_FAILED;
+		ngx_md5_update(&md5, cur_source->file_key, sizeof(cur_source->file_key));
 	}
 
-	chain_head = context->chain_head;
+#if (NGX_HAVE_LIB_AV_CODEC)
+	// the configuration values that affect the generated output
+	ngx_md5_update(&md5, &conf->volume_map.interval, sizeof(conf->volume_map.interval));
+	ngx_md5_update(&md5, &conf->thumb.accurate, sizeof(conf->thumb.accurate));
+	ngx_md5_update(&md5, &conf->thumb.fast_decode, sizeof(conf->thumb.fast_decode));
+#if (NGX_HAVE_LIB_SW_SCALE)
+	ngx_md5_update(&md5, &conf->thumb.sprite_interval, sizeof(conf->thumb.sprite_interval));
+	ngx_md5_update(&md5, &conf->thumb.sprite_columns, sizeof(conf->thumb.sprite_columns));
+	ngx_md5_update(&md5, &conf->thumb.sprite_rows, sizeof(conf->thumb.sprite_rows));
+	ngx_md5_update(&md5, &conf->thumb.sprite_tile_width, sizeof(conf->thumb.sprite_tile_width));
+#endif // NGX_HAVE_LIB_SW_SCALE
+#endif // NGX_HAVE_LIB_AV_CODEC
 
-	chain->buf = chain_head->buf;
-	chain->next = chain_head->next;
+	ngx_md5_final(ctx->generated_cache_key, &md5);
 
-	chain_head->buf = b;
-	chain_head->next = chain;
+	return NGX_OK;
+}
 
-	if (chain_head == context->chain_end)
+static u_char*
+ngx_http_vod_get_generated_cache_file_path(ngx_http_vod_ctx_t *ctx, ngx_str_t* suffix)
+{
+	ngx_str_t* cache_path = &ctx->submodule_context.conf->generated_cache_path;
+	u_char* result;
+	u_char* p;
+
+	result = ngx_pnalloc(ctx->submodule_context.request_context.pool,
+		cache_path->len + sizeof("/") - 1 + BUFFER_CACHE_KEY_SIZE * 2 + suffix->len + 1);
+	if (result == NULL)
 	{
-		context->chain_end = chain;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_get_generated_cache_file_path: ngx_pnalloc failed");
+		return NULL;
 	}
 
-	context->total_size += size;
+	p = ngx_copy(result, cache_path->data, cache_path->len);
+	*p++ = '/';
+	p = ngx_hex_dump(p, ctx->generated_cache_key, BUFFER_CACHE_KEY_SIZE);
+	p = ngx_copy(p, suffix->data, suffix->len);
+	*p = '\0';
 
-	return VOD_OK;
+	return result;
 }
 
-static vod_status_t 
-ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
+static ngx_int_t
+ngx_http_vod_send_generated_response(ngx_http_vod_ctx_t *ctx, ngx_str_t* cache_buffer, ngx_flag_t from_file)
 {
-	ngx_http_vod_write_segment_context_t* context;
-	ngx_buf_t *b;
-	ngx_chain_t *chain;
-	ngx_chain_t out;
+	response_cache_header_t cache_header;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t content_type;
+	ngx_str_t response;
 	ngx_int_t rc;
 
-	if (size <= 0)
+	if (cache_buffer->len <= sizeof(cache_header))
 	{
-		return VOD_OK;
+		return NGX_DECLINED;
 	}
 
-	context = (ngx_http_vod_write_segment_context_t*)ctx;
-	
-	// create a wrapping ngx_buf_t
-	b = ngx_calloc_buf(context->r->pool);
-	if (b == NULL) 
+	// extract the content type
+	ngx_memcpy(&cache_header, cache_buffer->data, sizeof(cache_header));
+
+	content_type.data = cache_buffer->data + sizeof(cache_header);
+	content_type.len = cache_header.content_type_len;
+
+	if (cache_buffer->len - sizeof(cache_header) < content_type.len)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-			"ngx_http_vod_write_segment_buffer: ngx_calloc_buf failed");
-		return VOD_ALLOC_FAILED;
+		return NGX_DECLINED;
 	}
 
-	b->pos = buffer;
-	b->last = buffer + size;
-	b->temporary = 1;
+	// extract the response buffer
+	response.data = content_type.data + content_type.len;
+	response.len = cache_buffer->data + cache_buffer->len - response.data;
 
-	if (context->r->header_sent)
+	if (response.len != cache_header.response_len)
 	{
-		// headers already sent, output the chunk
-		out.buf = b;
-		out.next = NULL;
+		ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+			"ngx_http_vod_send_generated_response: response size %uz does not match the size %uz in the header, from file %i",
+			response.len, cache_header.response_len, from_file);
+		return NGX_DECLINED;
+	}
 
-		rc = ngx_http_output_filter(context->r, &out);
-		if (rc != NGX_OK && rc != NGX_AGAIN)
-		{
-			// either the connection dropped, or some allocation failed
-			// in case the connection dropped, the error code doesn't matter anyway
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-				"ngx_http_vod_write_segment_buffer: ngx_http_output_filter failed %i", rc);
-			return VOD_ALLOC_FAILED;
-		}
+	ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_send_generated_response: cache hit, size is %uz, from file %i", response.len, from_file);
+
+	// promote entries found in the file tier to shared memory
+	if (from_file && conf->generated_cache != NULL)
+	{
+		ngx_buffer_cache_store_perf(
+			ctx->perf_counters,
+			conf->generated_cache,
+			ctx->generated_cache_key,
+			cache_buffer->data,
+			cache_buffer->len);
 	}
-	else
+
+	// return the response
+	rc = ngx_http_vod_send_header(r, response.len, &content_type, cache_header.media_set_type, NULL);
+	if (rc != NGX_OK)
 	{
-		// headers not sent yet, add the buffer to the chain
-		if (context->chain_end->buf != NULL)
-		{
-			chain = ngx_alloc_chain_link(context->r->pool);
-			if (chain == NULL) 
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-					"ngx_http_vod_write_segment_buffer: ngx_alloc_chain_link failed");
-				return VOD_ALLOC_FAILED;
-			}
+		return rc;
+	}
 
-			context->chain_end->next = chain;
-			context->chain_end = chain;
-		}
-		context->chain_end->buf = b;
+	return ngx_http_vod_send_response(r, &response, NULL);
+}
+
+static ngx_int_t
+ngx_http_vod_generated_file_mapped(ngx_http_vod_ctx_t *ctx, ngx_int_t rc, ngx_str_t* cache_buffer, time_t mtime)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+
+	if (rc != NGX_OK)
+	{
+		return rc;
 	}
 
-	context->total_size += size;
+	if (conf->generated_cache_file_expiration > 0 &&
+		ngx_time() > mtime + conf->generated_cache_file_expiration)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.r->connection->log, 0,
+			"ngx_http_vod_generated_file_mapped: file expired");
+		return NGX_DECLINED;
+	}
 
-	return VOD_OK;
+	return ngx_http_vod_send_generated_response(ctx, cache_buffer, 1);
 }
 
-static ngx_int_t 
-ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
+#if (NGX_THREADS)
+static void
+ngx_http_vod_generated_file_map_callback(void* context, ngx_int_t rc, ngx_str_t* data, time_t mtime)
 {
+	ngx_http_vod_ctx_t *ctx = context;
 	ngx_http_request_t* r = ctx->submodule_context.r;
-	ngx_str_t output_buffer = ngx_null_string;
-	ngx_str_t content_type;
-	ngx_int_t rc;
-	off_t range_start;
-	off_t range_end;
+	ngx_connection_t* c = r->connection;
 
-	rc = ngx_http_vod_update_timescale(ctx);
-	if (rc != NGX_OK)
+	rc = ngx_http_vod_generated_file_mapped(ctx, rc, data, mtime);
+	if (rc == NGX_DECLINED)
 	{
-		return rc;
+		// cache miss, generate the response
+		rc = ngx_http_vod_start_reading_metadata(ctx);
 	}
 
-	// initialize the response writer
-	ctx->out.buf = NULL;
-	ctx->out.next = NULL;
-	ctx->write_segment_buffer_context.r = r;
-	ctx->write_segment_buffer_context.chain_head = &ctx->out;
-	ctx->write_segment_buffer_context.chain_end = &ctx->out;
-	ctx->write_segment_buffer_context.total_size = 0;
+	if (rc != NGX_AGAIN)
+	{
+		ngx_http_vod_finalize_request(ctx, rc);
+	}
 
-	ctx->segment_writer.write_tail = ngx_http_vod_write_segment_buffer;
-	ctx->segment_writer.write_head = ngx_http_vod_write_segment_header_buffer;
-	ctx->segment_writer.context = &ctx->write_segment_buffer_context;
+	ngx_http_run_posted_requests(c);
+}
+#endif // NGX_THREADS
 
-	// initialize the protocol specific frame processor
-	ngx_perf_counter_start(ctx->perf_counter_context);
+// returns NGX_DECLINED when the response was not found in the cache
+static ngx_int_t
+ngx_http_vod_fetch_generated_response(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t cache_buffer;
+	time_t mtime;
+	u_char* path;
+	ngx_int_t rc;
 
-	rc = ctx->request->init_frame_processor(
-		&ctx->submodule_context,
-		&ctx->segment_writer,
-		&ctx->frame_processor,
-		&ctx->frame_processor_state,
-		&output_buffer,
-		&ctx->content_length,
-		&content_type);
+	rc = ngx_http_vod_init_generated_cache_key(ctx);
 	if (rc != NGX_OK)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_init_frame_processing: init_frame_processor failed %i", rc);
 		return rc;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_INIT_FRAME_PROCESS);
+	if (conf->generated_cache != NULL &&
+		ngx_buffer_cache_fetch_copy_perf(
+			r,
+			ctx->perf_counters,
+			&conf->generated_cache,
+			1,
+			ctx->generated_cache_key,
+			&cache_buffer) >= 0)
+	{
+		return ngx_http_vod_send_generated_response(ctx, &cache_buffer, 0);
+	}
 
-	r->headers_out.content_type_len = content_type.len;
-	r->headers_out.content_type.len = content_type.len;
-	r->headers_out.content_type.data = content_type.data;
+	if (conf->generated_cache_path.len <= 0)
+	{
+		return NGX_DECLINED;
+	}
 
-	// if the frame processor can't determine the size in advance we have to build the whole response before we can start sending it
-	if (ctx->content_length != 0)
+	// shared memory miss, try the file tier
+	path = ngx_http_vod_get_generated_cache_file_path(ctx, &empty_string);
+	if (path == NULL)
 	{
-		// send the response header
-		rc = ngx_http_vod_send_header(r, ctx->content_length, NULL, MEDIA_SET_VOD, NULL);
-		if (rc != NGX_OK)
+		return NGX_ERROR;
+	}
+
+#if (NGX_THREADS)
+	if (conf->open_file_thread_pool != NULL)
+	{
+		rc = ngx_file_reader_map_file_async(
+			r,
+			conf->open_file_thread_pool,
+			path,
+			ngx_http_vod_generated_file_map_callback,
+			ctx);
+		if (rc != NGX_DECLINED)
 		{
 			return rc;
 		}
+	}
+#endif // NGX_THREADS
 
-		if (r->header_only || r->method == NGX_HTTP_HEAD)
-		{
-			return NGX_DONE;
-		}
+	rc = ngx_file_reader_map_file(r, path, &cache_buffer, &mtime);
+
+	return ngx_http_vod_generated_file_mapped(ctx, rc, &cache_buffer, mtime);
+}
+
+static void
+ngx_http_vod_write_generated_file(ngx_log_t* log, u_char* path, u_char* temp_path, ngx_str_t* buffers, ngx_uint_t buffer_count)
+{
+	ngx_str_t* cur_buffer;
+	ngx_str_t* buffers_end;
+	ngx_fd_t fd;
+
+	// write to a temp file and rename, so that readers never see a partial file.
+	// the name of the temp file is unique per write, an existing file is never truncated
+	fd = ngx_open_file(temp_path, NGX_FILE_WRONLY, O_CREAT|O_EXCL, NGX_FILE_DEFAULT_ACCESS);
+	if (fd == NGX_INVALID_FILE)
+	{
+		ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+			"ngx_http_vod_write_generated_file: " ngx_open_file_n " \"%s\" failed", temp_path);
+		return;
 	}
 
-	// write the initial buffer if provided
-	if (output_buffer.len != 0)
+	buffers_end = buffers + buffer_count;
+	for (cur_buffer = buffers; cur_buffer < buffers_end; cur_buffer++)
 	{
-		rc = ctx->segment_writer.write_tail(
-			ctx->segment_writer.context, 
-			output_buffer.data, 
-			output_buffer.len);
-		if (rc != VOD_OK)
+		if (ngx_write_fd(fd, cur_buffer->data, cur_buffer->len) != (ssize_t)cur_buffer->len)
 		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_init_frame_processing: write_tail failed %i", rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+			ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+				"ngx_http_vod_write_generated_file: " ngx_write_fd_n " \"%s\" failed", temp_path);
+			goto failed;
 		}
+	}
 
-		// in case of a range request that is fully contained in the output buffer (e.g. 0-0), we're done
-		if (ctx->content_length != 0 &&
-			ctx->submodule_context.r->headers_in.range != NULL &&
-			ngx_http_vod_range_parse(
-				&ctx->submodule_context.r->headers_in.range->value,
-				ctx->content_length,
-				&range_start,
-				&range_end) == NGX_OK &&
-			(size_t)range_end <= output_buffer.len)
-		{
-			return NGX_DONE;
-		}
+	if (ngx_close_file(fd) == NGX_FILE_ERROR)
+	{
+		ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+			"ngx_http_vod_write_generated_file: " ngx_close_file_n " \"%s\" failed", temp_path);
+		ngx_delete_file(temp_path);
+		return;
 	}
 
-	rc = read_cache_allocate_buffer_slots(&ctx->read_cache_state, 0);
-	if (rc != VOD_OK)
+	if (ngx_rename_file(temp_path, path) == NGX_FILE_ERROR)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_init_frame_processing: read_cache_allocate_buffer_slots failed %i", rc);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+			"ngx_http_vod_write_generated_file: " ngx_rename_file_n " \"%s\" to \"%s\" failed", temp_path, path);
+		ngx_delete_file(temp_path);
 	}
 
-	return NGX_OK;
+	return;
+
+failed:
+
+	ngx_close_file(fd);
+	ngx_delete_file(temp_path);
 }
 
-static ngx_int_t 
-ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
+#if (NGX_THREADS)
+typedef struct {
+	u_char* path;
+	u_char* temp_path;
+	ngx_str_t buffer;
+} ngx_http_vod_save_generated_task_ctx_t;
+
+static void
+ngx_http_vod_save_generated_thread_handler(void *data, ngx_log_t *log)
 {
-	read_cache_get_read_buffer_t read_buf;
-	size_t cache_buffer_size;
-	vod_status_t rc;
+	ngx_http_vod_save_generated_task_ctx_t* task_ctx = data;
 
-	for (;;)
+	// Note: the request may already be freed, using the cycle log
+	ngx_http_vod_write_generated_file(ngx_cycle->log, task_ctx->path, task_ctx->temp_path, &task_ctx->buffer, 1);
+}
+
+static void
+ngx_http_vod_save_generated_task_event_handler(ngx_event_t *ev)
+{
+	ngx_free(ev->data);
+}
+
+// the task is not tied to the request - the response is copied to a heap allocated task that is freed on completion
+static ngx_int_t
+ngx_http_vod_post_save_generated_task(
+	ngx_http_vod_ctx_t *ctx,
+	u_char* path,
+	u_char* temp_path,
+	ngx_str_t* buffers,
+	ngx_uint_t buffer_count)
+{
+	ngx_http_vod_save_generated_task_ctx_t* task_ctx;
+	ngx_thread_task_t* task;
+	ngx_str_t* cur_buffer;
+	ngx_str_t* buffers_end;
+	size_t path_size;
+	size_t temp_path_size;
+	size_t size;
+	u_char* p;
+
+	path_size = ngx_strlen(path) + 1;
+	temp_path_size = ngx_strlen(temp_path) + 1;
+
+	size = 0;
+	buffers_end = buffers + buffer_count;
+	for (cur_buffer = buffers; cur_buffer < buffers_end; cur_buffer++)
 	{
-		ngx_perf_counter_start(ctx->perf_counter_context);
+		size += cur_buffer->len;
+	}
 
-		rc = ctx->frame_processor(ctx->frame_processor_state);
+	task = ngx_calloc(sizeof(*task) + sizeof(*task_ctx) + path_size + temp_path_size + size, 
+		ctx->submodule_context.request_context.log);
+	if (task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_post_save_generated_task: ngx_calloc failed");
+		return NGX_ERROR;
+	}
 
-		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_PROCESS_FRAMES);
+	task_ctx = (void*)(task + 1);
+	task->ctx = task_ctx;
 
-		switch (rc)
-		{
-		case VOD_OK:
-			// we're done
-			return NGX_OK;
+	p = (u_char*)(task_ctx + 1);
+	task_ctx->path = p;
+	p = ngx_copy(p, path, path_size);
+	task_ctx->temp_path = p;
+	p = ngx_copy(p, temp_path, temp_path_size);
 
-		case VOD_AGAIN:
-			// handled outside the switch
-			break;
+	task_ctx->buffer.data = p;
+	for (cur_buffer = buffers; cur_buffer < buffers_end; cur_buffer++)
+	{
+		p = ngx_copy(p, cur_buffer->data, cur_buffer->len);
+	}
+	task_ctx->buffer.len = size;
 
-		default:
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_process_media_frames: frame_processor failed %i", rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-		}
+	task->handler = ngx_http_vod_save_generated_thread_handler;
+	task->event.data = task;
+	task->event.handler = ngx_http_vod_save_generated_task_event_handler;
 
-		// get a buffer to read into
-		read_cache_get_read_buffer(
-			&ctx->read_cache_state,
-			&read_buf);
+	if (ngx_thread_task_post(ctx->submodule_context.conf->open_file_thread_pool, task) != NGX_OK)
+	{
+		ngx_free(task);
+		return NGX_ERROR;
+	}
 
-		cache_buffer_size = ctx->submodule_context.conf->cache_buffer_size;
+	return NGX_OK;
+}
+#endif // NGX_THREADS
 
-		ctx->read_buffer.start = read_buf.buffer;
-		if (read_buf.buffer != NULL)
-		{
-			ctx->read_buffer.end = read_buf.buffer + cache_buffer_size;
-		}
+static void
+ngx_http_vod_save_generated_file(ngx_http_vod_ctx_t *ctx, ngx_str_t* buffers, ngx_uint_t buffer_count)
+{
+	static ngx_uint_t temp_file_index = 0;		// Note: incremented only on the event loop
+	ngx_str_t temp_suffix;
+	u_char temp_suffix_buf[NGX_INT64_LEN * 2 + sizeof("..tmp")];
+	u_char* temp_path;
+	u_char* path;
 
-		rc = ngx_http_vod_alloc_read_buffer(ctx, cache_buffer_size, ctx->alloc_params_index);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
-		
-		// perform the read
-		ngx_perf_counter_start(ctx->perf_counter_context);
+	path = ngx_http_vod_get_generated_cache_file_path(ctx, &empty_string);
+	if (path == NULL)
+	{
+		return;
+	}
 
-		rc = ctx->read(
-			read_buf.source->reader_context, 
-			&ctx->read_buffer, 
-			read_buf.size, 
-			read_buf.offset);
-		if (rc != NGX_OK)
-		{
-			if (rc != NGX_AGAIN)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_process_media_frames: async_read failed %i", rc);
-			}
-			return rc;
-		}
+	temp_suffix.data = temp_suffix_buf;
+	temp_suffix.len = ngx_sprintf(temp_suffix_buf, ".%P.%ui.tmp", ngx_pid, temp_file_index++) - temp_suffix_buf;
 
-		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
+	temp_path = ngx_http_vod_get_generated_cache_file_path(ctx, &temp_suffix);
+	if (temp_path == NULL)
+	{
+		return;
+	}
 
-		// read completed synchronously, update the read cache
-		read_cache_read_completed(&ctx->read_cache_state, &ctx->read_buffer);
+#if (NGX_THREADS)
+	if (ctx->submodule_context.conf->open_file_thread_pool != NULL)
+	{
+		// Note: the file tier is only a cache, when the task cannot be posted the file is not saved,
+		//	instead of blocking the event loop
+		if (ngx_http_vod_post_save_generated_task(ctx, path, temp_path, buffers, buffer_count) != NGX_OK)
+		{
+			ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_save_generated_file: failed to post save task for \"%s\"", path);
+		}
+		return;
 	}
+#endif // NGX_THREADS
+
+	ngx_http_vod_write_generated_file(ctx->submodule_context.request_context.log, path, temp_path, buffers, buffer_count);
 }
 
-static ngx_int_t
-ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
+static void
+ngx_http_vod_store_generated_response(ngx_http_vod_ctx_t *ctx)
 {
-	ngx_http_request_t *r = ctx->submodule_context.r;
-	ngx_int_t rc;
+	response_cache_header_t cache_header;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t* cache_buffers;
+	ngx_str_t* cur_buffer;
+	ngx_chain_t* cl;
+	ngx_uint_t buffer_count;
 
-	rc = ctx->segment_writer.write_tail(ctx->segment_writer.context, NULL, 0);
-	if (rc != VOD_OK)
+	// gather the response header and the output chain
+	buffer_count = 2;
+	for (cl = &ctx->out; cl != NULL; cl = cl->next)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_finalize_segment_response: write_tail failed %i", rc);
-		return ngx_http_vod_status_to_ngx_error(r, rc);
+		buffer_count++;
 	}
 
-	// if we already sent the headers and all the buffers, just signal completion and return
-	if (r->header_sent)
+	cache_buffers = ngx_palloc(r->pool, sizeof(cache_buffers[0]) * buffer_count);
+	if (cache_buffers == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_generated_response: ngx_palloc failed");
+		return;
+	}
+
+	cache_header.content_type_len = r->headers_out.content_type.len;
+	cache_header.response_len = 0;
+	cache_header.media_set_type = MEDIA_SET_VOD;
+	cache_buffers[0].data = (u_char*)&cache_header;
+	cache_buffers[0].len = sizeof(cache_header);
+	cache_buffers[1] = r->headers_out.content_type;
+
+	cur_buffer = cache_buffers + 2;
+	for (cl = &ctx->out; cl != NULL; cl = cl->next)
 	{
-		if (ctx->write_segment_buffer_context.total_size != ctx->content_length)
+		cur_buffer->data = cl->buf->pos;
+		cur_buffer->len = cl->buf->last - cl->buf->pos;
+		cache_header.response_len += cur_buffer->len;
+		cur_buffer++;
+	}
+
+	if (conf->generated_cache != NULL)
+	{
+		if (ngx_buffer_cache_store_gather_perf(ctx->perf_counters, conf->generated_cache, ctx->generated_cache_key, cache_buffers, buffer_count))
 		{
-			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-				"ngx_http_vod_finalize_segment_response: actual content length %uz is different than reported length %uz",
-				ctx->write_segment_buffer_context.total_size, ctx->content_length);
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_store_generated_response: stored in generated cache");
 		}
-
-		rc = ngx_http_send_special(r, NGX_HTTP_LAST);
-		if (rc != NGX_OK && rc != NGX_AGAIN)
+		else
 		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_finalize_segment_response: ngx_http_send_special failed %i", rc);
-			return rc;
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_store_generated_response: failed to store response in generated cache");
 		}
-		return NGX_OK;
 	}
 
-	// mark the current buffer as last
-	if (ctx->write_segment_buffer_context.chain_end->buf == NULL)
+	if (conf->generated_cache_path.len > 0)
 	{
-		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-			"ngx_http_vod_finalize_segment_response: no buffers were written");
-		return ngx_http_vod_status_to_ngx_error(r, VOD_UNEXPECTED);
+		ngx_http_vod_save_generated_file(ctx, cache_buffers, buffer_count);
 	}
+}
 
-	ctx->write_segment_buffer_context.chain_end->next = NULL;
-	ctx->write_segment_buffer_context.chain_end->buf->last_buf = 1;
-
-	// send the response header
-	rc = ngx_http_vod_send_header(r, ctx->write_segment_buffer_context.total_size, NULL, MEDIA_SET_VOD, NULL);
-	if (rc != NGX_OK)
-	{
-		return rc;
-	}
+ngx_int_t
+ngx_http_vod_store_related_response(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* content_type,
+	ngx_str_t* response)
+{
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	ngx_buffer_cache_t* cache;
+	u_char request_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_int_t rc;
 
-	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	cache = conf->response_cache[CACHE_TYPE_VOD];
+	if (cache == NULL)
 	{
 		return NGX_OK;
 	}
 
-	// send the response buffer chain
-	rc = ngx_http_output_filter(r, &ctx->out);
-	if (rc != NGX_OK && rc != NGX_AGAIN)
+	rc = ngx_http_vod_get_request_key(submodule_context->r, conf, uri, request_key);
+	if (rc != NGX_OK)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_finalize_segment_response: ngx_http_output_filter failed %i", rc);
 		return rc;
 	}
+
+	ngx_http_vod_store_response(
+		ngx_perf_counter_get_state(conf->perf_counters_zone),
+		cache,
+		&submodule_context->request_context,
+		request_key,
+		submodule_context->media_set.type,
+		content_type,
+		response);
+
 	return NGX_OK;
 }
 
-////// Audio filtering
-
 static ngx_int_t
-ngx_http_vod_init_process(ngx_cycle_t *cycle)
+ngx_http_vod_get_related_metadata_key(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* params,
+	u_char* result)
 {
-	vod_status_t rc;
+	media_clip_source_t* cur_source;
+	ngx_md5_t md5;
+	u_char request_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_int_t rc;
 
-	audio_filter_process_init(cycle->log);
+	// the uri identifies the response, the file keys identify the content it was built from
+	if (submodule_context->offloaded &&
+		uri->len == submodule_context->r->uri.len &&
+		ngx_memcmp(uri->data, submodule_context->r->uri.data, uri->len) == 0)
+	{
+		ngx_memcpy(request_key, submodule_context->uri_request_key, sizeof(request_key));
+	}
+	else
+	{
+		rc = ngx_http_vod_get_request_key(submodule_context->r, submodule_context->conf, uri, request_key);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+	}
 
-#if (NGX_HAVE_LIB_AV_CODEC)
-	audio_decoder_process_init(cycle->log);
-	audio_encoder_process_init(cycle->log);
-	thumb_grabber_process_init(cycle->log);
-#endif // NGX_HAVE_LIB_AV_CODEC
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, request_key, sizeof(request_key));
 
-	rc = language_code_process_init(cycle->pool, cycle->log);
-	if (rc != VOD_OK)
+	for (cur_source = submodule_context->media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
 	{
-		return NGX_ERROR;
+		ngx_md5_update(&md5, cur_source->file_key, sizeof(cur_source->file_key));
 	}
 
-	return NGX_OK;
-}
-
-static void 
-ngx_http_vod_exit_process()
-{
-#if (VOD_HAVE_ICONV)
-	webvtt_exit_process();
-#endif // VOD_HAVE_ICONV
+	ngx_md5_update(&md5, params->data, params->len);
+	ngx_md5_update(&md5, RELATED_METADATA_KEY_SUFFIX, sizeof(RELATED_METADATA_KEY_SUFFIX) - 1);
+	ngx_md5_final(result, &md5);
 
-#if (NGX_HAVE_LIBXML2)
-	dfxp_exit_process();
-#endif // NGX_HAVE_LIBXML2
+	return NGX_OK;
 }
 
-////// Clipping
-
-static ngx_int_t
-ngx_http_vod_send_clip_header(ngx_http_vod_ctx_t *ctx)
+ngx_flag_t
+ngx_http_vod_related_metadata_fetch(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* params,
+	ngx_str_t* buffer)
 {
-	ngx_http_request_t* r = ctx->submodule_context.r;
-	ngx_chain_t* out;
-	uint64_t first_offset;
-	uint64_t last_offset;
-	size_t response_size;
-	ngx_str_t content_type;
-	ngx_int_t rc;
-	off_t range_start;
-	off_t range_end;
-	off_t header_size;
-	off_t mdat_size;
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t cache_buffer;
 
-	rc = ctx->format->clipper_build_header(
-		&ctx->submodule_context.request_context,
-		ctx->metadata_parts,
-		ctx->metadata_part_count,
-		ctx->clipper_parse_result,
-		&out,
-		&response_size, 
-		&content_type);
-	if (rc != VOD_OK)
+	if (conf->metadata_cache == NULL)
 	{
-		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_send_clip_header: clipper_build_header(%V) failed %i", &ctx->format->name, rc);
-		return ngx_http_vod_status_to_ngx_error(r, rc);
+		return 0;
 	}
 
-	// send the response header
-	rc = ngx_http_vod_send_header(r, response_size, &content_type, MEDIA_SET_VOD, NULL);
-	if (rc != NGX_OK)
+	if (ngx_http_vod_get_related_metadata_key(submodule_context, uri, params, cache_key) != NGX_OK)
 	{
-		return rc;
+		return 0;
 	}
 
-	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	if (!ngx_buffer_cache_fetch_perf(
+		ngx_perf_counter_get_state(conf->perf_counters_zone),
+		conf->metadata_cache,
+		cache_key,
+		&cache_buffer))
 	{
-		return NGX_DONE;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_related_metadata_fetch: metadata cache miss");
+		return 0;
 	}
 
-	rc = ngx_http_output_filter(r, out);
-	if (rc != NGX_OK && rc != NGX_AGAIN)
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+		"ngx_http_vod_related_metadata_fetch: metadata cache hit, size is %uz", cache_buffer.len);
+
+	// Note: copying the buffer since the cache entry may be overwritten and the callers access it as structs
+	buffer->data = ngx_palloc(submodule_context->request_context.pool, cache_buffer.len);
+	if (buffer->data == NULL)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_send_clip_header: ngx_http_output_filter failed %i", rc);
-		return rc;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_related_metadata_fetch: ngx_palloc failed");
+		return 0;
 	}
 
-	if (ctx->submodule_context.conf->request_handler == ngx_http_vod_remote_request_handler && 
-		ctx->submodule_context.r->headers_in.range)
-	{
-		// in case of range request in remote mode, apply the requested range to the mdat dump offsets.
-		// nginx's range filter module does not touch the dumped part since it is written in the context
-		// a subrequest. 
+	ngx_memcpy(buffer->data, cache_buffer.data, cache_buffer.len);
+	buffer->len = cache_buffer.len;
 
-		// TODO: apply the range on the mp4 header as well and return 206, to avoid making assumptions on
-		//		nginx subrequest/range filter implementations
+	return 1;
+}
 
-		rc = ngx_http_vod_range_parse(
-			&ctx->submodule_context.r->headers_in.range->value,
-			response_size,
-			&range_start,
-			&range_end);
-		if (rc != NGX_OK)
-		{
-			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-				"ngx_http_vod_send_clip_header: failed to parse range header \"%V\"",
-				&ctx->submodule_context.r->headers_in.range->value);
-			return rc;
-		}
+void
+ngx_http_vod_related_metadata_store(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* params,
+	ngx_str_t* buffer)
+{
+	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
 
-		first_offset = ctx->clipper_parse_result->first_offset;
-		last_offset = ctx->clipper_parse_result->last_offset;
+	if (conf->metadata_cache == NULL)
+	{
+		return;
+	}
 
-		mdat_size = last_offset - first_offset;
-		header_size = response_size - mdat_size;
+	if (ngx_http_vod_get_related_metadata_key(submodule_context, uri, params, cache_key) != NGX_OK)
+	{
+		return;
+	}
 
-		if (range_end < header_size)
-		{
-			last_offset = 0;
-		}
-		else if (mdat_size > range_end - header_size)
-		{
-			last_offset = first_offset + range_end - header_size;
-		}
+	if (ngx_buffer_cache_store_perf(
+		ngx_perf_counter_get_state(conf->perf_counters_zone),
+		conf->metadata_cache,
+		cache_key,
+		buffer->data,
+		buffer->len))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_related_metadata_store: stored in metadata cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_related_metadata_store: failed to store in metadata cache");
+	}
+}
 
-		if (range_start > header_size)
-		{
-			first_offset += range_start - header_size;
-		}
+static ngx_int_t
+ngx_http_vod_build_metadata_response(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
+{
+	ngx_perf_counter_context(pcctx);
+	ngx_int_t rc;
 
-		ctx->clipper_parse_result->first_offset = first_offset;
-		ctx->clipper_parse_result->last_offset = last_offset;
+	ngx_perf_counter_start(pcctx);
+
+	rc = ctx->request->handle_metadata_request(
+		&ctx->submodule_context,
+		response,
+		content_type);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_build_metadata_response: handle_metadata_request failed %i", rc);
+		return rc;
 	}
 
+	ngx_perf_counter_end(ctx->perf_counters, pcctx, PC_BUILD_MANIFEST);
+
 	return NGX_OK;
 }
 
-////// Common
-
-static ngx_flag_t
-ngx_http_vod_generator_matches(
-	media_parse_params_t* parse_params,
-	media_generator_t* generator)
+static ngx_int_t
+ngx_http_vod_send_metadata_response(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
 {
-	uint32_t media_type;
+	ngx_buffer_cache_t* cache;
+	ngx_int_t rc;
+	int cache_type;
 
-	if ((parse_params->codecs_mask & generator->codec_mask) == 0)
+	if (ctx->submodule_context.media_set.original_type != MEDIA_SET_LIVE ||
+		(ctx->request->flags & REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE) == 0)
 	{
-		return 0;
+		cache_type = CACHE_TYPE_VOD;
+	}
+	else
+	{
+		cache_type = CACHE_TYPE_LIVE;
 	}
 
-	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
+	cache = ctx->submodule_context.conf->response_cache[cache_type];
+	if (cache != NULL && response->data != NULL)
 	{
-		if ((parse_params->required_tracks_mask[media_type] & generator->track_mask[media_type]) != 0)
-		{
-			return 1;
-		}
+		ngx_http_vod_store_response(
+			ctx->perf_counters,
+			cache,
+			&ctx->submodule_context.request_context,
+			ctx->request_key,
+			ctx->submodule_context.media_set.type,
+			content_type,
+			response);
 	}
 
-	return 0;
+	rc = ngx_http_vod_send_header(
+		ctx->submodule_context.r,
+		response->len,
+		content_type,
+		ctx->submodule_context.media_set.type,
+		ctx->request);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_send_response(ctx->submodule_context.r, response, NULL);
+}
+
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	ngx_str_t response;
+	ngx_str_t content_type;
+	ngx_int_t rc;
+} ngx_http_vod_metadata_task_ctx_t;
+
+static void
+ngx_http_vod_metadata_thread_handler(void *data, ngx_log_t *log)
+{
+	ngx_http_vod_metadata_task_ctx_t* task_ctx = data;
+
+	task_ctx->rc = ngx_http_vod_build_metadata_response(
+		task_ctx->ctx,
+		&task_ctx->response,
+		&task_ctx->content_type);
+}
+
+static void
+ngx_http_vod_metadata_task_event_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_metadata_task_ctx_t* task_ctx = ev->data;
+	ngx_http_vod_ctx_t* ctx = task_ctx->ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_connection_t* c = r->connection;
+	ngx_int_t rc;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	ctx->submodule_context.offloaded = 0;
+
+	rc = task_ctx->rc;
+	if (rc == NGX_OK)
+	{
+		rc = ngx_http_vod_send_metadata_response(ctx, &task_ctx->response, &task_ctx->content_type);
+	}
+
+	ngx_http_vod_finalize_request(ctx, rc);
+
+	ngx_http_run_posted_requests(c);
 }
 
 static ngx_int_t
-ngx_http_vod_run_generators(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_post_metadata_task(ngx_http_vod_ctx_t *ctx)
 {
-	media_clip_source_t* cur_source;
-	media_parse_params_t parse_params;
-	media_generator_t* generator;
-	media_range_t range;
-	uint32_t tracks_mask[MEDIA_TYPE_COUNT];
+	ngx_http_vod_metadata_task_ctx_t* task_ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_thread_task_t* task;
 	ngx_int_t rc;
 
-	for (cur_source = ctx->submodule_context.media_set.generators_head;
-		cur_source != NULL;
-		cur_source = cur_source->next)
+	// evaluate the base url / request key of the uri on the event loop
+	rc = ngx_http_vod_get_base_url(r, ctx->submodule_context.conf->base_url, &r->uri, &ctx->submodule_context.uri_base_url);
+	if (rc != NGX_OK)
 	{
-		ctx->cur_source = cur_source;
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_post_metadata_task: ngx_http_vod_get_base_url failed %i", rc);
+		return rc;
+	}
 
-		if (cur_source->clip_to >= UINT_MAX)
-		{
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_run_generators: unbounded generator source");
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
-		}
+	ctx->submodule_context.uri_request_key = ctx->request_key;
 
-		parse_params.clip_to = cur_source->clip_to;
-		parse_params.clip_from = 0;
+	task = ngx_thread_task_alloc(r->pool, sizeof(*task_ctx));
+	if (task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_post_metadata_task: ngx_thread_task_alloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
 
-		ngx_http_vod_init_parse_params_metadata(ctx, tracks_mask, &parse_params);
+	task_ctx = task->ctx;
+	task_ctx->ctx = ctx;
+	task_ctx->response.data = NULL;
+	task_ctx->response.len = 0;
 
-		// Note: currently, the only generator is the silence generator
-		generator = &silence_generator;
+	task->handler = ngx_http_vod_metadata_thread_handler;
+	task->event.data = task_ctx;
+	task->event.handler = ngx_http_vod_metadata_task_event_handler;
 
-		if (!ngx_http_vod_generator_matches(
-			&parse_params,
-			generator))
-		{
-			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
-			continue;
-		}
+	// Note: the flag must be set before posting, the thread may start running immediately
+	ctx->submodule_context.offloaded = 1;
 
-		if (parse_params.langs_mask != NULL &&
-			!vod_is_bit_set(parse_params.langs_mask, cur_source->sequence->language))
-		{
-			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
-			continue;
-		}
+	if (ngx_thread_task_post(ctx->submodule_context.conf->processing_thread_pool, task) != NGX_OK)
+	{
+		ctx->submodule_context.offloaded = 0;
+		return NGX_DECLINED;
+	}
 
-		rc = ngx_http_vod_init_parse_params_frames(
-			ctx,
-			&range,
-			&parse_params);
-		switch (rc)
-		{
-		case NGX_OK:
-			break;		// handled outside the switch
+	r->main->blocked++;
+	r->aio = 1;
 
-		case NGX_DONE:
-			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
-			continue;
+	return NGX_AGAIN;
+}
+#endif // NGX_THREADS
 
-		default:
-			return rc;
-		}
+static ngx_int_t
+ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf;
+	ngx_str_t content_type;
+	ngx_str_t response = ngx_null_string;
+	ngx_int_t rc;
 
-		rc = generator->generate(
-			&ctx->submodule_context.request_context,
-			&parse_params,
-			&cur_source->track_array);
-		if (rc != VOD_OK)
-		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_run_generators: generator failed %i", rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-		}
+	rc = ngx_http_vod_update_timescale(ctx);
+	if (rc != NGX_OK)
+	{
+		return rc;
 	}
 
-	ctx->cur_source = NULL;
+	// segment durations are cached per file key alongside the metadata
+	conf = ctx->submodule_context.conf;
+	if (conf->metadata_cache != NULL &&
+		conf->segmenter.get_segment_durations == segmenter_get_segment_durations_key_frames)
+	{
+		ctx->segment_durations_cache.context = ctx;
+		ctx->segment_durations_cache.fetch = ngx_http_vod_segment_durations_cache_fetch;
+		ctx->segment_durations_cache.store = ngx_http_vod_segment_durations_cache_store;
+		ctx->submodule_context.media_set.segment_durations_cache = &ctx->segment_durations_cache;
+	}
 
-	return NGX_OK;
+#if (NGX_THREADS)
+	if (conf->processing_thread_pool != NULL &&
+		(ctx->request->flags & REQUEST_FLAG_OFFLOAD_METADATA) != 0 &&
+		(rc = ngx_http_vod_post_metadata_task(ctx)) != NGX_DECLINED)
+	{
+		// Note: in case the task could not be posted (e.g. queue overflow), the response is built inline
+		return rc;
+	}
+#endif // NGX_THREADS
+
+	rc = ngx_http_vod_build_metadata_response(ctx, &response, &content_type);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_send_metadata_response(ctx, &response, &content_type);
 }
 
+////// Segment request handling
+
 static ngx_int_t
-ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_state_machine_open_files(ngx_http_vod_ctx_t *ctx)
 {
+	media_clip_source_t* cur_source;
+	ngx_str_t* path;
 	ngx_int_t rc;
-	uint32_t max_frame_count;
-	uint32_t output_codec_id;
 
-	switch (ctx->state)
+	rc = ngx_http_vod_open_sources(ctx, 0);
+	if (rc != NGX_OK)
 	{
-	case STATE_READ_DRM_INFO:
-		rc = ngx_http_vod_state_machine_get_drm_info(ctx);
-		if (rc != NGX_OK)
+		return rc;
+	}
+
+	for (cur_source = ctx->cur_source;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		// open the file if not already opened
+		if (cur_source->reader_context != NULL)
 		{
-			return rc;
+			continue;
 		}
 
-		ctx->state = STATE_READ_METADATA_INITIAL;
-		ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
-		// fallthrough
+		path = &cur_source->mapped_uri;
 
-	case STATE_READ_METADATA_INITIAL:
-	case STATE_READ_METADATA_OPEN_FILE:
-	case STATE_READ_METADATA_READ:
-	case STATE_READ_FRAMES_OPEN_FILE:
-	case STATE_READ_FRAMES_READ:
-
-		rc = ngx_http_vod_state_machine_parse_metadata(ctx);
+		rc = ctx->reader->open(ctx->submodule_context.r, path, 0, &cur_source->reader_context);
 		if (rc != NGX_OK)
 		{
-			return rc;
-		}
-
-		if (ctx->request == NULL)
-		{
-			rc = ngx_http_vod_send_clip_header(ctx);
-			if (rc != NGX_OK)
-			{
-				if (rc == NGX_DONE)
-				{
-					rc = NGX_OK;
-				}
-				else
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-						"ngx_http_vod_run_state_machine: ngx_http_vod_send_clip_header failed %i", rc);
-				}
-				return rc;
-			}
-		}
-		else
-		{
-			rc = ngx_http_vod_run_generators(ctx);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-
-			rc = filter_init_filtered_clips(
-				&ctx->submodule_context.request_context,
-				&ctx->submodule_context.media_set, 
-				(ctx->request->parse_type & PARSE_FLAG_FRAMES_DURATION) != 0);
-			if (rc != VOD_OK)
+			if (rc != NGX_AGAIN && rc != NGX_DONE)
 			{
 				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_run_state_machine: filter_init_filtered_clips failed %i", rc);
-				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-			}
-
-			rc = ngx_http_vod_validate_streams(ctx);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-
-			// handle metadata requests
-			if (ctx->request->handle_metadata_request != NULL)
-			{
-				return ngx_http_vod_handle_metadata_request(ctx);
+					"ngx_http_vod_state_machine_open_files: open_file failed %i", rc);
 			}
 
-			// initialize the read cache
-			read_cache_init(
-				&ctx->read_cache_state,
-				&ctx->submodule_context.request_context,
-				ctx->submodule_context.conf->cache_buffer_size,
-				ctx->alignment);
+			ctx->cur_source = cur_source;
+			return rc;
 		}
+	}
 
-		ctx->state = STATE_OPEN_FILE;
-		ctx->cur_source = ctx->submodule_context.media_set.sources_head;
-		// fallthrough
+	ctx->cur_source = NULL;
+	return NGX_OK;
+}
 
-	case STATE_OPEN_FILE:
-		rc = ngx_http_vod_state_machine_open_files(ctx);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+static void
+ngx_http_vod_enable_directio(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
 
-		// enable directio if enabled in the configuration (ignore errors)
-		// Note that directio is set on transfer only to allow the kernel to cache the "moov" atom
-		if (ctx->reader->enable_directio != NULL)
-		{
-			ngx_http_vod_enable_directio(ctx);
-		}
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		ngx_file_reader_enable_directio(cur_source->reader_context);
+	}
+}
 
-		if (ctx->request == NULL)
+static ngx_int_t
+ngx_http_vod_map_source(ngx_http_vod_ctx_t *ctx, media_clip_source_t* source)
+{
+	media_set_t* media_set = &ctx->submodule_context.media_set;
+	frame_list_chunk_t* cur_chunk;
+	frame_list_part_t* part;
+	media_track_t* cur_track;
+	input_frame_t* cur_frame;
+	uint64_t start_offset;
+	uint32_t frame_count;
+	vod_status_t rc;
+	size_t size;
+	u_char* data;
+
+	// get the min offset of the frames that are read from this source, the max is kept on the source
+	start_offset = source->last_offset;
+	for (cur_track = media_set->filtered_tracks; cur_track < media_set->filtered_tracks_end; cur_track++)
+	{
+		for (part = &cur_track->frames; part != NULL; part = part->next)
 		{
-			if (ctx->clipper_parse_result->first_offset < ctx->clipper_parse_result->last_offset)
+			if (get_frame_part_source_clip((*part)) != source)
 			{
-				ctx->cur_source = ctx->submodule_context.media_set.sources_head;
-
-				ctx->state = STATE_DUMP_FILE_PART;
+				continue;
+			}
 
-				rc = ctx->reader->dump_part(
-					ctx->cur_source->reader_context,
-					ctx->clipper_parse_result->first_offset,
-					ctx->clipper_parse_result->last_offset);
-				if (rc != NGX_OK)
+			if (part->compact != NULL)
+			{
+				frame_count = 0;
+				for (cur_chunk = part->compact->chunks; frame_count < part->compact->frame_count; cur_chunk++)
 				{
-					return rc;
+					start_offset = ngx_min(start_offset, cur_chunk->offset);
+					frame_count += cur_chunk->frame_count;
 				}
+				continue;
 			}
 
-			rc = ngx_http_send_special(ctx->submodule_context.r, NGX_HTTP_LAST);
-			if (rc != NGX_OK && rc != NGX_AGAIN)
+			for (cur_frame = part->first_frame; cur_frame < part->last_frame; cur_frame++)
 			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_run_state_machine: ngx_http_send_special failed %i", rc);
-				return rc;
+				start_offset = ngx_min(start_offset, cur_frame->offset);
 			}
-
-			return NGX_OK;
 		}
+	}
 
-		if (ctx->submodule_context.media_set.audio_filtering_needed)
-		{
-			// initialize the filtering of audio frames
-			ctx->state = STATE_FILTER_FRAMES;
-			ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+	if (start_offset >= source->last_offset)
+	{
+		return NGX_OK;		// nothing to read
+	}
 
-			if ((ctx->request->request_class & (REQUEST_CLASS_MANIFEST | REQUEST_CLASS_OTHER)) != 0)
-			{
-				max_frame_count = NON_SEGMENT_REQUEST_MAX_FRAME_COUNT;
-			}
-			else
-			{
-				max_frame_count = SEGMENT_REQUEST_MAX_FRAME_COUNT;
-			}
+	rc = ctx->reader->map(source->reader_context, start_offset, source->last_offset, &data, &size);
+	if (rc != NGX_OK)
+	{
+		// Note: the frames are read using the read cache
+		return rc == NGX_DECLINED ? NGX_OK : rc;
+	}
 
-#if (NGX_HAVE_LIB_AV_CODEC)
-			if (ctx->submodule_context.conf->submodule.name == volume_map.name)
-			{
-				output_codec_id = VOD_CODEC_ID_VOLUME_MAP;
-			}
-			else
-#endif // NGX_HAVE_LIB_AV_CODEC
+	// replace the frames source of all the frame parts of this source
+	for (cur_track = media_set->filtered_tracks; cur_track < media_set->filtered_tracks_end; cur_track++)
+	{
+		for (part = &cur_track->frames; part != NULL; part = part->next)
+		{
+			if (get_frame_part_source_clip((*part)) != source)
 			{
-				output_codec_id = VOD_CODEC_ID_AAC;
+				continue;
 			}
 
-			rc = filter_init_state(
+			rc = frames_source_mmap_init(
 				&ctx->submodule_context.request_context,
-				&ctx->read_cache_state,
-				&ctx->submodule_context.media_set,
-				max_frame_count,
-				output_codec_id,
-				&ctx->frame_processor_state);
+				data,
+				start_offset,
+				size,
+				&part->frames_source_context);
 			if (rc != VOD_OK)
 			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_run_state_machine: filter_init_state failed %i", rc);
 				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
 			}
 
-			ctx->frame_processor = filter_run_state_machine;
+			part->frames_source = &frames_source_mmap;
 		}
+	}
 
-		// fallthrough
-
-	case STATE_FILTER_FRAMES:
-		// if audio filtering already started, process frames
-		if (ctx->frame_processor != NULL)
-		{
-			rc = ngx_http_vod_process_media_frames(ctx);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-		}
+	return NGX_OK;
+}
 
-		// initialize the processing of the video/audio frames
-		rc = ngx_http_vod_init_frame_processing(ctx);
-		if (rc != NGX_OK)
-		{
-			if (rc == NGX_DONE)
-			{
-				rc = NGX_OK;
-			}
-			else
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_run_state_machine: ngx_http_vod_init_frame_processing failed %i", rc);
-			}
-			return rc;
-		}
+static ngx_int_t
+ngx_http_vod_map_sources(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
+	ngx_int_t rc;
 
-		if (ctx->frame_processor_state == NULL)
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		if (cur_source->reader_context == NULL)
 		{
-			return ngx_http_vod_finalize_segment_response(ctx);
+			continue;
 		}
 
-		ctx->submodule_context.request_context.log->action = "processing frames";
-		ctx->state = STATE_PROCESS_FRAMES;
-		// fallthrough
-
-	case STATE_PROCESS_FRAMES:
-		rc = ngx_http_vod_process_media_frames(ctx);
+		rc = ngx_http_vod_map_source(ctx, cur_source);
 		if (rc != NGX_OK)
-		{
-			if (rc != NGX_AGAIN)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_run_state_machine: ngx_http_vod_process_media_frames failed %i", rc);
-			}
-			return rc;
-		}
-
-		return ngx_http_vod_finalize_segment_response(ctx);
-
-	case STATE_DUMP_OPEN_FILE:
-		return ctx->reader->dump_request(ctx->cur_source->reader_context);
-
-	case STATE_DUMP_FILE_PART:
-		rc = ngx_http_send_special(ctx->submodule_context.r, NGX_HTTP_LAST);
-		if (rc != NGX_OK && rc != NGX_AGAIN)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_run_state_machine: ngx_http_send_special failed %i", rc);
+				"ngx_http_vod_map_sources: ngx_http_vod_map_source failed %i", rc);
 			return rc;
 		}
-
-		return NGX_OK;
 	}
 
-	ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-		"ngx_http_vod_run_state_machine: invalid state %d", ctx->state);
-	return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+	return NGX_OK;
 }
 
-static void
-ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read)
+static vod_status_t
+ngx_http_vod_write_segment_header_buffer(void* ctx, u_char* buffer, uint32_t size)
 {
-	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
-	ssize_t expected_size;
+	ngx_http_vod_write_segment_context_t* context = (ngx_http_vod_write_segment_context_t*)ctx;
+	ngx_chain_t *chain_head;
+	ngx_chain_t *chain;
+	ngx_buf_t *b;
 
-	if (rc != NGX_OK)
+	if (context->r->header_sent)
 	{
-		if (ctx->state == STATE_MAP_READ && 
-			ctx->mapping.stale_retries > 0 && 
-			errno == ESTALE)
-		{
-			ctx->mapping.stale_retries--;
-			ctx->state = STATE_MAP_INITIAL;
-
-			rc = ctx->state_machine(ctx);
-			if (rc == NGX_AGAIN)
-			{
-				return;
-			}
+		ngx_log_error(NGX_LOG_ERR, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_header_buffer: called after the headers were already sent");
+		return VOD_UNEXPECTED;
+	}
 
-			goto finalize_request;
-		}
-
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_handle_read_completed: read failed %i", rc);
-		goto finalize_request;
-	}
-
-	if (ctx->state == STATE_DUMP_FILE_PART)
+	b = ngx_calloc_buf(context->r->pool);
+	if (b == NULL)
 	{
-		expected_size = ctx->clipper_parse_result->last_offset - ctx->clipper_parse_result->first_offset;
-		if (bytes_read != expected_size)
-		{
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_read_completed: read size %z different than expected %z, probably a truncated file", 
-				bytes_read, expected_size);
-			rc = ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
-			goto finalize_request;
-		}
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_header_buffer: ngx_calloc_buf failed");
+		return VOD_ALLOC_FAILED;
 	}
-	else if (bytes_read <= 0)
-	{
-		switch (ctx->state)
-		{
-		case STATE_MAP_READ:		// the mapping state machine handles the case of empty mapping
-			break;
 
-		case STATE_READ_METADATA_READ:
-			if ((ctx->read_flags & MEDIA_READ_FLAG_ALLOW_EMPTY_READ) != 0)
-			{
-				break;
-			}
-			// fallthrough
+	b->pos = buffer;
+	b->last = buffer + size;
+	b->temporary = 1;
 
-		default:
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_handle_read_completed: bytes read is zero");
-			rc = ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
-			goto finalize_request;
-		}
+	chain = ngx_alloc_chain_link(context->r->pool);
+	if (chain == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_header_buffer: ngx_alloc_chain_link failed");
+		return VOD_ALLOC_FAILED;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, ctx->perf_counter_async_read);
+	chain_head = context->chain_head;
 
-	switch (ctx->state)
-	{
-	case STATE_FILTER_FRAMES:
-	case STATE_PROCESS_FRAMES:
-		if (buf == NULL)
-		{
-			buf = &ctx->read_buffer;
-		}
-		ctx->frames_bytes_read += (buf->last - buf->pos);
-		read_cache_read_completed(&ctx->read_cache_state, buf);
-		break;
+	chain->buf = chain_head->buf;
+	chain->next = chain_head->next;
 
-	default:
-		if (buf != NULL)
-		{
-			ctx->read_buffer = *buf;
-		}
-		break;
-	}
+	chain_head->buf = b;
+	chain_head->next = chain;
 
-	// run the state machine
-	rc = ctx->state_machine(ctx);
-	if (rc == NGX_AGAIN)
+	if (chain_head == context->chain_end)
 	{
-		return;
+		context->chain_end = chain;
 	}
 
-finalize_request:
+	context->total_size += size;
 
-	ngx_http_vod_finalize_request(ctx, rc);
+	return VOD_OK;
 }
 
-static void
-ngx_http_vod_init_file_key(media_clip_source_t* cur_source, ngx_str_t* prefix)
+static vod_status_t 
+ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 {
-	ngx_md5_t md5;
+	ngx_http_vod_write_segment_context_t* context;
+	ngx_buf_t *b;
+	ngx_chain_t *chain;
+	ngx_chain_t out;
+	ngx_int_t rc;
 
-	ngx_md5_init(&md5);
-	if (prefix != NULL)
+	if (size <= 0)
 	{
-		ngx_md5_update(&md5, prefix->data, prefix->len);
+		return VOD_OK;
 	}
-	ngx_md5_update(&md5, cur_source->mapped_uri.data, cur_source->mapped_uri.len);
-	ngx_md5_final(cur_source->file_key, &md5);
-}
 
-static ngx_int_t
-ngx_http_vod_init_encryption_key(
-	ngx_http_request_t *r, 
-	ngx_http_vod_loc_conf_t* conf, 
-	media_sequence_t* cur_sequence)
-{
-	ngx_str_t encryption_key_seed;
-	ngx_md5_t md5;
+	context = (ngx_http_vod_write_segment_context_t*)ctx;
+	
+	// create a wrapping ngx_buf_t
+	b = ngx_calloc_buf(context->r->pool);
+	if (b == NULL) 
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_buffer: ngx_calloc_buf failed");
+		return VOD_ALLOC_FAILED;
+	}
 
-	if (conf->secret_key != NULL)
+	b->pos = buffer;
+	b->last = buffer + size;
+	b->temporary = 1;
+
+	if (context->r->header_sent && !context->defer_output)
 	{
-		// calculate the encryption key seed
-		if (ngx_http_complex_value(
-			r,
-			conf->secret_key,
-			&encryption_key_seed) != NGX_OK)
+		// headers already sent, output the chunk
+		out.buf = b;
+		out.next = NULL;
+
+		rc = ngx_http_output_filter(context->r, &out);
+		if (rc != NGX_OK && rc != NGX_AGAIN)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_init_encryption_key: ngx_http_complex_value failed");
-			return NGX_ERROR;
+			// either the connection dropped, or some allocation failed
+			// in case the connection dropped, the error code doesn't matter anyway
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+				"ngx_http_vod_write_segment_buffer: ngx_http_output_filter failed %i", rc);
+			return VOD_ALLOC_FAILED;
 		}
 	}
 	else
 	{
-		encryption_key_seed = cur_sequence->mapped_uri;
+		// headers not sent yet / output deferred, add the buffer to the chain
+		if (context->chain_end->buf != NULL)
+		{
+			chain = ngx_alloc_chain_link(context->r->pool);
+			if (chain == NULL) 
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+					"ngx_http_vod_write_segment_buffer: ngx_alloc_chain_link failed");
+				return VOD_ALLOC_FAILED;
+			}
+
+			context->chain_end->next = chain;
+			context->chain_end = chain;
+		}
+		context->chain_end->buf = b;
 	}
 
-	// hash the seed to get the key
-	ngx_md5_init(&md5);
-	ngx_md5_update(&md5, encryption_key_seed.data, encryption_key_seed.len);
-	ngx_md5_final(cur_sequence->encryption_key, &md5);
+	context->total_size += size;
 
-	return NGX_OK;
+	return VOD_OK;
 }
 
+#if (NGX_THREADS)
 static ngx_int_t
-ngx_http_vod_start_processing_media_file(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_flush_segment_buffers(ngx_http_vod_write_segment_context_t* context)
 {
-	ngx_http_vod_loc_conf_t* conf;
-	media_clip_source_t* cur_source;
-	ngx_http_request_t *r;
 	ngx_int_t rc;
 
-	// update request flags
-	r = ctx->submodule_context.r;
-	r->root_tested = !r->error_page;
-	r->allow_ranges = 1;
-
-	// set the state machine
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
-	ctx->state_machine = ngx_http_vod_run_state_machine;
+	context->defer_output = 0;
 
-	// handle serve requests
-	if (ctx->request == NULL &&
-		ctx->submodule_context.media_set.sources_head->clip_from == 0 &&
-		ctx->submodule_context.media_set.sources_head->clip_to == ULLONG_MAX)
+	if (context->r == NULL || !context->r->header_sent || context->chain_end->buf == NULL)
 	{
-		ctx->state = STATE_DUMP_OPEN_FILE;
-
-		cur_source = ctx->submodule_context.media_set.sources_head;
-		ctx->cur_source = cur_source;
-
-		rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
-		if (rc != NGX_OK)
-		{
-			if (rc != NGX_AGAIN && rc != NGX_DONE)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_start_processing_media_file: open_file failed %i", rc);
-			}
-			return rc;
-		}
-
-		return ctx->reader->dump_request(ctx->cur_source->reader_context);
+		return NGX_OK;
 	}
 
-	// initialize the file keys
-	conf = ctx->submodule_context.conf;
+	context->chain_end->next = NULL;
 
-	for (cur_source = ctx->submodule_context.media_set.sources_head;
-		cur_source != NULL;
-		cur_source = cur_source->next)
+	rc = ngx_http_output_filter(context->r, context->chain_head);
+	if (rc != NGX_OK && rc != NGX_AGAIN)
 	{
-		ngx_http_vod_init_file_key(cur_source, ctx->file_key_prefix);
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_flush_segment_buffers: ngx_http_output_filter failed %i", rc);
+		return rc;
 	}
 
-	// initialize the uri / encryption keys
-	if (conf->drm_enabled || conf->secret_key != NULL)
-	{
-		for (ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
-			ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
-			ctx->cur_sequence++)
-		{
-			rc = ngx_http_vod_init_encryption_key(r, conf, ctx->cur_sequence);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-		}
-	}
+	context->chain_head->buf = NULL;
+	context->chain_head->next = NULL;
+	context->chain_end = context->chain_head;
 
-	// restart the file index/uri params
-	ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+	return NGX_OK;
+}
+#endif // NGX_THREADS
 
-	if (ctx->submodule_context.conf->drm_enabled)
-	{
-		ctx->state = STATE_READ_DRM_INFO;
-		ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
-	}
-	else
+static ngx_int_t 
+ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t output_buffer = ngx_null_string;
+	ngx_str_t content_type;
+	ngx_int_t rc;
+	off_t range_start;
+	off_t range_end;
+
+	rc = ngx_http_vod_update_timescale(ctx);
+	if (rc != NGX_OK)
 	{
-		ctx->state = STATE_READ_METADATA_INITIAL;
+		return rc;
 	}
 
-	return ngx_http_vod_run_state_machine(ctx);
-}
-
-////// Local & mapped modes
-
-static ngx_int_t
-ngx_http_vod_map_uris_to_paths(ngx_http_vod_ctx_t *ctx)
-{
-	media_clip_source_t* cur_source;
-	ngx_http_request_t *r = ctx->submodule_context.r;
-	ngx_str_t original_uri;
-	u_char *last;
-	size_t root;
-	ngx_str_t path;
+	// initialize the response writer
+	ctx->out.buf = NULL;
+	ctx->out.next = NULL;
+	ctx->write_segment_buffer_context.r = r;
+	ctx->write_segment_buffer_context.chain_head = &ctx->out;
+	ctx->write_segment_buffer_context.chain_end = &ctx->out;
+	ctx->write_segment_buffer_context.total_size = 0;
 
-	original_uri = r->uri;
-	for (cur_source = ctx->submodule_context.media_set.sources_head;
-		cur_source != NULL;
-		cur_source = cur_source->next)
+	ctx->segment_writer.write_tail = ngx_http_vod_write_segment_buffer;
+	ctx->segment_writer.write_head = ngx_http_vod_write_segment_header_buffer;
+	ctx->segment_writer.context = &ctx->write_segment_buffer_context;
+
+	// initialize the protocol specific frame processor
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+	rc = ctx->request->init_frame_processor(
+		&ctx->submodule_context,
+		&ctx->segment_writer,
+		&ctx->frame_processor,
+		&ctx->frame_processor_state,
+		&output_buffer,
+		&ctx->content_length,
+		&content_type);
+	if (rc != NGX_OK)
 	{
-		r->uri = cur_source->stripped_uri;
-		last = ngx_http_map_uri_to_path(r, &path, &root, 0);
-		r->uri = original_uri;
-		if (last == NULL)
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_init_frame_processing: init_frame_processor failed %i", rc);
+		return rc;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_INIT_FRAME_PROCESS);
+
+	r->headers_out.content_type_len = content_type.len;
+	r->headers_out.content_type.len = content_type.len;
+	r->headers_out.content_type.data = content_type.data;
+
+	// if the frame processor can't determine the size in advance we have to build the whole response before we can start sending it,
+	// unless chunked output is enabled (range / head requests are always built in full, since they need the size)
+	if (ctx->content_length != 0)
+	{
+		// send the response header
+		rc = ngx_http_vod_send_header(r, ctx->content_length, NULL, MEDIA_SET_VOD, NULL);
+		if (rc != NGX_OK)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_map_uris_to_paths: ngx_http_map_uri_to_path failed");
-			return NGX_HTTP_INTERNAL_SERVER_ERROR;
+			return rc;
 		}
 
-		path.len = last - path.data;
+		if (r->header_only || r->method == NGX_HTTP_HEAD)
+		{
+			return NGX_DONE;
+		}
+	}
+	else if (ctx->submodule_context.conf->chunked_segments &&
+		(ctx->request->flags & REQUEST_FLAG_CHUNKED_OUTPUT) != 0 &&
+		r->headers_in.range == NULL &&
+		r->method != NGX_HTTP_HEAD)
+	{
+		// send the response header without a content length
+		rc = ngx_http_vod_send_header(r, -1, NULL, MEDIA_SET_VOD, NULL);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
 
-		cur_source->mapped_uri = path;
+		if (r->header_only || r->method == NGX_HTTP_HEAD)
+		{
+			return NGX_DONE;
+		}
+	}
+
+	// write the initial buffer if provided
+	if (output_buffer.len != 0)
+	{
+		rc = ctx->segment_writer.write_tail(
+			ctx->segment_writer.context, 
+			output_buffer.data, 
+			output_buffer.len);
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_init_frame_processing: write_tail failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+
+		// in case of a range request that is fully contained in the output buffer (e.g. 0-0), we're done
+		if (ctx->content_length != 0 &&
+			ctx->submodule_context.r->headers_in.range != NULL &&
+			ngx_http_vod_range_parse(
+				&ctx->submodule_context.r->headers_in.range->value,
+				ctx->content_length,
+				&range_start,
+				&range_end) == NGX_OK &&
+			(size_t)range_end <= output_buffer.len)
+		{
+			return NGX_DONE;
+		}
+	}
+
+	rc = read_cache_allocate_buffer_slots(&ctx->read_cache_state, 0);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_init_frame_processing: read_cache_allocate_buffer_slots failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
 	}
 
 	return NGX_OK;
 }
 
-static ngx_int_t
-ngx_http_vod_dump_request_to_fallback(ngx_http_request_t *r)
-{
-	ngx_http_vod_loc_conf_t* conf;
-	ngx_child_request_params_t child_params;
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	ngx_perf_counter_context(perf_counter_context);
+	vod_status_t rc;
+} ngx_http_vod_processing_task_ctx_t;
 
-	conf = ngx_http_get_module_loc_conf(r, ngx_http_vod_module);
+static ngx_thread_pool_t*
+ngx_http_vod_get_processing_thread_pool(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
 
-	if (conf->fallback_upstream_location.len == 0)
+	// audio filtering (decode / filter / encode) can run on a dedicated pool, so that it will not delay segment requests
+	if (ctx->state == STATE_FILTER_FRAMES &&
+		conf->audio_filter_thread_pool != NULL)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_dump_request_to_fallback: no fallback configured");
-		return NGX_ERROR;
+		return conf->audio_filter_thread_pool;
 	}
 
-	if (ngx_http_vod_header_exists(r, &conf->proxy_header.key))
+#if (NGX_HAVE_LIB_AV_CODEC)
+	// thumbnails can be captured on a dedicated pool, so that they will not delay segment requests
+	if (ctx->request->request_class == REQUEST_CLASS_THUMB &&
+		conf->thumb.thread_pool != NULL)
 	{
-		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-			"ngx_http_vod_dump_request_to_fallback: proxy header exists");
-		return NGX_ERROR;
+		return conf->thumb.thread_pool;
 	}
+#endif // NGX_HAVE_LIB_AV_CODEC
 
-	// dump the request to the fallback upstream
-	ngx_memzero(&child_params, sizeof(child_params));
-	child_params.method = r->method;
-	child_params.base_uri = r->uri;
-	child_params.extra_args = r->args;
-	child_params.extra_header = conf->proxy_header;
-	child_params.proxy_range = 1;
-	child_params.proxy_all_headers = 1;
-
-	return ngx_child_request_start(
-		r,
-		NULL,
-		NULL,
-		&conf->fallback_upstream_location,
-		&child_params,
-		NULL);
+	return conf->processing_thread_pool;
 }
 
-#if (NGX_THREADS)
 static void
-ngx_http_vod_file_open_completed_internal(void* context, ngx_int_t rc, ngx_flag_t fallback)
+ngx_http_vod_processing_thread_handler(void *data, ngx_log_t *log)
 {
-	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
+	ngx_http_vod_processing_task_ctx_t* task_ctx = data;
+	ngx_http_vod_ctx_t* ctx = task_ctx->ctx;
 
-	if (rc != NGX_OK)
+	ngx_perf_counter_end(ctx->perf_counters, task_ctx->perf_counter_context, PC_PROCESS_FRAMES_QUEUE);
+
+	ngx_perf_counter_start(task_ctx->perf_counter_context);
+
+	if (ctx->state == STATE_FILTER_FRAMES)
 	{
-		if (fallback && rc == NGX_HTTP_NOT_FOUND)
+		// only the decoding / encoding runs on the pool, the filters are allocated and freed on the event loop
+		task_ctx->rc = filter_process_audio_filter(ctx->frame_processor_state);
+	}
+	else
+	{
+		task_ctx->rc = ctx->frame_processor(ctx->frame_processor_state);
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, task_ctx->perf_counter_context,
+		ctx->state == STATE_FILTER_FRAMES ? PC_AUDIO_FILTER : PC_ASYNC_PROCESS_FRAMES);
+}
+
+static ngx_flag_t
+ngx_http_vod_client_closed(ngx_http_request_t* r)
+{
+	ngx_connection_t* c = r->connection;
+	ngx_err_t err;
+	ssize_t n;
+	u_char buf[1];
+
+	if (c->error)
+	{
+		return 1;
+	}
+
+#if (NGX_HTTP_V2)
+	if (r->stream != NULL)
+	{
+		// the connection is shared by other streams
+		return 0;
+	}
+#endif // NGX_HTTP_V2
+
+	n = recv(c->fd, (char*)buf, 1, MSG_PEEK);
+	if (n == 0)
+	{
+		return 1;
+	}
+
+	if (n == -1)
+	{
+		err = ngx_socket_errno;
+		if (err != NGX_EAGAIN)
 		{
-			// try the fallback
-			rc = ngx_http_vod_dump_request_to_fallback(ctx->submodule_context.r);
-			if (rc != NGX_AGAIN)
-			{
-				rc = NGX_HTTP_NOT_FOUND;
-			}
-			goto finalize_request;
+			return 1;
 		}
+	}
 
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.r->connection->log, 0,
-			"ngx_http_vod_file_open_completed_internal: read failed %i", rc);
+	return 0;
+}
+
+static void
+ngx_http_vod_processing_task_event_handler(ngx_event_t *ev)
+{
+	ngx_http_vod_processing_task_ctx_t* task_ctx = ev->data;
+	ngx_http_vod_ctx_t* ctx = task_ctx->ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_connection_t* c = r->connection;
+	ngx_int_t rc;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	// cancel the processing when the client disconnects, instead of posting more work to the pool
+	if (ngx_http_vod_client_closed(r))
+	{
+		ngx_log_error(NGX_LOG_INFO, c->log, 0,
+			"ngx_http_vod_processing_task_event_handler: client closed the connection, canceling");
+		rc = NGX_HTTP_CLIENT_CLOSED_REQUEST;
 		goto finalize_request;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_ASYNC_OPEN_FILE);
+	// send the buffers that were written by the frame processor
+	rc = ngx_http_vod_flush_segment_buffers(&ctx->write_segment_buffer_context);
+	if (rc != NGX_OK)
+	{
+		goto finalize_request;
+	}
+
+	ctx->processing_completed = 1;
+	ctx->processing_rc = task_ctx->rc;
 
 	// run the state machine
 	rc = ctx->state_machine(ctx);
 	if (rc == NGX_AGAIN)
 	{
+		ngx_http_run_posted_requests(c);
 		return;
 	}
 
 finalize_request:
 
 	ngx_http_vod_finalize_request(ctx, rc);
-}
-
-static void
-ngx_http_vod_file_open_completed(void* context, ngx_int_t rc)
-{
-	ngx_http_vod_file_open_completed_internal(context, rc, 0);
-}
 
-static void
-ngx_http_vod_file_open_completed_with_fallback(void* context, ngx_int_t rc)
-{
-	ngx_http_vod_file_open_completed_internal(context, rc, 1);
+	ngx_http_run_posted_requests(c);
 }
-#endif // NGX_THREADS
 
 static ngx_int_t
-ngx_http_vod_init_file_reader_internal(ngx_http_request_t *r, ngx_str_t* path, void** context, uint32_t flags)
+ngx_http_vod_post_processing_task(ngx_http_vod_ctx_t *ctx)
 {
-	ngx_file_reader_state_t* state;
-	ngx_http_core_loc_conf_t *clcf;
-	ngx_http_vod_ctx_t *ctx;
-	ngx_flag_t fallback = (flags & OPEN_FILE_FALLBACK_ENABLED) != 0;
-	ngx_int_t rc;
+	ngx_http_vod_processing_task_ctx_t* task_ctx;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_thread_task_t* task;
+	vod_status_t rc;
+	bool_t done;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	if (ctx->state == STATE_FILTER_FRAMES)
+	{
+		// allocate the filter of the next track on the event loop
+		rc = filter_prepare_audio_filter(ctx->frame_processor_state, &done);
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_post_processing_task: filter_prepare_audio_filter failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(r, rc);
+		}
 
-	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+		if (done)
+		{
+			// all tracks were filtered
+			return NGX_OK;
+		}
+	}
 
-	state = ngx_pcalloc(r->pool, sizeof(*state));
-	if (state == NULL)
+	task = ctx->processing_task;
+	if (task == NULL)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_init_file_reader_internal: ngx_pcalloc failed");
-		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		task = ngx_thread_task_alloc(r->pool, sizeof(*task_ctx));
+		if (task == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_post_processing_task: ngx_thread_task_alloc failed");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		}
+
+		task_ctx = task->ctx;
+		task_ctx->ctx = ctx;
+
+		task->handler = ngx_http_vod_processing_thread_handler;
+		task->event.data = task_ctx;
+		task->event.handler = ngx_http_vod_processing_task_event_handler;
+
+		ctx->processing_task = task;
 	}
 
-	*context = state;
+	task_ctx = task->ctx;
 
-	ngx_perf_counter_start(ctx->perf_counter_context);
+	ngx_perf_counter_start(task_ctx->perf_counter_context);
 
-#if (NGX_THREADS)
-	if (ctx->submodule_context.conf->open_file_thread_pool != NULL)
+	// Note: the output filters must not run on the worker thread, the buffers are sent on completion
+	ctx->write_segment_buffer_context.defer_output = 1;
+
+	if (ngx_thread_task_post(ngx_http_vod_get_processing_thread_pool(ctx), task) != NGX_OK)
 	{
-		rc = ngx_file_reader_init_async(
-			state,
-			&ctx->async_open_context,
-			ctx->submodule_context.conf->open_file_thread_pool,
-			fallback ? ngx_http_vod_file_open_completed_with_fallback : ngx_http_vod_file_open_completed,
-			ngx_http_vod_handle_read_completed,
-			ctx,
-			r,
-			clcf,
-			path,
-			flags);
+		ctx->write_segment_buffer_context.defer_output = 0;
+
+		if (ctx->state == STATE_FILTER_FRAMES &&
+			ctx->submodule_context.conf->audio_filter_thread_pool != NULL)
+		{
+			// back pressure - when the audio filter pool is saturated, reject the request instead of
+			//	transcoding on the nginx worker
+			ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+				"ngx_http_vod_post_processing_task: failed to post audio filter task, rejecting the request");
+			return NGX_HTTP_SERVICE_UNAVAILABLE;
+		}
+
+		return NGX_DECLINED;
 	}
-	else
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	return NGX_AGAIN;
+}
 #endif // NGX_THREADS
+
+static ngx_int_t 
+ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
+{
+	read_cache_get_read_buffer_t read_buf;
+	size_t cache_buffer_size;
+	vod_status_t rc;
+
+	for (;;)
 	{
-		rc = ngx_file_reader_init(
-			state,
-			ngx_http_vod_handle_read_completed,
-			ctx,
-			r,
-			clcf,
-			path,
-			flags);
-	}
-	if (rc != NGX_OK)
-	{
-		if (fallback && rc == NGX_HTTP_NOT_FOUND)
+#if (NGX_THREADS)
+		if (ctx->processing_completed)
+		{
+			ctx->processing_completed = 0;
+			rc = ctx->processing_rc;
+
+			if (rc == VOD_OK && ctx->state == STATE_FILTER_FRAMES)
+			{
+				// the current track was filtered, move to the next track
+				continue;
+			}
+		}
+		else if (ngx_http_vod_get_processing_thread_pool(ctx) != NULL &&
+			(rc = ngx_http_vod_post_processing_task(ctx)) != NGX_DECLINED)
+		{
+			// Note: in case the task could not be posted (e.g. queue overflow), the frames are processed inline
+			return rc;
+		}
+		else
+#endif // NGX_THREADS
+		{
+			ngx_perf_counter_start(ctx->perf_counter_context);
+
+			rc = ctx->frame_processor(ctx->frame_processor_state);
+
+			ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context,
+				ctx->state == STATE_FILTER_FRAMES ? PC_AUDIO_FILTER : PC_PROCESS_FRAMES);
+		}
+
+		switch (rc)
+		{
+		case VOD_OK:
+			// we're done
+			return NGX_OK;
+
+		case VOD_AGAIN:
+			// handled outside the switch
+			break;
+
+		default:
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_process_media_frames: frame_processor failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+
+		// get a buffer to read into
+		read_cache_get_read_buffer(
+			&ctx->read_cache_state,
+			&read_buf);
+
+		cache_buffer_size = ctx->submodule_context.conf->cache_buffer_size;
+
+		ctx->read_buffer.start = read_buf.buffer;
+		if (read_buf.buffer != NULL)
+		{
+			ctx->read_buffer.end = read_buf.buffer + cache_buffer_size;
+		}
+
+		rc = ngx_http_vod_alloc_read_buffer(ctx, cache_buffer_size, ctx->alloc_params_index);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+		
+		// perform the read
+		ngx_perf_counter_start(ctx->perf_counter_context);
+
+		rc = ctx->read(
+			read_buf.source->reader_context, 
+			&ctx->read_buffer, 
+			read_buf.size, 
+			read_buf.offset);
+		if (rc != NGX_OK)
 		{
-			// try the fallback
-			rc = ngx_http_vod_dump_request_to_fallback(r);
 			if (rc != NGX_AGAIN)
 			{
-				return NGX_HTTP_NOT_FOUND;
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_process_media_frames: async_read failed %i", rc);
 			}
 			return rc;
 		}
 
-		if (rc != NGX_AGAIN)
+		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
+
+		// read completed synchronously, update the read cache
+		read_cache_read_completed(&ctx->read_cache_state, &ctx->read_buffer);
+	}
+}
+
+static ngx_int_t
+ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_request_t *r = ctx->submodule_context.r;
+	ngx_int_t rc;
+
+	rc = ctx->segment_writer.write_tail(ctx->segment_writer.context, NULL, 0);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_finalize_segment_response: write_tail failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(r, rc);
+	}
+
+	// if we already sent the headers and all the buffers, just signal completion and return
+	if (r->header_sent)
+	{
+		if (ctx->content_length != 0 &&
+			ctx->write_segment_buffer_context.total_size != ctx->content_length)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_finalize_segment_response: actual content length %uz is different than reported length %uz",
+				ctx->write_segment_buffer_context.total_size, ctx->content_length);
+		}
+
+		rc = ngx_http_send_special(r, NGX_HTTP_LAST);
+		if (rc != NGX_OK && rc != NGX_AGAIN)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_init_file_reader_internal: ngx_file_reader_init failed %i", rc);
+				"ngx_http_vod_finalize_segment_response: ngx_http_send_special failed %i", rc);
+			return rc;
 		}
+		return NGX_OK;
+	}
+
+	// mark the current buffer as last
+	if (ctx->write_segment_buffer_context.chain_end->buf == NULL)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_finalize_segment_response: no buffers were written");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_UNEXPECTED);
+	}
+
+	ctx->write_segment_buffer_context.chain_end->next = NULL;
+	ctx->write_segment_buffer_context.chain_end->buf->last_buf = 1;
+
+	if (ngx_http_vod_generated_cache_enabled(ctx))
+	{
+		ngx_http_vod_store_generated_response(ctx);
+	}
+
+	// send the response header
+	rc = ngx_http_vod_send_header(r, ctx->write_segment_buffer_context.total_size, NULL, MEDIA_SET_VOD, NULL);
+	if (rc != NGX_OK)
+	{
 		return rc;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_OPEN_FILE);
+	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	{
+		return NGX_OK;
+	}
 
+	// send the response buffer chain
+	rc = ngx_http_output_filter(r, &ctx->out);
+	if (rc != NGX_OK && rc != NGX_AGAIN)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_finalize_segment_response: ngx_http_output_filter failed %i", rc);
+		return rc;
+	}
 	return NGX_OK;
 }
 
+////// Audio filtering
+
 static ngx_int_t
-ngx_http_vod_init_file_reader(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context)
+ngx_http_vod_get_filtered_track_key(
+	ngx_http_vod_ctx_t *ctx,
+	media_track_t* track,
+	uint32_t output_codec_id,
+	u_char* key)
 {
-	return ngx_http_vod_init_file_reader_internal(r, path, context, flags);
+	ngx_md5_t md5;
+	u_char* buffer;
+	u_char* end;
+
+	buffer = ngx_palloc(ctx->submodule_context.request_context.pool, audio_filter_get_cache_key_size(track));
+	if (buffer == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_get_filtered_track_key: ngx_palloc failed");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+	}
+
+	end = audio_filter_write_cache_key(buffer, track, output_codec_id);
+
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, buffer, end - buffer);
+	ngx_md5_final(key, &md5);
+
+	return NGX_OK;
 }
 
 static ngx_int_t
-ngx_http_vod_init_file_reader_with_fallback(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context)
+ngx_http_vod_fetch_filtered_tracks(
+	ngx_http_vod_ctx_t *ctx,
+	uint32_t output_codec_id,
+	ngx_flag_t* filtering_needed)
 {
-	return ngx_http_vod_init_file_reader_internal(r, path, context, flags | OPEN_FILE_FALLBACK_ENABLED);
+	ngx_http_vod_filtered_track_t* filtered_track;
+	media_clip_filtered_t* cur_clip;
+	media_sequence_t* sequence;
+	media_set_t* media_set = &ctx->submodule_context.media_set;
+	media_track_t* cur_track;
+	ngx_str_t cache_buffer;
+	ngx_uint_t count;
+	ngx_int_t rc;
+
+	*filtering_needed = 0;
+
+	// count the tracks that require filtering
+	count = 0;
+	for (cur_track = media_set->filtered_tracks; cur_track < media_set->filtered_tracks_end; cur_track++)
+	{
+		if (cur_track->source_clip != NULL)
+		{
+			count++;
+		}
+	}
+
+	if (count <= 0)
+	{
+		return NGX_OK;
+	}
+
+	filtered_track = ngx_palloc(ctx->submodule_context.request_context.pool, sizeof(filtered_track[0]) * count);
+	if (filtered_track == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_fetch_filtered_tracks: ngx_palloc failed");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+	}
+
+	ctx->filtered_tracks = filtered_track;
+
+	for (sequence = media_set->sequences; sequence < media_set->sequences_end; sequence++)
+	{
+		for (cur_clip = sequence->filtered_clips; cur_clip < sequence->filtered_clips_end; cur_clip++)
+		{
+			for (cur_track = cur_clip->first_track; cur_track < cur_clip->last_track; cur_track++)
+			{
+				if (cur_track->source_clip == NULL)
+				{
+					continue;
+				}
+
+				rc = ngx_http_vod_get_filtered_track_key(ctx, cur_track, output_codec_id, filtered_track->cache_key);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+
+				if (ngx_buffer_cache_fetch_copy_perf(
+					ctx->submodule_context.r,
+					ctx->perf_counters,
+					&ctx->submodule_context.conf->filtered_audio_cache,
+					1,
+					filtered_track->cache_key,
+					&cache_buffer) >= 0)
+				{
+					rc = audio_filter_cache_deserialize(
+						&ctx->submodule_context.request_context,
+						sequence,
+						cur_track,
+						&cache_buffer);
+					if (rc == VOD_OK)
+					{
+						ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+							"ngx_http_vod_fetch_filtered_tracks: filtered audio cache hit, size is %uz", cache_buffer.len);
+						continue;
+					}
+
+					if (rc != VOD_BAD_DATA)
+					{
+						return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+					}
+				}
+
+				// cache miss, filter the track and save it when done
+				filtered_track->sequence = sequence;
+				filtered_track->track = cur_track;
+				filtered_track++;
+
+				*filtering_needed = 1;
+			}
+		}
+	}
+
+	ctx->filtered_tracks_end = filtered_track;
+
+	return NGX_OK;
 }
 
-// Note: this function initializes r->exten in order to have nginx select the correct mime type for the request
-//		the code was copied from nginx's ngx_http_set_exten
 static void
-ngx_http_vod_set_request_extension(ngx_http_request_t *r, ngx_str_t* path)
+ngx_http_vod_store_filtered_tracks(ngx_http_vod_ctx_t *ctx)
 {
-	ngx_int_t  i;
+	ngx_http_vod_filtered_track_t* cur_track;
+	uint32_t buffer_count;
+	ngx_str_t* buffers;
+	vod_status_t rc;
+
+	for (cur_track = ctx->filtered_tracks; cur_track < ctx->filtered_tracks_end; cur_track++)
+	{
+		rc = audio_filter_cache_serialize(
+			&ctx->submodule_context.request_context,
+			cur_track->track,
+			&buffers,
+			&buffer_count);
+		if (rc != VOD_OK)
+		{
+			continue;
+		}
+
+		if (ngx_buffer_cache_store_gather_perf(
+			ctx->perf_counters,
+			ctx->submodule_context.conf->filtered_audio_cache,
+			cur_track->cache_key,
+			buffers,
+			buffer_count))
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_store_filtered_tracks: stored in filtered audio cache");
+		}
+		else
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_store_filtered_tracks: failed to store track in filtered audio cache");
+		}
+	}
+
+	ctx->filtered_tracks = NULL;
+	ctx->filtered_tracks_end = NULL;
+}
+
+static ngx_int_t
+ngx_http_vod_init_process(ngx_cycle_t *cycle)
+{
+	vod_status_t rc;
+
+	audio_filter_process_init(cycle->log);
+
+#if (NGX_HAVE_LIB_AV_CODEC)
+	audio_decoder_process_init(cycle->log);
+	audio_encoder_process_init(cycle->log);
+	thumb_grabber_process_init(cycle->log);
+#endif // NGX_HAVE_LIB_AV_CODEC
+
+	rc = language_code_process_init(cycle->pool, cycle->log);
+	if (rc != VOD_OK)
+	{
+		return NGX_ERROR;
+	}
+
+	return NGX_OK;
+}
+
+static void 
+ngx_http_vod_exit_process()
+{
+#if (VOD_HAVE_ICONV)
+	webvtt_exit_process();
+#endif // VOD_HAVE_ICONV
+
+#if (NGX_HAVE_LIBXML2)
+	dfxp_exit_process();
+#endif // NGX_HAVE_LIBXML2
+}
+
+////// Clipping
+
+static ngx_int_t
+ngx_http_vod_send_clip_header(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_chain_t* out;
+	uint64_t first_offset;
+	uint64_t last_offset;
+	size_t response_size;
+	ngx_str_t content_type;
+	ngx_int_t rc;
+	off_t range_start;
+	off_t range_end;
+	off_t header_size;
+	off_t mdat_size;
+
+	rc = ctx->format->clipper_build_header(
+		&ctx->submodule_context.request_context,
+		ctx->metadata_parts,
+		ctx->metadata_part_count,
+		ctx->clipper_parse_result,
+		&out,
+		&response_size, 
+		&content_type);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_clip_header: clipper_build_header(%V) failed %i", &ctx->format->name, rc);
+		return ngx_http_vod_status_to_ngx_error(r, rc);
+	}
+
+	// send the response header
+	rc = ngx_http_vod_send_header(r, response_size, &content_type, MEDIA_SET_VOD, NULL);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	{
+		return NGX_DONE;
+	}
+
+	rc = ngx_http_output_filter(r, out);
+	if (rc != NGX_OK && rc != NGX_AGAIN)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_clip_header: ngx_http_output_filter failed %i", rc);
+		return rc;
+	}
+
+	if (ctx->submodule_context.conf->request_handler == ngx_http_vod_remote_request_handler && 
+		ctx->submodule_context.r->headers_in.range)
+	{
+		// in case of range request in remote mode, apply the requested range to the mdat dump offsets.
+		// nginx's range filter module does not touch the dumped part since it is written in the context
+		// a subrequest. 
+
+		// TODO: apply the range on the mp4 header as well and return 206, to avoid making assumptions on
+		//		nginx subrequest/range filter implementations
+
+		rc = ngx_http_vod_range_parse(
+			&ctx->submodule_context.r->headers_in.range->value,
+			response_size,
+			&range_start,
+			&range_end);
+		if (rc != NGX_OK)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_send_clip_header: failed to parse range header \"%V\"",
+				&ctx->submodule_context.r->headers_in.range->value);
+			return rc;
+		}
+
+		first_offset = ctx->clipper_parse_result->first_offset;
+		last_offset = ctx->clipper_parse_result->last_offset;
+
+		mdat_size = last_offset - first_offset;
+		header_size = response_size - mdat_size;
+
+		if (range_end < header_size)
+		{
+			last_offset = 0;
+		}
+		else if (mdat_size > range_end - header_size)
+		{
+			last_offset = first_offset + range_end - header_size;
+		}
+
+		if (range_start > header_size)
+		{
+			first_offset += range_start - header_size;
+		}
+
+		ctx->clipper_parse_result->first_offset = first_offset;
+		ctx->clipper_parse_result->last_offset = last_offset;
+	}
+
+	return NGX_OK;
+}
+
+////// Common
+
+static ngx_flag_t
+ngx_http_vod_generator_matches(
+	media_parse_params_t* parse_params,
+	media_generator_t* generator)
+{
+	uint32_t media_type;
+
+	if ((parse_params->codecs_mask & generator->codec_mask) == 0)
+	{
+		return 0;
+	}
+
+	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
+	{
+		if ((parse_params->required_tracks_mask[media_type] & generator->track_mask[media_type]) != 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static ngx_int_t
+ngx_http_vod_run_generators(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
+	media_parse_params_t parse_params;
+	media_generator_t* generator;
+	media_range_t range;
+	uint32_t tracks_mask[MEDIA_TYPE_COUNT];
+	ngx_int_t rc;
+
+	for (cur_source = ctx->submodule_context.media_set.generators_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		ctx->cur_source = cur_source;
+
+		if (cur_source->clip_to >= UINT_MAX)
+		{
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_run_generators: unbounded generator source");
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+		}
+
+		parse_params.clip_to = cur_source->clip_to;
+		parse_params.clip_from = 0;
+
+		ngx_http_vod_init_parse_params_metadata(ctx, tracks_mask, &parse_params);
+
+		// Note: currently, the only generator is the silence generator
+		generator = &silence_generator;
+
+		if (!ngx_http_vod_generator_matches(
+			&parse_params,
+			generator))
+		{
+			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
+			continue;
+		}
+
+		if (parse_params.langs_mask != NULL &&
+			!vod_is_bit_set(parse_params.langs_mask, cur_source->sequence->language))
+		{
+			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
+			continue;
+		}
+
+		rc = ngx_http_vod_init_parse_params_frames(
+			ctx,
+			&range,
+			&parse_params);
+		switch (rc)
+		{
+		case NGX_OK:
+			break;		// handled outside the switch
+
+		case NGX_DONE:
+			ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
+			continue;
+
+		default:
+			return rc;
+		}
+
+		rc = generator->generate(
+			&ctx->submodule_context.request_context,
+			&parse_params,
+			&cur_source->track_array);
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_run_generators: generator failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+	}
+
+	ctx->cur_source = NULL;
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_flag_t filtering_needed;
+	ngx_int_t rc;
+	uint32_t max_frame_count;
+	uint32_t output_codec_id;
+
+	switch (ctx->state)
+	{
+	case STATE_READ_DRM_INFO:
+		rc = ngx_http_vod_state_machine_get_drm_info(ctx);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		ctx->state = STATE_READ_METADATA_INITIAL;
+		ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
+		// fallthrough
+
+	case STATE_READ_METADATA_INITIAL:
+	case STATE_READ_METADATA_OPEN_FILE:
+	case STATE_READ_METADATA_READ:
+	case STATE_PARSE_CACHED_METADATA:
+	case STATE_PARSE_METADATA:
+	case STATE_READ_FRAMES_OPEN_FILE:
+	case STATE_READ_FRAMES_READ:
+
+		rc = ngx_http_vod_state_machine_parse_metadata(ctx);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		if (ctx->request == NULL)
+		{
+			rc = ngx_http_vod_send_clip_header(ctx);
+			if (rc != NGX_OK)
+			{
+				if (rc == NGX_DONE)
+				{
+					rc = NGX_OK;
+				}
+				else
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+						"ngx_http_vod_run_state_machine: ngx_http_vod_send_clip_header failed %i", rc);
+				}
+				return rc;
+			}
+		}
+		else
+		{
+			rc = ngx_http_vod_run_generators(ctx);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			rc = filter_init_filtered_clips(
+				&ctx->submodule_context.request_context,
+				&ctx->submodule_context.media_set, 
+				(ctx->request->parse_type & PARSE_FLAG_FRAMES_DURATION) != 0);
+			if (rc != VOD_OK)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_run_state_machine: filter_init_filtered_clips failed %i", rc);
+				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+			}
+
+			rc = ngx_http_vod_validate_streams(ctx);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			// handle metadata requests
+			if (ctx->request->handle_metadata_request != NULL)
+			{
+				return ngx_http_vod_handle_metadata_request(ctx);
+			}
+
+			// initialize the read cache
+			read_cache_init(
+				&ctx->read_cache_state,
+				&ctx->submodule_context.request_context,
+				ctx->submodule_context.conf->cache_buffer_size,
+				ctx->alignment);
+		}
+
+		ctx->state = STATE_OPEN_FILE;
+		ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+		// fallthrough
+
+	case STATE_OPEN_FILE:
+		rc = ngx_http_vod_state_machine_open_files(ctx);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		if (ctx->submodule_context.conf->mmap_sources &&
+			ctx->reader->map != NULL &&
+			ctx->request != NULL)
+		{
+			// read the frames directly from a mapping of the files
+			rc = ngx_http_vod_map_sources(ctx);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+		}
+		else if (ctx->reader->enable_directio != NULL)
+		{
+			// enable directio if enabled in the configuration (ignore errors)
+			// Note that directio is set on transfer only to allow the kernel to cache the "moov" atom
+			ngx_http_vod_enable_directio(ctx);
+		}
+
+		if (ctx->request == NULL)
+		{
+			if (ctx->clipper_parse_result->first_offset < ctx->clipper_parse_result->last_offset)
+			{
+				ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+
+				ctx->state = STATE_DUMP_FILE_PART;
+
+				rc = ctx->reader->dump_part(
+					ctx->cur_source->reader_context,
+					ctx->clipper_parse_result->first_offset,
+					ctx->clipper_parse_result->last_offset);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+			}
+
+			rc = ngx_http_send_special(ctx->submodule_context.r, NGX_HTTP_LAST);
+			if (rc != NGX_OK && rc != NGX_AGAIN)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_run_state_machine: ngx_http_send_special failed %i", rc);
+				return rc;
+			}
+
+			return NGX_OK;
+		}
+
+		if (ctx->submodule_context.media_set.audio_filtering_needed)
+		{
+			// initialize the filtering of audio frames
+			ctx->state = STATE_FILTER_FRAMES;
+			ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+
+			if ((ctx->request->request_class & (REQUEST_CLASS_MANIFEST | REQUEST_CLASS_OTHER)) != 0)
+			{
+				max_frame_count = NON_SEGMENT_REQUEST_MAX_FRAME_COUNT;
+			}
+			else
+			{
+				max_frame_count = SEGMENT_REQUEST_MAX_FRAME_COUNT;
+			}
+
+#if (NGX_HAVE_LIB_AV_CODEC)
+			if (ctx->submodule_context.conf->submodule.name == volume_map.name)
+			{
+				output_codec_id = VOD_CODEC_ID_VOLUME_MAP;
+			}
+			else
+#endif // NGX_HAVE_LIB_AV_CODEC
+			{
+				output_codec_id = VOD_CODEC_ID_AAC;
+			}
+
+			filtering_needed = 1;
+			if (ctx->submodule_context.conf->filtered_audio_cache != NULL)
+			{
+				rc = ngx_http_vod_fetch_filtered_tracks(ctx, output_codec_id, &filtering_needed);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+			}
+		}
+
+		if (ctx->submodule_context.media_set.audio_filtering_needed && filtering_needed)
+		{
+			rc = filter_init_state(
+				&ctx->submodule_context.request_context,
+				&ctx->read_cache_state,
+				&ctx->submodule_context.media_set,
+				max_frame_count,
+				output_codec_id,
+				&ctx->frame_processor_state);
+			if (rc != VOD_OK)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_run_state_machine: filter_init_state failed %i", rc);
+				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+			}
+
+			ctx->frame_processor = filter_run_state_machine;
+		}
+
+		// fallthrough
+
+	case STATE_FILTER_FRAMES:
+		// if audio filtering already started, process frames
+		if (ctx->frame_processor != NULL)
+		{
+			rc = ngx_http_vod_process_media_frames(ctx);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			if (ctx->filtered_tracks != NULL)
+			{
+				ngx_http_vod_store_filtered_tracks(ctx);
+			}
+		}
+
+		// initialize the processing of the video/audio frames
+		rc = ngx_http_vod_init_frame_processing(ctx);
+		if (rc != NGX_OK)
+		{
+			if (rc == NGX_DONE)
+			{
+				rc = NGX_OK;
+			}
+			else
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_run_state_machine: ngx_http_vod_init_frame_processing failed %i", rc);
+			}
+			return rc;
+		}
+
+		if (ctx->frame_processor_state == NULL)
+		{
+			return ngx_http_vod_finalize_segment_response(ctx);
+		}
+
+		ctx->submodule_context.request_context.log->action = "processing frames";
+		ctx->state = STATE_PROCESS_FRAMES;
+		// fallthrough
+
+	case STATE_PROCESS_FRAMES:
+		rc = ngx_http_vod_process_media_frames(ctx);
+		if (rc != NGX_OK)
+		{
+			if (rc != NGX_AGAIN)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_run_state_machine: ngx_http_vod_process_media_frames failed %i", rc);
+			}
+			return rc;
+		}
+
+		return ngx_http_vod_finalize_segment_response(ctx);
+
+	case STATE_DUMP_OPEN_FILE:
+		return ctx->reader->dump_request(ctx->cur_source->reader_context);
+
+	case STATE_DUMP_FILE_PART:
+		rc = ngx_http_send_special(ctx->submodule_context.r, NGX_HTTP_LAST);
+		if (rc != NGX_OK && rc != NGX_AGAIN)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_run_state_machine: ngx_http_send_special failed %i", rc);
+			return rc;
+		}
+
+		return NGX_OK;
+	}
+
+	ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_run_state_machine: invalid state %d", ctx->state);
+	return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+}
+
+static void
+ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read)
+{
+	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
+	ssize_t expected_size;
+
+	if (rc != NGX_OK)
+	{
+		if (ctx->state == STATE_MAP_READ && 
+			ctx->mapping.stale_retries > 0 && 
+			errno == ESTALE)
+		{
+			ctx->mapping.stale_retries--;
+			ctx->state = STATE_MAP_INITIAL;
+
+			rc = ctx->state_machine(ctx);
+			if (rc == NGX_AGAIN)
+			{
+				return;
+			}
+
+			goto finalize_request;
+		}
+
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_handle_read_completed: read failed %i", rc);
+		goto finalize_request;
+	}
+
+	if (ctx->state == STATE_DUMP_FILE_PART)
+	{
+		expected_size = ctx->clipper_parse_result->last_offset - ctx->clipper_parse_result->first_offset;
+		if (bytes_read != expected_size)
+		{
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_handle_read_completed: read size %z different than expected %z, probably a truncated file", 
+				bytes_read, expected_size);
+			rc = ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+			goto finalize_request;
+		}
+	}
+	else if (bytes_read <= 0)
+	{
+		switch (ctx->state)
+		{
+		case STATE_MAP_READ:		// the mapping state machine handles the case of empty mapping
+			break;
+
+		case STATE_READ_METADATA_READ:
+			if ((ctx->read_flags & MEDIA_READ_FLAG_ALLOW_EMPTY_READ) != 0)
+			{
+				break;
+			}
+			// fallthrough
+
+		default:
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_handle_read_completed: bytes read is zero");
+			rc = ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+			goto finalize_request;
+		}
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, ctx->perf_counter_async_read);
+
+	switch (ctx->state)
+	{
+	case STATE_FILTER_FRAMES:
+	case STATE_PROCESS_FRAMES:
+		if (buf == NULL)
+		{
+			buf = &ctx->read_buffer;
+		}
+		ctx->frames_bytes_read += (buf->last - buf->pos);
+		read_cache_read_completed(&ctx->read_cache_state, buf);
+		break;
+
+	default:
+		if (buf != NULL)
+		{
+			ctx->read_buffer = *buf;
+		}
+		break;
+	}
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+finalize_request:
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+
+static void
+ngx_http_vod_init_file_key(media_clip_source_t* cur_source, ngx_str_t* prefix)
+{
+	ngx_md5_t md5;
+
+	ngx_md5_init(&md5);
+	if (prefix != NULL)
+	{
+		ngx_md5_update(&md5, prefix->data, prefix->len);
+	}
+	ngx_md5_update(&md5, cur_source->mapped_uri.data, cur_source->mapped_uri.len);
+	ngx_md5_final(cur_source->file_key, &md5);
+}
+
+static ngx_int_t
+ngx_http_vod_init_encryption_key(
+	ngx_http_request_t *r, 
+	ngx_http_vod_loc_conf_t* conf, 
+	media_sequence_t* cur_sequence)
+{
+	ngx_str_t encryption_key_seed;
+	ngx_md5_t md5;
+
+	if (conf->secret_key != NULL)
+	{
+		// calculate the encryption key seed
+		if (ngx_http_complex_value(
+			r,
+			conf->secret_key,
+			&encryption_key_seed) != NGX_OK)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_init_encryption_key: ngx_http_complex_value failed");
+			return NGX_ERROR;
+		}
+	}
+	else
+	{
+		encryption_key_seed = cur_sequence->mapped_uri;
+	}
+
+	// hash the seed to get the key
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, encryption_key_seed.data, encryption_key_seed.len);
+	ngx_md5_final(cur_sequence->encryption_key, &md5);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_start_processing_media_file(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
+	ngx_http_request_t *r;
+	ngx_int_t rc;
+
+	// update request flags
+	r = ctx->submodule_context.r;
+	r->root_tested = !r->error_page;
+	r->allow_ranges = 1;
+
+	// set the state machine
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	ctx->state_machine = ngx_http_vod_run_state_machine;
+
+	// handle serve requests
+	if (ctx->request == NULL &&
+		ctx->submodule_context.media_set.sources_head->clip_from == 0 &&
+		ctx->submodule_context.media_set.sources_head->clip_to == ULLONG_MAX)
+	{
+		ctx->state = STATE_DUMP_OPEN_FILE;
+
+		cur_source = ctx->submodule_context.media_set.sources_head;
+		ctx->cur_source = cur_source;
+
+		rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
+		if (rc != NGX_OK)
+		{
+			if (rc != NGX_AGAIN && rc != NGX_DONE)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_start_processing_media_file: open_file failed %i", rc);
+			}
+			return rc;
+		}
+
+		return ctx->reader->dump_request(ctx->cur_source->reader_context);
+	}
+
+	// initialize the file keys
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		ngx_http_vod_init_file_key(cur_source, ctx->file_key_prefix);
+	}
+
+	// try to serve previously generated responses (thumbnails / volume maps)
+	if (ngx_http_vod_generated_cache_enabled(ctx))
+	{
+		rc = ngx_http_vod_fetch_generated_response(ctx);
+		if (rc != NGX_DECLINED)
+		{
+			return rc;
+		}
+	}
+
+	return ngx_http_vod_start_reading_metadata(ctx);
+}
+
+static ngx_int_t
+ngx_http_vod_start_reading_metadata(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t *r = ctx->submodule_context.r;
+	ngx_int_t rc;
+
+	// initialize the uri / encryption keys
+	if (conf->drm_enabled || conf->secret_key != NULL)
+	{
+		for (ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
+			ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
+			ctx->cur_sequence++)
+		{
+			rc = ngx_http_vod_init_encryption_key(r, conf, ctx->cur_sequence);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+		}
+	}
+
+	// restart the file index/uri params
+	ctx->cur_source = ctx->submodule_context.media_set.sources_head;
+
+	if (ctx->submodule_context.conf->drm_enabled)
+	{
+		ctx->state = STATE_READ_DRM_INFO;
+		ctx->cur_sequence = ctx->submodule_context.media_set.sequences;
+	}
+	else
+	{
+		ctx->state = STATE_READ_METADATA_INITIAL;
+	}
+
+	return ngx_http_vod_run_state_machine(ctx);
+}
+
+////// Local & mapped modes
+
+static ngx_int_t
+ngx_http_vod_map_uris_to_paths(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* cur_source;
+	ngx_http_request_t *r = ctx->submodule_context.r;
+	ngx_str_t original_uri;
+	u_char *last;
+	size_t root;
+	ngx_str_t path;
+
+	original_uri = r->uri;
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		r->uri = cur_source->stripped_uri;
+		last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+		r->uri = original_uri;
+		if (last == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_map_uris_to_paths: ngx_http_map_uri_to_path failed");
+			return NGX_HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+		path.len = last - path.data;
+
+		cur_source->mapped_uri = path;
+	}
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_dump_request_to_fallback(ngx_http_request_t *r)
+{
+	ngx_http_vod_loc_conf_t* conf;
+	ngx_child_request_params_t child_params;
+
+	conf = ngx_http_get_module_loc_conf(r, ngx_http_vod_module);
+
+	if (conf->fallback_upstream_location.len == 0)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_dump_request_to_fallback: no fallback configured");
+		return NGX_ERROR;
+	}
+
+	if (ngx_http_vod_header_exists(r, &conf->proxy_header.key))
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_dump_request_to_fallback: proxy header exists");
+		return NGX_ERROR;
+	}
+
+	// dump the request to the fallback upstream
+	ngx_memzero(&child_params, sizeof(child_params));
+	child_params.method = r->method;
+	child_params.base_uri = r->uri;
+	child_params.extra_args = r->args;
+	child_params.extra_header = conf->proxy_header;
+	child_params.proxy_range = 1;
+	child_params.proxy_all_headers = 1;
+
+	return ngx_child_request_start(
+		r,
+		NULL,
+		NULL,
+		&conf->fallback_upstream_location,
+		&child_params,
+		NULL);
+}
+
+#if (NGX_THREADS)
+static void
+ngx_http_vod_file_open_completed_internal(void* context, ngx_int_t rc, ngx_flag_t fallback)
+{
+	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
+
+	if (rc != NGX_OK)
+	{
+		if (fallback && rc == NGX_HTTP_NOT_FOUND)
+		{
+			// try the fallback
+			rc = ngx_http_vod_dump_request_to_fallback(ctx->submodule_context.r);
+			if (rc != NGX_AGAIN)
+			{
+				rc = NGX_HTTP_NOT_FOUND;
+			}
+			goto finalize_request;
+		}
+
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.r->connection->log, 0,
+			"ngx_http_vod_file_open_completed_internal: read failed %i", rc);
+		goto finalize_request;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_ASYNC_OPEN_FILE);
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+finalize_request:
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+
+static void
+ngx_http_vod_file_open_completed(void* context, ngx_int_t rc)
+{
+	ngx_http_vod_file_open_completed_internal(context, rc, 0);
+}
+
+static void
+ngx_http_vod_file_open_completed_with_fallback(void* context, ngx_int_t rc)
+{
+	ngx_http_vod_file_open_completed_internal(context, rc, 1);
+}
+
+static void
+ngx_http_vod_file_open_concurrent_completed(void* context, ngx_int_t rc)
+{
+	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
+
+	if (rc != NGX_OK && ctx->open_rc == NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.r->connection->log, 0,
+			"ngx_http_vod_file_open_concurrent_completed: open failed %i", rc);
+		ctx->open_rc = rc;
+	}
+
+	ctx->pending_opens--;
+	if (ctx->pending_opens > 0)
+	{
+		// Note: the request is still blocked by the other opens
+		ctx->submodule_context.r->aio = 1;
+		return;
+	}
+
+	rc = ctx->open_rc;
+	if (rc != NGX_OK)
+	{
+		goto finalize_request;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_ASYNC_OPEN_FILE);
+
+	ngx_http_vod_prefetch_sources(ctx);
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+finalize_request:
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+#endif // NGX_THREADS
+
+static ngx_int_t
+ngx_http_vod_init_file_reader_internal(ngx_http_request_t *r, ngx_str_t* path, void** context, uint32_t flags)
+{
+	ngx_file_reader_state_t* state;
+	ngx_http_core_loc_conf_t *clcf;
+	ngx_http_vod_ctx_t *ctx;
+	ngx_flag_t fallback = (flags & OPEN_FILE_FALLBACK_ENABLED) != 0;
+	ngx_int_t rc;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+	state = ngx_pcalloc(r->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_init_file_reader_internal: ngx_pcalloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
+
+	*context = state;
+
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+#if (NGX_THREADS)
+	if (ctx->pending_opens > 0 && ctx->submodule_context.conf->open_file_thread_pool != NULL)
+	{
+		// concurrent open, use a dedicated open context and join the completions
+		rc = ngx_file_reader_init_async(
+			state,
+			NULL,
+			ctx->submodule_context.conf->open_file_thread_pool,
+			ngx_http_vod_file_open_concurrent_completed,
+			ngx_http_vod_handle_read_completed,
+			ctx,
+			r,
+			clcf,
+			path,
+			flags);
+	}
+	else if (ctx->submodule_context.conf->open_file_thread_pool != NULL)
+	{
+		rc = ngx_file_reader_init_async(
+			state,
+			&ctx->async_open_context,
+			ctx->submodule_context.conf->open_file_thread_pool,
+			fallback ? ngx_http_vod_file_open_completed_with_fallback : ngx_http_vod_file_open_completed,
+			ngx_http_vod_handle_read_completed,
+			ctx,
+			r,
+			clcf,
+			path,
+			flags);
+	}
+	else
+#endif // NGX_THREADS
+	{
+		rc = ngx_file_reader_init(
+			state,
+			ngx_http_vod_handle_read_completed,
+			ctx,
+			r,
+			clcf,
+			path,
+			flags);
+	}
+	if (rc != NGX_OK)
+	{
+		if (fallback && rc == NGX_HTTP_NOT_FOUND)
+		{
+			// try the fallback
+			rc = ngx_http_vod_dump_request_to_fallback(r);
+			if (rc != NGX_AGAIN)
+			{
+				return NGX_HTTP_NOT_FOUND;
+			}
+			return rc;
+		}
+
+		if (rc != NGX_AGAIN)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_init_file_reader_internal: ngx_file_reader_init failed %i", rc);
+		}
+		return rc;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_OPEN_FILE);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_init_file_reader(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context)
+{
+	return ngx_http_vod_init_file_reader_internal(r, path, context, flags);
+}
+
+static ngx_int_t
+ngx_http_vod_init_file_reader_with_fallback(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context)
+{
+	return ngx_http_vod_init_file_reader_internal(r, path, context, flags | OPEN_FILE_FALLBACK_ENABLED);
+}
+
+// Note: this function initializes r->exten in order to have nginx select the correct mime type for the request
+//		the code was copied from nginx's ngx_http_set_exten
+static void
+ngx_http_vod_set_request_extension(ngx_http_request_t *r, ngx_str_t* path)
+{
+	ngx_int_t  i;
+
+	ngx_str_null(&r->exten);
+
+	for (i = path->len - 1; i > 1; i--) {
+		if (path->data[i] == '.' && path->data[i - 1] != '/') {
+
+			r->exten.len = path->len - i - 1;
+			r->exten.data = &path->data[i + 1];
+
+			return;
+
+		}
+		else if (path->data[i] == '/') {
+			return;
+		}
+	}
+
+	return;
+}
+
+static ngx_int_t
+ngx_http_vod_dump_file(void* context)
+{
+	ngx_file_reader_state_t* state = context;
+	ngx_http_request_t* r = state->r;
+	ngx_int_t rc;
+
+	ngx_http_vod_set_request_extension(r, &state->file.name);
+
+	rc = ngx_http_set_content_type(r);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, state->log, 0,
+			"ngx_http_vod_dump_file: ngx_http_set_content_type failed %i", rc);
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	// send the response header
+	rc = ngx_http_vod_send_header(r, state->file_size, NULL, MEDIA_SET_VOD, NULL);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	{
+		return NGX_OK;
+	}
+
+	ngx_file_reader_enable_directio(state);		// ignore errors
+
+	return ngx_file_reader_dump_file_part(state, 0, 0);
+}
+
+////// Remote & mapped modes
+
+static ngx_int_t
+ngx_http_vod_async_http_read(ngx_http_vod_http_reader_state_t *state, ngx_buf_t *buf, size_t size, off_t offset)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_child_request_params_t child_params;
+
+	ctx = ngx_http_get_module_ctx(state->r, ngx_http_vod_module);
+
+	ngx_memzero(&child_params, sizeof(child_params));
+	child_params.method = NGX_HTTP_GET;
+	child_params.base_uri = state->cur_remote_suburi;
+	child_params.extra_args = ctx->upstream_extra_args;
+	child_params.range_start = offset;
+	child_params.range_end = offset + size;
+
+	return ngx_child_request_start(
+		state->r,
+		ngx_http_vod_handle_read_completed,
+		ctx,
+		&state->upstream_location,
+		&child_params,
+		buf);
+}
+
+static ngx_int_t
+ngx_http_vod_dump_http_part(void* context, off_t start, off_t end)
+{
+	ngx_http_vod_http_reader_state_t *state = context;
+	ngx_child_request_params_t child_params;
+	ngx_http_request_t* r = state->r;
+	ngx_http_vod_ctx_t *ctx;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	ngx_memzero(&child_params, sizeof(child_params));
+	child_params.method = NGX_HTTP_GET;
+	child_params.base_uri = state->cur_remote_suburi;
+	child_params.extra_args = ctx->upstream_extra_args;
+	child_params.range_start = start;
+	child_params.range_end = end;
+
+	return ngx_child_request_start(
+		r,
+		ngx_http_vod_handle_read_completed,
+		ctx,
+		&state->upstream_location,
+		&child_params,
+		NULL);
+}
+
+static ngx_int_t
+ngx_http_vod_dump_http_request(void* context)
+{
+	ngx_http_vod_http_reader_state_t* state = context;
+	ngx_child_request_params_t child_params;
+	ngx_http_request_t* r = state->r;
+	ngx_http_vod_ctx_t *ctx;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	ngx_memzero(&child_params, sizeof(child_params));
+	child_params.method = r->method;
+	child_params.base_uri = state->cur_remote_suburi;
+	child_params.extra_args = ctx->upstream_extra_args;
+	child_params.proxy_range = 1;
+	child_params.proxy_all_headers = 1;
+
+	return ngx_child_request_start(
+		r,
+		NULL,
+		NULL,
+		&state->upstream_location,
+		&child_params,
+		NULL);
+}
+
+static ngx_int_t
+ngx_http_vod_http_reader_open_file(ngx_http_request_t* r, ngx_str_t* path, uint32_t flags, void** context)
+{
+	ngx_http_vod_http_reader_state_t* state;
+	ngx_http_vod_ctx_t *ctx;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	// initialize the upstream variables
+	if (ctx->upstream_extra_args.len == 0 &&
+		ctx->submodule_context.conf->upstream_extra_args != NULL)
+	{
+		if (ngx_http_complex_value(
+			ctx->submodule_context.r,
+			ctx->submodule_context.conf->upstream_extra_args,
+			&ctx->upstream_extra_args) != NGX_OK)
+		{
+			return NGX_ERROR;
+		}
+	}
+
+	state = ngx_palloc(r->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_http_reader_open_file: ngx_palloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
+
+	// Note: for http, no need to open any files, just save the remote uri
+	state->r = r;
+	state->cur_remote_suburi = *path;
+	if (ctx->state == STATE_MAP_OPEN || ctx->submodule_context.conf->remote_upstream_location.len == 0)
+	{
+		state->upstream_location = ctx->submodule_context.conf->upstream_location;
+	}
+	else
+	{
+		state->upstream_location = ctx->submodule_context.conf->remote_upstream_location;
+	}
+	*context = state;
+
+	return NGX_OK;
+}
+
+static void	
+ngx_http_vod_http_reader_get_path(void* context, ngx_str_t* path)
+{
+	ngx_http_vod_http_reader_state_t* ctx = context;
+
+	*path = ctx->cur_remote_suburi;
+}
+
+////// Local mode only
+
+ngx_int_t
+ngx_http_vod_local_request_handler(ngx_http_request_t *r)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_int_t rc;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	// map all uris to paths
+	rc = ngx_http_vod_map_uris_to_paths(ctx);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	// initialize for reading files
+	ctx->reader = &reader_file_with_fallback;
+	ctx->read = (ngx_http_vod_async_read_func_t)ngx_async_file_read;
+	ctx->alloc_params_index = READER_FILE;
+	ctx->alignment = ctx->alloc_params[READER_FILE].alignment;
+	ctx->perf_counter_async_read = PC_ASYNC_READ_FILE;
+
+	// start the state machine
+	rc = ngx_http_vod_start_processing_media_file(ctx);
+	if (rc != NGX_AGAIN && rc != NGX_DONE && rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_local_request_handler: ngx_http_vod_start_processing_media_file failed %i", rc);
+	}
+
+	return rc;
+}
+
+////// Mapped mode only
+
+static void
+ngx_http_vod_map_get_cache_key(ngx_http_vod_ctx_t *ctx, ngx_str_t* uri, u_char* cache_key)
+{
+	ngx_str_t* prefix;
+	ngx_md5_t md5;
+
+	prefix = ctx->mapping.cache_key_prefix;
+	ngx_md5_init(&md5);
+	if (prefix != NULL)
+	{
+		ngx_md5_update(&md5, prefix->data, prefix->len);
+	}
+	ngx_md5_update(&md5, uri->data, uri->len);
+	ngx_md5_final(cache_key, &md5);
+}
+
+static ngx_int_t
+ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_buffer_cache_t* cache;
+	ngx_buf_t* response;
+	ngx_str_t mapping;
+	ngx_str_t uri;
+	ngx_int_t rc;
+	size_t read_size;
+	int cache_index;
+
+	switch (ctx->state)
+	{
+	case STATE_MAP_INITIAL:
+		// get the uri
+		rc = ctx->mapping.get_uri(ctx, &uri);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		// calculate the cache key
+		ngx_http_vod_map_get_cache_key(ctx, &uri, ctx->mapping.cache_key);
+
+		// try getting the mapping from cache
+		if (ngx_buffer_cache_fetch_multi_perf(
+			ctx->perf_counters,
+			ctx->mapping.caches,
+			ctx->mapping.cache_count,
+			ctx->mapping.cache_key,
+			&mapping) >= 0)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_run_step: mapping cache hit %V", &mapping);
+
+			rc = ctx->mapping.apply(ctx, &mapping, &cache_index);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			break;
+		}
+		else
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_run_step: mapping cache miss");
+		}
+
+		// open the mapping file
+		ctx->submodule_context.request_context.log->action = "getting mapping";
+
+		ctx->state = STATE_MAP_OPEN;
+
+		rc = ctx->reader->open(ctx->submodule_context.r, &uri, OPEN_FILE_NO_CACHE, &ctx->mapping.reader_context);
+		if (rc != NGX_OK)
+		{
+			if (rc != NGX_AGAIN && rc != NGX_DONE)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: open_file failed %i", rc);
+			}
+			return rc;
+		}
+
+		// fallthrough
+
+	case STATE_MAP_OPEN:
+
+		if (ctx->reader->get_size != NULL)
+		{
+			read_size = ctx->reader->get_size(ctx->mapping.reader_context);
+			if (read_size <= 0)
+			{
+				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: empty mapping response");
+				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_EMPTY_MAPPING);
+			}
+			else if (read_size > ctx->mapping.max_response_size)
+			{
+				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: mapping size %uz greater than limit %uz", 
+					read_size, ctx->mapping.max_response_size);
+				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_MAPPING);
+			}
+		}
+		else
+		{
+			read_size = ctx->mapping.max_response_size;
+		}
+
+		rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		// read the mapping
+		ctx->state = STATE_MAP_READ;
+		ngx_perf_counter_start(ctx->perf_counter_context);
+
+		rc = ctx->read(ctx->mapping.reader_context, &ctx->read_buffer, read_size, 0);
+		if (rc != NGX_OK)
+		{
+			if (rc != NGX_AGAIN)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: async_read failed %i", rc);
+			}
+			return rc;
+		}
+
+		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_MAP_PATH);
+
+		// fallthrough
+
+	case STATE_MAP_READ:
 
-	ngx_str_null(&r->exten);
+		response = &ctx->read_buffer;
 
-	for (i = path->len - 1; i > 1; i--) {
-		if (path->data[i] == '.' && path->data[i - 1] != '/') {
+		if (response->last == response->pos)
+		{
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_run_step: empty mapping response");
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_EMPTY_MAPPING);
+		}
 
-			r->exten.len = path->len - i - 1;
-			r->exten.data = &path->data[i + 1];
+		// apply the mapping
+		if (response->last >= response->end)
+		{
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_run_step: not enough room in buffer for null terminator");
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_MAPPING);
+		}
 
-			return;
+		*response->last = '\0';
+
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_run_step: mapping result %s", response->pos);
 
+		mapping.data = response->pos;
+		mapping.len = response->last - response->pos;
+		rc = ctx->mapping.apply(ctx, &mapping, &cache_index);
+		if (rc != NGX_OK)
+		{
+			return rc;
 		}
-		else if (path->data[i] == '/') {
-			return;
+
+		// save to cache
+		cache = ctx->mapping.caches[cache_index];
+		if (cache != NULL)
+		{
+			if (ngx_buffer_cache_store_perf(
+				ctx->perf_counters,
+				cache,
+				ctx->mapping.cache_key,
+				response->pos,
+				response->last - response->pos))
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: stored in mapping cache");
+			}
+			else
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_map_run_step: failed to store mapping in cache");
+			}
 		}
+
+		ctx->state = STATE_MAP_INITIAL;
+		break;
+
+	default:
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_run_step: invalid state %d", ctx->state);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
 	}
 
-	return;
+	return NGX_OK;
 }
 
+/// parallel mapping
+
 static ngx_int_t
-ngx_http_vod_dump_file(void* context)
+ngx_http_vod_map_parallel_apply(ngx_http_vod_ctx_t *ctx, ngx_http_vod_mapping_request_t* request)
 {
-	ngx_file_reader_state_t* state = context;
-	ngx_http_request_t* r = state->r;
+	ngx_buffer_cache_t* cache;
+	ngx_buf_t* response = &request->read_buffer;
+	ngx_str_t mapping;
 	ngx_int_t rc;
+	int cache_index;
 
-	ngx_http_vod_set_request_extension(r, &state->file.name);
+	if (response->last == response->pos)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_parallel_apply: empty mapping response");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_EMPTY_MAPPING);
+	}
 
-	rc = ngx_http_set_content_type(r);
-	if (rc != NGX_OK)
+	if (response->last >= response->end)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, state->log, 0,
-			"ngx_http_vod_dump_file: ngx_http_set_content_type failed %i", rc);
-		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_parallel_apply: not enough room in buffer for null terminator");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_MAPPING);
 	}
 
-	// send the response header
-	rc = ngx_http_vod_send_header(r, state->file_size, NULL, MEDIA_SET_VOD, NULL);
+	*response->last = '\0';
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_map_parallel_apply: mapping result %s", response->pos);
+
+	// apply the mapping
+	ctx->cur_clip = request->clip;
+
+	mapping.data = response->pos;
+	mapping.len = response->last - response->pos;
+	rc = ctx->mapping.apply(ctx, &mapping, &cache_index);
 	if (rc != NGX_OK)
 	{
 		return rc;
 	}
 
-	if (r->header_only || r->method == NGX_HTTP_HEAD)
+	// save to cache
+	cache = ctx->mapping.caches[cache_index];
+	if (cache != NULL)
 	{
-		return NGX_OK;
+		if (ngx_buffer_cache_store_perf(
+			ctx->perf_counters,
+			cache,
+			request->cache_key,
+			response->pos,
+			response->last - response->pos))
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_parallel_apply: stored in mapping cache");
+		}
+		else
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_parallel_apply: failed to store mapping in cache");
+		}
 	}
 
-	ngx_file_reader_enable_directio(state);		// ignore errors
-
-	return ngx_file_reader_dump_file_part(state, 0, 0);
+	return NGX_OK;
 }
 
-////// Remote & mapped modes
-
-static ngx_int_t
-ngx_http_vod_async_http_read(ngx_http_vod_http_reader_state_t *state, ngx_buf_t *buf, size_t size, off_t offset)
-{
-	ngx_http_vod_ctx_t *ctx;
-	ngx_child_request_params_t child_params;
-
-	ctx = ngx_http_get_module_ctx(state->r, ngx_http_vod_module);
-
-	ngx_memzero(&child_params, sizeof(child_params));
-	child_params.method = NGX_HTTP_GET;
-	child_params.base_uri = state->cur_remote_suburi;
-	child_params.extra_args = ctx->upstream_extra_args;
-	child_params.range_start = offset;
-	child_params.range_end = offset + size;
-
-	return ngx_child_request_start(
-		state->r,
-		ngx_http_vod_handle_read_completed,
-		ctx,
-		&state->upstream_location,
-		&child_params,
-		buf);
-}
+static void ngx_http_vod_map_parallel_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
 
 static ngx_int_t
-ngx_http_vod_dump_http_part(void* context, off_t start, off_t end)
+ngx_http_vod_map_parallel_start_requests(ngx_http_vod_ctx_t *ctx)
 {
-	ngx_http_vod_http_reader_state_t *state = context;
+	ngx_http_vod_http_reader_state_t* state;
+	ngx_http_vod_mapping_request_t* request;
 	ngx_child_request_params_t child_params;
-	ngx_http_request_t* r = state->r;
-	ngx_http_vod_ctx_t *ctx;
-
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
-
-	ngx_memzero(&child_params, sizeof(child_params));
-	child_params.method = NGX_HTTP_GET;
-	child_params.base_uri = state->cur_remote_suburi;
-	child_params.extra_args = ctx->upstream_extra_args;
-	child_params.range_start = start;
-	child_params.range_end = end;
+	ngx_int_t rc;
 
-	return ngx_child_request_start(
-		r,
-		ngx_http_vod_handle_read_completed,
-		ctx,
-		&state->upstream_location,
-		&child_params,
-		NULL);
-}
+	while (ctx->mapping.pending_requests < ctx->submodule_context.conf->max_mapping_concurrency &&
+		ctx->mapping.next_request < ctx->mapping.requests_end)
+	{
+		request = ctx->mapping.next_request++;
+		state = request->reader_context;
+		if (state == NULL)
+		{
+			continue;		// fetched from cache
+		}
 
-static ngx_int_t
-ngx_http_vod_dump_http_request(void* context)
-{
-	ngx_http_vod_http_reader_state_t* state = context;
-	ngx_child_request_params_t child_params;
-	ngx_http_request_t* r = state->r;
-	ngx_http_vod_ctx_t *ctx;
+		ngx_memzero(&child_params, sizeof(child_params));
+		child_params.method = NGX_HTTP_GET;
+		child_params.base_uri = state->cur_remote_suburi;
+		child_params.extra_args = ctx->upstream_extra_args;
+		child_params.range_start = 0;
+		child_params.range_end = ctx->mapping.max_response_size;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+		rc = ngx_child_request_start(
+			ctx->submodule_context.r,
+			ngx_http_vod_map_parallel_read_completed,
+			request,
+			&state->upstream_location,
+			&child_params,
+			&request->read_buffer);
+		if (rc != NGX_AGAIN)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_parallel_start_requests: ngx_child_request_start failed %i", rc);
+			return rc;
+		}
 
-	ngx_memzero(&child_params, sizeof(child_params));
-	child_params.method = r->method;
-	child_params.base_uri = state->cur_remote_suburi;
-	child_params.extra_args = ctx->upstream_extra_args;
-	child_params.proxy_range = 1;
-	child_params.proxy_all_headers = 1;
+		ctx->mapping.pending_requests++;
+	}
 
-	return ngx_child_request_start(
-		r,
-		NULL,
-		NULL,
-		&state->upstream_location,
-		&child_params,
-		NULL);
+	return NGX_OK;
 }
 
-static ngx_int_t
-ngx_http_vod_http_reader_open_file(ngx_http_request_t* r, ngx_str_t* path, uint32_t flags, void** context)
+static void
+ngx_http_vod_map_parallel_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read)
 {
-	ngx_http_vod_http_reader_state_t* state;
-	ngx_http_vod_ctx_t *ctx;
+	ngx_http_vod_mapping_request_t* request = context;
+	ngx_http_vod_ctx_t *ctx = request->ctx;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	ctx->mapping.pending_requests--;
 
-	// initialize the upstream variables
-	if (ctx->upstream_extra_args.len == 0 &&
-		ctx->submodule_context.conf->upstream_extra_args != NULL)
+	// Note: after a failure, the responses of the pending requests are ignored
+	if (ctx->mapping.requests_rc == NGX_OK)
 	{
-		if (ngx_http_complex_value(
-			ctx->submodule_context.r,
-			ctx->submodule_context.conf->upstream_extra_args,
-			&ctx->upstream_extra_args) != NGX_OK)
+		if (rc != NGX_OK)
 		{
-			return NGX_ERROR;
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_parallel_read_completed: read failed %i", rc);
+		}
+		else
+		{
+			if (buf != NULL)
+			{
+				request->read_buffer = *buf;
+			}
+
+			rc = ngx_http_vod_map_parallel_apply(ctx, request);
+			if (rc == NGX_OK)
+			{
+				rc = ngx_http_vod_map_parallel_start_requests(ctx);
+			}
 		}
+
+		ctx->mapping.requests_rc = rc;
 	}
 
-	state = ngx_palloc(r->pool, sizeof(*state));
-	if (state == NULL)
+	if (ctx->mapping.pending_requests > 0)
 	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_http_reader_open_file: ngx_palloc failed");
-		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+		return;
 	}
 
-	// Note: for http, no need to open any files, just save the remote uri
-	state->r = r;
-	state->cur_remote_suburi = *path;
-	if (ctx->state == STATE_MAP_OPEN || ctx->submodule_context.conf->remote_upstream_location.len == 0)
+	rc = ctx->mapping.requests_rc;
+	if (rc != NGX_OK)
 	{
-		state->upstream_location = ctx->submodule_context.conf->upstream_location;
+		goto finalize_request;
 	}
-	else
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_MAP_PATH);
+
+	ctx->cur_clip = NULL;
+
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
 	{
-		state->upstream_location = ctx->submodule_context.conf->remote_upstream_location;
+		return;
 	}
-	*context = state;
 
-	return NGX_OK;
-}
-
-static void	
-ngx_http_vod_http_reader_get_path(void* context, ngx_str_t* path)
-{
-	ngx_http_vod_http_reader_state_t* ctx = context;
+finalize_request:
 
-	*path = ctx->cur_remote_suburi;
+	ngx_http_vod_finalize_request(ctx, rc);
 }
 
-////// Local mode only
-
-ngx_int_t
-ngx_http_vod_local_request_handler(ngx_http_request_t *r)
+// maps all the clips of a list, the cache is checked for all the clips at once, and the mapping requests of
+// the clips that were not found are sent in parallel. once all the clips are mapped, ctx->state_machine is called.
+// returns NGX_DECLINED when the clips should be mapped one by one
+static ngx_int_t
+ngx_http_vod_map_parallel_start(
+	ngx_http_vod_ctx_t *ctx,
+	media_clip_t* first_clip,
+	ngx_http_vod_mapping_next_clip_t get_next)
 {
-	ngx_http_vod_ctx_t *ctx;
+	ngx_http_vod_mapping_request_t* requests;
+	ngx_http_vod_mapping_request_t* request;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	media_clip_t* cur_clip;
+	ngx_str_t* buffers;
+	ngx_uint_t count;
+	ngx_uint_t i;
 	ngx_int_t rc;
+	u_char** keys;
+	int cache_index;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
-
-	// map all uris to paths
-	rc = ngx_http_vod_map_uris_to_paths(ctx);
-	if (rc != NGX_OK)
+	if (ctx->submodule_context.conf->max_mapping_concurrency <= 1 || ctx->reader != &reader_http)
 	{
-		return rc;
+		return NGX_DECLINED;
 	}
 
-	// initialize for reading files
-	ctx->reader = &reader_file_with_fallback;
-	ctx->read = (ngx_http_vod_async_read_func_t)ngx_async_file_read;
-	ctx->alloc_params_index = READER_FILE;
-	ctx->alignment = ctx->alloc_params[READER_FILE].alignment;
-	ctx->perf_counter_async_read = PC_ASYNC_READ_FILE;
-
-	// start the state machine
-	rc = ngx_http_vod_start_processing_media_file(ctx);
-	if (rc != NGX_AGAIN && rc != NGX_DONE && rc != NGX_OK)
+	count = 0;
+	for (cur_clip = first_clip; cur_clip != NULL; cur_clip = get_next(cur_clip))
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_local_request_handler: ngx_http_vod_start_processing_media_file failed %i", rc);
+		count++;
 	}
 
-	return rc;
-}
+	if (count <= 1)
+	{
+		return NGX_DECLINED;
+	}
 
-////// Mapped mode only
+	requests = ngx_palloc(r->pool, (sizeof(requests[0]) + sizeof(keys[0]) + sizeof(buffers[0])) * count);
+	if (requests == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_parallel_start: ngx_palloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
 
-static ngx_int_t
-ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
-{
-	ngx_buffer_cache_t* cache;
-	ngx_buf_t* response;
-	ngx_str_t* prefix;
-	ngx_str_t mapping;
-	ngx_str_t uri;
-	ngx_md5_t md5;
-	ngx_int_t rc;
-	size_t read_size;
-	int cache_index;
+	keys = (u_char**)(requests + count);
+	buffers = (ngx_str_t*)(keys + count);
 
-	switch (ctx->state)
+	// get the uris
+	request = requests;
+	for (cur_clip = first_clip; cur_clip != NULL; cur_clip = get_next(cur_clip), request++)
 	{
-	case STATE_MAP_INITIAL:
-		// get the uri
-		rc = ctx->mapping.get_uri(ctx, &uri);
+		request->ctx = ctx;
+		request->clip = cur_clip;
+		request->reader_context = NULL;
+
+		ctx->cur_clip = cur_clip;
+		rc = ctx->mapping.get_uri(ctx, &request->uri);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
 
-		// calculate the cache key
-		prefix = ctx->mapping.cache_key_prefix;
-		ngx_md5_init(&md5);
-		if (prefix != NULL)
-		{
-			ngx_md5_update(&md5, prefix->data, prefix->len);
-		}
-		ngx_md5_update(&md5, uri.data, uri.len);
-		ngx_md5_final(ctx->mapping.cache_key, &md5);
+		ngx_http_vod_map_get_cache_key(ctx, &request->uri, request->cache_key);
+	}
 
-		// try getting the mapping from cache
-		if (ngx_buffer_cache_fetch_multi_perf(
-			ctx->perf_counters,
-			ctx->mapping.caches,
-			ctx->mapping.cache_count,
-			ctx->mapping.cache_key,
-			&mapping) >= 0)
+	// try getting the mappings from cache
+	for (i = 0; i < count; i++)
+	{
+		keys[i] = requests[i].cache_key;
+		buffers[i].data = NULL;
+		buffers[i].len = 0;
+	}
+
+	ngx_buffer_cache_fetch_batch_perf(
+		ctx->perf_counters,
+		ctx->mapping.caches,
+		ctx->mapping.cache_count,
+		keys,
+		buffers,
+		count);
+
+	ctx->submodule_context.request_context.log->action = "getting mapping";
+
+	for (i = 0; i < count; i++)
+	{
+		request = &requests[i];
+
+		if (buffers[i].data != NULL)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_map_run_step: mapping cache hit %V", &mapping);
+				"ngx_http_vod_map_parallel_start: mapping cache hit %V", &buffers[i]);
 
-			rc = ctx->mapping.apply(ctx, &mapping, &cache_index);
+			ctx->cur_clip = request->clip;
+			rc = ctx->mapping.apply(ctx, &buffers[i], &cache_index);
 			if (rc != NGX_OK)
 			{
 				return rc;
 			}
 
-			break;
-		}
-		else
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_map_run_step: mapping cache miss");
+			continue;
 		}
 
-		// open the mapping file
-		ctx->submodule_context.request_context.log->action = "getting mapping";
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_parallel_start: mapping cache miss");
 
+		// Note: the state is used by the http reader to choose the upstream location
 		ctx->state = STATE_MAP_OPEN;
 
-		rc = ctx->reader->open(ctx->submodule_context.r, &uri, OPEN_FILE_NO_CACHE, &ctx->mapping.reader_context);
-		if (rc != NGX_OK)
-		{
-			if (rc != NGX_AGAIN && rc != NGX_DONE)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: open_file failed %i", rc);
-			}
-			return rc;
-		}
-
-		// fallthrough
-
-	case STATE_MAP_OPEN:
+		rc = ctx->reader->open(r, &request->uri, OPEN_FILE_NO_CACHE, &request->reader_context);
 
-		if (ctx->reader->get_size != NULL)
-		{
-			read_size = ctx->reader->get_size(ctx->mapping.reader_context);
-			if (read_size <= 0)
-			{
-				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: empty mapping response");
-				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_EMPTY_MAPPING);
-			}
-			else if (read_size > ctx->mapping.max_response_size)
-			{
-				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: mapping size %uz greater than limit %uz", 
-					read_size, ctx->mapping.max_response_size);
-				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_MAPPING);
-			}
-		}
-		else
-		{
-			read_size = ctx->mapping.max_response_size;
-		}
+		ctx->state = STATE_MAP_INITIAL;
 
-		rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
 		if (rc != NGX_OK)
 		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_map_parallel_start: open_file failed %i", rc);
 			return rc;
 		}
 
-		// read the mapping
-		ctx->state = STATE_MAP_READ;
-		ngx_perf_counter_start(ctx->perf_counter_context);
+		// allocate a dedicated buffer for the request
+		ctx->read_buffer.start = NULL;
 
-		rc = ctx->read(ctx->mapping.reader_context, &ctx->read_buffer, read_size, 0);
+		rc = ngx_http_vod_alloc_read_buffer(ctx, ctx->mapping.max_response_size, ctx->alloc_params_index);
 		if (rc != NGX_OK)
 		{
-			if (rc != NGX_AGAIN)
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: async_read failed %i", rc);
-			}
 			return rc;
 		}
 
-		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_MAP_PATH);
-
-		// fallthrough
-
-	case STATE_MAP_READ:
-
-		response = &ctx->read_buffer;
-
-		if (response->last == response->pos)
-		{
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_map_run_step: empty mapping response");
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_EMPTY_MAPPING);
-		}
-
-		// apply the mapping
-		if (response->last >= response->end)
-		{
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_map_run_step: not enough room in buffer for null terminator");
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_MAPPING);
-		}
+		request->read_buffer = ctx->read_buffer;
+	}
 
-		*response->last = '\0';
+	// start the mapping requests
+	ctx->mapping.next_request = requests;
+	ctx->mapping.requests_end = requests + count;
+	ctx->mapping.pending_requests = 0;
+	ctx->mapping.requests_rc = NGX_OK;
 
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_map_run_step: mapping result %s", response->pos);
+	ngx_perf_counter_start(ctx->perf_counter_context);
 
-		mapping.data = response->pos;
-		mapping.len = response->last - response->pos;
-		rc = ctx->mapping.apply(ctx, &mapping, &cache_index);
-		if (rc != NGX_OK)
+	rc = ngx_http_vod_map_parallel_start_requests(ctx);
+	if (rc != NGX_OK)
+	{
+		if (ctx->mapping.pending_requests <= 0)
 		{
 			return rc;
 		}
 
-		// save to cache
-		cache = ctx->mapping.caches[cache_index];
-		if (cache != NULL)
-		{
-			if (ngx_buffer_cache_store_perf(
-				ctx->perf_counters,
-				cache,
-				ctx->mapping.cache_key,
-				response->pos,
-				response->last - response->pos))
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: stored in mapping cache");
-			}
-			else
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_map_run_step: failed to store mapping in cache");
-			}
-		}
-
-		ctx->state = STATE_MAP_INITIAL;
-		break;
+		// wait for the requests that were already started
+		ctx->mapping.requests_rc = rc;
+		return NGX_AGAIN;
+	}
 
-	default:
-		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_map_run_step: invalid state %d", ctx->state);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+	if (ctx->mapping.pending_requests > 0)
+	{
+		return NGX_AGAIN;
 	}
 
+	ctx->cur_clip = NULL;
+
 	return NGX_OK;
 }
 
@@ -4452,6 +7293,31 @@ ngx_http_vod_map_source_clip_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping,
 	return NGX_OK;
 }
 
+static media_clip_t*
+ngx_http_vod_map_source_clip_next(media_clip_t* clip)
+{
+	media_clip_source_t* next = ((media_clip_source_t*)clip)->next;
+
+	return next != NULL ? &next->base : NULL;
+}
+
+static ngx_int_t
+ngx_http_vod_map_source_clip_merge(ngx_http_vod_ctx_t *ctx)
+{
+	media_clip_source_t* last_clip;
+
+	// merge the mapped sources list with the sources list
+	for (last_clip = ctx->submodule_context.media_set.mapped_sources_head;
+		last_clip->next != NULL;
+		last_clip = last_clip->next);
+
+	last_clip->next = ctx->submodule_context.media_set.sources_head;
+	ctx->submodule_context.media_set.sources_head = ctx->submodule_context.media_set.mapped_sources_head;
+	ctx->cur_clip = NULL;
+
+	return ngx_http_vod_map_source_clip_done(ctx);
+}
+
 static ngx_int_t
 ngx_http_vod_map_source_clip_state_machine(ngx_http_vod_ctx_t *ctx)
 {
@@ -4476,18 +7342,14 @@ ngx_http_vod_map_source_clip_state_machine(ngx_http_vod_ctx_t *ctx)
 		ctx->cur_clip = &cur_clip->next->base;
 	}
 
-	// merge the mapped sources list with the sources list
-	cur_clip->next = ctx->submodule_context.media_set.sources_head;
-	ctx->submodule_context.media_set.sources_head = ctx->submodule_context.media_set.mapped_sources_head;
-	ctx->cur_clip = NULL;
-
-	return ngx_http_vod_map_source_clip_done(ctx);
+	return ngx_http_vod_map_source_clip_merge(ctx);
 }
 
 static ngx_int_t
 ngx_http_vod_map_source_clip_start(ngx_http_vod_ctx_t *ctx)
 {
 	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_int_t rc;
 
 	if (conf->source_clip_map_uri == NULL)
 	{
@@ -4501,6 +7363,22 @@ ngx_http_vod_map_source_clip_start(ngx_http_vod_ctx_t *ctx)
 	ctx->mapping.get_uri = ngx_http_vod_map_source_clip_get_uri;
 	ctx->mapping.apply = ngx_http_vod_map_source_clip_apply;
 
+	ctx->state_machine = ngx_http_vod_map_source_clip_merge;
+
+	rc = ngx_http_vod_map_parallel_start(
+		ctx,
+		&ctx->submodule_context.media_set.mapped_sources_head->base,
+		ngx_http_vod_map_source_clip_next);
+	if (rc != NGX_DECLINED)
+	{
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		return ngx_http_vod_map_source_clip_merge(ctx);
+	}
+
 	ctx->cur_clip = &ctx->submodule_context.media_set.mapped_sources_head->base;
 	ctx->state_machine = ngx_http_vod_map_source_clip_state_machine;
 
@@ -4649,6 +7527,14 @@ ngx_http_vod_map_dynamic_clip_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping,
 	return NGX_OK;
 }
 
+static media_clip_t*
+ngx_http_vod_map_dynamic_clip_next(media_clip_t* clip)
+{
+	media_clip_dynamic_t* next = ((media_clip_dynamic_t*)clip)->next;
+
+	return next != NULL ? &next->base : NULL;
+}
+
 static ngx_int_t
 ngx_http_vod_map_dynamic_clip_state_machine(ngx_http_vod_ctx_t *ctx)
 {
@@ -4673,6 +7559,7 @@ static ngx_int_t
 ngx_http_vod_map_dynamic_clip_start(ngx_http_vod_ctx_t *ctx)
 {
 	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_int_t rc;
 
 	// map the dynamic clips by calling the upstream
 	if (conf->dynamic_clip_map_uri == NULL)
@@ -4687,6 +7574,22 @@ ngx_http_vod_map_dynamic_clip_start(ngx_http_vod_ctx_t *ctx)
 	ctx->mapping.get_uri = ngx_http_vod_map_dynamic_clip_get_uri;
 	ctx->mapping.apply = ngx_http_vod_map_dynamic_clip_apply;
 
+	ctx->state_machine = ngx_http_vod_map_dynamic_clip_done;
+
+	rc = ngx_http_vod_map_parallel_start(
+		ctx,
+		&ctx->submodule_context.media_set.dynamic_clips_head->base,
+		ngx_http_vod_map_dynamic_clip_next);
+	if (rc != NGX_DECLINED)
+	{
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		return ngx_http_vod_map_dynamic_clip_done(ctx);
+	}
+
 	ctx->cur_clip = &ctx->submodule_context.media_set.dynamic_clips_head->base;
 	ctx->state_machine = ngx_http_vod_map_dynamic_clip_state_machine;
 
@@ -5219,11 +8122,9 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 	ngx_http_core_loc_conf_t *clcf;
 	ngx_http_vod_loc_conf_t *conf;
 	u_char request_key[BUFFER_CACHE_KEY_SIZE];
-	ngx_md5_t md5;
 	ngx_str_t cache_buffer;
 	ngx_str_t content_type;
 	ngx_str_t response;
-	ngx_str_t base_url;
 	ngx_int_t rc;
 	int cache_type;
 #if (NGX_DEBUG)
@@ -5316,30 +8217,11 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 		request->handle_metadata_request != NULL)
 	{
 		// calc request key from host + uri
-		ngx_md5_init(&md5);
-
-		base_url.len = 0;
-		rc = ngx_http_vod_get_base_url(r, conf->base_url, &empty_string, &base_url);
+		rc = ngx_http_vod_get_request_key(r, conf, &r->uri, request_key);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
-		ngx_md5_update(&md5, base_url.data, base_url.len);
-
-		if (conf->segments_base_url != NULL)
-		{
-			base_url.len = 0;
-			rc = ngx_http_vod_get_base_url(r, conf->segments_base_url, &empty_string, &base_url);
-			if (rc != NGX_OK)
-			{
-				return rc;
-			}
-			ngx_md5_update(&md5, base_url.data, base_url.len);
-		}
-
-		ngx_md5_update(&md5, r->uri.data, r->uri.len);
-
-		ngx_md5_final(request_key, &md5);
 
 		// try to fetch from cache
 		cache_type = ngx_buffer_cache_fetch_copy_perf(
@@ -5413,8 +8295,18 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 	ctx->submodule_context.request_context.pool = r->pool;
 	ctx->submodule_context.request_context.log = r->connection->log;
 	ctx->submodule_context.request_context.output_buffer_pool = conf->output_buffer_pool;
+#if (NGX_THREADS)
+	if (conf->processing_thread_pool != NULL)
+	{
+		// Note: the free list of the buffer pool is not thread safe, the frames of this request may be processed 
+		//	on a thread pool while the buffers of other requests are returned on the event loop
+		ctx->submodule_context.request_context.output_buffer_pool = NULL;
+	}
+#endif // NGX_THREADS
 	ctx->perf_counters = perf_counters;
 	ngx_perf_counter_copy(ctx->total_perf_counter_context, pcctx);
+	ctx->read_predictor = ngx_read_predictor_get_state(conf->read_predictor_zone);
+	ctx->read_predictor_type = NGX_READ_PREDICTOR_COUNT;
 
 #if (NGX_DEBUG)
 	// in debug builds allow overriding the server time
@@ -71,6 +71,16 @@ static ngx_http_vod_cache_info_t cache_infos[] = {
 		ngx_string("<live_response_cache>\r\n"),
 		ngx_string("</live_response_cache>\r\n"),
 	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, generated_cache),
+		ngx_string("<generated_cache>\r\n"),
+		ngx_string("</generated_cache>\r\n"),
+	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, filtered_audio_cache),
+		ngx_string("<filtered_audio_cache>\r\n"),
+		ngx_string("</filtered_audio_cache>\r\n"),
+	},
 	{
 		offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_VOD]),
 		ngx_string("<mapping_cache>\r\n"),
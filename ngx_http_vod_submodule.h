@@ -47,6 +47,12 @@ typedef struct {
 	request_params_t request_params;
 	ngx_http_request_t* r;
 	struct ngx_http_vod_loc_conf_s* conf;
+
+	// when the response is built on a thread pool, the values that require evaluating complex values
+	//	are computed on the event loop in advance (ngx_http_complex_value is not thread safe)
+	ngx_flag_t offloaded;
+	ngx_str_t uri_base_url;			// the base url of the request uri
+	u_char* uri_request_key;		// the request key of the request uri
 } ngx_http_vod_submodule_context_t;
 
 // submodule request
@@ -110,4 +116,25 @@ typedef struct {
 // globals
 extern const ngx_http_vod_submodule_t* submodules[];
 
+// functions
+ngx_int_t ngx_http_vod_store_related_response(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* content_type,
+	ngx_str_t* response);
+
+// metadata that is derived from a response (e.g. the size of a segment) is cached in the metadata cache, 
+// the key is built from the uri of the response, the file keys of the media set and the params
+ngx_flag_t ngx_http_vod_related_metadata_fetch(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* params,
+	ngx_str_t* buffer);
+
+void ngx_http_vod_related_metadata_store(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* uri,
+	ngx_str_t* params,
+	ngx_str_t* buffer);
+
 #endif // _NGX_HTTP_VOD_SUBMODULE_H_INCLUDED_
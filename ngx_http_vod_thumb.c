@@ -7,6 +7,12 @@
 
 #define THUMB_TIMESCALE (1000)
 
+#define SPRITE_VTT_HEADER "WEBVTT\n\n"
+#define SPRITE_VTT_TIMESTAMP_FORMAT "%02uD:%02uD:%02uD.%03uD"
+#define SPRITE_VTT_TIMESTAMP_DELIM " --> "
+#define SPRITE_VTT_TIMESTAMP_MAX_SIZE (VOD_INT32_LEN + sizeof(":00:00.000") - 1)
+#define SPRITE_VTT_TILE_FORMAT "#xywh=%uD,%uD,%uD,%uD\n\n"
+
 // macros
 #define skip_dash(start_pos, end_pos)	\
 	if (start_pos >= end_pos)			\
@@ -24,6 +30,10 @@
 
 static const u_char jpg_file_ext[] = ".jpg";
 static u_char jpeg_content_type[] = "image/jpeg";
+#if (NGX_HAVE_LIB_SW_SCALE)
+static const u_char vtt_file_ext[] = ".vtt";
+static u_char vtt_content_type[] = "text/vtt";
+#endif // NGX_HAVE_LIB_SW_SCALE
 
 ngx_int_t 
 ngx_http_vod_thumb_get_url(
@@ -126,6 +136,9 @@ ngx_http_vod_thumb_init_frame_processor(
 		submodule_context->media_set.filtered_tracks,
 		&submodule_context->request_params,
 		submodule_context->conf->thumb.accurate,
+		submodule_context->conf->thumb.fast_decode,
+		submodule_context->conf->thumb.decoder_threads,
+		submodule_context->conf->thumb.max_decoder_threads,
 		segment_writer->write_tail,
 		segment_writer->context,
 		frame_processor_state);
@@ -145,7 +158,7 @@ ngx_http_vod_thumb_init_frame_processor(
 }
 
 static const ngx_http_vod_request_t thumb_request = {
-	REQUEST_FLAG_SINGLE_TRACK,
+	REQUEST_FLAG_SINGLE_TRACK | REQUEST_FLAG_CACHE_GENERATED,
 	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_EXTRA_DATA,
 	REQUEST_CLASS_THUMB,
 	VOD_CODEC_FLAG(AVC) | VOD_CODEC_FLAG(HEVC) | VOD_CODEC_FLAG(VP8) | VOD_CODEC_FLAG(VP9),
@@ -154,12 +167,266 @@ static const ngx_http_vod_request_t thumb_request = {
 	ngx_http_vod_thumb_init_frame_processor,
 };
 
+#if (NGX_HAVE_LIB_SW_SCALE)
+static ngx_int_t
+ngx_http_vod_thumb_init_sprite_frame_processor(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	segment_writer_t* segment_writer,
+	ngx_http_vod_frame_processor_t* frame_processor,
+	void** frame_processor_state,
+	ngx_str_t* output_buffer,
+	size_t* response_size,
+	ngx_str_t* content_type)
+{
+	ngx_http_vod_thumb_loc_conf_t* conf = &submodule_context->conf->thumb;
+	vod_status_t rc;
+
+	rc = thumb_grabber_init_sprite_state(
+		&submodule_context->request_context,
+		submodule_context->media_set.filtered_tracks,
+		&submodule_context->request_params,
+		conf->sprite_columns,
+		conf->sprite_rows,
+		conf->sprite_interval,
+		conf->fast_decode,
+		conf->decoder_threads,
+		conf->max_decoder_threads,
+		segment_writer->write_tail,
+		segment_writer->context,
+		frame_processor_state);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_init_sprite_frame_processor: thumb_grabber_init_sprite_state failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
+	}
+
+	*frame_processor = (ngx_http_vod_frame_processor_t)thumb_grabber_process_sprite;
+
+	content_type->len = sizeof(jpeg_content_type) - 1;
+	content_type->data = (u_char *)jpeg_content_type;
+
+	return NGX_OK;
+}
+
+static u_char*
+ngx_http_vod_thumb_write_vtt_timestamp(u_char* p, uint64_t timestamp)
+{
+	return vod_sprintf(p, SPRITE_VTT_TIMESTAMP_FORMAT,
+		(uint32_t)(timestamp / 3600000),
+		(uint32_t)((timestamp / 60000) % 60),
+		(uint32_t)((timestamp / 1000) % 60),
+		(uint32_t)(timestamp % 1000));
+}
+
+static ngx_int_t
+ngx_http_vod_thumb_handle_sprite_vtt(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_str_t* response,
+	ngx_str_t* content_type)
+{
+	ngx_http_vod_thumb_loc_conf_t* conf = &submodule_context->conf->thumb;
+	request_params_t* request_params = &submodule_context->request_params;
+	media_set_t* media_set = &submodule_context->media_set;
+	ngx_http_request_t* r = submodule_context->r;
+	ngx_str_t request_params_str;
+	ngx_str_t base_url = ngx_null_string;
+	vod_status_t rc;
+	media_clip_timing_t* timing = &media_set->timing;
+	uint64_t clip_start;
+	uint64_t clip_end;
+	uint64_t tile_time;
+	uint32_t tiles_per_sprite = conf->sprite_columns * conf->sprite_rows;
+	uint32_t sprite_duration = conf->sprite_interval * tiles_per_sprite;
+	uint32_t sprite_index;
+	uint32_t clip_duration;
+	uint32_t clip_count;
+	uint32_t clip_index;
+	uint32_t cue_count;
+	uint32_t tile_index;
+	uint32_t tile_width;
+	uint32_t tile_height;
+	uint32_t tile;
+	size_t result_size;
+	size_t cue_size;
+	u_char* p;
+
+	if (media_set->type != MEDIA_SET_VOD)
+	{
+		ngx_log_error(NGX_LOG_ERR, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: sprites are supported only for vod media sets");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+	}
+
+	rc = thumb_grabber_get_sprite_tile_size(
+		&submodule_context->request_context,
+		&media_set->filtered_tracks->media_info,
+		request_params,
+		conf->sprite_columns,
+		conf->sprite_rows,
+		&tile_width,
+		&tile_height);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: thumb_grabber_get_sprite_tile_size failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(r, rc);
+	}
+
+	// get the base url
+	rc = ngx_http_vod_get_base_url(
+		r,
+		submodule_context->conf->segments_base_url != NULL ? submodule_context->conf->segments_base_url : submodule_context->conf->base_url,
+		&r->uri,
+		&base_url);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: ngx_http_vod_get_base_url failed %i", rc);
+		return rc;
+	}
+
+	// get the request params string
+	rc = manifest_utils_build_request_params_string(
+		&submodule_context->request_context,
+		request_params->tracks_mask,
+		INVALID_SEGMENT_INDEX,
+		request_params->sequences_mask,
+		NULL,
+		NULL,
+		request_params->tracks_mask,
+		&request_params_str);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: manifest_utils_build_request_params_string failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(r, rc);
+	}
+
+	// get the result size
+	cue_size = SPRITE_VTT_TIMESTAMP_MAX_SIZE * 2 + sizeof(SPRITE_VTT_TIMESTAMP_DELIM) - 1 + 1 +
+		base_url.len + conf->sprite_file_name_prefix.len + sizeof("-%uD-w%uD-h%uD") - 1 + 3 * VOD_INT32_LEN +
+		request_params_str.len + sizeof(jpg_file_ext) - 1 +
+		sizeof(SPRITE_VTT_TILE_FORMAT) - 1 + 4 * VOD_INT32_LEN;
+
+	// Note: the sprites restart at the beginning of each clip, so that a sprite never crosses a clip boundary
+	//	(see segmenter_get_sprite_start_time)
+	clip_count = timing->durations != NULL ? timing->total_count : 1;
+
+	cue_count = 0;
+	for (clip_index = 0; clip_index < clip_count; clip_index++)
+	{
+		clip_duration = timing->durations != NULL ? timing->durations[clip_index] : (uint32_t)timing->total_duration;
+		cue_count += vod_div_ceil(clip_duration, conf->sprite_interval);
+	}
+
+	result_size = sizeof(SPRITE_VTT_HEADER) - 1 + cue_count * cue_size;
+
+	// allocate the result buffer
+	p = ngx_pnalloc(submodule_context->request_context.pool, result_size);
+	if (p == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: ngx_pnalloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+	}
+
+	response->data = p;
+
+	// write the result
+	p = ngx_copy(p, SPRITE_VTT_HEADER, sizeof(SPRITE_VTT_HEADER) - 1);
+
+	clip_start = 0;
+	sprite_index = 0;
+	for (clip_index = 0; clip_index < clip_count; clip_index++)
+	{
+		clip_duration = timing->durations != NULL ? timing->durations[clip_index] : (uint32_t)timing->total_duration;
+		clip_end = clip_start + clip_duration;
+
+		for (tile_index = 0, tile_time = clip_start; tile_time < clip_end; tile_index++, tile_time += conf->sprite_interval)
+		{
+			p = ngx_http_vod_thumb_write_vtt_timestamp(p, tile_time);
+			p = ngx_copy(p, SPRITE_VTT_TIMESTAMP_DELIM, sizeof(SPRITE_VTT_TIMESTAMP_DELIM) - 1);
+			p = ngx_http_vod_thumb_write_vtt_timestamp(p, vod_min(tile_time + conf->sprite_interval, clip_end));
+			*p++ = '\n';
+
+			if (base_url.len != 0)
+			{
+				p = ngx_copy(p, base_url.data, base_url.len);
+			}
+
+			p = ngx_copy(p, conf->sprite_file_name_prefix.data, conf->sprite_file_name_prefix.len);
+			p = ngx_sprintf(p, "-%uD-w%uD-h%uD", sprite_index + tile_index / tiles_per_sprite, tile_width, tile_height);
+			p = ngx_copy(p, request_params_str.data, request_params_str.len);
+			p = ngx_copy(p, jpg_file_ext, sizeof(jpg_file_ext) - 1);
+
+			tile = tile_index % tiles_per_sprite;
+			p = ngx_sprintf(p, SPRITE_VTT_TILE_FORMAT,
+				(tile % conf->sprite_columns) * tile_width,
+				(tile / conf->sprite_columns) * tile_height,
+				tile_width,
+				tile_height);
+		}
+
+		sprite_index += vod_div_ceil(clip_duration, sprite_duration);
+		clip_start = clip_end;
+	}
+
+	response->len = p - response->data;
+
+	if (response->len > result_size)
+	{
+		ngx_log_error(NGX_LOG_ERR, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_handle_sprite_vtt: result length %uz exceeded allocated length %uz",
+			response->len, result_size);
+		return ngx_http_vod_status_to_ngx_error(r, VOD_UNEXPECTED);
+	}
+
+	content_type->len = sizeof(vtt_content_type) - 1;
+	content_type->data = (u_char *)vtt_content_type;
+
+	return NGX_OK;
+}
+
+static const ngx_http_vod_request_t sprite_request = {
+	REQUEST_FLAG_SINGLE_TRACK | REQUEST_FLAG_CACHE_GENERATED,
+	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_EXTRA_DATA,
+	REQUEST_CLASS_THUMB,
+	VOD_CODEC_FLAG(AVC) | VOD_CODEC_FLAG(HEVC) | VOD_CODEC_FLAG(VP8) | VOD_CODEC_FLAG(VP9),
+	THUMB_TIMESCALE,
+	NULL,
+	ngx_http_vod_thumb_init_sprite_frame_processor,
+};
+
+static const ngx_http_vod_request_t sprite_vtt_request = {
+	REQUEST_FLAG_SINGLE_TRACK,
+	PARSE_BASIC_METADATA_ONLY,
+	REQUEST_CLASS_MANIFEST,
+	VOD_CODEC_FLAG(AVC) | VOD_CODEC_FLAG(HEVC) | VOD_CODEC_FLAG(VP8) | VOD_CODEC_FLAG(VP9),
+	THUMB_TIMESCALE,
+	ngx_http_vod_thumb_handle_sprite_vtt,
+	NULL,
+};
+#endif // NGX_HAVE_LIB_SW_SCALE
+
 static void
 ngx_http_vod_thumb_create_loc_conf(
 	ngx_conf_t *cf,
 	ngx_http_vod_thumb_loc_conf_t *conf)
 {
 	conf->accurate = NGX_CONF_UNSET;
+	conf->fast_decode = NGX_CONF_UNSET;
+	conf->decoder_threads = NGX_CONF_UNSET_UINT;
+	conf->max_decoder_threads = NGX_CONF_UNSET_UINT;
+#if (NGX_THREADS)
+	conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif // NGX_THREADS
+#if (NGX_HAVE_LIB_SW_SCALE)
+	conf->sprite_interval = NGX_CONF_UNSET_UINT;
+	conf->sprite_columns = NGX_CONF_UNSET_UINT;
+	conf->sprite_rows = NGX_CONF_UNSET_UINT;
+	conf->sprite_tile_width = NGX_CONF_UNSET_UINT;
+#endif // NGX_HAVE_LIB_SW_SCALE
 }
 
 static char *
@@ -171,6 +438,33 @@ ngx_http_vod_thumb_merge_loc_conf(
 {
 	ngx_conf_merge_str_value(conf->file_name_prefix, prev->file_name_prefix, "thumb");
 	ngx_conf_merge_value(conf->accurate, prev->accurate, 1);
+	ngx_conf_merge_value(conf->fast_decode, prev->fast_decode, 0);
+	ngx_conf_merge_uint_value(conf->decoder_threads, prev->decoder_threads, 1);
+	ngx_conf_merge_uint_value(conf->max_decoder_threads, prev->max_decoder_threads, 16);
+#if (NGX_THREADS)
+	ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif // NGX_THREADS
+#if (NGX_HAVE_LIB_SW_SCALE)
+	ngx_conf_merge_str_value(conf->sprite_file_name_prefix, prev->sprite_file_name_prefix, "sprite");
+	ngx_conf_merge_uint_value(conf->sprite_interval, prev->sprite_interval, 10000);
+	ngx_conf_merge_uint_value(conf->sprite_columns, prev->sprite_columns, 5);
+	ngx_conf_merge_uint_value(conf->sprite_rows, prev->sprite_rows, 5);
+	ngx_conf_merge_uint_value(conf->sprite_tile_width, prev->sprite_tile_width, 160);
+
+	if (conf->sprite_interval <= 0 || conf->sprite_columns <= 0 || conf->sprite_rows <= 0)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"\"vod_thumb_sprite_interval\", \"vod_thumb_sprite_columns\" and \"vod_thumb_sprite_rows\" must be positive");
+		return NGX_CONF_ERROR;
+	}
+
+	if ((uint64_t)conf->sprite_interval * conf->sprite_columns * conf->sprite_rows > NGX_MAX_UINT32_VALUE)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"the duration of a sprite must not exceed %uD", NGX_MAX_UINT32_VALUE);
+		return NGX_CONF_ERROR;
+	}
+#endif // NGX_HAVE_LIB_SW_SCALE
 	return NGX_CONF_OK;
 }
 
@@ -220,6 +514,70 @@ ngx_http_vod_thumb_parse_dimensions(
 
 	return start_pos;
 }
+
+static ngx_int_t
+ngx_http_vod_thumb_parse_sprite_file_name(
+	ngx_http_request_t *r,
+	ngx_http_vod_loc_conf_t *conf,
+	u_char* start_pos,
+	u_char* end_pos,
+	bool_t has_index,
+	request_params_t* request_params)
+{
+	uint32_t sprite_index = 0;
+	ngx_int_t rc;
+
+	// parse the sprite index
+	if (has_index)
+	{
+		if (start_pos < end_pos && *start_pos == '-')
+		{
+			start_pos++;		// skip the -
+		}
+
+		if (start_pos >= end_pos || *start_pos < '0' || *start_pos > '9')
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_thumb_parse_sprite_file_name: failed to parse sprite index");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+		}
+
+		start_pos = parse_utils_extract_uint32_token(start_pos, end_pos, &sprite_index);
+	}
+
+	start_pos = ngx_http_vod_thumb_parse_dimensions(r, start_pos, end_pos, request_params);
+	if (start_pos == NULL)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_thumb_parse_sprite_file_name: failed to parse width/height");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+	}
+
+	// parse the required tracks string
+	rc = ngx_http_vod_parse_uri_file_name(r, start_pos, end_pos, 0, request_params);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_thumb_parse_sprite_file_name: ngx_http_vod_parse_uri_file_name failed %i", rc);
+		return rc;
+	}
+
+	if (request_params->width == 0 && request_params->height == 0)
+	{
+		request_params->width = conf->thumb.sprite_tile_width;
+	}
+
+	if (has_index)
+	{
+		request_params->sprite_duration = conf->thumb.sprite_interval * conf->thumb.sprite_columns * conf->thumb.sprite_rows;
+		request_params->segment_time = (int64_t)sprite_index * request_params->sprite_duration;
+	}
+
+	request_params->tracks_mask[MEDIA_TYPE_AUDIO] = 0;
+	request_params->tracks_mask[MEDIA_TYPE_SUBTITLE] = 0;
+
+	return NGX_OK;
+}
 #endif // NGX_HAVE_LIB_SW_SCALE
 
 static ngx_int_t
@@ -235,6 +593,26 @@ ngx_http_vod_thumb_parse_uri_file_name(
 	int64_t time;
 	ngx_int_t rc;
 
+#if (NGX_HAVE_LIB_SW_SCALE)
+	// sprite
+	if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->thumb.sprite_file_name_prefix, jpg_file_ext))
+	{
+		start_pos += conf->thumb.sprite_file_name_prefix.len;
+		end_pos -= (sizeof(jpg_file_ext) - 1);
+		*request = &sprite_request;
+		return ngx_http_vod_thumb_parse_sprite_file_name(r, conf, start_pos, end_pos, TRUE, request_params);
+	}
+
+	// sprite index
+	if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->thumb.sprite_file_name_prefix, vtt_file_ext))
+	{
+		start_pos += conf->thumb.sprite_file_name_prefix.len;
+		end_pos -= (sizeof(vtt_file_ext) - 1);
+		*request = &sprite_vtt_request;
+		return ngx_http_vod_thumb_parse_sprite_file_name(r, conf, start_pos, end_pos, FALSE, request_params);
+	}
+#endif // NGX_HAVE_LIB_SW_SCALE
+
 	if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->thumb.file_name_prefix, jpg_file_ext))
 	{
 		start_pos += conf->thumb.file_name_prefix.len;
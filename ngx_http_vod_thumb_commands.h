@@ -14,4 +14,71 @@
 	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, accurate),
 	NULL },
 
+	{ ngx_string("vod_thumb_fast_decode"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, fast_decode),
+	NULL },
+
+	{ ngx_string("vod_thumb_decoder_threads"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, decoder_threads),
+	NULL },
+
+	{ ngx_string("vod_thumb_max_decoder_threads"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, max_decoder_threads),
+	NULL },
+
+#if (NGX_THREADS)
+	{ ngx_string("vod_thumb_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, thread_pool),
+	NULL },
+#endif // NGX_THREADS
+
+#if (NGX_HAVE_LIB_SW_SCALE)
+	{ ngx_string("vod_thumb_sprite_file_name_prefix"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_str_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, sprite_file_name_prefix),
+	NULL },
+
+	{ ngx_string("vod_thumb_sprite_interval"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, sprite_interval),
+	NULL },
+
+	{ ngx_string("vod_thumb_sprite_columns"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, sprite_columns),
+	NULL },
+
+	{ ngx_string("vod_thumb_sprite_rows"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, sprite_rows),
+	NULL },
+
+	{ ngx_string("vod_thumb_sprite_tile_width"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, sprite_tile_width),
+	NULL },
+#endif // NGX_HAVE_LIB_SW_SCALE
+
 #undef BASE_OFFSET
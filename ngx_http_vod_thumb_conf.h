@@ -9,6 +9,19 @@ typedef struct
 {
 	ngx_str_t file_name_prefix;
 	ngx_flag_t accurate;
+	ngx_flag_t fast_decode;
+	ngx_uint_t decoder_threads;
+	ngx_uint_t max_decoder_threads;
+#if (NGX_THREADS)
+	ngx_thread_pool_t *thread_pool;
+#endif // NGX_THREADS
+#if (NGX_HAVE_LIB_SW_SCALE)
+	ngx_str_t sprite_file_name_prefix;
+	ngx_uint_t sprite_interval;
+	ngx_uint_t sprite_columns;
+	ngx_uint_t sprite_rows;
+	ngx_uint_t sprite_tile_width;
+#endif // NGX_HAVE_LIB_SW_SCALE
 } ngx_http_vod_thumb_loc_conf_t;
 
 #endif // _NGX_HTTP_VOD_THUMB_CONF_H_INCLUDED_
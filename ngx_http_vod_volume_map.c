@@ -45,7 +45,7 @@ ngx_http_vod_volume_map_init_frame_processor(
 }
 
 static const ngx_http_vod_request_t volume_map_request = {
-	REQUEST_FLAG_SINGLE_TRACK | REQUEST_FLAG_PARSE_ALL_CLIPS,
+	REQUEST_FLAG_SINGLE_TRACK | REQUEST_FLAG_PARSE_ALL_CLIPS | REQUEST_FLAG_CACHE_GENERATED,
 	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_EXTRA_DATA,
 	REQUEST_CLASS_OTHER,
 	VOD_CODEC_FLAG(AAC),
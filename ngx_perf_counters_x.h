@@ -11,4 +11,7 @@ PC(MEDIA_PARSE,				media_parse)
 PC(BUILD_MANIFEST,			build_manifest)
 PC(INIT_FRAME_PROCESS,		init_frame_processing)
 PC(PROCESS_FRAMES,			process_frames)
+PC(PROCESS_FRAMES_QUEUE,	process_frames_queue)
+PC(ASYNC_PROCESS_FRAMES,	async_process_frames)
+PC(AUDIO_FILTER,			audio_filter)
 PC(TOTAL,					total)
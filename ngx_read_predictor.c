@@ -0,0 +1,129 @@
+#include "ngx_read_predictor.h"
+
+#define LOG_CONTEXT_FORMAT " in read predictor \"%V\"%Z"
+
+// when the required size is smaller than the prediction, the prediction moves 1/8 of the way towards it
+#define NGX_READ_PREDICTOR_DECAY_SHIFT (3)
+
+static ngx_int_t
+ngx_read_predictor_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+	ngx_read_predictor_t *state;
+	ngx_slab_pool_t *shpool;
+	u_char* p;
+
+	if (data)
+	{
+		shm_zone->data = data;
+		return NGX_OK;
+	}
+
+	shpool = (ngx_slab_pool_t *)shm_zone->shm.addr;
+
+	if (shm_zone->shm.exists)
+	{
+		shm_zone->data = shpool->data;
+		return NGX_OK;
+	}
+
+	// start following the ngx_slab_pool_t that was allocated at the beginning of the chunk
+	p = shm_zone->shm.addr + sizeof(ngx_slab_pool_t);
+
+	// initialize the log context
+	shpool->log_ctx = p;
+	p = ngx_sprintf(shpool->log_ctx, LOG_CONTEXT_FORMAT, &shm_zone->shm.name);
+
+	// allocate the predictor state
+	state = (ngx_read_predictor_t*)ngx_align_ptr(p, sizeof(ngx_atomic_t));
+
+	ngx_memzero(state, sizeof(*state));
+
+	shpool->data = state;
+
+	return NGX_OK;
+}
+
+ngx_shm_zone_t*
+ngx_read_predictor_create_zone(ngx_conf_t *cf, ngx_str_t *name, void *tag)
+{
+	ngx_shm_zone_t* result;
+
+	result = ngx_shared_memory_add(cf, name, sizeof(ngx_slab_pool_t) + sizeof(LOG_CONTEXT_FORMAT) + name->len + 
+		sizeof(ngx_atomic_t) + sizeof(ngx_read_predictor_t), tag);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+
+	result->init = ngx_read_predictor_init;
+	return result;
+}
+
+uint32_t
+ngx_read_predictor_get_key(ngx_str_t* prefix, ngx_str_t* path)
+{
+	uint32_t key;
+	size_t dir_len;
+
+	// files in the same folder are expected to have a similar layout
+	for (dir_len = path->len; dir_len > 0; dir_len--)
+	{
+		if (path->data[dir_len - 1] == '/')
+		{
+			break;
+		}
+	}
+
+	ngx_crc32_init(key);
+	ngx_crc32_update(&key, prefix->data, prefix->len);
+	ngx_crc32_update(&key, path->data, dir_len);
+	ngx_crc32_final(key);
+
+	return key != 0 ? key : 1;		// zero marks an empty slot
+}
+
+size_t
+ngx_read_predictor_get(ngx_read_predictor_t* state, uint32_t key, ngx_uint_t type)
+{
+	ngx_read_predictor_slot_t* slot;
+
+	slot = &state->slots[key % NGX_READ_PREDICTOR_SLOTS];
+	if (slot->key != key)
+	{
+		return 0;
+	}
+
+	return slot->size[type];
+}
+
+// Note: the slots are updated without locking, concurrent updates may lose a sample or mix the values 
+//		of two keys that share a slot. this is acceptable since the values are only used as hints, 
+//		a wrong prediction results in an additional read or in reading more than required.
+void
+ngx_read_predictor_update(ngx_read_predictor_t* state, uint32_t key, ngx_uint_t type, size_t size)
+{
+	ngx_read_predictor_slot_t* slot;
+	size_t cur_size;
+	ngx_uint_t i;
+
+	slot = &state->slots[key % NGX_READ_PREDICTOR_SLOTS];
+
+	if (slot->key != key)
+	{
+		for (i = 0; i < NGX_READ_PREDICTOR_COUNT; i++)
+		{
+			slot->size[i] = 0;
+		}
+		slot->key = key;
+	}
+
+	cur_size = slot->size[type];
+	if (size >= cur_size)
+	{
+		slot->size[type] = size;
+	}
+	else
+	{
+		slot->size[type] = cur_size - ((cur_size - size) >> NGX_READ_PREDICTOR_DECAY_SHIFT);
+	}
+}
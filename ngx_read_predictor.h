@@ -0,0 +1,42 @@
+#ifndef _NGX_READ_PREDICTOR_H_INCLUDED_
+#define _NGX_READ_PREDICTOR_H_INCLUDED_
+
+// includes
+#include <ngx_core.h>
+
+// constants
+#define NGX_READ_PREDICTOR_SLOTS (4096)
+
+// macros
+#define ngx_read_predictor_get_state(shm_zone)						\
+	(shm_zone != NULL ? ((ngx_slab_pool_t *)shm_zone->shm.addr)->data : NULL)
+
+// typedefs
+enum {
+	NGX_READ_PREDICTOR_HEAD,		// the first read of the file (offset 0)
+	NGX_READ_PREDICTOR_PROBE,		// a read of unknown size at an offset determined by the format (e.g. moov at the end)
+
+	NGX_READ_PREDICTOR_COUNT
+};
+
+typedef struct {
+	ngx_atomic_t key;
+	ngx_atomic_t size[NGX_READ_PREDICTOR_COUNT];
+} ngx_read_predictor_slot_t;
+
+typedef struct {
+	ngx_read_predictor_slot_t slots[NGX_READ_PREDICTOR_SLOTS];
+} ngx_read_predictor_t;
+
+// functions
+ngx_shm_zone_t* ngx_read_predictor_create_zone(ngx_conf_t *cf, ngx_str_t *name, void *tag);
+
+uint32_t ngx_read_predictor_get_key(ngx_str_t* prefix, ngx_str_t* path);
+
+// returns the predicted size of a read, or zero if there is no prediction
+size_t ngx_read_predictor_get(ngx_read_predictor_t* state, uint32_t key, ngx_uint_t type);
+
+// updates the size that was required for a read
+void ngx_read_predictor_update(ngx_read_predictor_t* state, uint32_t key, ngx_uint_t type, size_t size);
+
+#endif // _NGX_READ_PREDICTOR_H_INCLUDED_
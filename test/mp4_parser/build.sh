@@ -0,0 +1,13 @@
+#!/bin/bash
+
+if [ -z "$NGX_ROOT" ]; then 
+	echo "NGX_ROOT not set"
+	exit 1
+fi
+
+if [ -z "$VOD_ROOT" ]; then 
+	echo "VOD_ROOT not set"
+	exit 1
+fi
+
+cc -Wall -O2 -DNGX_HAVE_X86_SIMD=1 -omp4parsertest $VOD_ROOT/vod/mp4/mp4_table_decoder.c $VOD_ROOT/test/mp4_parser/main.c -I $NGX_ROOT/src/core  -I $NGX_ROOT/src/event -I $NGX_ROOT/src/event/modules -I $NGX_ROOT/src/os/unix -I $NGX_ROOT/objs -I $VOD_ROOT
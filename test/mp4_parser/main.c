@@ -0,0 +1,275 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <ngx_core.h>
+#include <vod/mp4/mp4_table_decoder.h>
+#include <vod/mp4/mp4_defs.h>
+#include <vod/read_stream.h>
+
+#define ITERATIONS (100)
+#define MAX_TABLES (64)
+
+typedef struct {
+	uint32_t name;
+	const u_char* data;			// after the version / flags
+	uint64_t size;
+} table_t;
+
+static table_t tables[MAX_TABLES];
+static int table_count;
+
+static double
+get_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+find_tables(const u_char* pos, const u_char* end)
+{
+	uint64_t atom_size;
+	uint32_t header_size;
+	uint32_t name;
+
+	while (pos + 8 <= end && table_count < MAX_TABLES)
+	{
+		atom_size = parse_be32(pos);
+		name = *(uint32_t*)(pos + 4);
+		header_size = 8;
+		if (atom_size == 1)
+		{
+			if (pos + 16 > end)
+			{
+				return;
+			}
+			atom_size = parse_be64(pos + 8);
+			header_size = 16;
+		}
+		else if (atom_size == 0)
+		{
+			atom_size = end - pos;
+		}
+
+		if (atom_size < header_size || atom_size > (uint64_t)(end - pos))
+		{
+			return;
+		}
+
+		switch (name)
+		{
+		case ATOM_NAME_MOOV:
+		case ATOM_NAME_TRAK:
+		case ATOM_NAME_MDIA:
+		case ATOM_NAME_MINF:
+		case ATOM_NAME_STBL:
+			find_tables(pos + header_size, pos + atom_size);
+			break;
+
+		case ATOM_NAME_STSZ:
+		case ATOM_NAME_STCO:
+		case ATOM_NAME_CO64:
+		case ATOM_NAME_STTS:
+			tables[table_count].name = name;
+			tables[table_count].data = pos + header_size + 4;
+			tables[table_count].size = atom_size - header_size - 4;
+			table_count++;
+			break;
+		}
+
+		pos += atom_size;
+	}
+}
+
+static uint64_t
+decode_table(table_t* table, input_frame_t* frames, uint64_t* checksum)
+{
+	uint64_t total_size;
+	uint32_t uniform_size;
+	uint32_t max_size;
+	uint32_t entries;
+	uint32_t i;
+
+	switch (table->name)
+	{
+	case ATOM_NAME_STSZ:
+		uniform_size = parse_be32(table->data);
+		entries = parse_be32(table->data + 4);
+		if (uniform_size != 0 || table->size < 8 + (uint64_t)entries * sizeof(uint32_t))
+		{
+			return 0;
+		}
+		total_size = mp4_table_decode_stsz32(frames, frames + entries, table->data + 8, &max_size);
+		if (checksum != NULL)
+		{
+			*checksum += total_size + max_size;
+			for (i = 0; i < entries; i++)
+			{
+				*checksum += frames[i].size * (i + 1);
+			}
+		}
+		return entries;
+
+	case ATOM_NAME_STCO:
+	case ATOM_NAME_CO64:
+		entries = parse_be32(table->data);
+		if (table->size < 4 + (uint64_t)entries * (table->name == ATOM_NAME_CO64 ? sizeof(uint64_t) : sizeof(uint32_t)))
+		{
+			return 0;
+		}
+		if (table->name == ATOM_NAME_CO64)
+		{
+			mp4_table_decode_stco64(frames, frames + entries, table->data + 4);
+		}
+		else
+		{
+			mp4_table_decode_stco32(frames, frames + entries, table->data + 4);
+		}
+		if (checksum != NULL)
+		{
+			for (i = 0; i < entries; i++)
+			{
+				*checksum += frames[i].offset * (i + 1);
+			}
+		}
+		return entries;
+
+	case ATOM_NAME_STTS:
+		entries = parse_be32(table->data);
+		if (table->size < 4 + (uint64_t)entries * sizeof(stts_entry_t))
+		{
+			return 0;
+		}
+		total_size = mp4_table_decode_stts_duration(table->data + 4, entries);
+		if (checksum != NULL)
+		{
+			*checksum += total_size;
+		}
+		return entries;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	input_frame_t* frames;
+	uint64_t frame_counts[MP4_TABLE_DECODER_COUNT][4];
+	uint64_t checksums[MP4_TABLE_DECODER_COUNT];
+	double times[MP4_TABLE_DECODER_COUNT][4];
+	const char* table_names[] = { "stsz", "stco", "co64", "stts" };
+	double start;
+	uint32_t max_entries;
+	uint32_t level;
+	uint32_t max_level;
+	uint32_t cur_level;
+	u_char* buffer;
+	size_t size;
+	FILE* fp;
+	int table_index;
+	int index;
+	int i;
+
+	if (argc < 2)
+	{
+		printf("Usage:\n\t%s <moov file / mp4 with moov at start>...\n", argv[0]);
+		return 1;
+	}
+
+	// load the tables
+	for (i = 1; i < argc; i++)
+	{
+		fp = fopen(argv[i], "rb");
+		if (fp == NULL)
+		{
+			printf("Error: failed to open %s\n", argv[i]);
+			return 1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		buffer = malloc(size);
+		if (buffer == NULL || fread(buffer, 1, size, fp) != size)
+		{
+			printf("Error: failed to read %s\n", argv[i]);
+			return 1;
+		}
+		fclose(fp);
+
+		find_tables(buffer, buffer + size);
+	}
+
+	max_entries = 0;
+	for (i = 0; i < table_count; i++)
+	{
+		max_entries = vod_max(max_entries, parse_be32(tables[i].data + (tables[i].name == ATOM_NAME_STSZ ? 4 : 0)));
+	}
+
+	frames = malloc(sizeof(frames[0]) * (max_entries + 1));
+	if (frames == NULL)
+	{
+		printf("Error: failed to allocate frames\n");
+		return 1;
+	}
+
+	// run the benchmark for each of the supported implementations
+	memset(frame_counts, 0, sizeof(frame_counts));
+	memset(times, 0, sizeof(times));
+	memset(checksums, 0, sizeof(checksums));
+
+	max_level = mp4_table_decoder_init(MP4_TABLE_DECODER_COUNT - 1);
+	for (level = 0; level <= max_level; level++)
+	{
+		cur_level = mp4_table_decoder_init(level);
+		if (cur_level != level)
+		{
+			continue;
+		}
+
+		for (table_index = 0; table_index < table_count; table_index++)
+		{
+			switch (tables[table_index].name)
+			{
+			case ATOM_NAME_STSZ: index = 0; break;
+			case ATOM_NAME_STCO: index = 1; break;
+			case ATOM_NAME_CO64: index = 2; break;
+			default: index = 3; break;
+			}
+
+			start = get_time();
+			for (i = 0; i < ITERATIONS; i++)
+			{
+				frame_counts[level][index] += decode_table(&tables[table_index], frames, NULL);
+			}
+			times[level][index] += get_time() - start;
+
+			// verify the output against the scalar implementation
+			decode_table(&tables[table_index], frames, &checksums[level]);
+		}
+
+		if (checksums[level] != checksums[0])
+		{
+			printf("Error: %s results differ from scalar\n", mp4_table_decoder_get_name(level));
+		}
+	}
+
+	for (level = 0; level <= max_level; level++)
+	{
+		printf("%s:\n", mp4_table_decoder_get_name(level));
+		for (index = 0; index < 4; index++)
+		{
+			if (frame_counts[level][index] == 0)
+			{
+				continue;
+			}
+
+			printf("\t%s: %.1f M entries/sec\n", table_names[index], frame_counts[level][index] / times[level][index] / 1e6);
+		}
+	}
+
+	return 0;
+}
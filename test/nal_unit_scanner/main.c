@@ -0,0 +1,157 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <ngx_core.h>
+#include <vod/nal_unit_scanner.h>
+
+#define ITERATIONS (20)
+#define MAX_FILES (64)
+
+typedef struct {
+	const u_char* data;
+	size_t size;
+} input_file_t;
+
+static input_file_t files[MAX_FILES];
+static int file_count;
+
+static double
+get_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// counts the emulation prevention sequences (00 00 03), the escapable sequences (00 00 0x, x <= 3)
+// and the zero pairs, same as the loops of avc_hevc_parser
+static uint64_t
+scan_file(input_file_t* file, uint64_t* checksum)
+{
+	const u_char* end_pos = file->data + file->size;
+	const u_char* cur_pos;
+	uint64_t emulation_prevention = 0;
+	uint64_t escapable = 0;
+	uint64_t zero_pairs = 0;
+
+	for (cur_pos = file->data;; cur_pos++)
+	{
+		cur_pos = nal_unit_scanner_find_zero_pair(cur_pos, end_pos);
+		if (end_pos - cur_pos < 3)
+		{
+			break;
+		}
+
+		zero_pairs++;
+		if (cur_pos[2] <= 3)
+		{
+			escapable++;
+			if (cur_pos[2] == 3)
+			{
+				emulation_prevention++;
+			}
+		}
+	}
+
+	if (checksum != NULL)
+	{
+		*checksum += zero_pairs + (escapable << 20) + (emulation_prevention << 40);
+	}
+
+	return file->size;
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t checksums[NAL_UNIT_SCANNER_COUNT];
+	uint64_t byte_counts[NAL_UNIT_SCANNER_COUNT];
+	double times[NAL_UNIT_SCANNER_COUNT];
+	double start;
+	uint32_t level;
+	uint32_t max_level;
+	uint32_t cur_level;
+	u_char* buffer;
+	size_t size;
+	FILE* fp;
+	int file_index;
+	int i;
+
+	if (argc < 2)
+	{
+		printf("Usage:\n\t%s <h264 / hevc / mp4 file>...\n", argv[0]);
+		return 1;
+	}
+
+	// load the files
+	for (i = 1; i < argc && file_count < MAX_FILES; i++)
+	{
+		fp = fopen(argv[i], "rb");
+		if (fp == NULL)
+		{
+			printf("Error: failed to open %s\n", argv[i]);
+			return 1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		buffer = malloc(size);
+		if (buffer == NULL || fread(buffer, 1, size, fp) != size)
+		{
+			printf("Error: failed to read %s\n", argv[i]);
+			return 1;
+		}
+		fclose(fp);
+
+		files[file_count].data = buffer;
+		files[file_count].size = size;
+		file_count++;
+	}
+
+	// run the benchmark for each of the supported implementations
+	memset(byte_counts, 0, sizeof(byte_counts));
+	memset(times, 0, sizeof(times));
+	memset(checksums, 0, sizeof(checksums));
+
+	max_level = nal_unit_scanner_init(NAL_UNIT_SCANNER_COUNT - 1);
+	for (level = 0; level <= max_level; level++)
+	{
+		cur_level = nal_unit_scanner_init(level);
+		if (cur_level != level)
+		{
+			continue;
+		}
+
+		for (file_index = 0; file_index < file_count; file_index++)
+		{
+			start = get_time();
+			for (i = 0; i < ITERATIONS; i++)
+			{
+				byte_counts[level] += scan_file(&files[file_index], NULL);
+			}
+			times[level] += get_time() - start;
+
+			// verify the output against the scalar implementation
+			scan_file(&files[file_index], &checksums[level]);
+		}
+
+		if (checksums[level] != checksums[0])
+		{
+			printf("Error: %s results differ from scalar\n", nal_unit_scanner_get_name(level));
+		}
+	}
+
+	for (level = 0; level <= max_level; level++)
+	{
+		if (byte_counts[level] == 0)
+		{
+			continue;
+		}
+
+		printf("%s: %.1f MB/sec\n", nal_unit_scanner_get_name(level), byte_counts[level] / times[level] / 1e6);
+	}
+
+	return 0;
+}
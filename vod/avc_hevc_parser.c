@@ -1,4 +1,5 @@
 #include "avc_hevc_parser.h"
+#include "nal_unit_scanner.h"
 
 bool_t
 avc_hevc_parser_rbsp_trailing_bits(bit_reader_state_t* reader)
@@ -76,19 +77,50 @@ avc_hevc_parser_emulation_prevention_encode_bytes(
 {
 	uint32_t result = 0;
 
-	end_pos -= 2;
-	for (; cur_pos < end_pos; cur_pos++)
+	for (;;)
 	{
-		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] <= 3)
+		cur_pos = nal_unit_scanner_find_zero_pair(cur_pos, end_pos);
+		if (end_pos - cur_pos < 3)
+		{
+			break;
+		}
+
+		if (cur_pos[2] <= 3)
 		{
 			result++;
-			cur_pos += 2;
+			cur_pos += 3;
+		}
+		else
+		{
+			cur_pos++;
 		}
 	}
 
 	return result;
 }
 
+static const u_char*
+avc_hevc_parser_find_emulation_prevention(
+	const u_char* cur_pos,
+	const u_char* end_pos)
+{
+	for (;;)
+	{
+		cur_pos = nal_unit_scanner_find_zero_pair(cur_pos, end_pos);
+		if (end_pos - cur_pos < 3)
+		{
+			return NULL;
+		}
+
+		if (cur_pos[2] == 3)
+		{
+			return cur_pos;
+		}
+
+		cur_pos++;
+	}
+}
+
 vod_status_t
 avc_hevc_parser_emulation_prevention_decode(
 	request_context_t* request_context,
@@ -98,22 +130,11 @@ avc_hevc_parser_emulation_prevention_decode(
 {
 	const u_char* cur_pos;
 	const u_char* end_pos = buffer + size;
-	const u_char* limit = end_pos - 2;
+	const u_char* next_pos;
 	u_char* output;
-	u_char cur_byte;
-	bool_t requires_strip;
-
-	requires_strip = FALSE;
-	for (cur_pos = buffer; cur_pos < limit; cur_pos++)
-	{
-		if (cur_pos[0] == 0 && cur_pos[1] == 0 && cur_pos[2] == 3)
-		{
-			requires_strip = TRUE;
-			break;
-		}
-	}
 
-	if (!requires_strip)
+	next_pos = avc_hevc_parser_find_emulation_prevention(buffer, end_pos);
+	if (next_pos == NULL)
 	{
 		bit_read_stream_init(reader, buffer, size);
 		return VOD_OK;
@@ -129,26 +150,17 @@ avc_hevc_parser_emulation_prevention_decode(
 
 	bit_read_stream_init(reader, output, 0);	// size updated later
 
-	for (cur_pos = buffer; cur_pos < limit; )
+	// copy everything except the 03 of 00 00 03 sequences
+	cur_pos = buffer;
+	do
 	{
-		cur_byte = *cur_pos;
-		if (cur_byte == 0 && cur_pos[1] == 0 && cur_pos[2] == 3)
-		{
-			*output++ = 0;
-			*output++ = 0;
-			cur_pos += 3;
-		}
-		else
-		{
-			*output++ = cur_byte;
-			cur_pos++;
-		}
-	}
+		output = vod_copy(output, cur_pos, next_pos + 2 - cur_pos);
+		cur_pos = next_pos + 3;
 
-	while (cur_pos < end_pos)
-	{
-		*output++ = *cur_pos++;
-	}
+		next_pos = avc_hevc_parser_find_emulation_prevention(cur_pos, end_pos);
+	} while (next_pos != NULL);
+
+	output = vod_copy(output, cur_pos, end_pos - cur_pos);
 
 	reader->stream.end_pos = output;
 	return VOD_OK;
@@ -74,6 +74,13 @@ bit_read_stream_get(bit_reader_state_t* state, int count)
 	return result;
 }
 
+// returns the number of bits that were consumed, start is the buffer passed to init
+static vod_inline uint32_t
+bit_read_stream_get_position(bit_reader_state_t* state, const u_char* start)
+{
+	return ((state->stream.cur_pos - start) << 3) - (state->cur_bit + 1);
+}
+
 static vod_inline int64_t
 bit_read_stream_get_long(bit_reader_state_t* state, int count)
 {
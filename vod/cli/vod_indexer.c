@@ -0,0 +1,341 @@
+// creates index files for mp4 files, the index files are used by nginx-vod-module when vod_index_sidecar is enabled.
+// the index contains the ftyp & moov atoms, so that the module can load the metadata of the file with a single
+// mapping of a small file, instead of searching for the moov atom inside the media file.
+//
+// usage: vod_indexer <mp4 file>...
+// the index of each file is written to <mp4 file>.vodidx
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ngx_core.h>
+#include <vod/input/index_file.h>
+#include <vod/mp4/mp4_format.h>
+#include <vod/mp4/mp4_defs.h>
+#include <vod/read_stream.h>
+
+#define ATOM_HEADER_SIZE (8)
+#define ATOM_HEADER64_SIZE (16)
+#define MAX_METADATA_SIZE (128 * 1024 * 1024)
+
+volatile ngx_cycle_t  *ngx_cycle;
+static ngx_log_t ngx_log;
+
+typedef struct {
+	off_t offset;		// offset of the atom data
+	uint64_t size;		// size of the atom data
+} atom_location_t;
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+	u_char buf[NGX_MAX_ERROR_STR];
+	u_char* p;
+#if (NGX_HAVE_VARIADIC_MACROS)
+	va_list args;
+
+	va_start(args, fmt);
+	p = ngx_vslprintf(buf, buf + sizeof(buf), fmt, args);
+	va_end(args);
+#else
+	p = ngx_vslprintf(buf, buf + sizeof(buf), fmt, args);
+#endif
+
+	fprintf(stderr, "Error: %.*s\n", (int)(p - buf), buf);
+}
+
+static int
+find_metadata_atoms(int fd, off_t file_size, atom_location_t* ftyp, atom_location_t* moov)
+{
+	u_char header[ATOM_HEADER64_SIZE];
+	uint64_t atom_size;
+	uint32_t header_size;
+	uint32_t name;
+	off_t pos;
+
+	ftyp->size = 0;
+	moov->size = 0;
+
+	// walk the top level atoms
+	for (pos = 0; pos + ATOM_HEADER_SIZE <= file_size; pos += atom_size)
+	{
+		if (pread(fd, header, sizeof(header), pos) < ATOM_HEADER_SIZE)
+		{
+			return 0;
+		}
+
+		atom_size = parse_be32(header);
+		name = *(uint32_t*)(header + 4);
+		header_size = ATOM_HEADER_SIZE;
+		if (atom_size == 1)
+		{
+			atom_size = parse_be64(header + 8);
+			header_size = ATOM_HEADER64_SIZE;
+		}
+		else if (atom_size == 0)
+		{
+			atom_size = file_size - pos;
+		}
+
+		if (atom_size < header_size || atom_size > (uint64_t)(file_size - pos))
+		{
+			return 0;
+		}
+
+		switch (name)
+		{
+		case ATOM_NAME_FTYP:
+			ftyp->offset = pos + header_size;
+			ftyp->size = atom_size - header_size;
+			break;
+
+		case ATOM_NAME_MOOV:
+			moov->offset = pos + header_size;
+			moov->size = atom_size - header_size;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+read_part(int fd, atom_location_t* location, vod_str_t* part)
+{
+	part->len = location->size;
+	if (part->len == 0)
+	{
+		part->data = NULL;
+		return 1;
+	}
+
+	part->data = malloc(part->len);
+	if (part->data == NULL)
+	{
+		return 0;
+	}
+
+	return pread(fd, part->data, part->len, location->offset) == (ssize_t)part->len;
+}
+
+static int
+verify_index(ngx_pool_t* pool, vod_str_t* buffer, index_file_t* index)
+{
+	request_context_t request_context;
+	index_file_t parsed;
+	uint32_t i;
+
+	ngx_memzero(&request_context, sizeof(request_context));
+	request_context.pool = pool;
+	request_context.log = &ngx_log;
+
+	if (index_file_parse(&request_context, buffer, index->file_size, index->file_mtime, &parsed) != VOD_OK ||
+		parsed.format_id != index->format_id ||
+		parsed.part_count != index->part_count)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < parsed.part_count; i++)
+	{
+		if (parsed.parts[i].len != index->parts[i].len ||
+			ngx_memcmp(parsed.parts[i].data, index->parts[i].data, parsed.parts[i].len) != 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+create_index(ngx_pool_t* pool, const char* path)
+{
+	vod_str_t parts[MP4_METADATA_PART_COUNT];
+	atom_location_t ftyp;
+	atom_location_t moov;
+	index_file_t index;
+	vod_str_t buffer;
+	struct stat st;
+	char* index_path;
+	char* temp_path;
+	u_char* p;
+	size_t size;
+	FILE* fp;
+	int result = 0;
+	int fd;
+	int i;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1)
+	{
+		printf("Error: failed to open %s\n", path);
+		return 0;
+	}
+
+	ngx_memzero(parts, sizeof(parts));
+
+	if (!find_metadata_atoms(fd, st.st_size, &ftyp, &moov))
+	{
+		printf("Error: moov atom not found in %s (only mp4 files are supported)\n", path);
+		goto done;
+	}
+
+	if (moov.size > MAX_METADATA_SIZE)
+	{
+		printf("Error: moov size %" PRIu64 " too big in %s\n", moov.size, path);
+		goto done;
+	}
+
+	if (!read_part(fd, &ftyp, &parts[MP4_METADATA_PART_FTYP]) ||
+		!read_part(fd, &moov, &parts[MP4_METADATA_PART_MOOV]))
+	{
+		printf("Error: failed to read the metadata of %s\n", path);
+		goto done;
+	}
+
+	// compressed moov atoms are inflated by the module when read from the media file, not supported here
+	if (parts[MP4_METADATA_PART_MOOV].len >= ATOM_HEADER_SIZE &&
+		*(uint32_t*)(parts[MP4_METADATA_PART_MOOV].data + 4) == ATOM_NAME_CMOV)
+	{
+		printf("Error: compressed moov atoms are not supported, %s\n", path);
+		goto done;
+	}
+
+	// build the index
+	index.format_id = FORMAT_ID_MP4;
+	index.file_size = st.st_size;
+	index.file_mtime = st.st_mtime;
+	index.parts = parts;
+	index.part_count = MP4_METADATA_PART_COUNT;
+
+	size = index_file_get_header_size(index.part_count);
+	for (i = 0; i < MP4_METADATA_PART_COUNT; i++)
+	{
+		size += parts[i].len;
+	}
+
+	buffer.data = malloc(size);
+	if (buffer.data == NULL)
+	{
+		printf("Error: failed to allocate the index of %s\n", path);
+		goto done;
+	}
+
+	p = index_file_write_header(buffer.data, &index);
+	for (i = 0; i < MP4_METADATA_PART_COUNT; i++)
+	{
+		p = ngx_copy(p, parts[i].data, parts[i].len);
+	}
+	buffer.len = p - buffer.data;
+
+	if (!verify_index(pool, &buffer, &index))
+	{
+		printf("Error: failed to verify the index of %s\n", path);
+		goto free_buffer;
+	}
+
+	// write to a temp file and rename, so that the module never sees a partial index
+	index_path = malloc(strlen(path) * 2 + sizeof(INDEX_FILE_EXTENSION) * 2 + sizeof(".tmp"));
+	if (index_path == NULL)
+	{
+		printf("Error: failed to allocate the index path of %s\n", path);
+		goto free_buffer;
+	}
+
+	temp_path = index_path + strlen(path) + sizeof(INDEX_FILE_EXTENSION);
+	sprintf(index_path, "%s%s", path, INDEX_FILE_EXTENSION);
+	sprintf(temp_path, "%s.tmp", index_path);
+
+	fp = fopen(temp_path, "wb");
+	if (fp == NULL)
+	{
+		printf("Error: failed to open %s\n", temp_path);
+		goto free_path;
+	}
+
+	if (fwrite(buffer.data, 1, buffer.len, fp) != buffer.len)
+	{
+		printf("Error: failed to write %s\n", temp_path);
+		fclose(fp);
+		unlink(temp_path);
+		goto free_path;
+	}
+
+	if (fclose(fp) != 0 || rename(temp_path, index_path) != 0)
+	{
+		printf("Error: failed to save %s\n", index_path);
+		unlink(temp_path);
+		goto free_path;
+	}
+
+	printf("%s: ftyp %" PRIu64 " bytes, moov %" PRIu64 " bytes, index %zu bytes\n",
+		index_path, ftyp.size, moov.size, buffer.len);
+	result = 1;
+
+free_path:
+	free(index_path);
+
+free_buffer:
+	free(buffer.data);
+
+done:
+	for (i = 0; i < MP4_METADATA_PART_COUNT; i++)
+	{
+		free(parts[i].data);
+	}
+
+	close(fd);
+	return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+	ngx_pool_t* pool;
+	int failed = 0;
+	int i;
+
+	if (argc < 2)
+	{
+		printf("Usage:\n\t%s <mp4 file>...\n", argv[0]);
+		return 1;
+	}
+
+	ngx_pagesize = getpagesize();
+
+	pool = ngx_create_pool(16 * 1024, &ngx_log);
+	if (pool == NULL)
+	{
+		printf("Error: failed to create pool\n");
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!create_index(pool, argv[i]))
+		{
+			failed++;
+		}
+
+		ngx_reset_pool(pool);
+	}
+
+	ngx_destroy_pool(pool);
+
+	return failed > 0 ? 1 : 0;
+}
@@ -103,6 +103,8 @@ void vod_log_error(vod_uint_t level, vod_log_t *log, int err,
 #define VOD_HAVE_LIBXML2 NGX_HAVE_LIBXML2
 #define VOD_HAVE_ICONV NGX_HAVE_ICONV
 #define VOD_HAVE_ZLIB NGX_HAVE_ZLIB
+#define VOD_HAVE_X86_SIMD NGX_HAVE_X86_SIMD
+#define VOD_HAVE_THREADS NGX_THREADS
 
 #define VOD_DEBUG NGX_DEBUG
 
@@ -183,6 +185,14 @@ void vod_log_error(vod_uint_t level, vod_log_t *log, int err,
 #define vod_hash_init(hinit, names, nelts) ngx_hash_init(hinit, names, nelts)
 #define vod_hash_find(hash, key, name, len) ngx_hash_find(hash, key, name, len)
 
+// thread functions
+#if (VOD_HAVE_THREADS)
+typedef ngx_thread_mutex_t vod_thread_mutex_t;
+#define vod_thread_mutex_create(mtx, log) ngx_thread_mutex_create(mtx, log)
+#define vod_thread_mutex_lock(mtx, log) ngx_thread_mutex_lock(mtx, log)
+#define vod_thread_mutex_unlock(mtx, log) ngx_thread_mutex_unlock(mtx, log)
+#endif // VOD_HAVE_THREADS
+
 // time functions
 #if (VOD_DEBUG)
 #define vod_time(request_context) (request_context->time > 0 ? request_context->time : ngx_time())
@@ -0,0 +1,83 @@
+#include "context_cache.h"
+
+#if (VOD_HAVE_THREADS)
+#define context_cache_lock(cache) vod_thread_mutex_lock(&(cache)->mutex, (cache)->log)
+#define context_cache_unlock(cache) vod_thread_mutex_unlock(&(cache)->mutex, (cache)->log)
+#else
+#define context_cache_lock(cache)
+#define context_cache_unlock(cache)
+#endif // VOD_HAVE_THREADS
+
+vod_status_t
+context_cache_init(context_cache_t* cache, void(*free)(void* context), vod_log_t* log)
+{
+	cache->count = 0;
+	cache->free = free;
+
+#if (VOD_HAVE_THREADS)
+	cache->log = log;
+	if (vod_thread_mutex_create(&cache->mutex, log) != VOD_OK)
+	{
+		return VOD_UNEXPECTED;
+	}
+#endif // VOD_HAVE_THREADS
+
+	return VOD_OK;
+}
+
+void*
+context_cache_get(context_cache_t* cache, context_cache_key_t* key)
+{
+	context_cache_entry_t* cur;
+	void* result = NULL;
+
+	context_cache_lock(cache);
+
+	// search from the most recently released
+	for (cur = cache->entries + cache->count - 1; cur >= cache->entries; cur--)
+	{
+		if (vod_memcmp(&cur->key, key, sizeof(*key)) != 0)
+		{
+			continue;
+		}
+
+		result = cur->context;
+
+		cache->count--;
+		vod_memmove(cur, cur + 1, (cache->entries + cache->count - cur) * sizeof(*cur));
+		break;
+	}
+
+	context_cache_unlock(cache);
+
+	return result;
+}
+
+void
+context_cache_put(context_cache_t* cache, context_cache_key_t* key, void* context)
+{
+	context_cache_entry_t* cur;
+	void* evicted = NULL;
+
+	context_cache_lock(cache);
+
+	if (cache->count >= CONTEXT_CACHE_SIZE)
+	{
+		// evict the least recently released
+		evicted = cache->entries[0].context;
+		cache->count--;
+		vod_memmove(cache->entries, cache->entries + 1, cache->count * sizeof(cache->entries[0]));
+	}
+
+	cur = &cache->entries[cache->count++];
+	cur->key = *key;
+	cur->context = context;
+
+	context_cache_unlock(cache);
+
+	// Note: freeing outside the lock, closing a codec may take a while
+	if (evicted != NULL)
+	{
+		cache->free(evicted);
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef __CONTEXT_CACHE_H__
+#define __CONTEXT_CACHE_H__
+
+// includes
+#include "common.h"
+
+// constants
+#define CONTEXT_CACHE_SIZE (16)		// max idle contexts kept by a worker process
+#define CONTEXT_CACHE_KEY_VALUES (10)
+
+// typedefs
+typedef struct {
+	uint32_t values[CONTEXT_CACHE_KEY_VALUES];
+} context_cache_key_t;
+
+typedef struct {
+	context_cache_key_t key;
+	void* context;
+} context_cache_entry_t;
+
+// a per process cache of idle codec contexts, that are expensive to create.
+// Note: the frame processing may run on thread pools (vod_processing_thread_pool / vod_audio_filter_thread_pool / 
+//		vod_thumb_thread_pool), so when threads are enabled, get / put are protected by a mutex
+typedef struct {
+	context_cache_entry_t entries[CONTEXT_CACHE_SIZE];		// ordered by release time
+	uint32_t count;
+	void(*free)(void* context);
+#if (VOD_HAVE_THREADS)
+	vod_thread_mutex_t mutex;
+	vod_log_t* log;
+#endif // VOD_HAVE_THREADS
+} context_cache_t;
+
+// functions
+vod_status_t context_cache_init(context_cache_t* cache, void(*free)(void* context), vod_log_t* log);
+
+void* context_cache_get(context_cache_t* cache, context_cache_key_t* key);
+
+void context_cache_put(context_cache_t* cache, context_cache_key_t* key, void* context);
+
+#endif // __CONTEXT_CACHE_H__
@@ -16,11 +16,32 @@ static const uint64_t aac_channel_layout[] = {
 static AVCodec *decoder_codec = NULL;
 static bool_t initialized = FALSE;
 
+// Note: the decoders are taken / returned when the audio filter is allocated / freed, on the event loop,
+//		only the frame processing runs on the thread pool. the cache is protected by a mutex regardless
+static context_cache_t decoder_cache;
+
+static void
+audio_decoder_free_decoder(void* context)
+{
+	AVCodecContext* decoder = context;
+
+	avcodec_close(decoder);
+	av_freep(&decoder->extradata);
+	av_free(decoder);
+}
+
 void
 audio_decoder_process_init(vod_log_t* log)
 {
 	avcodec_register_all();
 
+	if (context_cache_init(&decoder_cache, audio_decoder_free_decoder, log) != VOD_OK)
+	{
+		vod_log_error(VOD_LOG_WARN, log, 0,
+			"audio_decoder_process_init: context_cache_init failed, audio decoding is disabled");
+		return;
+	}
+
 	decoder_codec = avcodec_find_decoder(AV_CODEC_ID_AAC);
 	if (decoder_codec == NULL)
 	{
@@ -38,6 +59,7 @@ audio_decoder_init_decoder(
 	media_info_t* media_info)
 {
 	AVCodecContext* decoder;
+	vod_str_t* extra_data = &media_info->extra_data;
 	uint8_t channel_config;
 	int avrc;
 
@@ -48,6 +70,33 @@ audio_decoder_init_decoder(
 		return VOD_BAD_REQUEST;
 	}
 
+	channel_config = media_info->u.audio.codec_config.channel_config;
+
+	// try to reuse a decoder of a previous request
+	vod_memzero(&state->decoder_key, sizeof(state->decoder_key));
+	state->decoder_key.values[0] = media_info->format;
+	state->decoder_key.values[1] = media_info->frames_timescale;
+	state->decoder_key.values[2] = media_info->u.audio.channels;
+	state->decoder_key.values[3] = media_info->u.audio.bits_per_sample;
+	state->decoder_key.values[4] = media_info->u.audio.sample_rate;
+	state->decoder_key.values[5] = channel_config;
+	state->decoder_key.values[6] = extra_data->len;
+	state->decoder_key.values[7] = vod_crc32_short(extra_data->data, extra_data->len);
+
+	decoder = context_cache_get(&decoder_cache, &state->decoder_key);
+	if (decoder != NULL)
+	{
+		if (decoder->extradata_size == (int)extra_data->len &&
+			vod_memcmp(decoder->extradata, extra_data->data, extra_data->len) == 0)
+		{
+			state->decoder = decoder;
+			return VOD_OK;
+		}
+
+		// crc collision
+		audio_decoder_free_decoder(decoder);
+	}
+
 	// init the decoder	
 	decoder = avcodec_alloc_context3(decoder_codec);
 	if (decoder == NULL)
@@ -57,19 +106,30 @@ audio_decoder_init_decoder(
 		return VOD_ALLOC_FAILED;
 	}
 
-	state->decoder = decoder;	
-	
+	// Note: the extra data is copied since the decoder may outlive the request
+	if (extra_data->len > 0)
+	{
+		decoder->extradata = av_mallocz(extra_data->len + VOD_BUFFER_PADDING_SIZE);
+		if (decoder->extradata == NULL)
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"audio_decoder_init_decoder: av_mallocz failed");
+			av_free(decoder);
+			return VOD_ALLOC_FAILED;
+		}
+
+		vod_memcpy(decoder->extradata, extra_data->data, extra_data->len);
+		decoder->extradata_size = extra_data->len;
+	}
+
 	decoder->codec_tag = media_info->format;
 	decoder->bit_rate = media_info->bitrate;
 	decoder->time_base.num = 1;
 	decoder->time_base.den = media_info->frames_timescale;
 	decoder->pkt_timebase = decoder->time_base;
-	decoder->extradata = media_info->extra_data.data;
-	decoder->extradata_size = media_info->extra_data.len;
 	decoder->channels = media_info->u.audio.channels;
 	decoder->bits_per_coded_sample = media_info->u.audio.bits_per_sample;
 	decoder->sample_rate = media_info->u.audio.sample_rate;
-	channel_config = media_info->u.audio.codec_config.channel_config;
 	if (channel_config < vod_array_entries(aac_channel_layout))
 	{
 		decoder->channel_layout = aac_channel_layout[channel_config];
@@ -84,9 +144,12 @@ audio_decoder_init_decoder(
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
 			"audio_decoder_init_decoder: avcodec_open2 failed %d", avrc);
+		audio_decoder_free_decoder(decoder);
 		return VOD_UNEXPECTED;
 	}
 
+	state->decoder = decoder;
+
 	return VOD_OK;
 }
 
@@ -172,9 +235,14 @@ audio_decoder_init(
 void
 audio_decoder_free(audio_decoder_state_t* state)
 {
-	avcodec_close(state->decoder);
-	av_free(state->decoder);
-	state->decoder = NULL;
+	// return the decoder to the cache of the worker, for use by subsequent requests
+	if (state->decoder != NULL)
+	{
+		avcodec_flush_buffers(state->decoder);
+		context_cache_put(&decoder_cache, &state->decoder_key, state->decoder);
+		state->decoder = NULL;
+	}
+
 	av_frame_free(&state->decoded_frame);
 }
 
@@ -3,6 +3,7 @@
 
 // includes
 #include "../media_format.h"
+#include "../context_cache.h"
 #include <libavcodec/avcodec.h>
 
 // macros
@@ -13,6 +14,7 @@
 typedef struct {
 	request_context_t* request_context;
 	AVCodecContext* decoder;
+	context_cache_key_t decoder_key;
 	AVFrame* decoded_frame;
 
 	frame_list_part_t cur_frame_part;
@@ -1,5 +1,6 @@
 #include "audio_encoder.h"
 #include "audio_filter.h"
+#include "../context_cache.h"
 
 // constants
 #define AUDIO_ENCODER_BITS_PER_SAMPLE (16)
@@ -11,12 +12,27 @@ typedef struct
 	request_context_t* request_context;
 	vod_array_t* frames_array;
 	AVCodecContext *encoder;
+	context_cache_key_t encoder_key;
+	bool_t encoder_idle;
 } audio_encoder_state_t;
 
 // globals
 static AVCodec *encoder_codec = NULL;
 static bool_t initialized = FALSE;
 
+// Note: the encoders are taken / returned when the audio filter is allocated / freed, on the event loop,
+//		only the frame processing runs on the thread pool. the cache is protected by a mutex regardless
+static context_cache_t encoder_cache;
+
+static void
+audio_encoder_free_encoder(void* context)
+{
+	AVCodecContext* encoder = context;
+
+	avcodec_close(encoder);
+	av_free(encoder);
+}
+
 static bool_t
 audio_encoder_is_format_supported(AVCodec *codec, enum AVSampleFormat sample_fmt)
 {
@@ -38,6 +54,13 @@ audio_encoder_process_init(vod_log_t* log)
 {
 	avcodec_register_all();
 
+	if (context_cache_init(&encoder_cache, audio_encoder_free_encoder, log) != VOD_OK)
+	{
+		vod_log_error(VOD_LOG_WARN, log, 0,
+			"audio_encoder_process_init: context_cache_init failed, audio encoding is disabled");
+		return;
+	}
+
 	encoder_codec = avcodec_find_encoder_by_name(AAC_ENCODER_NAME);
 	if (encoder_codec == NULL)
 	{
@@ -82,6 +105,26 @@ audio_encoder_init(
 		return VOD_ALLOC_FAILED;
 	}
 
+	state->request_context = request_context;
+	state->frames_array = frames_array;
+	state->encoder_idle = TRUE;
+
+	// try to reuse an encoder of a previous request
+	vod_memzero(&state->encoder_key, sizeof(state->encoder_key));
+	state->encoder_key.values[0] = params->timescale;
+	state->encoder_key.values[1] = params->sample_rate;
+	state->encoder_key.values[2] = (uint32_t)params->channel_layout;
+	state->encoder_key.values[3] = (uint32_t)(params->channel_layout >> 32);
+	state->encoder_key.values[4] = params->channels;
+	state->encoder_key.values[5] = params->bitrate;
+
+	state->encoder = context_cache_get(&encoder_cache, &state->encoder_key);
+	if (state->encoder != NULL)
+	{
+		*result = state;
+		return VOD_OK;
+	}
+
 	// init the encoder
 	encoder = avcodec_alloc_context3(encoder_codec);
 	if (encoder == NULL)
@@ -91,8 +134,6 @@ audio_encoder_init(
 		return VOD_ALLOC_FAILED;
 	}
 
-	state->encoder = encoder;
-
 	encoder->sample_fmt = AUDIO_ENCODER_INPUT_SAMPLE_FORMAT;
 	encoder->time_base.num = 1;
 	encoder->time_base.den = params->timescale;
@@ -107,12 +148,11 @@ audio_encoder_init(
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"audio_encoder_init: avcodec_open2 failed %d", avrc);
-		audio_encoder_free(state);
+		audio_encoder_free_encoder(encoder);
 		return VOD_UNEXPECTED;
 	}
 
-	state->request_context = request_context;
-	state->frames_array = frames_array;
+	state->encoder = encoder;
 
 	*result = state;
 
@@ -125,13 +165,30 @@ audio_encoder_free(
 {
 	audio_encoder_state_t* state = context;
 
-	if (state == NULL)
+	if (state == NULL || state->encoder == NULL)
 	{
 		return;
 	}
-	
-	avcodec_close(state->encoder);
-	av_free(state->encoder);
+
+	// return the encoder to the cache of the worker, for use by subsequent requests.
+	//	a drained encoder can be reused only if the codec supports flushing
+	if (state->encoder_idle)
+	{
+		context_cache_put(&encoder_cache, &state->encoder_key, state->encoder);
+	}
+#ifdef AV_CODEC_CAP_ENCODER_FLUSH
+	else if ((state->encoder->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) != 0)
+	{
+		avcodec_flush_buffers(state->encoder);
+		context_cache_put(&encoder_cache, &state->encoder_key, state->encoder);
+	}
+#endif // AV_CODEC_CAP_ENCODER_FLUSH
+	else
+	{
+		audio_encoder_free_encoder(state->encoder);
+	}
+
+	state->encoder = NULL;
 }
 
 size_t
@@ -186,6 +243,8 @@ audio_encoder_write_frame(
 	int avrc;
 
 	// send frame
+	state->encoder_idle = FALSE;
+
 	avrc = avcodec_send_frame(state->encoder, frame);
 
 	av_frame_unref(frame);
@@ -232,6 +291,8 @@ audio_encoder_flush(
 	vod_status_t rc;
 	int avrc;
 
+	state->encoder_idle = FALSE;
+
 	avrc = avcodec_send_frame(state->encoder, NULL);
 	if (avrc < 0)
 	{
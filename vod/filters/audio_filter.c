@@ -1,5 +1,6 @@
 #include "audio_filter.h"
 #include "rate_filter.h"
+#include "../input/frames_source_memory.h"
 
 #if (VOD_HAVE_LIB_AV_CODEC && VOD_HAVE_LIB_AV_FILTER)
 #include <libavcodec/avcodec.h>
@@ -10,7 +11,6 @@
 #include "audio_encoder.h"
 #include "audio_decoder.h"
 #include "volume_map.h"
-#include "../input/frames_source_memory.h"
 
 // constants
 #define BUFFERSRC_ARGS_FORMAT ("time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%uxL%Z")
@@ -208,6 +208,321 @@ audio_filter_walk_filters_prepare_init(
 	return VOD_OK;
 }
 
+// cache key / serialization of filtered tracks
+typedef struct {
+	u_char file_key[MEDIA_CLIP_KEY_SIZE];
+	uint64_t clip_from;
+	uint64_t first_frame_time_offset;
+	uint32_t type;
+	uint32_t track_id;
+	uint32_t first_frame_index;
+	uint32_t frame_count;
+} audio_filter_cache_key_source_t;
+
+typedef struct {
+	uint32_t output_codec_id;
+	uint32_t bitrate;
+	uint32_t sample_rate;
+	uint32_t channel_config;
+} audio_filter_cache_key_output_t;
+
+typedef struct {
+	uint32_t codec_id;
+	uint32_t timescale;
+	uint32_t bitrate;
+	uint32_t frame_count;
+	uint64_t duration;
+	uint64_t first_frame_time_offset;
+	uint64_t total_frames_size;
+	uint64_t total_frames_duration;
+	audio_media_info_t audio;
+	uint32_t extra_data_size;
+} audio_filter_cache_header_t;		// followed by the extra data (aligned), the frames and the frames data
+
+static uint32_t
+audio_filter_get_clip_cache_key_size(media_clip_t* clip)
+{
+	media_clip_t** sources_end;
+	media_clip_t** sources_cur;
+	uint32_t result;
+
+	if (media_clip_is_source(clip->type))
+	{
+		return sizeof(audio_filter_cache_key_source_t);
+	}
+
+	result = sizeof(uint32_t);
+	if (clip->audio_filter != NULL)
+	{
+		result += clip->audio_filter->get_filter_desc_size(clip);
+	}
+
+	sources_end = clip->sources + clip->source_count;
+	for (sources_cur = clip->sources; sources_cur < sources_end; sources_cur++)
+	{
+		if (*sources_cur != NULL)
+		{
+			result += audio_filter_get_clip_cache_key_size(*sources_cur);
+		}
+	}
+
+	return result;
+}
+
+static u_char*
+audio_filter_write_clip_cache_key(u_char* p, media_clip_t* clip)
+{
+	audio_filter_cache_key_source_t key;
+	media_clip_source_t* source;
+	media_track_t* cur_track;
+	media_clip_t** sources_end;
+	media_clip_t** sources_cur;
+	uint32_t type;
+
+	if (media_clip_is_source(clip->type))
+	{
+		source = vod_container_of(clip, media_clip_source_t, base);
+
+		vod_memzero(&key, sizeof(key));
+		vod_memcpy(key.file_key, source->file_key, sizeof(key.file_key));
+		key.clip_from = source->clip_from;
+		key.type = clip->type;
+
+		// the frames of the audio track identify the time range of the source
+		for (cur_track = source->track_array.first_track; cur_track < source->track_array.last_track; cur_track++)
+		{
+			if (cur_track->media_info.media_type == MEDIA_TYPE_AUDIO)
+			{
+				key.first_frame_time_offset = cur_track->first_frame_time_offset;
+				key.track_id = cur_track->media_info.track_id;
+				key.first_frame_index = cur_track->first_frame_index;
+				key.frame_count = cur_track->frame_count;
+				break;
+			}
+		}
+
+		return vod_copy(p, &key, sizeof(key));
+	}
+
+	type = clip->type;
+	p = vod_copy(p, &type, sizeof(type));
+	if (clip->audio_filter != NULL)
+	{
+		p = clip->audio_filter->append_filter_desc(p, clip);
+	}
+
+	sources_end = clip->sources + clip->source_count;
+	for (sources_cur = clip->sources; sources_cur < sources_end; sources_cur++)
+	{
+		if (*sources_cur != NULL)
+		{
+			p = audio_filter_write_clip_cache_key(p, *sources_cur);
+		}
+	}
+
+	return p;
+}
+
+uint32_t
+audio_filter_get_cache_key_size(media_track_t* output_track)
+{
+	return sizeof(audio_filter_cache_key_output_t) +
+		audio_filter_get_clip_cache_key_size(output_track->source_clip);
+}
+
+u_char*
+audio_filter_write_cache_key(u_char* p, media_track_t* output_track, uint32_t output_codec_id)
+{
+	audio_filter_cache_key_output_t key;
+
+	vod_memzero(&key, sizeof(key));
+	key.output_codec_id = output_codec_id;
+	key.bitrate = output_track->media_info.bitrate;
+	key.sample_rate = output_track->media_info.u.audio.sample_rate;
+	key.channel_config = output_track->media_info.u.audio.codec_config.channel_config;
+	p = vod_copy(p, &key, sizeof(key));
+
+	return audio_filter_write_clip_cache_key(p, output_track->source_clip);
+}
+
+vod_status_t
+audio_filter_cache_serialize(
+	request_context_t* request_context,
+	media_track_t* track,
+	vod_str_t** result,
+	uint32_t* result_count)
+{
+	audio_filter_cache_header_t* header;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	input_frame_t* dest_frame;
+	vod_str_t* buffers;
+	vod_str_t* cur_buffer;
+	uint64_t offset;
+	size_t extra_data_size;
+	size_t size;
+	u_char* p;
+
+	// Note: audio_filter_update_track always returns a single frames part
+	if (track->frame_count <= 0 || track->frames.next != NULL)
+	{
+		return VOD_NOT_FOUND;
+	}
+
+	buffers = vod_alloc(request_context->pool, sizeof(buffers[0]) * (track->frame_count + 1));
+	if (buffers == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"audio_filter_cache_serialize: vod_alloc failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	extra_data_size = vod_align(track->media_info.extra_data.len, sizeof(uint64_t));
+	size = vod_align(sizeof(*header), sizeof(uint64_t)) + extra_data_size +
+		sizeof(input_frame_t) * track->frame_count;
+
+	p = vod_alloc(request_context->pool, size);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"audio_filter_cache_serialize: vod_alloc failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(p, size);
+
+	// header
+	header = (void*)p;
+	header->codec_id = track->media_info.codec_id;
+	header->timescale = track->media_info.timescale;
+	header->bitrate = track->media_info.bitrate;
+	header->frame_count = track->frame_count;
+	header->duration = track->media_info.duration;
+	header->first_frame_time_offset = track->first_frame_time_offset;
+	header->total_frames_size = track->total_frames_size;
+	header->total_frames_duration = track->total_frames_duration;
+	header->audio = track->media_info.u.audio;
+	header->extra_data_size = track->media_info.extra_data.len;
+
+	buffers[0].data = p;
+	buffers[0].len = size;
+
+	p += vod_align(sizeof(*header), sizeof(uint64_t));
+	vod_memcpy(p, track->media_info.extra_data.data, track->media_info.extra_data.len);
+	p += extra_data_size;
+
+	// frames, the offsets are saved relative to the beginning of the frames data
+	dest_frame = (void*)p;
+	cur_buffer = buffers + 1;
+	offset = 0;
+
+	last_frame = track->frames.last_frame;
+	for (cur_frame = track->frames.first_frame; cur_frame < last_frame; cur_frame++, dest_frame++, cur_buffer++)
+	{
+		*dest_frame = *cur_frame;
+		dest_frame->offset = offset;
+		offset += cur_frame->size;
+
+		cur_buffer->data = (u_char*)(uintptr_t)cur_frame->offset;
+		cur_buffer->len = cur_frame->size;
+	}
+
+	*result = buffers;
+	*result_count = track->frame_count + 1;
+
+	return VOD_OK;
+}
+
+vod_status_t
+audio_filter_cache_deserialize(
+	request_context_t* request_context,
+	media_sequence_t* sequence,
+	media_track_t* track,
+	vod_str_t* buffer)
+{
+	audio_filter_cache_header_t header;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	size_t frames_offset;
+	u_char* frames_data;
+	vod_status_t rc;
+
+	if (buffer->len < sizeof(header))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"audio_filter_cache_deserialize: buffer size %uz too small", buffer->len);
+		return VOD_BAD_DATA;
+	}
+
+	vod_memcpy(&header, buffer->data, sizeof(header));
+
+	frames_offset = vod_align(sizeof(header), sizeof(uint64_t)) +
+		vod_align(header.extra_data_size, sizeof(uint64_t));
+	if (header.frame_count <= 0 ||
+		buffer->len < frames_offset + sizeof(input_frame_t) * header.frame_count + header.total_frames_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"audio_filter_cache_deserialize: invalid buffer, size %uz, frame count %uD",
+			buffer->len, header.frame_count);
+		return VOD_BAD_DATA;
+	}
+
+	// update the frames
+	sequence->total_frame_count -= track->frame_count;
+	sequence->total_frame_size -= track->total_frames_size;
+
+	track->frame_count = header.frame_count;
+	track->total_frames_size = header.total_frames_size;
+	track->total_frames_duration = header.total_frames_duration;
+	track->key_frame_count = 0;
+
+	track->frames.first_frame = (void*)(buffer->data + frames_offset);
+	track->frames.last_frame = track->frames.first_frame + track->frame_count;
+	track->frames.next = NULL;
+	track->frames.compact = NULL;
+
+	frames_data = (u_char*)track->frames.last_frame;
+	last_frame = track->frames.last_frame;
+	for (cur_frame = track->frames.first_frame; cur_frame < last_frame; cur_frame++)
+	{
+		cur_frame->offset = (uintptr_t)(frames_data + cur_frame->offset);
+	}
+
+	rc = frames_source_memory_init(request_context, &track->frames.frames_source_context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	track->frames.frames_source = &frames_source_memory;
+
+	// update the media info
+	track->media_info.codec_id = header.codec_id;
+	track->media_info.timescale = header.timescale;
+	track->media_info.bitrate = header.bitrate;
+	track->media_info.u.audio = header.audio;
+	track->media_info.extra_data.data = buffer->data + vod_align(sizeof(header), sizeof(uint64_t));
+	track->media_info.extra_data.len = header.extra_data_size;
+	track->media_info.duration = header.duration;
+	track->first_frame_time_offset = header.first_frame_time_offset;
+
+	if (track->media_info.codec_name.data != NULL)
+	{
+		rc = codec_config_get_audio_codec_name(request_context, &track->media_info);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	sequence->total_frame_count += track->frame_count;
+	sequence->total_frame_size += track->total_frames_size;
+
+	track->source_clip = NULL;		// no need to filter
+
+	return VOD_OK;
+}
+
 #if (VOD_HAVE_LIB_AV_CODEC && VOD_HAVE_LIB_AV_FILTER)
 
 typedef struct {
@@ -860,6 +1175,7 @@ audio_filter_update_track(audio_filter_state_t* state)
 	output->frames.first_frame = state->sink.frames_array.elts;
 	output->frames.last_frame = output->frames.first_frame + output->frame_count;
 	output->frames.next = NULL;
+	output->frames.compact = NULL;
 
 	// check whether there are any frames with duration
 	has_frames = FALSE;
@@ -29,6 +29,23 @@ void audio_filter_free_state(void* context);
 
 vod_status_t audio_filter_process(void* context);
 
+// cache of filtered tracks
+uint32_t audio_filter_get_cache_key_size(media_track_t* output_track);
+
+u_char* audio_filter_write_cache_key(u_char* p, media_track_t* output_track, uint32_t output_codec_id);
+
+vod_status_t audio_filter_cache_serialize(
+	request_context_t* request_context,
+	media_track_t* track,
+	vod_str_t** result,
+	uint32_t* result_count);
+
+vod_status_t audio_filter_cache_deserialize(
+	request_context_t* request_context,
+	media_sequence_t* sequence,
+	media_track_t* track,
+	vod_str_t* buffer);
+
 vod_status_t audio_filter_alloc_memory_frame(
 	request_context_t* request_context,
 	vod_array_t* frames_array,
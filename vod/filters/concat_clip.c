@@ -524,12 +524,16 @@ concat_clip_concat(
 		for (i = 0; i < src_clip->track_array.total_track_count; i++)
 		{
 			src_track = &src_clip->track_array.first_track[i];
+			dest_track = &dest_clip->track_array.first_track[i];
+
+			// the key frame times of the sources cannot be merged, the segmenter falls back to estimate
+			dest_track->key_frame_times = NULL;
+
 			if (src_track->frame_count <= 0)
 			{
 				continue;
 			}
 
-			dest_track = &dest_clip->track_array.first_track[i];
 			if (dest_track->frame_count > 0)
 			{
 				dest_track->frames.next = &src_track->frames;
@@ -1,6 +1,7 @@
 #include "filter.h"
 #include "audio_filter.h"
 #include "rate_filter.h"
+#include "gain_filter.h"
 #include "concat_clip.h"
 #include "../media_set.h"
 #include "../segmenter.h"
@@ -27,6 +28,9 @@ typedef struct {
 	media_clip_filtered_t* output_clip;
 	media_track_t* cur_track;
 	void* audio_filter;
+	vod_status_t(*audio_filter_process)(void* context);
+	void(*audio_filter_free)(void* context);
+	bool_t audio_filter_completed;
 	uint32_t max_frame_count;
 	uint32_t output_codec_id;
 } apply_filters_state_t;
@@ -497,6 +501,7 @@ filter_init_state(
 	state->max_frame_count = max_frame_count;
 	state->output_codec_id = output_codec_id;
 	state->audio_filter = NULL;
+	state->audio_filter_completed = FALSE;
 
 	*context = state;
 
@@ -504,7 +509,7 @@ filter_init_state(
 }
 
 vod_status_t
-filter_run_state_machine(void* context)
+filter_prepare_audio_filter(void* context, bool_t* done)
 {
 	apply_filters_state_t* state = context;
 	vod_status_t rc;
@@ -514,15 +519,19 @@ filter_run_state_machine(void* context)
 	{
 		if (state->audio_filter != NULL)
 		{
-			// run the audio filter
-			rc = audio_filter_process(state->audio_filter);
-			if (rc != VOD_OK)
+			if (!state->audio_filter_completed)
 			{
-				return rc;
+				// the current filter still has frames to process
+				*done = FALSE;
+				return VOD_OK;
 			}
 
-			audio_filter_free_state(state->audio_filter);
+			if (state->audio_filter_free != NULL)
+			{
+				state->audio_filter_free(state->audio_filter);
+			}
 			state->audio_filter = NULL;
+			state->audio_filter_completed = FALSE;
 
 			state->cur_track++;
 		}
@@ -537,6 +546,7 @@ filter_run_state_machine(void* context)
 				state->sequence++;
 				if (state->sequence >= state->media_set->sequences_end)
 				{
+					*done = TRUE;
 					return VOD_OK;
 				}
 
@@ -553,15 +563,40 @@ filter_run_state_machine(void* context)
 		}
 
 		// initialize the audio filter
-		rc = audio_filter_alloc_state(
-			state->request_context,
-			state->sequence,
+		if (gain_filter_aac_is_supported(
 			state->cur_track->source_clip,
 			state->cur_track,
-			state->max_frame_count,
-			state->output_codec_id,
-			&cache_buffer_count,
-			&state->audio_filter);
+			state->output_codec_id))
+		{
+			// gain only, update the frames without decoding
+			rc = gain_filter_aac_alloc_state(
+				state->request_context,
+				state->sequence,
+				state->cur_track->source_clip,
+				state->cur_track,
+				state->max_frame_count,
+				&cache_buffer_count,
+				&state->audio_filter);
+
+			state->audio_filter_process = gain_filter_aac_process;
+			state->audio_filter_free = NULL;
+		}
+		else
+		{
+			rc = audio_filter_alloc_state(
+				state->request_context,
+				state->sequence,
+				state->cur_track->source_clip,
+				state->cur_track,
+				state->max_frame_count,
+				state->output_codec_id,
+				&cache_buffer_count,
+				&state->audio_filter);
+
+			state->audio_filter_process = audio_filter_process;
+			state->audio_filter_free = audio_filter_free_state;
+		}
+
 		if (rc != VOD_OK)
 		{
 			return rc;
@@ -582,3 +617,47 @@ filter_run_state_machine(void* context)
 		}
 	}
 }
+
+vod_status_t
+filter_process_audio_filter(void* context)
+{
+	apply_filters_state_t* state = context;
+	vod_status_t rc;
+
+	if (state->audio_filter == NULL || state->audio_filter_completed)
+	{
+		return VOD_OK;
+	}
+
+	rc = state->audio_filter_process(state->audio_filter);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	state->audio_filter_completed = TRUE;
+
+	return VOD_OK;
+}
+
+vod_status_t
+filter_run_state_machine(void* context)
+{
+	vod_status_t rc;
+	bool_t done;
+
+	for (;;)
+	{
+		rc = filter_prepare_audio_filter(context, &done);
+		if (rc != VOD_OK || done)
+		{
+			return rc;
+		}
+
+		rc = filter_process_audio_filter(context);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+}
@@ -21,4 +21,11 @@ vod_status_t filter_init_state(
 
 vod_status_t filter_run_state_machine(void* context);
 
+// the two functions below split filter_run_state_machine, so that the decoding / encoding can run on a thread pool -
+//	filter_prepare_audio_filter frees the completed filter and allocates the filter of the next track, it must be called
+//	on the nginx event loop. filter_process_audio_filter only processes the frames of the current filter.
+vod_status_t filter_prepare_audio_filter(void* context, bool_t* done);
+
+vod_status_t filter_process_audio_filter(void* context);
+
 #endif // __FILTER_H__
@@ -1,10 +1,30 @@
 #include "gain_filter.h"
 #include "audio_filter.h"
+#include "../input/frames_source_memory.h"
 #include "../media_set_parser.h"
+#include "../bit_read_stream.h"
 
 // macros
 #define GAIN_FILTER_DESC_PATTERN "[%uD]volume=volume=%uD.%02uD[%uD]"
 
+// constants
+#define AOT_AAC_LC (2)
+#define AAC_MIN_SAMPLE_RATE_INDEX (5)		// 32khz, lower rates may use implicit sbr
+#define AAC_MAX_GAIN_STEPS (40)				// 60db
+#define AAC_GAIN_STEP_TOLERANCE (0.01)
+
+// aac syntactic elements
+enum {
+	AAC_ID_SCE,
+	AAC_ID_CPE,
+	AAC_ID_CCE,
+	AAC_ID_LFE,
+	AAC_ID_DSE,
+	AAC_ID_PCE,
+	AAC_ID_FIL,
+	AAC_ID_END,
+};
+
 // enums
 enum {
 	GAIN_FILTER_PARAM_GAIN,
@@ -26,6 +46,24 @@ static json_object_key_def_t gain_filter_params[] = {
 	{ vod_null_string, 0, 0 }
 };
 
+typedef struct {
+	request_context_t* request_context;
+	media_sequence_t* sequence;
+	media_track_t* output;
+	int gain_steps;
+
+	frame_list_part_t cur_frame_part;
+	input_frame_t* cur_frame;
+	vod_array_t frames_array;
+	input_frame_t* output_frame;
+	uint32_t cur_frame_pos;
+	bool_t data_handled;
+	bool_t frame_started;
+} gain_filter_aac_state_t;
+
+// 2 ^ (n / 4), the step of aac scale factors
+static const double aac_gain_steps[] = { 1.0, 1.189207, 1.414214, 1.681793, 2.0 };
+
 // globals
 static vod_hash_t gain_filter_hash;
 
@@ -160,3 +198,394 @@ gain_filter_parser_init(
 
 	return VOD_OK;
 }
+
+////// AAC compressed domain gain
+
+static bool_t
+gain_filter_get_aac_gain_steps(vod_fraction_t* gain, int* result)
+{
+	double value;
+	double ratio;
+	int steps;
+	int i;
+
+	// normalize to [1, 2), a factor of 2 is 4 steps
+	value = (double)gain->num / gain->denom;
+	steps = 0;
+	while (value >= 2)
+	{
+		value /= 2;
+		steps += 4;
+	}
+
+	while (value < 1)
+	{
+		value *= 2;
+		steps -= 4;
+	}
+
+	for (i = 0; i < (int)vod_array_entries(aac_gain_steps); i++)
+	{
+		ratio = value / aac_gain_steps[i];
+		if (ratio > 1 - AAC_GAIN_STEP_TOLERANCE && ratio < 1 + AAC_GAIN_STEP_TOLERANCE)
+		{
+			*result = steps + i;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static bool_t
+gain_filter_aac_get_clip_steps(media_clip_t* clip, int* result)
+{
+	media_clip_gain_filter_t* filter;
+	int total_steps;
+	int steps;
+
+	// only a chain of gain filters on top of a source is supported
+	total_steps = 0;
+	while (!media_clip_is_source(clip->type))
+	{
+		if (clip->type != MEDIA_CLIP_GAIN_FILTER)
+		{
+			return FALSE;
+		}
+
+		filter = vod_container_of(clip, media_clip_gain_filter_t, base);
+		if (!gain_filter_get_aac_gain_steps(&filter->gain, &steps))
+		{
+			return FALSE;
+		}
+
+		total_steps += steps;
+		clip = clip->sources[0];
+	}
+
+	if (total_steps < -AAC_MAX_GAIN_STEPS || total_steps > AAC_MAX_GAIN_STEPS)
+	{
+		return FALSE;
+	}
+
+	*result = total_steps;
+	return TRUE;
+}
+
+bool_t
+gain_filter_aac_is_supported(
+	media_clip_t* clip,
+	media_track_t* output_track,
+	uint32_t output_codec_id)
+{
+	media_info_t* media_info = &output_track->media_info;
+	int steps;
+
+	// the global gain of a cpe can only be located by huffman decoding the first channel,
+	// so only mono aac-lc is supported
+	return output_codec_id == VOD_CODEC_ID_AAC &&
+		media_info->codec_id == VOD_CODEC_ID_AAC &&
+		media_info->u.audio.codec_config.object_type == AOT_AAC_LC &&
+		media_info->u.audio.codec_config.channel_config == 1 &&
+		media_info->u.audio.codec_config.sample_rate_index <= AAC_MIN_SAMPLE_RATE_INDEX &&
+		gain_filter_aac_get_clip_steps(clip, &steps);
+}
+
+vod_status_t
+gain_filter_aac_alloc_state(
+	request_context_t* request_context,
+	media_sequence_t* sequence,
+	media_clip_t* clip,
+	media_track_t* output_track,
+	uint32_t max_frame_count,
+	size_t* cache_buffer_count,
+	void** result)
+{
+	gain_filter_aac_state_t* state;
+
+	if (output_track->frame_count > max_frame_count)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"gain_filter_aac_alloc_state: frame count %uD too big", output_track->frame_count);
+		return VOD_BAD_REQUEST;
+	}
+
+	state = vod_alloc(request_context->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"gain_filter_aac_alloc_state: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	if (!gain_filter_aac_get_clip_steps(clip, &state->gain_steps))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"gain_filter_aac_alloc_state: unexpected - unsupported clip");
+		return VOD_UNEXPECTED;
+	}
+
+	if (vod_array_init(&state->frames_array, request_context->pool, output_track->frame_count + 1, sizeof(input_frame_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"gain_filter_aac_alloc_state: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	state->request_context = request_context;
+	state->sequence = sequence;
+	state->output = output_track;
+
+	state->cur_frame_part = output_track->frames;
+	state->cur_frame = output_track->frames.first_frame;
+	state->output_frame = NULL;
+	state->cur_frame_pos = 0;
+	state->data_handled = TRUE;
+	state->frame_started = FALSE;
+
+	state->cur_frame_part.frames_source->set_cache_slot_id(
+		state->cur_frame_part.frames_source_context,
+		0);
+
+	vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+		"gain_filter_aac_alloc_state: applying %d gain steps in compressed domain", state->gain_steps);
+
+	*cache_buffer_count = 1;
+	*result = state;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+gain_filter_aac_update_frame(gain_filter_aac_state_t* state, u_char* buffer, uint32_t size)
+{
+	bit_reader_state_t reader;
+	uint32_t count;
+	uint32_t pos;
+	uint32_t shift;
+	uint32_t value;
+	int global_gain;
+	int id;
+
+	bit_read_stream_init(&reader, buffer, size);
+
+	// skip to the first single channel element
+	for (;;)
+	{
+		id = bit_read_stream_get(&reader, 3);
+		if (reader.stream.eof_reached)
+		{
+			break;
+		}
+
+		switch (id)
+		{
+		case AAC_ID_SCE:
+			bit_read_stream_skip(&reader, 4);		// element_instance_tag
+			pos = bit_read_stream_get_position(&reader, buffer);
+			if (reader.stream.eof_reached || pos + 8 > size * 8)
+			{
+				break;
+			}
+
+			// the global gain is the first field of the individual channel stream
+			buffer += pos >> 3;
+			shift = 8 - (pos & 7);
+			value = ((uint32_t)buffer[0] << 8) | (shift < 8 ? buffer[1] : 0);
+
+			global_gain = ((value >> shift) & 0xff) + state->gain_steps;
+			global_gain = vod_min(vod_max(global_gain, 0), 0xff);
+
+			value = (value & ~(0xff << shift)) | ((uint32_t)global_gain << shift);
+			buffer[0] = value >> 8;
+			if (shift < 8)
+			{
+				buffer[1] = value & 0xff;
+			}
+			return VOD_OK;
+
+		case AAC_ID_DSE:
+			bit_read_stream_skip(&reader, 4);		// element_instance_tag
+			if (bit_read_stream_get_one(&reader))	// data_byte_align_flag
+			{
+				count = bit_read_stream_get(&reader, 8);
+				if (count == 255)
+				{
+					count += bit_read_stream_get(&reader, 8);
+				}
+
+				pos = bit_read_stream_get_position(&reader, buffer);
+				if ((pos & 7) != 0)
+				{
+					bit_read_stream_skip(&reader, 8 - (pos & 7));
+				}
+			}
+			else
+			{
+				count = bit_read_stream_get(&reader, 8);
+				if (count == 255)
+				{
+					count += bit_read_stream_get(&reader, 8);
+				}
+			}
+
+			if (count > 0)
+			{
+				bit_read_stream_skip(&reader, count * 8);
+			}
+			continue;
+
+		case AAC_ID_FIL:
+			count = bit_read_stream_get(&reader, 4);
+			if (count == 15)
+			{
+				count += bit_read_stream_get(&reader, 8) - 1;
+			}
+
+			if (count > 0)
+			{
+				bit_read_stream_skip(&reader, count * 8);
+			}
+			continue;
+		}
+
+		break;
+	}
+
+	vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+		"gain_filter_aac_update_frame: failed to find a single channel element, last element id %d", id);
+	return VOD_BAD_DATA;
+}
+
+static vod_status_t
+gain_filter_aac_update_track(gain_filter_aac_state_t* state)
+{
+	media_track_t* output = state->output;
+	vod_status_t rc;
+
+	// Note: the frame count, sizes and timestamps are unchanged
+	output->frames.first_frame = state->frames_array.elts;
+	output->frames.last_frame = output->frames.first_frame + state->frames_array.nelts;
+	output->frames.next = NULL;
+	output->frames.compact = NULL;
+
+	rc = frames_source_memory_init(state->request_context, &output->frames.frames_source_context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	output->frames.frames_source = &frames_source_memory;
+	output->key_frame_count = 0;
+
+	return VOD_OK;
+}
+
+vod_status_t
+gain_filter_aac_process(void* context)
+{
+	gain_filter_aac_state_t* state = context;
+	u_char* read_buffer;
+	uint32_t read_size;
+	vod_status_t rc;
+	bool_t frame_done;
+
+	for (;;)
+	{
+		// start a frame if needed
+		if (!state->frame_started)
+		{
+			if (state->cur_frame >= state->cur_frame_part.last_frame)
+			{
+				if (state->cur_frame_part.next == NULL)
+				{
+					return gain_filter_aac_update_track(state);
+				}
+
+				state->cur_frame_part = *state->cur_frame_part.next;
+				state->cur_frame = state->cur_frame_part.first_frame;
+				continue;
+			}
+
+			rc = audio_filter_alloc_memory_frame(
+				state->request_context,
+				&state->frames_array,
+				state->cur_frame->size,
+				&state->output_frame);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			state->output_frame->duration = state->cur_frame->duration;
+			state->output_frame->pts_delay = state->cur_frame->pts_delay;
+
+			rc = state->cur_frame_part.frames_source->start_frame(
+				state->cur_frame_part.frames_source_context,
+				state->cur_frame,
+				NULL);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			state->cur_frame_pos = 0;
+			state->frame_started = TRUE;
+		}
+
+		// read some data from the frame
+		rc = state->cur_frame_part.frames_source->read(
+			state->cur_frame_part.frames_source_context,
+			&read_buffer,
+			&read_size,
+			&frame_done);
+		if (rc != VOD_OK)
+		{
+			if (rc != VOD_AGAIN)
+			{
+				return rc;
+			}
+
+			if (!state->data_handled)
+			{
+				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+					"gain_filter_aac_process: no data was handled, probably a truncated file");
+				return VOD_BAD_DATA;
+			}
+
+			state->data_handled = FALSE;
+			return VOD_AGAIN;
+		}
+
+		state->data_handled = TRUE;
+
+		if (read_size > state->output_frame->size - state->cur_frame_pos)
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"gain_filter_aac_process: read size %uD exceeds the frame size %uD", 
+				state->cur_frame_pos + read_size, state->output_frame->size);
+			return VOD_UNEXPECTED;
+		}
+
+		vod_memcpy((u_char*)(uintptr_t)state->output_frame->offset + state->cur_frame_pos, read_buffer, read_size);
+		state->cur_frame_pos += read_size;
+
+		if (!frame_done)
+		{
+			continue;
+		}
+
+		rc = gain_filter_aac_update_frame(
+			state, 
+			(u_char*)(uintptr_t)state->output_frame->offset, 
+			state->output_frame->size);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		// move to the next frame
+		state->cur_frame++;
+		state->frame_started = FALSE;
+	}
+}
@@ -3,6 +3,7 @@
 
 // includes
 #include "../json_parser.h"
+#include "../media_set.h"
 
 // functions
 vod_status_t gain_filter_parse(
@@ -14,4 +15,21 @@ vod_status_t gain_filter_parser_init(
 	vod_pool_t* pool,
 	vod_pool_t* temp_pool);
 
+// applies the gain by updating the global gain of aac frames, without decoding them
+bool_t gain_filter_aac_is_supported(
+	media_clip_t* clip,
+	media_track_t* output_track,
+	uint32_t output_codec_id);
+
+vod_status_t gain_filter_aac_alloc_state(
+	request_context_t* request_context,
+	media_sequence_t* sequence,
+	media_clip_t* clip,
+	media_track_t* output_track,
+	uint32_t max_frame_count,
+	size_t* cache_buffer_count,
+	void** result);
+
+vod_status_t gain_filter_aac_process(void* context);
+
 #endif // __GAIN_FILTER_H__
@@ -50,6 +50,9 @@ rate_filter_scale_track_timestamps(
 
 	track->media_info.min_frame_duration *= speed_denom;
 
+	// the key frame times are not scaled, the segmenter falls back to estimate
+	track->key_frame_times = NULL;
+
 	if (track->media_info.media_type == MEDIA_TYPE_AUDIO)
 	{
 		return;		// should not change the frame durations for audio, since they will be filtered by libavcodec
@@ -46,9 +46,8 @@ hls_muxer_init_track(
 
 	cur_stream->media_type = track->media_info.media_type;
 	cur_stream->first_frame_part = &track->frames;
-	cur_stream->cur_frame_part = track->frames;
-	cur_stream->cur_frame = track->frames.first_frame;
-	cur_stream->source = get_frame_part_source_clip(cur_stream->cur_frame_part);
+	frame_list_iterator_init(&cur_stream->frames, &track->frames);
+	cur_stream->source = get_frame_part_source_clip(track->frames);
 	cur_stream->first_frame_time_offset = hls_rescale_millis(track->clip_start_time) + track->first_frame_time_offset;
 	cur_stream->clip_from_frame_offset = track->clip_from_frame_offset;
 	cur_stream->next_frame_time_offset = cur_stream->first_frame_time_offset;
@@ -222,6 +221,7 @@ hls_muxer_init_id3_stream(
 		}
 		dest_track->frames.frames_source = &frames_source_memory;
 		dest_track->frames.frames_source_context = frames_source_context;
+		dest_track->frames.compact = NULL;
 
 		// init the frame
 		timestamp = ref_track->original_clip_time + 
@@ -498,7 +498,8 @@ hls_muxer_init_segment(
 		return rc;
 	}
 
-	if (simulation_supported)
+	// Note: response_size is NULL when the caller does not need the size (e.g. it was fetched from cache)
+	if (simulation_supported && response_size != NULL)
 	{
 		rc = hls_muxer_simulate_get_segment_size(state, response_size);
 		if (rc != VOD_OK)
@@ -570,15 +571,13 @@ hls_muxer_choose_stream(hls_muxer_state_t* state, hls_muxer_stream_state_t** res
 	{
 		for (cur_stream = state->first_stream; cur_stream < state->last_stream; cur_stream++)
 		{
-			if (cur_stream->cur_frame >= cur_stream->cur_frame_part.last_frame)
+			if (!frame_list_iterator_fill(&cur_stream->frames))
 			{
-				if (cur_stream->cur_frame_part.next == NULL)
+				if (!frame_list_iterator_next_part(&cur_stream->frames))
 				{
 					continue;
 				}
-				cur_stream->cur_frame_part = *cur_stream->cur_frame_part.next;
-				cur_stream->cur_frame = cur_stream->cur_frame_part.first_frame;
-				cur_stream->source = get_frame_part_source_clip(cur_stream->cur_frame_part);
+				cur_stream->source = get_frame_part_source_clip((*cur_stream->frames.part));
 				state->first_time = TRUE;
 			}
 
@@ -641,17 +640,16 @@ hls_muxer_start_frame(hls_muxer_state_t* state)
 	}
 
 	// init the frame
-	state->cur_frame = selected_stream->cur_frame;
-	selected_stream->cur_frame++;
-	state->frames_source = selected_stream->cur_frame_part.frames_source;
-	state->frames_source_context = selected_stream->cur_frame_part.frames_source_context;
+	state->cur_frame = selected_stream->frames.cur_frame;
+	selected_stream->frames.cur_frame++;
+	state->frames_source = selected_stream->frames.part->frames_source;
+	state->frames_source_context = selected_stream->frames.part->frames_source_context;
 	cur_frame_time_offset = selected_stream->next_frame_time_offset;
 	cur_frame_dts = selected_stream->next_frame_time_offset;
 	selected_stream->next_frame_time_offset += state->cur_frame->duration;
 
 	// TODO: in the case of multi clip without discontinuity, the test below is not sufficient
-	state->last_stream_frame = selected_stream->cur_frame >= selected_stream->cur_frame_part.last_frame && 
-		selected_stream->cur_frame_part.next == NULL;
+	state->last_stream_frame = frame_list_iterator_is_last(&selected_stream->frames);
 
 	cache_hint.min_offset = ULLONG_MAX;
 
@@ -677,8 +675,8 @@ hls_muxer_start_frame(hls_muxer_state_t* state)
 		}
 
 		// find the min offset
-		cur_frame = cur_stream->cur_frame;
-		if (cur_frame < cur_stream->cur_frame_part.last_frame &&
+		cur_frame = cur_stream->frames.cur_frame;
+		if (cur_frame < cur_stream->frames.last_frame &&
 			cur_frame->offset < cache_hint.min_offset &&
 			cur_stream->source == selected_stream->source)
 		{
@@ -1012,8 +1010,8 @@ hls_muxer_simulate_get_iframes(
 		}
 
 		// update the stream state
-		cur_frame = selected_stream->cur_frame;
-		selected_stream->cur_frame++;
+		cur_frame = selected_stream->frames.cur_frame;
+		selected_stream->frames.cur_frame++;
 		cur_frame_time_offset = selected_stream->next_frame_time_offset;
 		cur_frame_dts = selected_stream->next_frame_time_offset;
 		selected_stream->next_frame_time_offset += cur_frame->duration;
@@ -1022,8 +1020,7 @@ hls_muxer_simulate_get_iframes(
 		hls_muxer_simulation_flush_delayed_streams(&state, selected_stream, cur_frame_dts);
 
 		// check whether this is the last frame of the selected stream in this segment
-		last_frame = ((selected_stream->cur_frame >= selected_stream->cur_frame_part.last_frame && 
-			selected_stream->cur_frame_part.next == NULL) ||
+		last_frame = (frame_list_iterator_is_last(&selected_stream->frames) ||
 			selected_stream->next_frame_time_offset >= selected_stream->segment_limit);
 
 		// write the frame
@@ -1147,8 +1144,8 @@ hls_muxer_simulate_get_segment_size(hls_muxer_state_t* state, size_t* result)
 			return rc;
 		}
 
-		cur_frame = selected_stream->cur_frame;
-		selected_stream->cur_frame++;
+		cur_frame = selected_stream->frames.cur_frame;
+		selected_stream->frames.cur_frame++;
 		cur_frame_dts = selected_stream->next_frame_time_offset;
 		selected_stream->next_frame_time_offset += cur_frame->duration;
 
@@ -1164,8 +1161,7 @@ hls_muxer_simulate_get_segment_size(hls_muxer_state_t* state, size_t* result)
 			selected_stream, 
 			cur_frame, 
 			cur_frame_dts, 
-			selected_stream->cur_frame >= selected_stream->cur_frame_part.last_frame && 
-				selected_stream->cur_frame_part.next == NULL);
+			frame_list_iterator_is_last(&selected_stream->frames));
 
 #if (VOD_DEBUG)
 		if (cur_frame_start != state->queue.cur_offset)
@@ -1213,9 +1209,8 @@ hls_muxer_simulation_reset(hls_muxer_state_t* state)
 	{
 		for (cur_stream = state->first_stream; cur_stream < state->last_stream; cur_stream++)
 		{
-			cur_stream->cur_frame_part = *cur_stream->first_frame_part;
-			cur_stream->cur_frame = cur_stream->cur_frame_part.first_frame;
-			cur_stream->source = get_frame_part_source_clip(cur_stream->cur_frame_part);
+			frame_list_iterator_init(&cur_stream->frames, cur_stream->first_frame_part);
+			cur_stream->source = get_frame_part_source_clip((*cur_stream->first_frame_part));
 			cur_stream->next_frame_time_offset = cur_stream->first_frame_time_offset;
 		}
 	}
@@ -7,6 +7,7 @@
 #include "mpegts_encoder_filter.h"
 #include "buffer_filter.h"
 #include "../media_format.h"
+#include "../input/frame_list.h"
 #include "../segmenter.h"
 
 // constants
@@ -23,6 +24,19 @@ typedef void(*hls_get_iframe_positions_callback_t)(
 	uint32_t frame_start, 
 	uint32_t frame_size);
 
+typedef struct {
+	uint32_t segment_index;
+	uint32_t frame_duration;
+	uint32_t frame_start;
+	uint32_t frame_size;
+} hls_iframe_position_t;
+
+typedef struct hls_iframes_cache_s {
+	void* context;
+	bool_t (*fetch)(void* context, vod_str_t* buffer);
+	void (*store)(void* context, vod_str_t* buffer);
+} hls_iframes_cache_t;
+
 typedef struct {
 	bool_t interleave_frames;
 	bool_t align_frames;
@@ -34,8 +48,7 @@ typedef struct {
 	
 	// input frames
 	frame_list_part_t* first_frame_part;
-	frame_list_part_t cur_frame_part;
-	input_frame_t* cur_frame;
+	frame_list_iterator_t frames;
 	media_clip_source_t* source;
 
 	// time offsets
@@ -58,6 +58,7 @@ typedef struct {
 	vod_str_t name_suffix;
 	vod_str_t* base_url;
 	vod_str_t* segment_file_name_prefix;
+	hls_iframe_position_t* cur_position;		// optional, saves the positions for caching
 } write_segment_context_t;
 
 // Notes: 
@@ -124,6 +125,15 @@ m3u8_builder_append_iframe_string(void* context, uint32_t segment_index, uint32_
 {
 	write_segment_context_t* ctx = (write_segment_context_t*)context;
 
+	if (ctx->cur_position != NULL)
+	{
+		ctx->cur_position->segment_index = segment_index;
+		ctx->cur_position->frame_duration = frame_duration;
+		ctx->cur_position->frame_start = frame_start;
+		ctx->cur_position->frame_size = frame_size;
+		ctx->cur_position++;
+	}
+
 	ctx->p = m3u8_builder_append_extinf_tag(ctx->p, frame_duration, 1000);
 	ctx->p = vod_sprintf(ctx->p, byte_range_tag_format, frame_size, frame_start);
 	ctx->p = m3u8_builder_append_segment_name(
@@ -134,6 +144,45 @@ m3u8_builder_append_iframe_string(void* context, uint32_t segment_index, uint32_
 		&ctx->name_suffix);
 }
 
+static bool_t
+m3u8_builder_write_cached_iframes(
+	request_context_t* request_context,
+	hls_iframes_cache_t* cache,
+	uint32_t max_count,
+	write_segment_context_t* ctx)
+{
+	hls_iframe_position_t* cur_position;
+	hls_iframe_position_t* last_position;
+	vod_str_t buffer;
+
+	if (!cache->fetch(cache->context, &buffer))
+	{
+		return FALSE;
+	}
+
+	if (buffer.len % sizeof(*cur_position) != 0 ||
+		buffer.len / sizeof(*cur_position) > max_count)
+	{
+		vod_log_error(VOD_LOG_WARN, request_context->log, 0,
+			"m3u8_builder_write_cached_iframes: invalid size %uz", buffer.len);
+		return FALSE;
+	}
+
+	cur_position = (hls_iframe_position_t*)buffer.data;
+	last_position = (hls_iframe_position_t*)(buffer.data + buffer.len);
+	for (; cur_position < last_position; cur_position++)
+	{
+		m3u8_builder_append_iframe_string(
+			ctx,
+			cur_position->segment_index,
+			cur_position->frame_duration,
+			cur_position->frame_start,
+			cur_position->frame_size);
+	}
+
+	return TRUE;
+}
+
 static vod_status_t
 m3u8_builder_build_tracks_spec(
 	request_context_t* request_context,
@@ -206,10 +255,14 @@ m3u8_builder_build_iframe_playlist(
 	vod_str_t* base_url,
 	request_params_t* request_params,
 	media_set_t* media_set,
+	hls_iframes_cache_t* cache,
 	vod_str_t* result)
 {
 	hls_encryption_params_t encryption_params;
+	hls_iframe_position_t* positions;
 	write_segment_context_t ctx;
+	vod_str_t cache_buffer;
+	uint32_t key_frame_count;
 	segment_durations_t segment_durations;
 	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
 	size_t iframe_length;
@@ -267,9 +320,11 @@ m3u8_builder_build_iframe_playlist(
 		sizeof(byte_range_tag_format) + VOD_INT32_LEN + vod_get_int_print_len(MAX_FRAME_SIZE) - (sizeof("%uD%uD") - 1) +
 		base_url->len + conf->segment_file_name_prefix.len + 1 + vod_get_int_print_len(segment_durations.segment_count) + ctx.name_suffix.len;
 
+	key_frame_count = media_set->sequences[0].video_key_frame_count;
+
 	result_size =
 		conf->iframes_m3u8_header_len +
-		iframe_length * media_set->sequences[0].video_key_frame_count +
+		iframe_length * key_frame_count +
 		sizeof(m3u8_footer);
 
 	// allocate the buffer
@@ -277,17 +332,38 @@ m3u8_builder_build_iframe_playlist(
 	if (result->data == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"m3u8_builder_build_iframe_playlist: vod_alloc failed");
+			"m3u8_builder_build_iframe_playlist: vod_alloc failed (1)");
 		return VOD_ALLOC_FAILED;
 	}
 
 	// fill out the buffer
 	ctx.p = vod_copy(result->data, conf->iframes_m3u8_header, conf->iframes_m3u8_header_len);
+	ctx.cur_position = NULL;
 
-	if (media_set->sequences[0].video_key_frame_count > 0)
+	if (key_frame_count > 0)
 	{
 		ctx.base_url = base_url;
 		ctx.segment_file_name_prefix = &conf->segment_file_name_prefix;
+
+		if (cache != NULL &&
+			m3u8_builder_write_cached_iframes(request_context, cache, key_frame_count, &ctx))
+		{
+			goto done;
+		}
+
+		// the simulation passes over all the frames of the media set, save the positions for the next time
+		positions = NULL;
+		if (cache != NULL)
+		{
+			positions = vod_alloc(request_context->pool, sizeof(positions[0]) * key_frame_count);
+			if (positions == NULL)
+			{
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+					"m3u8_builder_build_iframe_playlist: vod_alloc failed (2)");
+				return VOD_ALLOC_FAILED;
+			}
+			ctx.cur_position = positions;
+		}
 	
 		rc = hls_muxer_simulate_get_iframes(
 			request_context,
@@ -301,8 +377,17 @@ m3u8_builder_build_iframe_playlist(
 		{
 			return rc;
 		}
+
+		if (positions != NULL)
+		{
+			cache_buffer.data = (u_char*)positions;
+			cache_buffer.len = (u_char*)ctx.cur_position - (u_char*)positions;
+			cache->store(cache->context, &cache_buffer);
+		}
 	}
 
+done:
+
 	ctx.p = vod_copy(ctx.p, m3u8_footer, sizeof(m3u8_footer) - 1);
 	result->len = ctx.p - result->data;
 
@@ -682,18 +767,14 @@ m3u8_builder_get_audio_codec_count(
 	return count;
 }
 
-static u_char*
-m3u8_builder_append_index_url(
-	u_char* p,
-	vod_str_t* prefix,
-	media_set_t* media_set,
+static bool_t
+m3u8_builder_get_direct_uri(
 	media_track_t** tracks,
-	vod_str_t* base_url)
+	vod_str_t** uri)
 {
 	media_track_t* main_track;
 	media_track_t* sub_track;
 	uint32_t media_type;
-	bool_t write_sequence_index;
 
 	// get the main track and sub track
 	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
@@ -706,15 +787,35 @@ m3u8_builder_append_index_url(
 	main_track = tracks[media_type];
 	sub_track = media_type == MEDIA_TYPE_VIDEO ? tracks[MEDIA_TYPE_AUDIO] : NULL;
 
+	if (main_track->file_info.uri.len == 0 ||
+		(sub_track != NULL && !vod_str_equals(main_track->file_info.uri, sub_track->file_info.uri)))
+	{
+		return FALSE;
+	}
+
+	*uri = &main_track->file_info.uri;
+	return TRUE;
+}
+
+static u_char*
+m3u8_builder_append_index_url(
+	u_char* p,
+	vod_str_t* prefix,
+	media_set_t* media_set,
+	media_track_t** tracks,
+	vod_str_t* base_url)
+{
+	vod_str_t* uri;
+	bool_t write_sequence_index;
+
 	write_sequence_index = media_set->has_multi_sequences;
 	if (base_url->len != 0)
 	{
 		// absolute url only
 		p = vod_copy(p, base_url->data, base_url->len);
-		if (main_track->file_info.uri.len != 0 &&
-			(sub_track == NULL || vod_str_equals(main_track->file_info.uri, sub_track->file_info.uri)))
+		if (m3u8_builder_get_direct_uri(tracks, &uri))
 		{
-			p = vod_copy(p, main_track->file_info.uri.data, main_track->file_info.uri.len);
+			p = vod_copy(p, uri->data, uri->len);
 			write_sequence_index = FALSE;		// no need to pass the sequence index since we have a direct uri
 		}
 		else
@@ -991,6 +1092,41 @@ m3u8_builder_write_variants(
 	return p;
 }
 
+static bool_t
+m3u8_builder_iframe_variant_supported(
+	m3u8_config_t* conf,
+	media_info_t* video)
+{
+	if (conf->container_format == HLS_CONTAINER_AUTO && 
+		video->codec_id == VOD_CODEC_ID_HEVC)
+	{
+		return FALSE;
+	}
+
+	if (video->u.video.key_frame_bitrate == 0 ||
+		!mp4_to_annexb_simulation_supported(video))
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+m3u8_builder_iframe_playlist_supported(
+	m3u8_config_t* conf,
+	vod_uint_t encryption_method,
+	media_set_t* media_set,
+	adaptation_sets_t* adaptation_sets)
+{
+	return media_set->type == MEDIA_SET_VOD &&
+		media_set->timing.total_count <= 1 &&
+		encryption_method == HLS_ENC_NONE &&
+		conf->container_format != HLS_CONTAINER_FMP4 &&
+		!media_set->audio_filtering_needed &&
+		(adaptation_sets->first->type == ADAPTATION_TYPE_MUXED || adaptation_sets->first->type == ADAPTATION_TYPE_VIDEO);
+}
+
 static u_char*
 m3u8_builder_write_iframe_variants(
 	u_char* p,
@@ -1028,14 +1164,7 @@ m3u8_builder_write_iframe_variants(
 		}
 
 		video = &tracks[MEDIA_TYPE_VIDEO]->media_info;
-		if (conf->container_format == HLS_CONTAINER_AUTO && 
-			video->codec_id == VOD_CODEC_ID_HEVC)
-		{
-			continue;
-		}
-
-		if (video->u.video.key_frame_bitrate == 0 ||
-			!mp4_to_annexb_simulation_supported(video))
+		if (!m3u8_builder_iframe_variant_supported(conf, video))
 		{
 			continue;
 		}
@@ -1098,12 +1227,11 @@ m3u8_builder_build_master_playlist(
 		return rc;
 	}
 
-	iframe_playlist = media_set->type == MEDIA_SET_VOD &&
-		media_set->timing.total_count <= 1 &&
-		encryption_method == HLS_ENC_NONE &&
-		conf->container_format != HLS_CONTAINER_FMP4 &&
-		!media_set->audio_filtering_needed &&
-		(adaptation_sets.first->type == ADAPTATION_TYPE_MUXED || adaptation_sets.first->type == ADAPTATION_TYPE_VIDEO);
+	iframe_playlist = m3u8_builder_iframe_playlist_supported(
+		conf,
+		encryption_method,
+		media_set,
+		&adaptation_sets);
 
 	// get the response size
 	base_url_len = base_url->len + 1 + conf->index_file_name_prefix.len +			// 1 = /
@@ -1276,6 +1404,238 @@ m3u8_builder_build_master_playlist(
 	return VOD_OK;
 }
 
+static vod_status_t
+m3u8_builder_get_variant_uri(
+	request_context_t* request_context,
+	vod_str_t* prefix,
+	media_set_t* media_set,
+	media_track_t** tracks,
+	bool_t absolute_urls,
+	bool_t* write_sequence_index,
+	vod_str_t* result)
+{
+	vod_str_t* uri;
+	size_t result_size;
+	u_char* p;
+
+	// Note: must match the logic of m3u8_builder_append_index_url
+	*write_sequence_index = media_set->has_multi_sequences;
+	if (absolute_urls && m3u8_builder_get_direct_uri(tracks, &uri))
+	{
+		*write_sequence_index = FALSE;
+	}
+	else
+	{
+		uri = &media_set->uri;
+	}
+
+	result_size = uri->len + 1 + prefix->len + MANIFEST_UTILS_TRACKS_SPEC_MAX_SIZE + sizeof(m3u8_url_suffix) - 1;
+
+	p = vod_alloc(request_context->pool, result_size);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"m3u8_builder_get_variant_uri: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+	result->data = p;
+
+	p = vod_copy(p, uri->data, uri->len);
+	*p++ = '/';
+	p = vod_copy(p, prefix->data, prefix->len);
+	p = manifest_utils_append_tracks_spec(p, tracks, MEDIA_TYPE_COUNT, *write_sequence_index);
+	p = vod_copy(p, m3u8_url_suffix, sizeof(m3u8_url_suffix) - 1);
+
+	result->len = p - result->data;
+
+	if (result->len > result_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"m3u8_builder_get_variant_uri: result length %uz exceeded allocated length %uz",
+			result->len, result_size);
+		return VOD_UNEXPECTED;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+m3u8_builder_add_variant(
+	request_context_t* request_context,
+	m3u8_config_t* conf,
+	media_set_t* media_set,
+	media_track_t** tracks,
+	bool_t absolute_urls,
+	bool_t iframe_playlist,
+	vod_array_t* result)
+{
+	m3u8_variant_t* cur_variant;
+	m3u8_variant_t* last_variant;
+	vod_status_t rc;
+
+	// skip duplicates (e.g. in audio only sets, the first track is referenced twice)
+	cur_variant = result->elts;
+	last_variant = cur_variant + result->nelts;
+	for (; cur_variant < last_variant; cur_variant++)
+	{
+		if (vod_memcmp(cur_variant->tracks, tracks, sizeof(cur_variant->tracks)) == 0)
+		{
+			return VOD_OK;
+		}
+	}
+
+	cur_variant = vod_array_push(result);
+	if (cur_variant == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"m3u8_builder_add_variant: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memcpy(cur_variant->tracks, tracks, sizeof(cur_variant->tracks));
+
+	rc = m3u8_builder_get_variant_uri(
+		request_context,
+		&conf->index_file_name_prefix,
+		media_set,
+		tracks,
+		absolute_urls,
+		&cur_variant->has_multi_sequences,
+		&cur_variant->index_uri);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (!iframe_playlist || 
+		tracks[MEDIA_TYPE_VIDEO] == NULL ||
+		!m3u8_builder_iframe_variant_supported(conf, &tracks[MEDIA_TYPE_VIDEO]->media_info))
+	{
+		cur_variant->iframes_uri.len = 0;
+		return VOD_OK;
+	}
+
+	return m3u8_builder_get_variant_uri(
+		request_context,
+		&conf->iframes_file_name_prefix,
+		media_set,
+		tracks,
+		absolute_urls,
+		&cur_variant->has_multi_sequences,
+		&cur_variant->iframes_uri);
+}
+
+vod_status_t
+m3u8_builder_get_variants(
+	request_context_t* request_context,
+	m3u8_config_t* conf,
+	vod_uint_t encryption_method,
+	bool_t absolute_urls,
+	media_set_t* media_set,
+	vod_array_t* result)
+{
+	adaptation_sets_t adaptation_sets;
+	adaptation_set_t* last_adaptation_set;
+	adaptation_set_t* cur_adaptation_set;
+	media_track_t** cur_track_ptr;
+	media_track_t* tracks[MEDIA_TYPE_COUNT];
+	vod_status_t rc;
+	uint32_t muxed_tracks;
+	bool_t iframe_playlist;
+
+	// Note: must match the logic of m3u8_builder_build_master_playlist
+	rc = manifest_utils_get_adaptation_sets(
+		request_context, 
+		media_set, 
+		(conf->force_unmuxed_segments ? 0 : ADAPTATION_SETS_FLAG_MUXED) |
+		ADAPTATION_SETS_FLAG_SINGLE_LANG_TRACK | ADAPTATION_SETS_FLAG_MULTI_CODEC,
+		&adaptation_sets);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (vod_array_init(result, request_context->pool, adaptation_sets.first->count + adaptation_sets.count[ADAPTATION_TYPE_AUDIO], sizeof(m3u8_variant_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"m3u8_builder_get_variants: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	iframe_playlist = m3u8_builder_iframe_playlist_supported(
+		conf,
+		encryption_method,
+		media_set,
+		&adaptation_sets);
+
+	// alternative audio
+	vod_memzero(tracks, sizeof(tracks));
+
+	if (adaptation_sets.count[ADAPTATION_TYPE_AUDIO] > 0 && adaptation_sets.total_count > 1)
+	{
+		cur_adaptation_set = adaptation_sets.first_by_type[ADAPTATION_TYPE_AUDIO];
+		last_adaptation_set = cur_adaptation_set + adaptation_sets.count[ADAPTATION_TYPE_AUDIO];
+		for (; cur_adaptation_set < last_adaptation_set; cur_adaptation_set++)
+		{
+			tracks[MEDIA_TYPE_AUDIO] = cur_adaptation_set->first[0];
+
+			rc = m3u8_builder_add_variant(
+				request_context,
+				conf,
+				media_set,
+				tracks,
+				absolute_urls,
+				FALSE,
+				result);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
+		tracks[MEDIA_TYPE_AUDIO] = NULL;
+	}
+
+	// variants
+	cur_adaptation_set = adaptation_sets.first;
+	muxed_tracks = cur_adaptation_set->type == ADAPTATION_TYPE_MUXED ? MEDIA_TYPE_COUNT : 1;
+
+	for (cur_track_ptr = cur_adaptation_set->first;
+		cur_track_ptr < cur_adaptation_set->last;
+		cur_track_ptr += muxed_tracks)
+	{
+		if (muxed_tracks == MEDIA_TYPE_COUNT)
+		{
+			tracks[MEDIA_TYPE_VIDEO] = cur_track_ptr[MEDIA_TYPE_VIDEO];
+			tracks[MEDIA_TYPE_AUDIO] = cur_track_ptr[MEDIA_TYPE_AUDIO];
+		}
+		else
+		{
+			tracks[cur_adaptation_set->type] = cur_track_ptr[0];
+		}
+
+		if (tracks[MEDIA_TYPE_VIDEO] == NULL && tracks[MEDIA_TYPE_AUDIO] == NULL)
+		{
+			continue;		// subtitles only
+		}
+
+		rc = m3u8_builder_add_variant(
+			request_context,
+			conf,
+			media_set,
+			tracks,
+			absolute_urls,
+			iframe_playlist,
+			result);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
 void 
 m3u8_builder_init_config(
 	m3u8_config_t* conf, 
@@ -33,6 +33,13 @@ typedef struct {
 	vod_str_t encryption_key_format_versions;
 } m3u8_config_t;
 
+typedef struct {
+	media_track_t* tracks[MEDIA_TYPE_COUNT];
+	bool_t has_multi_sequences;		// whether the playlist urls contain a sequence index
+	vod_str_t index_uri;			// path of the index playlist
+	vod_str_t iframes_uri;			// path of the iframes playlist, empty if not referenced by the master playlist
+} m3u8_variant_t;
+
 // functions
 vod_status_t m3u8_builder_build_master_playlist(
 	request_context_t* request_context,
@@ -42,6 +49,14 @@ vod_status_t m3u8_builder_build_master_playlist(
 	media_set_t* media_set,
 	vod_str_t* result);
 
+vod_status_t m3u8_builder_get_variants(
+	request_context_t* request_context,
+	m3u8_config_t* conf,
+	vod_uint_t encryption_method,
+	bool_t absolute_urls,
+	media_set_t* media_set,
+	vod_array_t* result);
+
 vod_status_t m3u8_builder_build_index_playlist(
 	request_context_t* request_context,
 	m3u8_config_t* conf,
@@ -60,6 +75,7 @@ vod_status_t m3u8_builder_build_iframe_playlist(
 	vod_str_t* base_url,
 	request_params_t* request_params,
 	media_set_t* media_set,
+	hls_iframes_cache_t* cache,
 	vod_str_t* result);
 
 void m3u8_builder_init_config(
@@ -6,6 +6,7 @@
 
 #include <openssl/evp.h>
 #include "aes_cbc_encrypt.h"
+#include "../nal_unit_scanner.h"
 #include "../avc_defs.h"
 
 #define SAMPLE_AES_KEY_SIZE (16)
@@ -98,11 +99,36 @@ sample_aes_avc_write_emulation_prevention(
 	sample_aes_avc_filter_state_t* state = get_context(context);
 	const u_char* last_output_pos = buffer;
 	const u_char* buffer_end = buffer + size;
+	const u_char* next_pos;
 	const u_char* cur_pos;
 	vod_status_t rc;
 
 	for (cur_pos = buffer; cur_pos < buffer_end; cur_pos++)
 	{
+		if ((state->last_three_bytes & 0xff) != 0)
+		{
+			// the previous byte is not zero, an emulation prevention byte can only follow
+			// a zero pair that starts at the current position or later
+			next_pos = nal_unit_scanner_find_zero_pair(cur_pos, buffer_end);
+			if (next_pos > cur_pos)
+			{
+				if (next_pos - cur_pos > 3)
+				{
+					cur_pos = next_pos - 3;
+				}
+
+				for (; cur_pos < next_pos; cur_pos++)
+				{
+					state->last_three_bytes = ((state->last_three_bytes << 8) | *cur_pos) & 0xffffff;
+				}
+
+				if (cur_pos >= buffer_end)
+				{
+					break;
+				}
+			}
+		}
+
 		state->last_three_bytes = ((state->last_three_bytes << 8) | *cur_pos) & 0xffffff;
 		if (state->last_three_bytes > 3)
 		{
@@ -0,0 +1,370 @@
+#include "frame_list.h"
+
+// macros
+#define frame_list_get_field(frame, field_offset) (*(uint32_t*)((u_char*)(frame) + (field_offset)))
+
+static uint32_t
+frame_list_get_run_count(input_frame_t* cur_frame, input_frame_t* last_frame, size_t field_offset)
+{
+	uint32_t value;
+	uint32_t result = 1;
+
+	value = frame_list_get_field(cur_frame, field_offset);
+	for (cur_frame++; cur_frame < last_frame; cur_frame++)
+	{
+		if (frame_list_get_field(cur_frame, field_offset) != value)
+		{
+			value = frame_list_get_field(cur_frame, field_offset);
+			result++;
+		}
+	}
+
+	return result;
+}
+
+static void
+frame_list_write_runs(input_frame_t* cur_frame, input_frame_t* last_frame, size_t field_offset, frame_list_run_t* cur_run)
+{
+	cur_run->value = frame_list_get_field(cur_frame, field_offset);
+	cur_run->count = 1;
+
+	for (cur_frame++; cur_frame < last_frame; cur_frame++)
+	{
+		if (frame_list_get_field(cur_frame, field_offset) == cur_run->value)
+		{
+			cur_run->count++;
+			continue;
+		}
+
+		cur_run++;
+		cur_run->value = frame_list_get_field(cur_frame, field_offset);
+		cur_run->count = 1;
+	}
+}
+
+vod_status_t
+frame_list_compact_encode(
+	request_context_t* request_context,
+	frame_list_part_t* part,
+	uint32_t timescale)
+{
+	frame_list_compact_t* compact;
+	frame_list_chunk_t* cur_chunk;
+	input_frame_t* first_frame = part->first_frame;
+	input_frame_t* last_frame = part->last_frame;
+	input_frame_t* cur_frame;
+	uint64_t next_offset;
+	uint64_t total_duration;
+	uint32_t pts_delay_runs;
+	uint32_t key_frame_runs;
+	uint32_t duration_runs;
+	uint32_t chunk_count;
+	uint32_t frame_count;
+	uint32_t max_size;
+	uint32_t i;
+	u_char* p;
+
+	if (first_frame >= last_frame)
+	{
+		return VOD_OK;
+	}
+
+	frame_count = last_frame - first_frame;
+
+	// get the sizes of the arrays
+	duration_runs = frame_list_get_run_count(first_frame, last_frame, offsetof(input_frame_t, duration));
+	pts_delay_runs = frame_list_get_run_count(first_frame, last_frame, offsetof(input_frame_t, pts_delay));
+	key_frame_runs = frame_list_get_run_count(first_frame, last_frame, offsetof(input_frame_t, key_frame));
+
+	chunk_count = 1;
+	max_size = first_frame->size;
+	total_duration = first_frame->duration;
+	for (cur_frame = first_frame + 1; cur_frame < last_frame; cur_frame++)
+	{
+		if (cur_frame->offset != cur_frame[-1].offset + cur_frame[-1].size)
+		{
+			chunk_count++;
+		}
+
+		if (cur_frame->size > max_size)
+		{
+			max_size = cur_frame->size;
+		}
+
+		total_duration += cur_frame->duration;
+	}
+
+	// allocate the compact list
+	compact = vod_alloc(request_context->pool,
+		sizeof(*compact) +
+		sizeof(compact->chunks[0]) * chunk_count +
+		sizeof(compact->durations[0]) * (duration_runs + pts_delay_runs + key_frame_runs) +
+		(max_size <= 0xffff ? sizeof(uint16_t) : sizeof(uint32_t)) * frame_count);
+	if (compact == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"frame_list_compact_encode: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	compact->frame_count = frame_count;
+	compact->total_duration = total_duration;
+	compact->last_frame_duration = last_frame[-1].duration;
+	compact->timescale = timescale;
+	compact->scaled_timescale = 0;
+	compact->first_dts = 0;
+	compact->pts_delay = 0;
+	compact->scaled_last_frame_duration = 0;
+
+	compact->chunks = (void*)(compact + 1);
+	compact->durations = (void*)(compact->chunks + chunk_count);
+	compact->pts_delays = compact->durations + duration_runs;
+	compact->key_frames = compact->pts_delays + pts_delay_runs;
+	compact->sizes = compact->key_frames + key_frame_runs;
+
+	// runs
+	frame_list_write_runs(first_frame, last_frame, offsetof(input_frame_t, duration), compact->durations);
+	frame_list_write_runs(first_frame, last_frame, offsetof(input_frame_t, pts_delay), compact->pts_delays);
+	frame_list_write_runs(first_frame, last_frame, offsetof(input_frame_t, key_frame), compact->key_frames);
+
+	// chunks
+	cur_chunk = compact->chunks;
+	cur_chunk->offset = first_frame->offset;
+	cur_chunk->frame_count = 0;
+	next_offset = first_frame->offset;
+	for (cur_frame = first_frame; cur_frame < last_frame; cur_frame++)
+	{
+		if (cur_frame->offset != next_offset)
+		{
+			cur_chunk++;
+			cur_chunk->offset = cur_frame->offset;
+			cur_chunk->frame_count = 0;
+		}
+
+		cur_chunk->frame_count++;
+		next_offset = cur_frame->offset + cur_frame->size;
+	}
+
+	// sizes
+	p = compact->sizes;
+	if (max_size <= 0xffff)
+	{
+		compact->size_width = sizeof(uint16_t);
+		for (i = 0; i < frame_count; i++)
+		{
+			((uint16_t*)p)[i] = first_frame[i].size;
+		}
+	}
+	else
+	{
+		compact->size_width = sizeof(uint32_t);
+		for (i = 0; i < frame_count; i++)
+		{
+			((uint32_t*)p)[i] = first_frame[i].size;
+		}
+	}
+
+	// replace the frames array
+	vod_free(request_context->pool, first_frame);
+
+	part->first_frame = NULL;
+	part->last_frame = NULL;
+	part->compact = compact;
+
+	return VOD_OK;
+}
+
+uint64_t
+frame_list_compact_set_timescale(
+	frame_list_compact_t* compact,
+	uint64_t first_dts,
+	uint32_t scaled_timescale,
+	uint32_t pts_delay,
+	uint64_t clip_end_dts)
+{
+	uint64_t last_frame_dts;
+	uint64_t end_dts;
+
+	compact->first_dts = first_dts;
+	compact->scaled_timescale = scaled_timescale;
+	compact->pts_delay = pts_delay;
+	compact->scaled_last_frame_duration = 0;
+
+	end_dts = first_dts + compact->total_duration;
+	if (clip_end_dts == ULLONG_MAX)
+	{
+		return rescale_time(end_dts, compact->timescale, scaled_timescale);
+	}
+
+	// same as the array case - the duration of the last frame is extended up to the clip end
+	last_frame_dts = rescale_time(end_dts - compact->last_frame_duration, compact->timescale, scaled_timescale);
+	if (clip_end_dts <= last_frame_dts)
+	{
+		return rescale_time(end_dts, compact->timescale, scaled_timescale);
+	}
+
+	compact->scaled_last_frame_duration = clip_end_dts - last_frame_dts;
+
+	return clip_end_dts;
+}
+
+bool_t
+frame_list_iterator_fill(frame_list_iterator_t* iter)
+{
+	frame_list_compact_t* compact;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	uint64_t next_scaled_dts;
+	uint64_t scaled_pts;
+	uint32_t pts_delay;
+	uint32_t duration;
+	uint32_t count;
+
+	if (iter->cur_frame < iter->last_frame)
+	{
+		return TRUE;
+	}
+
+	if (iter->frames_left <= 0)
+	{
+		return FALSE;
+	}
+
+	compact = iter->part->compact;
+
+	count = vod_min(iter->frames_left, FRAME_LIST_ITERATOR_WINDOW_SIZE);
+	last_frame = iter->window + count;
+	for (cur_frame = iter->window; cur_frame < last_frame; cur_frame++)
+	{
+		// advance the runs
+		if (iter->duration_left <= 0)
+		{
+			iter->cur_duration++;
+			iter->duration_left = iter->cur_duration->count;
+		}
+		iter->duration_left--;
+
+		if (iter->pts_delay_left <= 0)
+		{
+			iter->cur_pts_delay++;
+			iter->pts_delay_left = iter->cur_pts_delay->count;
+		}
+		iter->pts_delay_left--;
+
+		if (iter->key_frame_left <= 0)
+		{
+			iter->cur_key_frame++;
+			iter->key_frame_left = iter->cur_key_frame->count;
+		}
+		iter->key_frame_left--;
+
+		if (iter->chunk_left <= 0)
+		{
+			iter->cur_chunk++;
+			iter->chunk_left = iter->cur_chunk->frame_count;
+			iter->offset = iter->cur_chunk->offset;
+		}
+		iter->chunk_left--;
+
+		// offset / size
+		if (compact->size_width == sizeof(uint16_t))
+		{
+			cur_frame->size = ((uint16_t*)compact->sizes)[iter->size_index];
+		}
+		else
+		{
+			cur_frame->size = ((uint32_t*)compact->sizes)[iter->size_index];
+		}
+		iter->size_index++;
+
+		cur_frame->offset = iter->offset;
+		iter->offset += cur_frame->size;
+
+		cur_frame->key_frame = iter->cur_key_frame->value;
+
+		// timestamps
+		duration = iter->cur_duration->value;
+		pts_delay = iter->cur_pts_delay->value;
+		if (compact->scaled_timescale == 0)
+		{
+			cur_frame->duration = duration;
+			cur_frame->pts_delay = pts_delay;
+			continue;
+		}
+
+		scaled_pts = rescale_time(iter->dts + pts_delay, compact->timescale, compact->scaled_timescale);
+		cur_frame->pts_delay = scaled_pts - iter->scaled_dts + compact->pts_delay;
+
+		iter->dts += duration;
+		next_scaled_dts = rescale_time(iter->dts, compact->timescale, compact->scaled_timescale);
+		cur_frame->duration = next_scaled_dts - iter->scaled_dts;
+		iter->scaled_dts = next_scaled_dts;
+	}
+
+	iter->frames_left -= count;
+	if (iter->frames_left <= 0 && compact->scaled_last_frame_duration != 0)
+	{
+		last_frame[-1].duration = compact->scaled_last_frame_duration;
+	}
+
+	iter->cur_frame = iter->window;
+	iter->last_frame = last_frame;
+
+	return TRUE;
+}
+
+void
+frame_list_iterator_init(frame_list_iterator_t* iter, frame_list_part_t* part)
+{
+	frame_list_compact_t* compact = part->compact;
+
+	iter->part = part;
+
+	if (compact == NULL)
+	{
+		iter->cur_frame = part->first_frame;
+		iter->last_frame = part->last_frame;
+		iter->frames_left = 0;
+		return;
+	}
+
+	iter->cur_frame = iter->window;
+	iter->last_frame = iter->window;
+	iter->frames_left = compact->frame_count;
+
+	iter->cur_duration = compact->durations - 1;
+	iter->duration_left = 0;
+	iter->cur_pts_delay = compact->pts_delays - 1;
+	iter->pts_delay_left = 0;
+	iter->cur_key_frame = compact->key_frames - 1;
+	iter->key_frame_left = 0;
+	iter->cur_chunk = compact->chunks - 1;
+	iter->chunk_left = 0;
+	iter->size_index = 0;
+	iter->offset = 0;
+
+	iter->dts = compact->first_dts;
+	if (compact->scaled_timescale != 0)
+	{
+		iter->scaled_dts = rescale_time(compact->first_dts, compact->timescale, compact->scaled_timescale);
+	}
+	else
+	{
+		iter->scaled_dts = 0;
+	}
+
+	frame_list_iterator_fill(iter);
+}
+
+bool_t
+frame_list_iterator_next_part(frame_list_iterator_t* iter)
+{
+	if (iter->part->next == NULL)
+	{
+		return FALSE;
+	}
+
+	frame_list_iterator_init(iter, iter->part->next);
+
+	return TRUE;
+}
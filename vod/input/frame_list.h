@@ -0,0 +1,94 @@
+#ifndef __FRAME_LIST_H__
+#define __FRAME_LIST_H__
+
+// includes
+#include "../media_format.h"
+
+// constants
+#define FRAME_LIST_ITERATOR_WINDOW_SIZE (32)
+
+// macros
+#define frame_list_iterator_is_last(iter)					\
+	((iter)->cur_frame >= (iter)->last_frame &&				\
+	(iter)->frames_left == 0 &&								\
+	(iter)->part->next == NULL)
+
+// typedefs
+typedef struct {
+	uint32_t count;
+	uint32_t value;
+} frame_list_run_t;
+
+typedef struct {
+	uint64_t offset;
+	uint32_t frame_count;
+} frame_list_chunk_t;
+
+struct frame_list_compact_s {
+	uint32_t frame_count;
+
+	// run length encoded fields
+	frame_list_run_t* durations;
+	frame_list_run_t* pts_delays;
+	frame_list_run_t* key_frames;
+
+	// frame offsets are saved relative to the containing chunk
+	frame_list_chunk_t* chunks;
+	void* sizes;						// [frame_count], uint16_t / uint32_t according to size_width
+	uint32_t size_width;
+
+	uint64_t total_duration;
+	uint32_t last_frame_duration;
+
+	// timescale conversion
+	uint32_t timescale;
+	uint32_t scaled_timescale;			// zero = no conversion
+	uint64_t first_dts;
+	uint32_t pts_delay;
+	uint32_t scaled_last_frame_duration;	// zero = not overridden
+};
+
+typedef struct frame_list_compact_s frame_list_compact_t;
+
+typedef struct {
+	frame_list_part_t* part;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+
+	// compact parts only
+	uint32_t frames_left;
+	frame_list_run_t* cur_duration;
+	uint32_t duration_left;
+	frame_list_run_t* cur_pts_delay;
+	uint32_t pts_delay_left;
+	frame_list_run_t* cur_key_frame;
+	uint32_t key_frame_left;
+	frame_list_chunk_t* cur_chunk;
+	uint32_t chunk_left;
+	uint32_t size_index;
+	uint64_t offset;
+	uint64_t dts;
+	uint64_t scaled_dts;
+	input_frame_t window[FRAME_LIST_ITERATOR_WINDOW_SIZE];
+} frame_list_iterator_t;
+
+// functions
+vod_status_t frame_list_compact_encode(
+	request_context_t* request_context,
+	frame_list_part_t* part,
+	uint32_t timescale);
+
+uint64_t frame_list_compact_set_timescale(
+	frame_list_compact_t* compact,
+	uint64_t first_dts,
+	uint32_t scaled_timescale,
+	uint32_t pts_delay,
+	uint64_t clip_end_dts);
+
+void frame_list_iterator_init(frame_list_iterator_t* iter, frame_list_part_t* part);
+
+bool_t frame_list_iterator_fill(frame_list_iterator_t* iter);
+
+bool_t frame_list_iterator_next_part(frame_list_iterator_t* iter);
+
+#endif //__FRAME_LIST_H__
@@ -0,0 +1,91 @@
+#include "frames_source_mmap.h"
+#include "../media_format.h"
+
+// typedefs
+typedef struct {
+	request_context_t* request_context;
+	u_char* data;
+	uint64_t data_offset;
+	uint64_t data_size;
+	u_char* buffer;
+	uint32_t size;
+} frames_source_mmap_state_t;
+
+vod_status_t
+frames_source_mmap_init(
+	request_context_t* request_context,
+	u_char* data,
+	uint64_t offset,
+	uint64_t size,
+	void** result)
+{
+	frames_source_mmap_state_t* state;
+
+	state = vod_alloc(request_context->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"frames_source_mmap_init: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	state->request_context = request_context;
+	state->data = data;
+	state->data_offset = offset;
+	state->data_size = size;
+
+	*result = state;
+
+	return VOD_OK;
+}
+
+static void
+frames_source_mmap_set_cache_slot_id(void* ctx, int cache_slot_id)
+{
+}
+
+static vod_status_t
+frames_source_mmap_start_frame(void* ctx, input_frame_t* frame, read_cache_hint_t* cache_hint)
+{
+	frames_source_mmap_state_t* state = ctx;
+
+	if (frame->offset < state->data_offset ||
+		frame->offset - state->data_offset > state->data_size || 
+		frame->size > state->data_size - (frame->offset - state->data_offset))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"frames_source_mmap_start_frame: frame offset %uL size %uD exceed the mapped range %uL-%uL",
+			frame->offset, frame->size, state->data_offset, state->data_offset + state->data_size);
+		return VOD_BAD_DATA;
+	}
+
+	state->buffer = state->data + (frame->offset - state->data_offset);
+	state->size = frame->size;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+frames_source_mmap_read(void* ctx, u_char** buffer, uint32_t* size, bool_t* frame_done)
+{
+	frames_source_mmap_state_t* state = ctx;
+
+	*buffer = state->buffer;
+	*size = state->size;
+	*frame_done = TRUE;
+
+	return VOD_OK;
+}
+
+static void
+frames_source_mmap_disable_buffer_reuse(void* ctx)
+{
+}
+
+// globals
+frames_source_t frames_source_mmap = {
+	frames_source_mmap_set_cache_slot_id,
+	frames_source_mmap_start_frame,
+	frames_source_mmap_read,
+	frames_source_mmap_disable_buffer_reuse,
+};
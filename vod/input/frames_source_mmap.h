@@ -0,0 +1,20 @@
+#ifndef __FRAMES_SOURCE_MMAP_H__
+#define __FRAMES_SOURCE_MMAP_H__
+
+// includes
+#include "frames_source.h"
+
+// globals
+extern frames_source_t frames_source_mmap;
+
+// functions
+
+// data points to a mapping of the range [offset, offset + size) of the source file
+vod_status_t frames_source_mmap_init(
+	request_context_t* request_context,
+	u_char* data,
+	uint64_t offset,
+	uint64_t size,
+	void** result);
+
+#endif //__FRAMES_SOURCE_MMAP_H__
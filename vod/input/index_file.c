@@ -0,0 +1,129 @@
+#include "index_file.h"
+#include "../read_stream.h"
+#include "../write_stream.h"
+
+// constants
+#define INDEX_FILE_MAGIC "VIDX"
+#define INDEX_FILE_VERSION (1)
+
+// typedefs
+typedef struct {
+	u_char magic[4];
+	u_char version[4];
+	u_char format_id[4];
+	u_char part_count[4];
+	u_char file_size[8];
+	u_char file_mtime[8];
+} index_file_header_t;		// followed by an 8 byte size per part, and then by the parts
+
+size_t
+index_file_get_header_size(uint32_t part_count)
+{
+	return sizeof(index_file_header_t) + part_count * sizeof(uint64_t);
+}
+
+u_char*
+index_file_write_header(u_char* p, index_file_t* index)
+{
+	uint32_t i;
+
+	p = vod_copy(p, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC) - 1);
+	write_be32(p, INDEX_FILE_VERSION);
+	write_be32(p, index->format_id);
+	write_be32(p, index->part_count);
+	write_be64(p, index->file_size);
+	write_be64(p, index->file_mtime);
+
+	for (i = 0; i < index->part_count; i++)
+	{
+		write_be64(p, (uint64_t)index->parts[i].len);
+	}
+
+	return p;
+}
+
+vod_status_t
+index_file_parse(
+	request_context_t* request_context,
+	vod_str_t* buffer,
+	uint64_t file_size,
+	uint64_t file_mtime,
+	index_file_t* result)
+{
+	index_file_header_t* header;
+	vod_str_t* cur_part;
+	uint64_t part_size;
+	uint32_t part_count;
+	uint32_t i;
+	u_char* sizes;
+	u_char* end;
+	u_char* p;
+
+	if (buffer->len < sizeof(*header))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"index_file_parse: index size %uz too small", buffer->len);
+		return VOD_BAD_DATA;
+	}
+
+	header = (index_file_header_t*)buffer->data;
+	if (vod_memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+		parse_be32(header->version) != INDEX_FILE_VERSION)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"index_file_parse: invalid magic / unsupported version");
+		return VOD_BAD_DATA;
+	}
+
+	if (parse_be64(header->file_size) != file_size ||
+		parse_be64(header->file_mtime) != file_mtime)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"index_file_parse: the index does not match the media file");
+		return VOD_NOT_FOUND;
+	}
+
+	part_count = parse_be32(header->part_count);
+	if (part_count <= 0 || part_count > INDEX_FILE_MAX_PARTS ||
+		buffer->len < index_file_get_header_size(part_count))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"index_file_parse: invalid part count %uD", part_count);
+		return VOD_BAD_DATA;
+	}
+
+	result->parts = vod_alloc(request_context->pool, sizeof(result->parts[0]) * part_count);
+	if (result->parts == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"index_file_parse: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	sizes = (u_char*)(header + 1);
+	p = buffer->data + index_file_get_header_size(part_count);
+	end = buffer->data + buffer->len;
+
+	cur_part = result->parts;
+	for (i = 0; i < part_count; i++, cur_part++)
+	{
+		read_be64(sizes, part_size);
+		if (part_size > (uint64_t)(end - p))
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"index_file_parse: part %uD size %uL overflows the index", i, part_size);
+			return VOD_BAD_DATA;
+		}
+
+		cur_part->data = p;
+		cur_part->len = part_size;
+		p += part_size;
+	}
+
+	result->format_id = parse_be32(header->format_id);
+	result->file_size = file_size;
+	result->file_mtime = file_mtime;
+	result->part_count = part_count;
+
+	return VOD_OK;
+}
@@ -0,0 +1,36 @@
+#ifndef __INDEX_FILE_H__
+#define __INDEX_FILE_H__
+
+// includes
+#include "../common.h"
+
+// constants
+#define INDEX_FILE_EXTENSION ".vodidx"
+#define INDEX_FILE_MAX_PARTS (8)
+
+// typedefs
+typedef struct {
+	uint32_t format_id;
+	uint64_t file_size;			// size of the media file when the index was created
+	uint64_t file_mtime;		// modification time of the media file when the index was created
+	vod_str_t* parts;			// the metadata parts, as returned by the format read_metadata
+	uint32_t part_count;
+} index_file_t;
+
+// functions
+
+// returns the size of the index file header, the parts follow the header in the order they appear in the array
+size_t index_file_get_header_size(uint32_t part_count);
+
+u_char* index_file_write_header(u_char* p, index_file_t* index);
+
+// parses an index file, the returned parts point into the buffer.
+// returns VOD_NOT_FOUND when the index was created for a different version of the media file
+vod_status_t index_file_parse(
+	request_context_t* request_context,
+	vod_str_t* buffer,
+	uint64_t file_size,
+	uint64_t file_mtime,
+	index_file_t* result);
+
+#endif // __INDEX_FILE_H__
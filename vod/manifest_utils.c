@@ -1,4 +1,5 @@
 #include "manifest_utils.h"
+#include "segmenter.h"
 
 // internal flags
 #define ADAPTATION_SETS_FLAG_MULTI_AUDIO		(0x1000)
@@ -1054,3 +1055,164 @@ manifest_utils_get_adaptation_sets(
 
 	return VOD_OK;
 }
+
+static media_sequence_t*
+manifest_utils_get_track_sequence(media_set_t* media_set, media_track_t* track)
+{
+	media_sequence_t* cur_sequence;
+
+	for (cur_sequence = media_set->sequences; cur_sequence < media_set->sequences_end; cur_sequence++)
+	{
+		if (track >= cur_sequence->filtered_clips[0].first_track &&
+			track < cur_sequence->filtered_clips[0].last_track)
+		{
+			return cur_sequence;
+		}
+	}
+
+	return NULL;
+}
+
+// builds a media set that contains only the given tracks (one per media type), as if it was parsed
+// by a request that selected only these tracks. supports single clip media sets only.
+vod_status_t
+manifest_utils_get_tracks_media_set(
+	request_context_t* request_context,
+	media_set_t* media_set,
+	media_track_t** tracks,
+	bool_t has_multi_sequences,
+	media_set_t* result)
+{
+	media_clip_filtered_t* output_clip;
+	media_sequence_t* output_sequence;
+	media_sequence_t* last_sequence;
+	media_sequence_t* cur_sequence;
+	media_track_t* sorted_tracks[MEDIA_TYPE_COUNT];
+	media_track_t* output_track;
+	media_track_t* cur_track;
+	uint32_t track_count;
+	uint32_t media_type;
+	uint32_t i;
+	uint32_t j;
+
+	if (media_set->clip_count != 1)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"manifest_utils_get_tracks_media_set: unexpected clip count %uD", media_set->clip_count);
+		return VOD_UNEXPECTED;
+	}
+
+	// sort the tracks by their position in the filtered tracks array (sequence order, then media type order)
+	track_count = 0;
+	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
+	{
+		cur_track = tracks[media_type];
+		if (cur_track == NULL)
+		{
+			continue;
+		}
+
+		for (j = track_count; j > 0 && sorted_tracks[j - 1] > cur_track; j--)
+		{
+			sorted_tracks[j] = sorted_tracks[j - 1];
+		}
+		sorted_tracks[j] = cur_track;
+		track_count++;
+	}
+
+	if (track_count == 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"manifest_utils_get_tracks_media_set: no tracks");
+		return VOD_UNEXPECTED;
+	}
+
+	// allocate the sequences, filtered clips and tracks
+	output_sequence = vod_alloc(request_context->pool, 
+		(sizeof(*output_sequence) + sizeof(*output_clip) + sizeof(*output_track)) * track_count);
+	if (output_sequence == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"manifest_utils_get_tracks_media_set: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+	output_clip = (void*)(output_sequence + track_count);
+	output_track = (void*)(output_clip + track_count);
+
+	*result = *media_set;
+	result->sequences = output_sequence;
+	result->has_multi_sequences = has_multi_sequences;
+	result->filtered_tracks = output_track;
+	vod_memzero(result->track_count, sizeof(result->track_count));
+	result->total_track_count = track_count;
+
+	output_sequence--;
+	last_sequence = NULL;
+	for (i = 0; i < track_count; i++)
+	{
+		cur_track = sorted_tracks[i];
+
+		cur_sequence = manifest_utils_get_track_sequence(media_set, cur_track);
+		if (cur_sequence == NULL)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"manifest_utils_get_tracks_media_set: track does not belong to the media set");
+			return VOD_UNEXPECTED;
+		}
+
+		if (cur_sequence != last_sequence)
+		{
+			// start a new sequence
+			last_sequence = cur_sequence;
+			output_sequence++;
+			*output_sequence = *cur_sequence;
+
+			vod_memzero(output_sequence->track_count, sizeof(output_sequence->track_count));
+			output_sequence->total_track_count = 0;
+			output_sequence->total_frame_size = 0;
+			output_sequence->total_frame_count = 0;
+			output_sequence->video_key_frame_count = 0;
+
+			output_sequence->filtered_clips = output_clip;
+			output_sequence->filtered_clips_end = output_clip + 1;
+			vod_memzero(output_clip->ref_track, sizeof(output_clip->ref_track));
+			output_clip->first_track = output_track;
+			output_clip++;
+		}
+
+		*output_track = *cur_track;
+
+		media_type = output_track->media_info.media_type;
+		output_sequence->filtered_clips[0].ref_track[media_type] = output_track;
+		output_sequence->filtered_clips[0].last_track = output_track + 1;
+		output_sequence->track_count[media_type]++;
+		output_sequence->total_track_count++;
+		output_sequence->media_type = output_sequence->total_track_count > 1 ? MEDIA_TYPE_NONE : (int)media_type;
+
+		if (media_type == MEDIA_TYPE_VIDEO)
+		{
+			output_sequence->video_key_frame_count += output_track->key_frame_count;
+		}
+		output_sequence->total_frame_count += output_track->frame_count;
+		output_sequence->total_frame_size += output_track->total_frames_size;
+
+		result->track_count[media_type]++;
+		output_track++;
+	}
+
+	result->sequences_end = output_sequence + 1;
+	result->sequence_count = result->sequences_end - result->sequences;
+	result->filtered_tracks_end = output_track;
+
+	if (result->timing.durations == NULL)
+	{
+		result->timing.total_duration = segmenter_get_total_duration(
+			result->segmenter_conf,
+			result,
+			result->sequences,
+			result->sequences_end,
+			MEDIA_TYPE_NONE);
+	}
+
+	return VOD_OK;
+}
@@ -63,4 +63,11 @@ vod_status_t manifest_utils_get_adaptation_sets(
 	uint32_t flags,
 	adaptation_sets_t* output);
 
+vod_status_t manifest_utils_get_tracks_media_set(
+	request_context_t* request_context,
+	media_set_t* media_set,
+	media_track_t** tracks,
+	bool_t has_multi_sequences,
+	media_set_t* result);
+
 #endif //__MANIFEST_UTILS_H__
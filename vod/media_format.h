@@ -45,6 +45,8 @@
 #define PARSE_FLAG_RELATIVE_TIMESTAMPS	(0x00800000)		// relative to segment
 #define PARSE_FLAG_INITIAL_PTS_DELAY	(0x01000000)
 #define PARSE_FLAG_KEY_FRAME_BITRATE	(0x02000000)
+#define PARSE_FLAG_KEY_FRAME_TIMES		(0x04000000)		// mp4 only
+#define PARSE_FLAG_FRAMES_COMPACT		(0x08000000)		// mp4 only
 
 // flag groups
 #define PARSE_FLAG_FRAMES_ALL (PARSE_FLAG_FRAMES_DURATION | PARSE_FLAG_FRAMES_PTS_DELAY | PARSE_FLAG_FRAMES_SIZE | PARSE_FLAG_FRAMES_OFFSET | PARSE_FLAG_FRAMES_IS_KEY)
@@ -62,6 +64,10 @@
 #define REQUEST_FLAG_LOOK_AHEAD_SEGMENTS			(0x10)
 #define REQUEST_FLAG_NO_DISCONTINUITY				(0x20)
 #define REQUEST_FLAG_FORCE_PLAYLIST_TYPE_VOD		(0x40)
+#define REQUEST_FLAG_CHUNKED_OUTPUT					(0x80)		// the segment can be sent before its size is known
+#define REQUEST_FLAG_OFFLOAD_METADATA				(0x100)		// the response is expensive to build, build it on a thread pool if possible
+#define REQUEST_FLAG_PER_CLIP_MEDIA_INFO			(0x200)		// the response may contain the media info of each clip (consistentSequenceMediaInfo)
+#define REQUEST_FLAG_CACHE_GENERATED				(0x400)		// the response is expensive to generate, save it in the generated cache (vod_generated_cache)
 
 #define VOD_CODEC_FLAG(name) (1 << (VOD_CODEC_ID_##name - 1))
 
@@ -128,6 +134,7 @@ typedef struct {
 	int parse_type;
 	int codecs_mask;
 	struct media_clip_source_s* source;
+	vod_str_t* clip_index;		// clipper only, optional. when empty on input, it is set if an index was built
 } media_parse_params_t;
 
 // typedefs
@@ -197,6 +204,13 @@ struct input_frame_s {
 
 typedef struct input_frame_s input_frame_t;
 
+typedef struct {
+	uint64_t* times;		// [count], relative to the first frame
+	uint32_t count;
+	uint32_t timescale;
+	uint64_t duration;		// total duration of all frames
+} media_key_frame_times_t;
+
 typedef struct frame_list_part_s {
 	struct frame_list_part_s* next;
 	input_frame_t* first_frame;
@@ -204,6 +218,7 @@ typedef struct frame_list_part_s {
 	uint32_t clip_to;
 	frames_source_t* frames_source;
 	void* frames_source_context;
+	struct frame_list_compact_s* compact;		// when set, first_frame / last_frame are null
 } frame_list_part_t;
 
 typedef struct {		// mp4 only
@@ -231,6 +246,7 @@ typedef struct media_track_s {
 	raw_atom_t raw_atoms[RTA_COUNT];		// mp4 only
 	void* source_clip;
 	media_encryption_t encryption_info;
+	media_key_frame_times_t* key_frame_times;		// PARSE_FLAG_KEY_FRAME_TIMES only
 	struct media_track_s* next;
 } media_track_t;
 
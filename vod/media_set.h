@@ -104,6 +104,7 @@ typedef struct {
 typedef struct {
 	// initialized during parsing
 	struct segmenter_conf_s* segmenter_conf;
+	struct segment_durations_cache_s* segment_durations_cache;		// optional
 	uint32_t version;
 
 	vod_str_t id;
@@ -165,6 +166,7 @@ typedef struct {
 	uint32_t version;
 	uint32_t width;
 	uint32_t height;
+	uint32_t sprite_duration;		// thumbnail sprites, the duration covered by the sprite that starts at segment_time
 } request_params_t;
 
 #endif //__MEDIA_SET_H__
@@ -2546,7 +2546,26 @@ media_set_parse_json(
 				return VOD_REDIRECT;
 			}
 
+			if (request_params->sprite_duration != 0 &&
+				result->timing.durations != NULL)
+			{
+				// sprite request, the index was converted to time assuming a single clip
+				rc = segmenter_get_sprite_start_time(
+					request_context,
+					&result->timing,
+					request_params->sprite_duration,
+					(uint32_t)(request_params->segment_time / request_params->sprite_duration),
+					&segment_time);
+				if (rc != VOD_OK)
+				{
+					return rc;
+				}
+
+				request_params->segment_time = segment_time;
+			}
+
 			get_ranges_params.time = request_params->segment_time;
+			get_ranges_params.duration = request_params->sprite_duration;
 			rc = segmenter_get_start_end_ranges_gop(
 				&get_ranges_params,
 				&context.clip_ranges);
@@ -2614,8 +2633,11 @@ media_set_parse_json(
 		else
 		{
 			// clip index not specified on the request
+			// Note: inconsistent media info requires parsing all clips only for requests that report it per clip,
+			//		other requests use the durations from the mapping and parse only the reference clip
 			if (params[MEDIA_SET_PARAM_CONSISTENT_SEQUENCE_MEDIA_INFO] != NULL &&
-				!params[MEDIA_SET_PARAM_CONSISTENT_SEQUENCE_MEDIA_INFO]->v.boolean)
+				!params[MEDIA_SET_PARAM_CONSISTENT_SEQUENCE_MEDIA_INFO]->v.boolean &&
+				(request_flags & REQUEST_FLAG_PER_CLIP_MEDIA_INFO) != 0)
 			{
 				parse_all_clips = TRUE;
 			}
@@ -1405,6 +1405,7 @@ mkv_parse_frame(
 		new_frames_part->frames_source = last_frames_part->frames_source;
 		new_frames_part->frames_source_context = last_frames_part->frames_source_context;
 		new_frames_part->clip_to = UINT_MAX;		// XXXXX fix this
+		new_frames_part->compact = NULL;
 
 		last_frames_part->next = new_frames_part;
 		track_context->last_frames_part = new_frames_part;
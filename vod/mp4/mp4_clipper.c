@@ -5,6 +5,10 @@
 #include "mp4_defs.h"
 #include "../read_stream.h"
 
+// constants
+#define MP4_CLIPPER_INDEX_VERSION (1)
+#define MP4_CLIPPER_INDEX_INTERVAL (256)		// number of table entries between checkpoints
+
 // macros
 #define set_be32(p, dw)				\
 	{								\
@@ -26,6 +30,8 @@
 	((u_char*)p)[7] = (qw) & 0xFF;			\
 	}
 
+#define mp4_clipper_index_checkpoint_count(entries) ((entries) > 0 ? ((entries) - 1) / MP4_CLIPPER_INDEX_INTERVAL : 0)
+
 #define full_atom_start(atom) ((atom).ptr - (atom).header_size)
 #define full_atom_size(atom) ((atom).size + (atom).header_size)
 #define copy_full_atom(p, atom) p = vod_copy(p, full_atom_start(atom), full_atom_size(atom))
@@ -184,6 +190,30 @@ typedef struct {
 	uint32_t entries;
 } stco_clip_result_t;
 
+// clip index - built once per file and saved in the metadata cache, the checkpoints
+// enable the iterators to skip directly to the entry that contains the clip position
+typedef struct {
+	uint32_t version;
+	uint32_t trak_count;
+} mp4_clipper_index_header_t;
+
+typedef struct {
+	uint32_t stts_entries;
+	uint32_t ctts_entries;
+	uint32_t stsc_entries;
+	uint32_t size;
+	// followed by -
+	//	mp4_clipper_stts_checkpoint_t[]
+	//	uint32_t ctts_frame_index[]
+	//	uint32_t stsc_frame_index[]
+} mp4_clipper_index_trak_t;
+
+typedef struct {
+	uint64_t accum_duration;
+	uint32_t frame_index;
+	uint32_t reserved;
+} mp4_clipper_stts_checkpoint_t;
+
 typedef struct {
 	atom_info_t atoms[TRAK_ATOM_COUNT];
 	tkhd_clip_result_t tkhd;
@@ -205,6 +235,15 @@ typedef struct {
 	media_parse_params_t parse_params;
 	uint32_t mvhd_timescale;
 	mp4_clipper_parse_result_t result;
+
+	// clip index
+	u_char* index_pos;
+	u_char* index_end;
+	uint32_t index_traks_left;
+	bool_t build_index;
+	bool_t index_used;
+	vod_array_t index_traks;
+	size_t index_size;
 } process_moov_context_t;
 
 typedef struct {
@@ -226,6 +265,8 @@ typedef struct {
 	uint32_t last_chunk_frame_index;
 	uint64_t first_frame_chunk_offset;
 	uint64_t last_frame_chunk_offset;
+
+	mp4_clipper_index_trak_t* index;
 } parse_trak_atom_context_t;
 
 // constants
@@ -324,6 +365,420 @@ mp4_clipper_clip_duration(
 	return VOD_OK;
 }
 
+// clip index
+static size_t
+mp4_clipper_index_get_trak_size(uint32_t stts_entries, uint32_t ctts_entries, uint32_t stsc_entries)
+{
+	size_t result;
+
+	result = sizeof(mp4_clipper_index_trak_t) +
+		sizeof(mp4_clipper_stts_checkpoint_t) * mp4_clipper_index_checkpoint_count(stts_entries) +
+		sizeof(uint32_t) * mp4_clipper_index_checkpoint_count(ctts_entries) +
+		sizeof(uint32_t) * mp4_clipper_index_checkpoint_count(stsc_entries);
+
+	return vod_align(result, sizeof(uint64_t));
+}
+
+static vod_status_t
+mp4_clipper_index_build_trak(
+	process_moov_context_t* context,
+	parsed_trak_t* parsed_trak,
+	mp4_clipper_index_trak_t** result)
+{
+	mp4_clipper_stts_checkpoint_t* stts_checkpoint;
+	mp4_clipper_index_trak_t* index;
+	stts_entry_t* stts_entry;
+	ctts_entry_t* ctts_entry;
+	stsc_entry_t* stsc_entry;
+	vod_status_t rc;
+	uint64_t accum_duration;
+	uint32_t samples_per_chunk;
+	uint32_t stts_entries;
+	uint32_t ctts_entries = 0;
+	uint32_t stsc_entries;
+	uint32_t frame_index;
+	uint32_t next_chunk;
+	uint32_t cur_chunk;
+	uint32_t sample_count;
+	uint32_t* checkpoint;
+	uint32_t i;
+	size_t size;
+
+	rc = mp4_parser_validate_stts_data(context->request_context, &parsed_trak->atoms[TRAK_ATOM_STTS], &stts_entries);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (parsed_trak->atoms[TRAK_ATOM_CTTS].size != 0)
+	{
+		rc = mp4_parser_validate_ctts_atom(context->request_context, &parsed_trak->atoms[TRAK_ATOM_CTTS], &ctts_entries);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	rc = mp4_parser_validate_stsc_atom(context->request_context, &parsed_trak->atoms[TRAK_ATOM_STSC], &stsc_entries);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	size = mp4_clipper_index_get_trak_size(stts_entries, ctts_entries, stsc_entries);
+
+	index = vod_alloc(context->request_context->pool, size);
+	if (index == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"mp4_clipper_index_build_trak: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(index, size);
+	index->stts_entries = stts_entries;
+	index->ctts_entries = ctts_entries;
+	index->stsc_entries = stsc_entries;
+	index->size = size;
+
+	// stts
+	stts_checkpoint = (void*)(index + 1);
+	stts_entry = (stts_entry_t*)(parsed_trak->atoms[TRAK_ATOM_STTS].ptr + sizeof(stts_atom_t));
+	accum_duration = 0;
+	frame_index = 0;
+	for (i = 0; i < stts_entries; i++, stts_entry++)
+	{
+		if (i > 0 && i % MP4_CLIPPER_INDEX_INTERVAL == 0)
+		{
+			stts_checkpoint->accum_duration = accum_duration;
+			stts_checkpoint->frame_index = frame_index;
+			stts_checkpoint++;
+		}
+
+		// Note: using the same arithmetic as mp4_parser_stts_iterator
+		sample_count = parse_be32(stts_entry->count);
+		accum_duration += parse_be32(stts_entry->duration) * sample_count;
+		frame_index += sample_count;
+	}
+
+	// ctts
+	checkpoint = (uint32_t*)stts_checkpoint;
+	ctts_entry = (ctts_entry_t*)(parsed_trak->atoms[TRAK_ATOM_CTTS].ptr + sizeof(ctts_atom_t));
+	frame_index = 0;
+	for (i = 0; i < ctts_entries; i++, ctts_entry++)
+	{
+		if (i > 0 && i % MP4_CLIPPER_INDEX_INTERVAL == 0)
+		{
+			*checkpoint++ = frame_index;
+		}
+
+		frame_index += parse_be32(ctts_entry->count);
+	}
+
+	// stsc - same validations as mp4_parser_stsc_iterator, in case of error the index is not built
+	stsc_entry = (stsc_entry_t*)(parsed_trak->atoms[TRAK_ATOM_STSC].ptr + sizeof(stsc_atom_t));
+	frame_index = 0;
+	if (stsc_entries > 0)
+	{
+		cur_chunk = parse_be32(stsc_entry->first_chunk);
+		samples_per_chunk = parse_be32(stsc_entry->samples_per_chunk);
+		if (cur_chunk < 1 || samples_per_chunk == 0)
+		{
+			*result = NULL;
+			return VOD_OK;
+		}
+
+		for (i = 1; i < stsc_entries; i++)
+		{
+			stsc_entry++;
+
+			next_chunk = parse_be32(stsc_entry->first_chunk);
+			if (next_chunk <= cur_chunk ||
+				next_chunk - cur_chunk > (UINT_MAX - frame_index) / samples_per_chunk)
+			{
+				*result = NULL;
+				return VOD_OK;
+			}
+
+			frame_index += (next_chunk - cur_chunk) * samples_per_chunk;
+			cur_chunk = next_chunk;
+			samples_per_chunk = parse_be32(stsc_entry->samples_per_chunk);
+			if (samples_per_chunk == 0)
+			{
+				*result = NULL;
+				return VOD_OK;
+			}
+
+			if (i % MP4_CLIPPER_INDEX_INTERVAL == 0)
+			{
+				*checkpoint++ = frame_index;
+			}
+		}
+	}
+
+	if (stts_entries > MP4_CLIPPER_INDEX_INTERVAL ||
+		ctts_entries > MP4_CLIPPER_INDEX_INTERVAL ||
+		stsc_entries > MP4_CLIPPER_INDEX_INTERVAL)
+	{
+		context->index_used = TRUE;
+	}
+
+	*result = index;
+	return VOD_OK;
+}
+
+static mp4_clipper_index_trak_t*
+mp4_clipper_index_get_trak(process_moov_context_t* context)
+{
+	mp4_clipper_index_trak_t* index;
+
+	if (context->index_traks_left <= 0)
+	{
+		return NULL;
+	}
+
+	index = (void*)context->index_pos;
+	if ((size_t)(context->index_end - context->index_pos) < sizeof(*index) ||
+		index->size > (size_t)(context->index_end - context->index_pos) ||
+		index->size != mp4_clipper_index_get_trak_size(index->stts_entries, index->ctts_entries, index->stsc_entries))
+	{
+		vod_log_error(VOD_LOG_WARN, context->request_context->log, 0,
+			"mp4_clipper_index_get_trak: invalid clip index");
+		context->index_traks_left = 0;
+		return NULL;
+	}
+
+	context->index_pos += index->size;
+	context->index_traks_left--;
+
+	return index;
+}
+
+static vod_status_t
+mp4_clipper_index_init(process_moov_context_t* context, vod_str_t* clip_index)
+{
+	mp4_clipper_index_header_t* header;
+
+	if (clip_index == NULL)
+	{
+		return VOD_OK;
+	}
+
+	if (clip_index->len <= 0)
+	{
+		// build a new index
+		if (vod_array_init(&context->index_traks, context->request_context->pool, 2, sizeof(mp4_clipper_index_trak_t*)) != VOD_OK)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+				"mp4_clipper_index_init: vod_array_init failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		context->build_index = TRUE;
+		context->index_size = sizeof(*header);
+		return VOD_OK;
+	}
+
+	header = (void*)clip_index->data;
+	if (clip_index->len < sizeof(*header) ||
+		header->version != MP4_CLIPPER_INDEX_VERSION)
+	{
+		vod_log_error(VOD_LOG_WARN, context->request_context->log, 0,
+			"mp4_clipper_index_init: invalid clip index header");
+		return VOD_OK;
+	}
+
+	context->index_pos = clip_index->data + sizeof(*header);
+	context->index_end = clip_index->data + clip_index->len;
+	context->index_traks_left = header->trak_count;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_clipper_index_write(process_moov_context_t* context, vod_str_t* clip_index)
+{
+	mp4_clipper_index_header_t* header;
+	mp4_clipper_index_trak_t** cur_trak;
+	mp4_clipper_index_trak_t** last_trak;
+	u_char* p;
+
+	if (!context->build_index || !context->index_used)
+	{
+		// the tables are small, no reason to save an index
+		return VOD_OK;
+	}
+
+	p = vod_alloc(context->request_context->pool, context->index_size);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"mp4_clipper_index_write: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	clip_index->data = p;
+
+	header = (void*)p;
+	header->version = MP4_CLIPPER_INDEX_VERSION;
+	header->trak_count = context->index_traks.nelts;
+	p += sizeof(*header);
+
+	cur_trak = context->index_traks.elts;
+	last_trak = cur_trak + context->index_traks.nelts;
+	for (; cur_trak < last_trak; cur_trak++)
+	{
+		p = vod_copy(p, *cur_trak, (*cur_trak)->size);
+	}
+
+	clip_index->len = p - clip_index->data;
+
+	return VOD_OK;
+}
+
+static void
+mp4_clipper_index_seek_stts(
+	mp4_clipper_index_trak_t* index,
+	stts_iterator_state_t* iterator,
+	stts_entry_t* first_entry,
+	uint64_t offset)
+{
+	mp4_clipper_stts_checkpoint_t* checkpoints = (void*)(index + 1);
+	stts_entry_t* cur_entry;
+	uint32_t right;
+	uint32_t left;
+	uint32_t mid;
+
+	// find the number of checkpoints that start at or before the offset
+	left = 0;
+	right = mp4_clipper_index_checkpoint_count(index->stts_entries);
+	while (left < right)
+	{
+		mid = (left + right) / 2;
+		if (checkpoints[mid].accum_duration <= offset)
+		{
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
+		}
+	}
+
+	if (left <= 0)
+	{
+		return;
+	}
+
+	cur_entry = first_entry + left * MP4_CLIPPER_INDEX_INTERVAL;
+	if (cur_entry <= iterator->cur_entry)
+	{
+		return;
+	}
+
+	iterator->cur_entry = cur_entry;
+	iterator->sample_count = parse_be32(cur_entry->count);
+	iterator->frame_index = checkpoints[left - 1].frame_index;
+	iterator->accum_duration = checkpoints[left - 1].accum_duration;
+}
+
+static uint32_t
+mp4_clipper_index_find_frame(uint32_t* checkpoints, uint32_t count, uint32_t frame_index)
+{
+	uint32_t right;
+	uint32_t left;
+	uint32_t mid;
+
+	// find the number of checkpoints that start at or before the frame
+	left = 0;
+	right = count;
+	while (left < right)
+	{
+		mid = (left + right) / 2;
+		if (checkpoints[mid] <= frame_index)
+		{
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
+		}
+	}
+
+	return left;
+}
+
+static void
+mp4_clipper_index_seek_ctts(
+	mp4_clipper_index_trak_t* index,
+	ctts_iterator_state_t* iterator,
+	ctts_entry_t* first_entry,
+	uint32_t frame_index)
+{
+	ctts_entry_t* cur_entry;
+	uint32_t* checkpoints;
+	uint32_t count;
+
+	checkpoints = (uint32_t*)((mp4_clipper_stts_checkpoint_t*)(index + 1) + 
+		mp4_clipper_index_checkpoint_count(index->stts_entries));
+
+	count = mp4_clipper_index_find_frame(
+		checkpoints, 
+		mp4_clipper_index_checkpoint_count(index->ctts_entries),
+		frame_index);
+	if (count <= 0)
+	{
+		return;
+	}
+
+	cur_entry = first_entry + count * MP4_CLIPPER_INDEX_INTERVAL;
+	if (cur_entry <= iterator->cur_entry)
+	{
+		return;
+	}
+
+	iterator->cur_entry = cur_entry;
+	iterator->sample_count = parse_be32(cur_entry->count);
+	iterator->frame_index = checkpoints[count - 1];
+}
+
+static void
+mp4_clipper_index_seek_stsc(
+	mp4_clipper_index_trak_t* index,
+	stsc_iterator_state_t* iterator,
+	stsc_entry_t* first_entry,
+	uint32_t frame_index)
+{
+	stsc_entry_t* cur_entry;
+	uint32_t* checkpoints;
+	uint32_t count;
+
+	checkpoints = (uint32_t*)((mp4_clipper_stts_checkpoint_t*)(index + 1) +
+		mp4_clipper_index_checkpoint_count(index->stts_entries)) +
+		mp4_clipper_index_checkpoint_count(index->ctts_entries);
+
+	count = mp4_clipper_index_find_frame(
+		checkpoints,
+		mp4_clipper_index_checkpoint_count(index->stsc_entries),
+		frame_index);
+	if (count <= 0)
+	{
+		return;
+	}
+
+	cur_entry = first_entry + count * MP4_CLIPPER_INDEX_INTERVAL;
+	if (cur_entry <= iterator->cur_entry)
+	{
+		return;
+	}
+
+	iterator->cur_entry = cur_entry;
+	iterator->cur_chunk = parse_be32(cur_entry->first_chunk);
+	iterator->samples_per_chunk = parse_be32(cur_entry->samples_per_chunk);
+	iterator->sample_desc = parse_be32(cur_entry->sample_desc);
+	iterator->frame_index = checkpoints[count - 1];
+}
+
 // mvhd
 static vod_status_t
 mp4_clipper_mvhd_clip_data(
@@ -537,7 +992,9 @@ mp4_clipper_stts_clip_data(
 	uint32_t* first_frame, 
 	uint32_t* last_frame)
 {
+	mp4_clipper_index_trak_t* index;
 	stts_iterator_state_t iterator;
+	stts_entry_t* first_entry;
 	vod_status_t rc;
 	uint32_t entries;
 	uint64_t clip_from;
@@ -557,16 +1014,28 @@ mp4_clipper_stts_clip_data(
 		return VOD_BAD_DATA;
 	}
 
+	index = context->index;
+	if (index != NULL && index->stts_entries != entries)
+	{
+		index = NULL;
+	}
+
 	// parse the first sample
+	first_entry = (stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t));
 	mp4_parser_stts_iterator_init(
 		&iterator,
 		&context->parse_params,
-		(stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t)),
+		first_entry,
 		entries);
 
 	if (context->parse_params.clip_from > 0)
 	{
 		clip_from = (((uint64_t)context->parse_params.clip_from * context->timescale) / 1000);
+		if (index != NULL)
+		{
+			mp4_clipper_index_seek_stts(index, &iterator, first_entry, clip_from);
+		}
+
 		if (!mp4_parser_stts_iterator(&iterator, clip_from))
 		{
 			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
@@ -590,6 +1059,11 @@ mp4_clipper_stts_clip_data(
 		clip_to = ULLONG_MAX;
 	}
 
+	if (index != NULL)
+	{
+		mp4_clipper_index_seek_stts(index, &iterator, first_entry, clip_to);
+	}
+
 	if (mp4_parser_stts_iterator(&iterator, clip_to))
 	{
 		result->last_entry = iterator.cur_entry + 1;
@@ -767,7 +1241,9 @@ mp4_clipper_ctts_clip_data(
 	atom_info_t* atom_info,
 	ctts_clip_result_t* result)
 {
+	mp4_clipper_index_trak_t* index;
 	ctts_iterator_state_t iterator;
+	ctts_entry_t* first_entry;
 	uint32_t entries;
 	vod_status_t rc;
 
@@ -783,14 +1259,26 @@ mp4_clipper_ctts_clip_data(
 		return rc;
 	}
 
+	index = context->index;
+	if (index != NULL && index->ctts_entries != entries)
+	{
+		index = NULL;
+	}
+
 	// parse the first sample
+	first_entry = (ctts_entry_t*)(atom_info->ptr + sizeof(ctts_atom_t));
 	mp4_parser_ctts_iterator_init(
 		&iterator,
-		(ctts_entry_t*)(atom_info->ptr + sizeof(ctts_atom_t)),
+		first_entry,
 		entries);
 
 	if (context->first_frame > 0)
 	{
+		if (index != NULL)
+		{
+			mp4_clipper_index_seek_ctts(index, &iterator, first_entry, context->first_frame);
+		}
+
 		if (!mp4_parser_ctts_iterator(&iterator, context->first_frame))
 		{
 			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
@@ -802,6 +1290,11 @@ mp4_clipper_ctts_clip_data(
 	result->first_entry = iterator.cur_entry;
 	result->first_count = iterator.sample_count;
 
+	if (context->parse_params.clip_to != UINT_MAX && index != NULL)
+	{
+		mp4_clipper_index_seek_ctts(index, &iterator, first_entry, context->last_frame);
+	}
+
 	if (context->parse_params.clip_to != UINT_MAX && 
 		mp4_parser_ctts_iterator(&iterator, context->last_frame))
 	{
@@ -905,6 +1398,17 @@ mp4_clipper_stsc_clip_data(
 		return rc;
 	}
 
+	// Note: only the first jump uses the index, since the previous samples per chunk
+	//		returned by the second jump depend on the entries that were traversed
+	if (context->index != NULL && context->index->stsc_entries == entries)
+	{
+		mp4_clipper_index_seek_stsc(
+			context->index, 
+			&iterator, 
+			(stsc_entry_t*)(atom_info->ptr + sizeof(stsc_atom_t)), 
+			context->first_frame);
+	}
+
 	// jump to the first frame
 	rc = mp4_parser_stsc_iterator(&iterator, context->first_frame, &target_chunk, &sample_count, &next_chunk, &prev_samples);
 	if (rc != VOD_OK)
@@ -1412,6 +1916,7 @@ mp4_clipper_process_moov_atom_callback(void* ctx, atom_info_t* atom_info)
 {
 	process_moov_context_t* context = (process_moov_context_t*)ctx;
 	save_relevant_atoms_context_t save_atoms_context;
+	mp4_clipper_index_trak_t** index_trak;
 	parsed_trak_t** result;
 	parsed_trak_t* parsed_trak;
 	vod_status_t rc;
@@ -1462,6 +1967,38 @@ mp4_clipper_process_moov_atom_callback(void* ctx, atom_info_t* atom_info)
 	parse_context.alloc_size = 4 * ATOM_HEADER_SIZE;	// trak, mdia, minf, stbl
 	parse_context.copy_data = context->result.copy_data;
 
+	// get the clip index of the trak
+	if (context->build_index)
+	{
+		rc = mp4_clipper_index_build_trak(context, parsed_trak, &parse_context.index);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		if (parse_context.index != NULL)
+		{
+			index_trak = vod_array_push(&context->index_traks);
+			if (index_trak == NULL)
+			{
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+					"mp4_clipper_process_moov_atom_callback: vod_array_push failed (1)");
+				return VOD_ALLOC_FAILED;
+			}
+
+			*index_trak = parse_context.index;
+			context->index_size += parse_context.index->size;
+		}
+		else
+		{
+			context->build_index = FALSE;
+		}
+	}
+	else
+	{
+		parse_context.index = mp4_clipper_index_get_trak(context);
+	}
+
 	rc = mp4_clipper_tkhd_clip_data(context, &parsed_trak->atoms[TRAK_ATOM_TKHD], &parsed_trak->tkhd);
 	if (rc != VOD_OK)
 	{
@@ -1583,7 +2120,7 @@ mp4_clipper_process_moov_atom_callback(void* ctx, atom_info_t* atom_info)
 	if (result == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
-			"mp4_clipper_process_moov_atom_callback: vod_array_push failed");
+			"mp4_clipper_process_moov_atom_callback: vod_array_push failed (2)");
 		return VOD_ALLOC_FAILED;
 	}
 
@@ -1685,6 +2222,12 @@ mp4_clipper_parse_moov(
 	process_moov_context.result.alloc_size = ATOM_HEADER_SIZE;		// moov
 	process_moov_context.result.base.first_offset = ULLONG_MAX;
 
+	rc = mp4_clipper_index_init(&process_moov_context, parse_params->clip_index);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
 	rc = mp4_parser_parse_atoms(
 		request_context, 
 		metadata_parts[MP4_METADATA_PART_MOOV].data, 
@@ -1697,6 +2240,12 @@ mp4_clipper_parse_moov(
 		return rc;
 	}
 
+	rc = mp4_clipper_index_write(&process_moov_context, parse_params->clip_index);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
 	if (copy_data)
 	{
 		process_moov_context.result.alloc_size = process_moov_context.result.moov_atom_size;
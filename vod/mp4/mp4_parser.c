@@ -1,8 +1,10 @@
 #include "mp4_parser.h"
 #include "mp4_format.h"
+#include "mp4_table_decoder.h"
 #include "mp4_defs.h"
 #include "../media_format.h"
 #include "../input/frames_source_cache.h"
+#include "../input/frame_list.h"
 #include "../read_stream.h"
 #include "../write_stream.h"
 #include "../codec_config.h"
@@ -123,6 +125,7 @@ typedef struct {
 	media_encryption_t encryption_info;
 	uint32_t auxiliary_info_start_offset;
 	uint32_t auxiliary_info_end_offset;
+	media_key_frame_times_t* key_frame_times;
 } frames_parse_context_t;
 
 typedef struct {
@@ -529,13 +532,9 @@ mp4_parser_parse_mdhd_atom(atom_info_t* atom_info, metadata_parse_context_t* con
 static vod_status_t
 mp4_parser_parse_stts_atom_total_duration_only(atom_info_t* atom_info, metadata_parse_context_t* context)
 {
-	const stts_entry_t* last_entry;
-	const stts_entry_t* cur_entry;
 	uint64_t duration;
 	uint32_t timescale;
 	uint32_t entries;
-	uint32_t sample_duration;
-	uint32_t sample_count;
 	vod_status_t rc;
 
 	rc = mp4_parser_validate_stts_data(context->request_context, atom_info, &entries);
@@ -544,16 +543,7 @@ mp4_parser_parse_stts_atom_total_duration_only(atom_info_t* atom_info, metadata_
 		return rc;
 	}
 
-	cur_entry = (const stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t));
-	last_entry = cur_entry + entries;
-
-	duration = 0;
-	for (; cur_entry < last_entry; cur_entry++)
-	{
-		sample_duration = parse_be32(cur_entry->duration);
-		sample_count = parse_be32(cur_entry->count);
-		duration += (uint64_t)sample_duration * sample_count;
-	}
+	duration = mp4_table_decode_stts_duration(atom_info->ptr + sizeof(stts_atom_t), entries);
 
 	timescale = context->media_info.timescale;
 	if (duration > (uint64_t)MAX_DURATION_SEC * timescale)
@@ -1310,17 +1300,11 @@ mp4_parser_parse_stco_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		cur_pos = atom_info->ptr + sizeof(stco_atom_t) + context->first_frame * entry_size;
 		if (atom_info->name == ATOM_NAME_CO64)
 		{
-			for (; cur_frame < last_frame; cur_frame++)
-			{
-				read_be64(cur_pos, cur_frame->offset);
-			}
+			mp4_table_decode_stco64(cur_frame, last_frame, cur_pos);
 		}
 		else
 		{
-			for (; cur_frame < last_frame; cur_frame++)
-			{
-				read_be32(cur_pos, cur_frame->offset);
-			}
+			mp4_table_decode_stco32(cur_frame, last_frame, cur_pos);
 		}
 		return VOD_OK;
 	}
@@ -1765,6 +1749,7 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	const u_char* cur_pos;
 	uint32_t uniform_size;
 	uint32_t cur_size;
+	uint32_t max_size;
 	uint32_t entries;
 	unsigned field_size;
 	vod_status_t rc;
@@ -1794,17 +1779,12 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		{
 			context->first_frame_chunk_offset += parse_be32(cur_pos);
 		}
-		for (; cur_frame < last_frame; cur_frame++)
+		context->total_frames_size += mp4_table_decode_stsz32(cur_frame, last_frame, cur_pos, &max_size);
+		if (max_size > MAX_FRAME_SIZE)
 		{
-			read_be32(cur_pos, cur_size);
-			if (cur_size > MAX_FRAME_SIZE)
-			{
-				vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
-					"mp4_parser_parse_stsz_atom: frame size %uD too big", cur_size);
-				return VOD_BAD_DATA;
-			}
-			context->total_frames_size += cur_size;
-			cur_frame->size = cur_size;
+			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+				"mp4_parser_parse_stsz_atom: frame size %uD too big", max_size);
+			return VOD_BAD_DATA;
 		}
 		break;
 
@@ -1814,13 +1794,8 @@ mp4_parser_parse_stsz_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		{
 			context->first_frame_chunk_offset += parse_be16(cur_pos);
 		}
-		for (; cur_frame < last_frame; cur_frame++)
-		{
-			read_be16(cur_pos, cur_size);
-			// Note: no need to validate the size here, since MAX_UINT16 < MAX_FRAME_SIZE
-			context->total_frames_size += cur_size;
-			cur_frame->size = cur_size;
-		}
+		// Note: no need to validate the size here, since MAX_UINT16 < MAX_FRAME_SIZE
+		context->total_frames_size += mp4_table_decode_stsz16(cur_frame, last_frame, cur_pos);
 		break;
 		
 	case 8:
@@ -1912,6 +1887,127 @@ mp4_parser_parse_stss_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	return VOD_OK;
 }
 
+static vod_status_t
+mp4_parser_parse_key_frame_times(
+	frames_parse_context_t* context,
+	atom_info_t* stts,
+	atom_info_t* stss)
+{
+	media_key_frame_times_t* result;
+	media_range_t* range = context->parse_params.range;
+	const stts_entry_t* last_entry;
+	const stts_entry_t* cur_entry;
+	const uint32_t* cur_pos;
+	const uint32_t* end_pos;
+	uint64_t accum_duration = 0;
+	uint64_t* cur_time;
+	uint32_t stts_entries;
+	uint32_t stss_entries;
+	uint32_t sample_duration = 0;
+	uint32_t sample_count = 0;
+	uint32_t frame_index = 0;
+	uint32_t key_frame_index;
+	uint32_t prev_key_frame_index = 0;
+	vod_status_t rc;
+
+	if (stss->size == 0)
+	{
+		// all frames are key frames, the segmenter falls back to estimate
+		return VOD_OK;
+	}
+
+	if (context->parse_params.clip_from > 0 ||
+		range->start != 0 ||
+		range->end != ULLONG_MAX)
+	{
+		// the times are relative to the beginning of the file, not supported with clipping
+		return VOD_OK;
+	}
+
+	rc = mp4_parser_validate_stts_data(context->request_context, stts, &stts_entries);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = mp4_parser_validate_stss_atom(context->request_context, stss, &stss_entries);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	result = vod_alloc(context->request_context->pool, sizeof(*result) + sizeof(result->times[0]) * stss_entries);
+	if (result == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"mp4_parser_parse_key_frame_times: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	result->times = (uint64_t*)(result + 1);
+	result->timescale = context->media_info->timescale;
+
+	cur_entry = (const stts_entry_t*)(stts->ptr + sizeof(stts_atom_t));
+	last_entry = cur_entry + stts_entries;
+
+	cur_pos = (const uint32_t*)(stss->ptr + sizeof(stss_atom_t));
+	end_pos = cur_pos + stss_entries;
+
+	cur_time = result->times;
+
+	// walk the stts entries only up to each key frame, without expanding them to frames
+	for (; cur_pos < end_pos; cur_pos++)
+	{
+		key_frame_index = parse_be32(cur_pos) - 1;		// 1 based index
+		if (cur_time > result->times && key_frame_index <= prev_key_frame_index)
+		{
+			if (key_frame_index == prev_key_frame_index)
+			{
+				continue;		// frame listed twice
+			}
+
+			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+				"mp4_parser_parse_key_frame_times: frame indexes are not strictly ascending");
+			return VOD_BAD_DATA;
+		}
+
+		while (key_frame_index >= frame_index + sample_count)
+		{
+			frame_index += sample_count;
+			accum_duration += (uint64_t)sample_duration * sample_count;
+			sample_count = 0;
+
+			if (cur_entry >= last_entry)
+			{
+				goto done;		// key frame index exceeds the number of frames
+			}
+
+			sample_duration = parse_be32(cur_entry->duration);
+			sample_count = parse_be32(cur_entry->count);
+			cur_entry++;
+		}
+
+		*cur_time++ = accum_duration + (uint64_t)(key_frame_index - frame_index) * sample_duration;
+		prev_key_frame_index = key_frame_index;
+	}
+
+done:
+
+	// get the total duration
+	accum_duration += (uint64_t)sample_duration * sample_count;
+	for (; cur_entry < last_entry; cur_entry++)
+	{
+		accum_duration += (uint64_t)parse_be32(cur_entry->duration) * parse_be32(cur_entry->count);
+	}
+
+	result->count = cur_time - result->times;
+	result->duration = accum_duration;
+
+	context->key_frame_times = result;
+
+	return VOD_OK;
+}
+
 static vod_status_t
 mp4_parser_parse_sinf_atoms(void* ctx, atom_info_t* atom_info)
 {
@@ -3159,6 +3255,19 @@ mp4_parser_parse_frames(
 			}
 		}
 
+		if ((parse_params->parse_type & PARSE_FLAG_KEY_FRAME_TIMES) != 0 &&
+			media_type == MEDIA_TYPE_VIDEO)
+		{
+			rc = mp4_parser_parse_key_frame_times(
+				&context,
+				&cur_track->trak_atom_infos.stts,
+				&cur_track->trak_atom_infos.stss);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
 		result_track = vod_array_push(&tracks);
 		if (result_track == NULL)
 		{
@@ -3216,6 +3325,7 @@ mp4_parser_parse_frames(
 		result_track->frames.first_frame = context.frames;
 		result_track->frames.last_frame = context.frames + context.frame_count;
 		result_track->frames.clip_to = context.clip_to;
+		result_track->frames.compact = NULL;
 
 		// copy the result
 		result_track->media_info = cur_track->media_info;
@@ -3229,6 +3339,7 @@ mp4_parser_parse_frames(
 		result_track->first_frame_time_offset = context.first_frame_time_offset;
 		result_track->clip_from_frame_offset = context.clip_from_frame_offset;
 		result_track->source_clip = NULL;
+		result_track->key_frame_times = context.key_frame_times;
 
 		// update the last offset of the source clip
 		if (context.frame_count > 0 && 
@@ -3265,6 +3376,20 @@ mp4_parser_parse_frames(
 			cur_frame->pts_delay += context.dts_shift;
 		}
 
+		// audio frames are uniform enough to be kept run length encoded
+		if ((parse_params->parse_type & PARSE_FLAG_FRAMES_COMPACT) != 0 &&
+			media_type == MEDIA_TYPE_AUDIO)
+		{
+			rc = frame_list_compact_encode(
+				request_context,
+				&result_track->frames,
+				cur_track->media_info.timescale);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
 		result->track_count[media_type]++;
 	}
 
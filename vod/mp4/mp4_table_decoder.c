@@ -0,0 +1,433 @@
+#include "mp4_table_decoder.h"
+#include "mp4_defs.h"
+#include "../read_stream.h"
+
+#if (VOD_HAVE_X86_SIMD)
+#include <immintrin.h>
+
+#define MP4_TABLE_DECODER_SSSE3_TARGET __attribute__((target("ssse3")))
+#define MP4_TABLE_DECODER_AVX2_TARGET __attribute__((target("avx2")))
+#endif // VOD_HAVE_X86_SIMD
+
+// typedefs
+typedef struct {
+	const char* name;
+	uint64_t(*stsz32)(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src, uint32_t* max_size);
+	uint64_t(*stsz16)(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src);
+	void(*stco32)(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src);
+	void(*stco64)(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src);
+	uint64_t(*stts_duration)(const u_char* src, uint32_t entries);
+} mp4_table_decoder_t;
+
+// scalar
+static uint64_t
+mp4_table_decode_stsz32_scalar(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src, uint32_t* max_size)
+{
+	uint64_t total_size = 0;
+	uint32_t cur_max = 0;
+	uint32_t cur_size;
+
+	for (; cur_frame < last_frame; cur_frame++)
+	{
+		read_be32(src, cur_size);
+		if (cur_size > cur_max)
+		{
+			cur_max = cur_size;
+		}
+		total_size += cur_size;
+		cur_frame->size = cur_size;
+	}
+
+	*max_size = cur_max;
+	return total_size;
+}
+
+static uint64_t
+mp4_table_decode_stsz16_scalar(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	uint64_t total_size = 0;
+	uint32_t cur_size;
+
+	for (; cur_frame < last_frame; cur_frame++)
+	{
+		read_be16(src, cur_size);
+		total_size += cur_size;
+		cur_frame->size = cur_size;
+	}
+
+	return total_size;
+}
+
+static void
+mp4_table_decode_stco32_scalar(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	for (; cur_frame < last_frame; cur_frame++)
+	{
+		read_be32(src, cur_frame->offset);
+	}
+}
+
+static void
+mp4_table_decode_stco64_scalar(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	for (; cur_frame < last_frame; cur_frame++)
+	{
+		read_be64(src, cur_frame->offset);
+	}
+}
+
+static uint64_t
+mp4_table_decode_stts_duration_scalar(const u_char* src, uint32_t entries)
+{
+	const stts_entry_t* cur_entry = (const stts_entry_t*)src;
+	const stts_entry_t* last_entry = cur_entry + entries;
+	uint64_t duration = 0;
+
+	for (; cur_entry < last_entry; cur_entry++)
+	{
+		duration += (uint64_t)parse_be32(cur_entry->duration) * parse_be32(cur_entry->count);
+	}
+
+	return duration;
+}
+
+#if (VOD_HAVE_X86_SIMD)
+
+// Note: the frames are not contiguous in memory, so the swapped values are stored to a temporary
+//		buffer and scattered from there, the gain is in the byte swapping / summing / validation
+
+// ssse3
+MP4_TABLE_DECODER_SSSE3_TARGET static uint64_t
+mp4_table_decode_stsz32_ssse3(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src, uint32_t* max_size)
+{
+	const __m128i swap_mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	const __m128i sign_bit = _mm_set1_epi32(0x80000000);
+	uint32_t sizes[4];
+	uint32_t scalar_max;
+	uint64_t totals[2];
+	__m128i max_biased = sign_bit;
+	__m128i total = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	__m128i values;
+	__m128i biased;
+	__m128i mask;
+	uint64_t result;
+
+	for (; last_frame - cur_frame >= 4; cur_frame += 4, src += 4 * sizeof(uint32_t))
+	{
+		values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap_mask);
+		_mm_storeu_si128((__m128i*)sizes, values);
+
+		// unsigned max, using a signed compare on the values with the sign bit flipped
+		biased = _mm_xor_si128(values, sign_bit);
+		mask = _mm_cmpgt_epi32(biased, max_biased);
+		max_biased = _mm_or_si128(_mm_and_si128(mask, biased), _mm_andnot_si128(mask, max_biased));
+
+		total = _mm_add_epi64(total, _mm_unpacklo_epi32(values, zero));
+		total = _mm_add_epi64(total, _mm_unpackhi_epi32(values, zero));
+
+		cur_frame[0].size = sizes[0];
+		cur_frame[1].size = sizes[1];
+		cur_frame[2].size = sizes[2];
+		cur_frame[3].size = sizes[3];
+	}
+
+	_mm_storeu_si128((__m128i*)sizes, _mm_xor_si128(max_biased, sign_bit));
+	_mm_storeu_si128((__m128i*)totals, total);
+
+	result = totals[0] + totals[1] + mp4_table_decode_stsz32_scalar(cur_frame, last_frame, src, &scalar_max);
+
+	*max_size = vod_max(vod_max(sizes[0], sizes[1]), vod_max(sizes[2], sizes[3]));
+	*max_size = vod_max(*max_size, scalar_max);
+
+	return result;
+}
+
+MP4_TABLE_DECODER_SSSE3_TARGET static uint64_t
+mp4_table_decode_stsz16_ssse3(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	const __m128i swap_mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+	const __m128i low_byte_mask = _mm_set1_epi16(0xff);
+	uint16_t sizes[8];
+	uint64_t totals[2];
+	__m128i total = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	__m128i values;
+
+	for (; last_frame - cur_frame >= 8; cur_frame += 8, src += 8 * sizeof(uint16_t))
+	{
+		values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap_mask);
+		_mm_storeu_si128((__m128i*)sizes, values);
+
+		// sum of absolute differences against zero = sum of the bytes in each 64 bit half
+		total = _mm_add_epi64(total, _mm_sad_epu8(_mm_and_si128(values, low_byte_mask), zero));
+		total = _mm_add_epi64(total, _mm_slli_epi64(_mm_sad_epu8(_mm_srli_epi16(values, 8), zero), 8));
+
+		cur_frame[0].size = sizes[0];
+		cur_frame[1].size = sizes[1];
+		cur_frame[2].size = sizes[2];
+		cur_frame[3].size = sizes[3];
+		cur_frame[4].size = sizes[4];
+		cur_frame[5].size = sizes[5];
+		cur_frame[6].size = sizes[6];
+		cur_frame[7].size = sizes[7];
+	}
+
+	_mm_storeu_si128((__m128i*)totals, total);
+
+	return totals[0] + totals[1] + mp4_table_decode_stsz16_scalar(cur_frame, last_frame, src);
+}
+
+MP4_TABLE_DECODER_SSSE3_TARGET static void
+mp4_table_decode_stco64_ssse3(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	const __m128i swap_mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	uint64_t offsets[2];
+
+	for (; last_frame - cur_frame >= 2; cur_frame += 2, src += 2 * sizeof(uint64_t))
+	{
+		_mm_storeu_si128((__m128i*)offsets, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap_mask));
+
+		cur_frame[0].offset = offsets[0];
+		cur_frame[1].offset = offsets[1];
+	}
+
+	mp4_table_decode_stco64_scalar(cur_frame, last_frame, src);
+}
+
+MP4_TABLE_DECODER_SSSE3_TARGET static uint64_t
+mp4_table_decode_stts_duration_ssse3(const u_char* src, uint32_t entries)
+{
+	const __m128i swap_mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint64_t totals[2];
+	__m128i total = _mm_setzero_si128();
+	__m128i values;
+
+	// each 128 bit load contains 2 entries - count0, duration0, count1, duration1
+	for (; entries >= 2; entries -= 2, src += 2 * sizeof(stts_entry_t))
+	{
+		values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap_mask);
+		total = _mm_add_epi64(total, _mm_mul_epu32(values, _mm_srli_epi64(values, 32)));
+	}
+
+	_mm_storeu_si128((__m128i*)totals, total);
+
+	return totals[0] + totals[1] + mp4_table_decode_stts_duration_scalar(src, entries);
+}
+
+// avx2
+MP4_TABLE_DECODER_AVX2_TARGET static uint64_t
+mp4_table_decode_stsz16_avx2(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	const __m256i swap_mask = _mm256_set_epi8(
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+	uint32_t sizes[16];
+	uint64_t totals[4];
+	__m256i total = _mm256_setzero_si256();
+	__m256i values;
+	__m256i low;
+	__m256i high;
+	uint32_t i;
+
+	for (; last_frame - cur_frame >= 16; cur_frame += 16, src += 16 * sizeof(uint16_t))
+	{
+		values = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), swap_mask);
+
+		// widen to 32 bit
+		low = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(values));
+		high = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(values, 1));
+		_mm256_storeu_si256((__m256i*)sizes, low);
+		_mm256_storeu_si256((__m256i*)sizes + 1, high);
+
+		// Note: the sum of 2 16 bit values fits in 32 bit, widen to 64 bit before accumulating
+		low = _mm256_add_epi32(low, high);
+		total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(low)));
+		total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(low, 1)));
+
+		for (i = 0; i < 16; i++)
+		{
+			cur_frame[i].size = sizes[i];
+		}
+	}
+
+	_mm256_storeu_si256((__m256i*)totals, total);
+
+	return totals[0] + totals[1] + totals[2] + totals[3] +
+		mp4_table_decode_stsz16_scalar(cur_frame, last_frame, src);
+}
+
+MP4_TABLE_DECODER_AVX2_TARGET static void
+mp4_table_decode_stco32_avx2(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	const __m128i swap_mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint64_t offsets[4];
+	__m128i values;
+
+	for (; last_frame - cur_frame >= 4; cur_frame += 4, src += 4 * sizeof(uint32_t))
+	{
+		values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap_mask);
+		_mm256_storeu_si256((__m256i*)offsets, _mm256_cvtepu32_epi64(values));
+
+		cur_frame[0].offset = offsets[0];
+		cur_frame[1].offset = offsets[1];
+		cur_frame[2].offset = offsets[2];
+		cur_frame[3].offset = offsets[3];
+	}
+
+	mp4_table_decode_stco32_scalar(cur_frame, last_frame, src);
+}
+
+MP4_TABLE_DECODER_AVX2_TARGET static void
+mp4_table_decode_stco64_avx2(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	const __m256i swap_mask = _mm256_set_epi8(
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	uint64_t offsets[4];
+
+	for (; last_frame - cur_frame >= 4; cur_frame += 4, src += 4 * sizeof(uint64_t))
+	{
+		_mm256_storeu_si256((__m256i*)offsets,
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), swap_mask));
+
+		cur_frame[0].offset = offsets[0];
+		cur_frame[1].offset = offsets[1];
+		cur_frame[2].offset = offsets[2];
+		cur_frame[3].offset = offsets[3];
+	}
+
+	mp4_table_decode_stco64_scalar(cur_frame, last_frame, src);
+}
+
+MP4_TABLE_DECODER_AVX2_TARGET static uint64_t
+mp4_table_decode_stts_duration_avx2(const u_char* src, uint32_t entries)
+{
+	const __m256i swap_mask = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint64_t totals[4];
+	__m256i total = _mm256_setzero_si256();
+	__m256i values;
+
+	for (; entries >= 4; entries -= 4, src += 4 * sizeof(stts_entry_t))
+	{
+		values = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), swap_mask);
+		total = _mm256_add_epi64(total, _mm256_mul_epu32(values, _mm256_srli_epi64(values, 32)));
+	}
+
+	_mm256_storeu_si256((__m256i*)totals, total);
+
+	return totals[0] + totals[1] + totals[2] + totals[3] +
+		mp4_table_decode_stts_duration_scalar(src, entries);
+}
+
+#endif // VOD_HAVE_X86_SIMD
+
+// globals
+static const mp4_table_decoder_t mp4_table_decoders[MP4_TABLE_DECODER_COUNT] = {
+	{
+		"scalar",
+		mp4_table_decode_stsz32_scalar,
+		mp4_table_decode_stsz16_scalar,
+		mp4_table_decode_stco32_scalar,
+		mp4_table_decode_stco64_scalar,
+		mp4_table_decode_stts_duration_scalar,
+	},
+#if (VOD_HAVE_X86_SIMD)
+	{
+		"ssse3",
+		mp4_table_decode_stsz32_ssse3,
+		mp4_table_decode_stsz16_ssse3,
+		mp4_table_decode_stco32_scalar,			// the 128 bit version was measured slower than scalar
+		mp4_table_decode_stco64_ssse3,
+		mp4_table_decode_stts_duration_ssse3,
+	},
+	{
+		"avx2",
+		mp4_table_decode_stsz32_ssse3,			// the 256 bit version was measured slower than 128 bit
+		mp4_table_decode_stsz16_avx2,
+		mp4_table_decode_stco32_avx2,
+		mp4_table_decode_stco64_avx2,
+		mp4_table_decode_stts_duration_avx2,
+	},
+#endif // VOD_HAVE_X86_SIMD
+};
+
+static const mp4_table_decoder_t* mp4_table_decoder = NULL;
+
+uint32_t
+mp4_table_decoder_init(uint32_t max_level)
+{
+	uint32_t level = MP4_TABLE_DECODER_SCALAR;
+
+#if (VOD_HAVE_X86_SIMD)
+	__builtin_cpu_init();
+
+	if (max_level >= MP4_TABLE_DECODER_AVX2 && __builtin_cpu_supports("avx2"))
+	{
+		level = MP4_TABLE_DECODER_AVX2;
+	}
+	else if (max_level >= MP4_TABLE_DECODER_SSSE3 && __builtin_cpu_supports("ssse3"))
+	{
+		level = MP4_TABLE_DECODER_SSSE3;
+	}
+#endif // VOD_HAVE_X86_SIMD
+
+	mp4_table_decoder = &mp4_table_decoders[level];
+
+	return level;
+}
+
+const char*
+mp4_table_decoder_get_name(uint32_t level)
+{
+	if (level >= vod_array_entries(mp4_table_decoders))
+	{
+		return NULL;
+	}
+
+	return mp4_table_decoders[level].name;
+}
+
+static const mp4_table_decoder_t*
+mp4_table_decoder_get()
+{
+	// Note: concurrent initialization is harmless, all threads select the same implementation
+	if (mp4_table_decoder == NULL)
+	{
+		mp4_table_decoder_init(MP4_TABLE_DECODER_COUNT - 1);
+	}
+
+	return mp4_table_decoder;
+}
+
+uint64_t
+mp4_table_decode_stsz32(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src, uint32_t* max_size)
+{
+	return mp4_table_decoder_get()->stsz32(cur_frame, last_frame, src, max_size);
+}
+
+uint64_t
+mp4_table_decode_stsz16(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	return mp4_table_decoder_get()->stsz16(cur_frame, last_frame, src);
+}
+
+void
+mp4_table_decode_stco32(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	mp4_table_decoder_get()->stco32(cur_frame, last_frame, src);
+}
+
+void
+mp4_table_decode_stco64(input_frame_t* cur_frame, input_frame_t* last_frame, const u_char* src)
+{
+	mp4_table_decoder_get()->stco64(cur_frame, last_frame, src);
+}
+
+uint64_t
+mp4_table_decode_stts_duration(const u_char* src, uint32_t entries)
+{
+	return mp4_table_decoder_get()->stts_duration(src, entries);
+}
@@ -0,0 +1,55 @@
+#ifndef __MP4_TABLE_DECODER_H__
+#define __MP4_TABLE_DECODER_H__
+
+// includes
+#include "../media_format.h"
+
+// typedefs
+enum {
+	MP4_TABLE_DECODER_SCALAR,
+	MP4_TABLE_DECODER_SSSE3,
+	MP4_TABLE_DECODER_AVX2,
+
+	MP4_TABLE_DECODER_COUNT
+};
+
+// functions
+
+// selects the implementation according to the cpu features, capped by max_level,
+// returns the selected level. calling this function is optional, when not called,
+// the best implementation is selected on first use
+uint32_t mp4_table_decoder_init(uint32_t max_level);
+
+const char* mp4_table_decoder_get_name(uint32_t level);
+
+// sets the size of the frames from a 32 bit stsz table, returns the total size,
+// max_size is set to the largest size that was read
+uint64_t mp4_table_decode_stsz32(
+	input_frame_t* cur_frame,
+	input_frame_t* last_frame,
+	const u_char* src,
+	uint32_t* max_size);
+
+// sets the size of the frames from a 16 bit stsz table, returns the total size
+uint64_t mp4_table_decode_stsz16(
+	input_frame_t* cur_frame,
+	input_frame_t* last_frame,
+	const u_char* src);
+
+// sets the offset of the frames from a stco / co64 table
+void mp4_table_decode_stco32(
+	input_frame_t* cur_frame,
+	input_frame_t* last_frame,
+	const u_char* src);
+
+void mp4_table_decode_stco64(
+	input_frame_t* cur_frame,
+	input_frame_t* last_frame,
+	const u_char* src);
+
+// returns the sum of count * duration of the stts entries
+uint64_t mp4_table_decode_stts_duration(
+	const u_char* src,
+	uint32_t entries);
+
+#endif // __MP4_TABLE_DECODER_H__
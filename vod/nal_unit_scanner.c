@@ -0,0 +1,155 @@
+#include "nal_unit_scanner.h"
+
+#if (VOD_HAVE_X86_SIMD)
+#include <immintrin.h>
+
+#define NAL_UNIT_SCANNER_SSE2_TARGET __attribute__((target("sse2")))
+#define NAL_UNIT_SCANNER_AVX2_TARGET __attribute__((target("avx2")))
+#endif // VOD_HAVE_X86_SIMD
+
+// typedefs
+typedef struct {
+	const char* name;
+	const u_char*(*find_zero_pair)(const u_char* cur_pos, const u_char* end_pos);
+} nal_unit_scanner_t;
+
+// scalar
+static const u_char*
+nal_unit_scanner_find_zero_pair_scalar(const u_char* cur_pos, const u_char* end_pos)
+{
+	const u_char* limit = end_pos - 1;
+
+	for (; cur_pos < limit; cur_pos++)
+	{
+		if (cur_pos[1] != 0)
+		{
+			cur_pos++;		// neither cur_pos nor cur_pos + 1 can start a zero pair
+			continue;
+		}
+
+		if (cur_pos[0] == 0)
+		{
+			return cur_pos;
+		}
+	}
+
+	return end_pos;
+}
+
+#if (VOD_HAVE_X86_SIMD)
+
+// compare each byte and the byte that follows it to zero, a set bit in the mask marks a zero pair
+
+// sse2
+NAL_UNIT_SCANNER_SSE2_TARGET static const u_char*
+nal_unit_scanner_find_zero_pair_sse2(const u_char* cur_pos, const u_char* end_pos)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i first;
+	__m128i second;
+	int mask;
+
+	for (; cur_pos + sizeof(__m128i) < end_pos; cur_pos += sizeof(__m128i))
+	{
+		first = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)cur_pos), zero);
+		second = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(cur_pos + 1)), zero);
+		mask = _mm_movemask_epi8(_mm_and_si128(first, second));
+		if (mask != 0)
+		{
+			return cur_pos + __builtin_ctz(mask);
+		}
+	}
+
+	return nal_unit_scanner_find_zero_pair_scalar(cur_pos, end_pos);
+}
+
+// avx2
+NAL_UNIT_SCANNER_AVX2_TARGET static const u_char*
+nal_unit_scanner_find_zero_pair_avx2(const u_char* cur_pos, const u_char* end_pos)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i first;
+	__m256i second;
+	uint32_t mask;
+
+	for (; cur_pos + sizeof(__m256i) < end_pos; cur_pos += sizeof(__m256i))
+	{
+		first = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)cur_pos), zero);
+		second = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(cur_pos + 1)), zero);
+		mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(first, second));
+		if (mask != 0)
+		{
+			return cur_pos + __builtin_ctz(mask);
+		}
+	}
+
+	return nal_unit_scanner_find_zero_pair_sse2(cur_pos, end_pos);
+}
+
+#endif // VOD_HAVE_X86_SIMD
+
+// globals
+static const nal_unit_scanner_t nal_unit_scanners[] = {
+	{
+		"scalar",
+		nal_unit_scanner_find_zero_pair_scalar,
+	},
+#if (VOD_HAVE_X86_SIMD)
+	{
+		"sse2",
+		nal_unit_scanner_find_zero_pair_sse2,
+	},
+	{
+		"avx2",
+		nal_unit_scanner_find_zero_pair_avx2,
+	},
+#endif // VOD_HAVE_X86_SIMD
+};
+
+static const nal_unit_scanner_t* nal_unit_scanner = NULL;
+
+uint32_t
+nal_unit_scanner_init(uint32_t max_level)
+{
+	uint32_t level = NAL_UNIT_SCANNER_SCALAR;
+
+#if (VOD_HAVE_X86_SIMD)
+	__builtin_cpu_init();
+
+	if (max_level >= NAL_UNIT_SCANNER_AVX2 && __builtin_cpu_supports("avx2"))
+	{
+		level = NAL_UNIT_SCANNER_AVX2;
+	}
+	else if (max_level >= NAL_UNIT_SCANNER_SSE2 && __builtin_cpu_supports("sse2"))
+	{
+		level = NAL_UNIT_SCANNER_SSE2;
+	}
+#endif // VOD_HAVE_X86_SIMD
+
+	nal_unit_scanner = &nal_unit_scanners[level];
+
+	return level;
+}
+
+const char*
+nal_unit_scanner_get_name(uint32_t level)
+{
+	if (level >= vod_array_entries(nal_unit_scanners))
+	{
+		return NULL;
+	}
+
+	return nal_unit_scanners[level].name;
+}
+
+const u_char*
+nal_unit_scanner_find_zero_pair(const u_char* cur_pos, const u_char* end_pos)
+{
+	// Note: concurrent initialization is harmless, all threads select the same implementation
+	if (nal_unit_scanner == NULL)
+	{
+		nal_unit_scanner_init(NAL_UNIT_SCANNER_COUNT - 1);
+	}
+
+	return nal_unit_scanner->find_zero_pair(cur_pos, end_pos);
+}
@@ -0,0 +1,32 @@
+#ifndef __NAL_UNIT_SCANNER_H__
+#define __NAL_UNIT_SCANNER_H__
+
+// includes
+#include "common.h"
+
+// typedefs
+enum {
+	NAL_UNIT_SCANNER_SCALAR,
+	NAL_UNIT_SCANNER_SSE2,
+	NAL_UNIT_SCANNER_AVX2,
+
+	NAL_UNIT_SCANNER_COUNT
+};
+
+// functions
+
+// selects the implementation according to the cpu features, capped by max_level,
+// returns the selected level. calling this function is optional, when not called,
+// the best implementation is selected on first use
+uint32_t nal_unit_scanner_init(uint32_t max_level);
+
+const char* nal_unit_scanner_get_name(uint32_t level);
+
+// returns the first position p in [cur_pos, end_pos - 1) where p[0] and p[1] are both zero,
+// or end_pos when there is no such position. zero pairs are the prefix of both start codes
+// and emulation prevention sequences (00 00 0x)
+const u_char* nal_unit_scanner_find_zero_pair(
+	const u_char* cur_pos,
+	const u_char* end_pos);
+
+#endif // __NAL_UNIT_SCANNER_H__
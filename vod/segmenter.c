@@ -1,4 +1,5 @@
 #include "segmenter.h"
+#include "input/frame_list.h"
 
 // constants
 #define MAX_SEGMENT_COUNT (100000)
@@ -32,6 +33,17 @@ typedef struct {
 	uint32_t last_boundary;
 } segmenter_boundary_iterator_context_t;
 
+typedef struct {
+	u_char file_key[MEDIA_CLIP_KEY_SIZE];
+	uint32_t track_index;
+	uint32_t timescale;
+	uint32_t duration_millis;
+	uint32_t segment_count;
+	uint32_t segment_duration;
+	uint32_t bootstrap_segments_count;
+	// followed by bootstrap_segments_durations
+} segment_durations_cache_key_t;
+
 vod_status_t
 segmenter_init_config(segmenter_conf_t* conf, vod_pool_t* pool)
 {
@@ -55,6 +67,11 @@ segmenter_init_config(segmenter_conf_t* conf, vod_pool_t* pool)
 			conf->parse_type |= PARSE_FLAG_FRAMES_IS_KEY;
 		}
 	}
+	else if (conf->get_segment_durations == segmenter_get_segment_durations_key_frames &&
+		conf->align_to_key_frames)
+	{
+		conf->parse_type = PARSE_FLAG_KEY_FRAME_TIMES;
+	}
 	else
 	{
 		conf->parse_type = 0;
@@ -450,7 +467,7 @@ segmenter_get_start_end_ranges_gop(
 		start = 0;
 	}
 
-	end = time - clip_time + conf->gop_look_ahead;
+	end = time - clip_time + params->duration + conf->gop_look_ahead;
 	if (end > clip_duration)
 	{
 		end = clip_duration;
@@ -492,6 +509,39 @@ segmenter_get_start_end_ranges_gop(
 	return VOD_OK;
 }
 
+vod_status_t
+segmenter_get_sprite_start_time(
+	request_context_t* request_context,
+	media_clip_timing_t* timing,
+	uint32_t sprite_duration,
+	uint32_t sprite_index,
+	uint64_t* result)
+{
+	uint32_t* cur_duration;
+	uint32_t* end_duration = timing->durations + timing->total_count;
+	uint64_t* cur_clip_time;
+	uint32_t sprite_count;
+
+	// the sprites restart at the beginning of each clip, so that a sprite never crosses a clip boundary
+	for (cur_duration = timing->durations, cur_clip_time = timing->times;
+		cur_duration < end_duration;
+		cur_duration++, cur_clip_time++)
+	{
+		sprite_count = vod_div_ceil(*cur_duration, sprite_duration);
+		if (sprite_index < sprite_count)
+		{
+			*result = *cur_clip_time + (uint64_t)sprite_index * sprite_duration;
+			return VOD_OK;
+		}
+
+		sprite_index -= sprite_count;
+	}
+
+	vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+		"segmenter_get_sprite_start_time: invalid sprite index, exceeds the clips by %uD", sprite_index);
+	return VOD_BAD_REQUEST;
+}
+
 vod_status_t
 segmenter_get_start_end_ranges_no_discontinuity(
 	get_clip_ranges_params_t* params,
@@ -1788,48 +1838,21 @@ segmenter_boundary_iterator_skip(segmenter_boundary_iterator_context_t* context,
 	}
 }
 
-vod_status_t 
-segmenter_get_segment_durations_accurate(
-	request_context_t* request_context,
+static media_track_t*
+segmenter_get_main_track(
 	segmenter_conf_t* conf,
 	media_set_t* media_set,
 	media_sequence_t* sequence,
 	uint32_t media_type,
-	segment_durations_t* result)
+	media_track_t** ref_track,
+	uint32_t* duration_millis)
 {
-	segmenter_boundary_iterator_context_t boundary_iterator;
-	media_track_t* cur_track;
-	media_track_t* last_track;
-	media_track_t* main_track = NULL;
-	media_track_t* ref_track = NULL;
-	segment_duration_item_t* cur_item;
 	media_sequence_t* sequences_end;
 	media_sequence_t* cur_sequence;
-	input_frame_t* last_frame;
-	input_frame_t* cur_frame;
-	uint64_t total_duration;
-	uint32_t segment_index = 0;
-	uint64_t accum_duration = 0;
-	uint64_t segment_start = 0;
-	uint64_t segment_limit_millis;
-	uint64_t segment_limit;
-	uint64_t cur_duration;
-	uint32_t duration_millis;
-	bool_t align_to_key_frames;
-
-	if (media_set->timing.durations != NULL)
-	{
-		// in case of a playlist fall back to estimate
-		return segmenter_get_segment_durations_estimate(
-			request_context,
-			conf,
-			media_set,
-			sequence,
-			media_type,
-			result);
-	}
+	media_track_t* main_track = NULL;
+	media_track_t* last_track;
+	media_track_t* cur_track;
 
-	// get the maximum duration and main track (=first video track if exists, or first audio track otherwise)
 	if (sequence != NULL)
 	{
 		cur_sequence = sequence;
@@ -1841,7 +1864,8 @@ segmenter_get_segment_durations_accurate(
 		sequences_end = media_set->sequences_end;
 	}
 
-	duration_millis = 0;
+	*ref_track = NULL;
+	*duration_millis = 0;
 	for (; cur_sequence < sequences_end; cur_sequence++)
 	{
 		last_track = cur_sequence->filtered_clips[0].last_track;
@@ -1858,29 +1882,29 @@ segmenter_get_segment_durations_accurate(
 				main_track = cur_track;
 			}
 
-			if (ref_track == NULL)
+			if (*ref_track == NULL)
 			{
-				ref_track = cur_track;
-				duration_millis = cur_track->media_info.duration_millis;
+				*ref_track = cur_track;
+				*duration_millis = cur_track->media_info.duration_millis;
 			}
 			else
 			{
 				switch (conf->manifest_duration_policy)
 				{
 				case MDP_MAX:
-					if (cur_track->media_info.duration_millis > duration_millis)
+					if (cur_track->media_info.duration_millis > *duration_millis)
 					{
-						ref_track = cur_track;
-						duration_millis = cur_track->media_info.duration_millis;
+						*ref_track = cur_track;
+						*duration_millis = cur_track->media_info.duration_millis;
 					}
 					break;
 
 				case MDP_MIN:
 					if (cur_track->media_info.duration_millis > 0 &&
-						(duration_millis == 0 || cur_track->media_info.duration_millis < duration_millis))
+						(*duration_millis == 0 || cur_track->media_info.duration_millis < *duration_millis))
 					{
-						ref_track = cur_track;
-						duration_millis = cur_track->media_info.duration_millis;
+						*ref_track = cur_track;
+						*duration_millis = cur_track->media_info.duration_millis;
 					}
 					break;
 				}
@@ -1888,6 +1912,55 @@ segmenter_get_segment_durations_accurate(
 		}
 	}
 
+	return main_track;
+}
+
+vod_status_t 
+segmenter_get_segment_durations_accurate(
+	request_context_t* request_context,
+	segmenter_conf_t* conf,
+	media_set_t* media_set,
+	media_sequence_t* sequence,
+	uint32_t media_type,
+	segment_durations_t* result)
+{
+	segmenter_boundary_iterator_context_t boundary_iterator;
+	media_track_t* main_track;
+	media_track_t* ref_track;
+	segment_duration_item_t* cur_item;
+	frame_list_iterator_t frames;
+	input_frame_t* cur_frame;
+	uint64_t total_duration;
+	uint32_t segment_index = 0;
+	uint64_t accum_duration = 0;
+	uint64_t segment_start = 0;
+	uint64_t segment_limit_millis;
+	uint64_t segment_limit;
+	uint64_t cur_duration;
+	uint32_t duration_millis;
+	bool_t align_to_key_frames;
+
+	if (media_set->timing.durations != NULL)
+	{
+		// in case of a playlist fall back to estimate
+		return segmenter_get_segment_durations_estimate(
+			request_context,
+			conf,
+			media_set,
+			sequence,
+			media_type,
+			result);
+	}
+
+	// get the maximum duration and main track (=first video track if exists, or first audio track otherwise)
+	main_track = segmenter_get_main_track(
+		conf,
+		media_set,
+		sequence,
+		media_type,
+		&ref_track,
+		&duration_millis);
+
 	if (main_track == NULL)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
@@ -1940,8 +2013,7 @@ segmenter_get_segment_durations_accurate(
 
 	// Note: assuming a single frame list part
 	cur_item = result->items - 1;
-	last_frame = main_track->frames.last_frame;
-	cur_frame = main_track->frames.first_frame;
+	frame_list_iterator_init(&frames, &main_track->frames);
 
 	align_to_key_frames = conf->align_to_key_frames && main_track->media_info.media_type == MEDIA_TYPE_VIDEO;
 
@@ -1950,8 +2022,10 @@ segmenter_get_segment_durations_accurate(
 	{
 		segment_limit = rescale_time(conf->bootstrap_segments_end[0], 1000, result->timescale);
 
-		for (; cur_frame < last_frame; cur_frame++)
+		for (; frame_list_iterator_fill(&frames); frames.cur_frame++)
 		{
+			cur_frame = frames.cur_frame;
+
 			while (accum_duration >= segment_limit && segment_index + 1 < result->segment_count &&
 				(!align_to_key_frames || cur_frame->key_frame))
 			{
@@ -1987,8 +2061,10 @@ post_bootstrap:
 	segment_limit_millis = conf->bootstrap_segments_total_duration + conf->segment_duration;
 	segment_limit = rescale_time(segment_limit_millis, 1000, result->timescale);
 
-	for (; cur_frame < last_frame; cur_frame++)
+	for (; frame_list_iterator_fill(&frames); frames.cur_frame++)
 	{
+		cur_frame = frames.cur_frame;
+
 		while (accum_duration >= segment_limit && segment_index + 1 < result->segment_count &&
 			(!align_to_key_frames || cur_frame->key_frame))
 		{
@@ -2088,3 +2164,329 @@ post_bootstrap:
 
 	return VOD_OK;
 }
+
+static vod_status_t
+segmenter_get_segment_durations_cache_key(
+	request_context_t* request_context,
+	segmenter_conf_t* conf,
+	media_track_t* main_track,
+	uint32_t duration_millis,
+	segment_durations_t* result,
+	vod_str_t* key)
+{
+	segment_durations_cache_key_t* header;
+	size_t bootstrap_size;
+
+	bootstrap_size = sizeof(conf->bootstrap_segments_durations[0]) * conf->bootstrap_segments_count;
+
+	header = vod_alloc(request_context->pool, sizeof(*header) + bootstrap_size);
+	if (header == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"segmenter_get_segment_durations_cache_key: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(header, sizeof(*header));
+	vod_memcpy(header->file_key, main_track->file_info.source->file_key, sizeof(header->file_key));
+	header->track_index = main_track->index;
+	header->timescale = result->timescale;
+	header->duration_millis = duration_millis;
+	header->segment_count = result->segment_count;
+	header->segment_duration = conf->segment_duration;
+	header->bootstrap_segments_count = conf->bootstrap_segments_count;
+
+	if (bootstrap_size > 0)
+	{
+		vod_memcpy(header + 1, conf->bootstrap_segments_durations, bootstrap_size);
+	}
+
+	key->data = (u_char*)header;
+	key->len = sizeof(*header) + bootstrap_size;
+
+	return VOD_OK;
+}
+
+static bool_t
+segmenter_get_segment_durations_cache_fetch(
+	request_context_t* request_context,
+	segment_durations_cache_t* cache,
+	vod_str_t* key,
+	segment_durations_t* result)
+{
+	segment_durations_t* cached;
+	vod_str_t buffer;
+	size_t items_size;
+
+	if (!cache->fetch(cache->context, key, &buffer))
+	{
+		return FALSE;
+	}
+
+	if (buffer.len < sizeof(*cached))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_segment_durations_cache_fetch: size %uz smaller than header size", buffer.len);
+		return FALSE;
+	}
+
+	cached = (segment_durations_t*)buffer.data;
+	items_size = sizeof(result->items[0]) * cached->item_count;
+	if (buffer.len != sizeof(*cached) + items_size)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_segment_durations_cache_fetch: size %uz does not match item count %uD",
+			buffer.len, cached->item_count);
+		return FALSE;
+	}
+
+	result->items = vod_alloc(request_context->pool, items_size + 1);
+	if (result->items == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"segmenter_get_segment_durations_cache_fetch: vod_alloc failed");
+		return FALSE;
+	}
+
+	vod_memcpy(result->items, cached + 1, items_size);
+	result->item_count = cached->item_count;
+	result->segment_count = cached->segment_count;
+	result->timescale = cached->timescale;
+	result->discontinuities = cached->discontinuities;
+	result->start_time = cached->start_time;
+	result->end_time = cached->end_time;
+	result->duration = cached->duration;
+
+	return TRUE;
+}
+
+static void
+segmenter_get_segment_durations_cache_store(
+	request_context_t* request_context,
+	segment_durations_cache_t* cache,
+	vod_str_t* key,
+	segment_durations_t* durations)
+{
+	segment_durations_t* header;
+	vod_str_t buffer;
+	size_t items_size;
+
+	items_size = sizeof(durations->items[0]) * durations->item_count;
+
+	header = vod_alloc(request_context->pool, sizeof(*header) + items_size);
+	if (header == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"segmenter_get_segment_durations_cache_store: vod_alloc failed");
+		return;
+	}
+
+	*header = *durations;
+	header->items = NULL;
+	vod_memcpy(header + 1, durations->items, items_size);
+
+	buffer.data = (u_char*)header;
+	buffer.len = sizeof(*header) + items_size;
+
+	cache->store(cache->context, key, &buffer);
+}
+
+vod_status_t
+segmenter_get_segment_durations_key_frames(
+	request_context_t* request_context,
+	segmenter_conf_t* conf,
+	media_set_t* media_set,
+	media_sequence_t* sequence,
+	uint32_t media_type,
+	segment_durations_t* result)
+{
+	segmenter_boundary_iterator_context_t boundary_iterator;
+	segment_durations_cache_t* cache;
+	media_key_frame_times_t* key_frame_times;
+	segment_duration_item_t* cur_item;
+	media_track_t* main_track;
+	media_track_t* ref_track;
+	vod_status_t rc;
+	vod_str_t cache_key;
+	uint64_t* last_time;
+	uint64_t* cur_time;
+	uint64_t key_frame_time;
+	uint64_t total_duration;
+	uint64_t segment_start = 0;
+	uint64_t segment_limit;
+	uint64_t cur_duration;
+	uint32_t segment_limit_millis;
+	uint32_t segment_index = 0;
+	uint32_t duration_millis;
+
+	if (media_set->timing.durations != NULL)
+	{
+		// in case of a playlist fall back to estimate
+		return segmenter_get_segment_durations_estimate(
+			request_context,
+			conf,
+			media_set,
+			sequence,
+			media_type,
+			result);
+	}
+
+	main_track = segmenter_get_main_track(
+		conf,
+		media_set,
+		sequence,
+		media_type,
+		&ref_track,
+		&duration_millis);
+
+	if (main_track == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_segment_durations_key_frames: didnt get any tracks");
+		return VOD_UNEXPECTED;
+	}
+
+	// the key frame times are available only for video tracks of unclipped mp4 files that have an stss atom,
+	// without key frame alignment the estimate is off by less than a frame
+	key_frame_times = main_track->key_frame_times;
+	if (main_track->media_info.media_type != MEDIA_TYPE_VIDEO ||
+		!conf->align_to_key_frames ||
+		key_frame_times == NULL)
+	{
+		return segmenter_get_segment_durations_estimate(
+			request_context,
+			conf,
+			media_set,
+			sequence,
+			media_type,
+			result);
+	}
+
+	// get the segment count
+	result->segment_count = conf->get_segment_count(conf, duration_millis);
+	if (result->segment_count > MAX_SEGMENT_COUNT)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_segment_durations_key_frames: segment count %uD is invalid", result->segment_count);
+		return VOD_BAD_DATA;
+	}
+
+	result->timescale = main_track->media_info.timescale;
+	result->discontinuities = 0;
+
+	// try to fetch from cache
+	cache = media_set->segment_durations_cache;
+	if (cache != NULL && main_track->file_info.source != NULL)
+	{
+		rc = segmenter_get_segment_durations_cache_key(
+			request_context,
+			conf,
+			main_track,
+			duration_millis,
+			result,
+			&cache_key);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		if (segmenter_get_segment_durations_cache_fetch(request_context, cache, &cache_key, result))
+		{
+			return VOD_OK;
+		}
+	}
+	else
+	{
+		cache = NULL;
+	}
+
+	// allocate the result buffer
+	result->items = vod_alloc(request_context->pool, sizeof(*result->items) * result->segment_count);
+	if (result->items == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"segmenter_get_segment_durations_key_frames: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	cur_item = result->items - 1;
+
+	segmenter_boundary_iterator_init(&boundary_iterator, conf, result->segment_count);
+	segment_limit_millis = segmenter_boundary_iterator_next(&boundary_iterator);
+	segment_limit = segment_limit_millis != UINT_MAX ?
+		rescale_time(segment_limit_millis, 1000, result->timescale) : ULLONG_MAX;
+
+	// a segment starts on the first key frame that is at or after the segment boundary
+	cur_time = key_frame_times->times;
+	last_time = cur_time + key_frame_times->count;
+	for (; cur_time < last_time; cur_time++)
+	{
+		key_frame_time = rescale_time(*cur_time, key_frame_times->timescale, result->timescale);
+
+		while (key_frame_time >= segment_limit)
+		{
+			// get the current duration and update to array
+			cur_duration = key_frame_time - segment_start;
+			if (cur_item < result->items || cur_duration != cur_item->duration)
+			{
+				cur_item++;
+				cur_item->repeat_count = 0;
+				cur_item->segment_index = segment_index;
+				cur_item->time = segment_start;
+				cur_item->duration = cur_duration;
+				cur_item->discontinuity = FALSE;
+			}
+			cur_item->repeat_count++;
+
+			// move to the next segment
+			segment_index++;
+			segment_start = key_frame_time;
+			segment_limit_millis = segmenter_boundary_iterator_next(&boundary_iterator);
+			segment_limit = segment_limit_millis != UINT_MAX ?
+				rescale_time(segment_limit_millis, 1000, result->timescale) : ULLONG_MAX;
+		}
+	}
+
+	// add the last segment / empty segments after the last keyframe
+	total_duration = rescale_time(key_frame_times->duration, key_frame_times->timescale, result->timescale);
+
+	while (segment_index < result->segment_count)
+	{
+		// get the current duration and update to array
+		cur_duration = total_duration - segment_start;
+		if (cur_item < result->items || cur_duration != cur_item->duration)
+		{
+			cur_item++;
+			cur_item->repeat_count = 0;
+			cur_item->segment_index = segment_index;
+			cur_item->time = segment_start;
+			cur_item->duration = cur_duration;
+			cur_item->discontinuity = FALSE;
+		}
+		cur_item->repeat_count++;
+
+		// move to the next segment
+		segment_index++;
+		segment_start = total_duration;
+	}
+
+	result->item_count = cur_item + 1 - result->items;
+
+	// remove any empty segments from the end
+	if (result->item_count > 0 && cur_item->duration == 0)
+	{
+		result->item_count--;
+		result->segment_count -= cur_item->repeat_count;
+	}
+
+	result->start_time = 0;
+	result->end_time = duration_millis;
+	result->duration = duration_millis;
+
+	if (cache != NULL)
+	{
+		segmenter_get_segment_durations_cache_store(request_context, cache, &cache_key, result);
+	}
+
+	return VOD_OK;
+}
@@ -40,6 +40,12 @@ typedef struct {
 	uint64_t duration;
 } segment_durations_t;
 
+typedef struct segment_durations_cache_s {
+	void* context;
+	bool_t (*fetch)(void* context, vod_str_t* key, vod_str_t* buffer);
+	void (*store)(void* context, vod_str_t* key, vod_str_t* buffer);
+} segment_durations_cache_t;
+
 typedef struct {
 	request_context_t* request_context;
 	segmenter_conf_t* conf;
@@ -57,6 +63,7 @@ typedef struct {
 
 	// gop
 	uint64_t time;
+	uint32_t duration;		// 0 for a single thumbnail, the duration covered by the thumbnails for sprites
 } get_clip_ranges_params_t;
 
 typedef struct {
@@ -85,7 +92,7 @@ struct segmenter_conf_s {
 	bool_t align_to_key_frames;
 	intptr_t live_window_duration;
 	segmenter_get_segment_count_t get_segment_count;			// last short / last long / last rounded
-	segmenter_get_segment_durations_t get_segment_durations;	// estimate / accurate
+	segmenter_get_segment_durations_t get_segment_durations;	// estimate / accurate / key frames
 	vod_uint_t manifest_duration_policy;
 	uintptr_t gop_look_behind;
 	uintptr_t gop_look_ahead;
@@ -158,6 +165,14 @@ vod_status_t segmenter_get_segment_durations_accurate(
 	uint32_t media_type,
 	segment_durations_t* result);
 
+vod_status_t segmenter_get_segment_durations_key_frames(
+	request_context_t* request_context,
+	segmenter_conf_t* conf,
+	media_set_t* media_set,
+	media_sequence_t* sequence,
+	uint32_t media_type,
+	segment_durations_t* result);
+
 // get segment index
 uint32_t segmenter_get_segment_index_no_discontinuity(
 	segmenter_conf_t* conf,
@@ -171,6 +186,14 @@ vod_status_t segmenter_get_segment_index_discontinuity(
 	uint64_t time_millis,
 	uint32_t* result);
 
+// sprites
+vod_status_t segmenter_get_sprite_start_time(
+	request_context_t* request_context,
+	media_clip_timing_t* timing,
+	uint32_t sprite_duration,
+	uint32_t sprite_index,
+	uint64_t* result);
+
 // get start end ranges
 vod_status_t segmenter_get_start_end_ranges_gop(
 	get_clip_ranges_params_t* params,
@@ -1,5 +1,6 @@
 #include "thumb_grabber.h"
 #include "../media_set.h"
+#include "../context_cache.h"
 
 #include <libavcodec/avcodec.h>
 
@@ -8,7 +9,20 @@
 #include <libavutil/imgutils.h>
 #endif // VOD_HAVE_LIB_SW_SCALE
 
+// constants
+#define THUMB_GRABBER_MAX_SPRITE_SIZE (8192)	// max width / height of a sprite
+
 // typedefs
+#if (VOD_HAVE_LIB_SW_SCALE)
+typedef struct {
+	frame_list_part_t* part;
+	input_frame_t* frame;		// a key frame
+	uint64_t dts;
+	uint32_t first_tile;
+	uint32_t tile_count;		// the number of consecutive tiles that use this frame
+} thumb_grabber_sprite_frame_t;
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 typedef struct
 {
 	// fixed
@@ -23,6 +37,14 @@ typedef struct
 	AVPacket output_packet;
 	void* resize_buffer;
 	int has_frame;
+	uint32_t decoder_threads;
+	context_cache_key_t decoder_key;
+	context_cache_key_t encoder_key;
+	bool_t encoder_idle;
+#if (VOD_HAVE_LIB_SW_SCALE)
+	struct SwsContext *sws_ctx;
+	context_cache_key_t sws_key;
+#endif // VOD_HAVE_LIB_SW_SCALE
 
 	// frame state
 	frame_list_part_t cur_frame_part;
@@ -38,6 +60,17 @@ typedef struct
 	u_char* frame_buffer;
 	uint32_t cur_frame_pos;
 
+#if (VOD_HAVE_LIB_SW_SCALE)
+	// sprite state
+	thumb_grabber_sprite_frame_t* sprite_frames_end;
+	thumb_grabber_sprite_frame_t* sprite_cur_frame;		// the next frame to read
+	thumb_grabber_sprite_frame_t* sprite_output_frame;	// the next frame expected from the decoder
+	AVFrame *canvas;
+	uint32_t sprite_columns;
+	uint32_t tile_width;
+	uint32_t tile_height;
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 } thumb_grabber_state_t;
 
 typedef struct {
@@ -50,6 +83,18 @@ typedef struct {
 static AVCodec *decoder_codec[VOD_CODEC_ID_COUNT];
 static AVCodec *encoder_codec = NULL;
 
+// Note: the decoder threads and the cached contexts are allocated and released on the main thread 
+//	(init state / pool cleanup), the processing itself may run on a thread pool.
+//	multi threaded decoders are freed when the request completes, and are not cached, 
+//	so decoder_threads_in_use covers all the decoder threads of the process
+static uint32_t decoder_threads_in_use = 0;
+
+static context_cache_t decoder_cache;
+static context_cache_t encoder_cache;
+#if (VOD_HAVE_LIB_SW_SCALE)
+static context_cache_t sws_cache;
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 static codec_id_mapping_t codec_mappings[] = {
 	{ VOD_CODEC_ID_AVC, AV_CODEC_ID_H264, "h264" },
 	{ VOD_CODEC_ID_HEVC, AV_CODEC_ID_H265, "h265" },
@@ -57,6 +102,33 @@ static codec_id_mapping_t codec_mappings[] = {
 	{ VOD_CODEC_ID_VP9, AV_CODEC_ID_VP9, "vp9" },
 };
 
+static void
+thumb_grabber_free_decoder(void* context)
+{
+	AVCodecContext* decoder = context;
+
+	avcodec_close(decoder);
+	av_freep(&decoder->extradata);
+	av_free(decoder);
+}
+
+static void
+thumb_grabber_free_encoder(void* context)
+{
+	AVCodecContext* encoder = context;
+
+	avcodec_close(encoder);
+	av_free(encoder);
+}
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+static void
+thumb_grabber_free_sws(void* context)
+{
+	sws_freeContext(context);
+}
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 void
 thumb_grabber_process_init(vod_log_t* log)
 {
@@ -68,6 +140,18 @@ thumb_grabber_process_init(vod_log_t* log)
 
 	vod_memzero(decoder_codec, sizeof(decoder_codec));
 
+	if (context_cache_init(&decoder_cache, thumb_grabber_free_decoder, log) != VOD_OK ||
+		context_cache_init(&encoder_cache, thumb_grabber_free_encoder, log) != VOD_OK
+#if (VOD_HAVE_LIB_SW_SCALE)
+		|| context_cache_init(&sws_cache, thumb_grabber_free_sws, log) != VOD_OK
+#endif // VOD_HAVE_LIB_SW_SCALE
+		)
+	{
+		vod_log_error(VOD_LOG_WARN, log, 0,
+			"thumb_grabber_process_init: context_cache_init failed, thumbnail capture is disabled");
+		return;
+	}
+
 	encoder_codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
 	if (encoder_codec == NULL)
 	{
@@ -103,21 +187,94 @@ thumb_grabber_free_state(void* context)
 		av_freep(state->resize_buffer);
 	}
 	av_frame_free(&state->decoded_frame);
-	avcodec_close(state->encoder);
-	av_free(state->encoder);
-	avcodec_close(state->decoder);
-	av_free(state->decoder);
+#if (VOD_HAVE_LIB_SW_SCALE)
+	if (state->canvas != NULL)
+	{
+		av_freep(&state->canvas->data[0]);
+		av_frame_free(&state->canvas);
+	}
+#endif // VOD_HAVE_LIB_SW_SCALE
+
+	// return the contexts to the cache of the worker, for use by subsequent requests
+	if (state->encoder != NULL)
+	{
+		if (state->encoder_idle)
+		{
+			context_cache_put(&encoder_cache, &state->encoder_key, state->encoder);
+		}
+		else
+		{
+			// the encoder may hold a pending frame / packet
+			thumb_grabber_free_encoder(state->encoder);
+		}
+	}
+
+	if (state->decoder != NULL)
+	{
+		if (state->decoder_threads > 1)
+		{
+			// the threads of the decoder are released with it, so that idle decoders do not hold threads
+			//	that are no longer counted in decoder_threads_in_use
+			thumb_grabber_free_decoder(state->decoder);
+		}
+		else
+		{
+			avcodec_flush_buffers(state->decoder);
+			context_cache_put(&decoder_cache, &state->decoder_key, state->decoder);
+		}
+	}
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+	if (state->sws_ctx != NULL)
+	{
+		context_cache_put(&sws_cache, &state->sws_key, state->sws_ctx);
+	}
+#endif // VOD_HAVE_LIB_SW_SCALE
+
+	decoder_threads_in_use -= state->decoder_threads;
 }
 
 static vod_status_t
 thumb_grabber_init_decoder(
 	request_context_t* request_context,
 	media_info_t* media_info,
+	uint32_t thread_count,
+	bool_t fast,
+	uint32_t lowres,
+	context_cache_key_t* key,
 	AVCodecContext** result)
 {
 	AVCodecContext *decoder;
+	vod_str_t* extra_data = &media_info->extra_data;
 	int avrc;
 
+	vod_memzero(key, sizeof(*key));
+	key->values[0] = media_info->codec_id;
+	key->values[1] = media_info->format;
+	key->values[2] = media_info->frames_timescale;
+	key->values[3] = media_info->u.video.width;
+	key->values[4] = media_info->u.video.height;
+	key->values[5] = thread_count;
+	key->values[6] = extra_data->len;
+	key->values[7] = vod_crc32_short(extra_data->data, extra_data->len);
+	key->values[8] = fast;
+	key->values[9] = lowres;
+
+	// Note: only single threaded decoders are cached
+	decoder = thread_count > 1 ? NULL : context_cache_get(&decoder_cache, key);
+	if (decoder != NULL)
+	{
+		if (decoder->extradata_size == (int)extra_data->len &&
+			vod_memcmp(decoder->extradata, extra_data->data, extra_data->len) == 0)
+		{
+			*result = decoder;
+			return VOD_OK;
+		}
+
+		// crc collision
+		thumb_grabber_free_decoder(decoder);
+	}
+
 	decoder = avcodec_alloc_context3(decoder_codec[media_info->codec_id]);
 	if (decoder == NULL) 
 	{
@@ -126,25 +283,59 @@ thumb_grabber_init_decoder(
 		return VOD_ALLOC_FAILED;
 	}
 
-	*result = decoder;
+	// Note: the extra data is copied since the decoder may outlive the request
+	if (extra_data->len > 0)
+	{
+		decoder->extradata = av_mallocz(extra_data->len + VOD_BUFFER_PADDING_SIZE);
+		if (decoder->extradata == NULL)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"thumb_grabber_init_decoder: av_mallocz failed");
+			av_free(decoder);
+			return VOD_ALLOC_FAILED;
+		}
+
+		vod_memcpy(decoder->extradata, extra_data->data, extra_data->len);
+		decoder->extradata_size = extra_data->len;
+	}
 
 	decoder->codec_tag = media_info->format;
 	decoder->time_base.num = 1;
 	decoder->time_base.den = media_info->frames_timescale;
 	decoder->pkt_timebase = decoder->time_base;
-	decoder->extradata = media_info->extra_data.data;
-	decoder->extradata_size = media_info->extra_data.len;
 	decoder->width = media_info->u.video.width;
 	decoder->height = media_info->u.video.height;
 
+	if (fast)
+	{
+		// the decoded frames are not used as references, and their artifacts are hidden by the downscale
+		decoder->skip_loop_filter = AVDISCARD_ALL;
+		decoder->flags2 |= AV_CODEC_FLAG2_FAST;
+		decoder->lowres = lowres;
+	}
+
+	if (thread_count > 1)
+	{
+		// Note: frames that are delayed by frame threading are collected by thumb_grabber_decode_flush
+		decoder->thread_count = thread_count;
+		decoder->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	}
+	else
+	{
+		decoder->thread_count = 1;
+	}
+
 	avrc = avcodec_open2(decoder, decoder_codec[media_info->codec_id], NULL);
 	if (avrc < 0)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"thumb_grabber_init_decoder: avcodec_open2 failed %d", avrc);
+		thumb_grabber_free_decoder(decoder);
 		return VOD_UNEXPECTED;
 	}
 
+	*result = decoder;
+
 	return VOD_OK;
 }
 
@@ -153,11 +344,23 @@ thumb_grabber_init_encoder(
 	request_context_t* request_context,
 	uint32_t width,
 	uint32_t height,
+	context_cache_key_t* key,
 	AVCodecContext** result)
 {
 	AVCodecContext *encoder;
 	int avrc;
 
+	vod_memzero(key, sizeof(*key));
+	key->values[0] = width;
+	key->values[1] = height;
+
+	encoder = context_cache_get(&encoder_cache, key);
+	if (encoder != NULL)
+	{
+		*result = encoder;
+		return VOD_OK;
+	}
+
 	encoder = avcodec_alloc_context3(encoder_codec);
 	if (encoder == NULL)
 	{
@@ -166,8 +369,6 @@ thumb_grabber_init_encoder(
 		return VOD_ALLOC_FAILED;
 	}
 
-	*result = encoder;
-
 	encoder->width = width;
 	encoder->height = height;
 	encoder->time_base = (AVRational){ 1, 1 };
@@ -178,9 +379,12 @@ thumb_grabber_init_encoder(
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"thumb_grabber_init_encoder: avcodec_open2 failed %d", avrc);
+		thumb_grabber_free_encoder(encoder);
 		return VOD_UNEXPECTED;
 	}
 
+	*result = encoder;
+
 	return VOD_OK;
 }
 
@@ -301,51 +505,114 @@ thumb_grabber_truncate_frames(
 	return VOD_OK;
 }
 
-vod_status_t
-thumb_grabber_init_state(
-	request_context_t* request_context,
-	media_track_t* track, 
-	request_params_t* request_params,
-	bool_t accurate,
-	write_callback_t write_callback,
-	void* write_context,
-	void** result)
+static vod_status_t
+thumb_grabber_validate_track(request_context_t* request_context, media_info_t* media_info)
 {
-	thumb_grabber_state_t* state;
-	vod_pool_cleanup_t *cln;
-	vod_status_t rc;
-	uint32_t output_width;
-	uint32_t output_height;
-	uint32_t frame_index;
-
-	if (decoder_codec[track->media_info.codec_id] == NULL)
+	if (decoder_codec[media_info->codec_id] == NULL)
 	{
 		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"thumb_grabber_init_state: no decoder was initialized for codec %uD", track->media_info.codec_id);
+			"thumb_grabber_validate_track: no decoder was initialized for codec %uD", media_info->codec_id);
 		return VOD_BAD_REQUEST;
 	}
 
-	if (track->media_info.u.video.width <= 0 || track->media_info.u.video.height <= 0)
+	if (media_info->u.video.width <= 0 || media_info->u.video.height <= 0)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"thumb_grabber_init_state: input width/height is zero");
+			"thumb_grabber_validate_track: input width/height is zero");
 		return VOD_BAD_DATA;
 	}
 
-	rc = thumb_grabber_truncate_frames(request_context, track, request_params->segment_time, accurate, &frame_index);
-	if (rc != VOD_OK)
+	return VOD_OK;
+}
+
+static void
+thumb_grabber_get_output_size(
+	media_info_t* media_info,
+	request_params_t* request_params,
+	uint32_t* output_width,
+	uint32_t* output_height)
+{
+	if (request_params->width != 0)
 	{
-		return rc;
+		*output_width = request_params->width;
+		if (request_params->height != 0)
+		{
+			*output_height = request_params->height;
+		}
+		else
+		{
+			*output_height = ((uint64_t)media_info->u.video.height * request_params->width) / media_info->u.video.width;
+		}
+	}
+	else
+	{
+		if (request_params->height != 0)
+		{
+			*output_width = ((uint64_t)media_info->u.video.width * request_params->height) / media_info->u.video.height;
+			*output_height = request_params->height;
+		}
+		else
+		{
+			*output_width = media_info->u.video.width;
+			*output_height = media_info->u.video.height;
+		}
 	}
+}
 
-	vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-		"thumb_grabber_init_state: frame index is %uD", frame_index);
+// returns TRUE if the frames can be decoded at a reduced quality / resolution, 
+// should be used only when decoding key frames that are downscaled by at least 2
+static bool_t
+thumb_grabber_is_fast_decode_possible(
+	media_info_t* media_info,
+	uint32_t output_width,
+	uint32_t output_height,
+	uint32_t* lowres)
+{
+	AVCodec* codec = decoder_codec[media_info->codec_id];
+	uint32_t width = media_info->u.video.width;
+	uint32_t height = media_info->u.video.height;
+
+	*lowres = 0;
+
+	if (output_width * 2 > width || output_height * 2 > height)
+	{
+		return FALSE;
+	}
+
+	// Note: max_lowres is zero for most codecs (e.g. h264)
+	while (*lowres < codec->max_lowres &&
+		(width >> (*lowres + 1)) >= output_width &&
+		(height >> (*lowres + 1)) >= output_height)
+	{
+		(*lowres)++;
+	}
+
+	return TRUE;
+}
+
+static vod_status_t
+thumb_grabber_init_common(
+	request_context_t* request_context,
+	media_info_t* media_info,
+	uint32_t output_width,
+	uint32_t output_height,
+	bool_t fast,
+	uint32_t lowres,
+	uint32_t decoder_threads,
+	uint32_t max_decoder_threads,
+	write_callback_t write_callback,
+	void* write_context,
+	thumb_grabber_state_t** result)
+{
+	thumb_grabber_state_t* state;
+	vod_pool_cleanup_t *cln;
+	vod_status_t rc;
 
 	state = vod_alloc(request_context->pool, sizeof(*state));
 	if (state == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"thumb_grabber_init_state: vod_alloc failed (1)");
+			"thumb_grabber_init_common: vod_alloc failed");
 		return VOD_ALLOC_FAILED;
 	}
 
@@ -354,6 +621,12 @@ thumb_grabber_init_state(
 	state->resize_buffer = NULL;
 	state->decoder = NULL;
 	state->encoder = NULL;
+	state->encoder_idle = TRUE;
+	state->decoder_threads = 0;
+#if (VOD_HAVE_LIB_SW_SCALE)
+	state->sws_ctx = NULL;
+	state->canvas = NULL;
+#endif // VOD_HAVE_LIB_SW_SCALE
 	av_init_packet(&state->output_packet);
 	state->output_packet.data = NULL;
 	state->output_packet.size = 0;
@@ -363,55 +636,55 @@ thumb_grabber_init_state(
 	if (cln == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"thumb_grabber_init_state: vod_pool_cleanup_add failed");
+			"thumb_grabber_init_common: vod_pool_cleanup_add failed");
 		return VOD_ALLOC_FAILED;
 	}
 
 	cln->handler = thumb_grabber_free_state;
 	cln->data = state;
 
-	rc = thumb_grabber_init_decoder(request_context, &track->media_info, &state->decoder);
-	if (rc != VOD_OK)
-	{
-		return rc;
-	}
-
-	if (request_params->width != 0)
+	// use multiple decoder threads as long as the total in this process does not exceed the limit
+	if (decoder_threads > 1 && decoder_threads_in_use < max_decoder_threads)
 	{
-		output_width = request_params->width;
-		if (request_params->height != 0)
+		state->decoder_threads = vod_min(decoder_threads, max_decoder_threads - decoder_threads_in_use);
+		if (state->decoder_threads > 1)
 		{
-			output_height = request_params->height;
+			decoder_threads_in_use += state->decoder_threads;
 		}
 		else
 		{
-			output_height = ((uint64_t)track->media_info.u.video.height * request_params->width) / track->media_info.u.video.width;
+			state->decoder_threads = 0;
 		}
 	}
-	else
+
+	rc = thumb_grabber_init_decoder(
+		request_context, 
+		media_info, 
+		state->decoder_threads, 
+		fast,
+		lowres,
+		&state->decoder_key, 
+		&state->decoder);
+	if (rc != VOD_OK)
 	{
-		if (request_params->height != 0)
-		{
-			output_width = ((uint64_t)track->media_info.u.video.width * request_params->height) / track->media_info.u.video.height;
-			output_height = request_params->height;
-		}
-		else
-		{
-			output_width = track->media_info.u.video.width;
-			output_height = track->media_info.u.video.height;
-		}
+		return rc;
 	}
 
 	if (output_width <= 0 || output_height <= 0)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"thumb_grabber_init_state: output width/height is zero");
+			"thumb_grabber_init_common: output width/height is zero");
 		return VOD_BAD_REQUEST;
 	}
 
 	// TODO: postpone the initialization of the encoder to after a frame is decoded
 
-	rc = thumb_grabber_init_encoder(request_context, output_width, output_height, &state->encoder);
+	rc = thumb_grabber_init_encoder(
+		request_context, 
+		output_width, 
+		output_height, 
+		&state->encoder_key, 
+		&state->encoder);
 	if (rc != VOD_OK)
 	{
 		return rc;
@@ -421,18 +694,14 @@ thumb_grabber_init_state(
 	if (state->decoded_frame == NULL)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"thumb_grabber_init_state: av_frame_alloc failed");
+			"thumb_grabber_init_common: av_frame_alloc failed");
 		return VOD_ALLOC_FAILED;
 	}
 
 	state->request_context = request_context;
 	state->write_callback = write_callback;
 	state->write_context = write_context;
-	state->cur_frame_part = track->frames;
-	state->cur_frame = track->frames.first_frame;
-	state->max_frame_size = thumb_grabber_get_max_frame_size(track, frame_index + 1);
 	state->frame_buffer = NULL;
-	state->skip_count = frame_index;
 	state->cur_frame_pos = 0;
 	state->first_time = TRUE;
 	state->frame_started = FALSE;
@@ -445,6 +714,91 @@ thumb_grabber_init_state(
 	return VOD_OK;
 }
 
+vod_status_t
+thumb_grabber_init_state(
+	request_context_t* request_context,
+	media_track_t* track, 
+	request_params_t* request_params,
+	bool_t accurate,
+	bool_t fast_decode,
+	uint32_t decoder_threads,
+	uint32_t max_decoder_threads,
+	write_callback_t write_callback,
+	void* write_context,
+	void** result)
+{
+	thumb_grabber_state_t* state;
+	vod_status_t rc;
+	uint32_t lowres = 0;
+	uint32_t output_width;
+	uint32_t output_height;
+	uint32_t frame_index;
+
+	rc = thumb_grabber_validate_track(request_context, &track->media_info);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = thumb_grabber_truncate_frames(request_context, track, request_params->segment_time, accurate, &frame_index);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+		"thumb_grabber_init_state: frame index is %uD", frame_index);
+
+	thumb_grabber_get_output_size(&track->media_info, request_params, &output_width, &output_height);
+
+	// a fast decode is possible only when the requested frame is a key frame
+	fast_decode = fast_decode && frame_index == 0 &&
+		thumb_grabber_is_fast_decode_possible(&track->media_info, output_width, output_height, &lowres);
+
+	rc = thumb_grabber_init_common(
+		request_context,
+		&track->media_info,
+		output_width,
+		output_height,
+		fast_decode,
+		lowres,
+		decoder_threads,
+		max_decoder_threads,
+		write_callback,
+		write_context,
+		&state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+	// get a cached scaler, assuming the decoder outputs frames of the video dimensions in yuv420p.
+	//	if the actual frames differ, the scaler is replaced in thumb_grabber_resize_frame
+	vod_memzero(&state->sws_key, sizeof(state->sws_key));
+	if (output_width != track->media_info.u.video.width ||
+		output_height != track->media_info.u.video.height)
+	{
+		state->sws_key.values[0] = track->media_info.u.video.width;
+		state->sws_key.values[1] = track->media_info.u.video.height;
+		state->sws_key.values[2] = AV_PIX_FMT_YUV420P;
+		state->sws_key.values[3] = output_width;
+		state->sws_key.values[4] = output_height;
+
+		state->sws_ctx = context_cache_get(&sws_cache, &state->sws_key);
+	}
+#endif // VOD_HAVE_LIB_SW_SCALE
+
+	state->cur_frame_part = track->frames;
+	state->cur_frame = track->frames.first_frame;
+	state->max_frame_size = thumb_grabber_get_max_frame_size(track, frame_index + 1);
+	state->skip_count = frame_index;
+
+	*result = state;
+
+	return VOD_OK;
+}
+
 static vod_status_t
 thumb_grabber_decode_flush(thumb_grabber_state_t* state)
 {
@@ -551,7 +905,7 @@ thumb_grabber_decode_frame(thumb_grabber_state_t* state, u_char* buffer)
 static vod_status_t
 thumb_grabber_resize_frame(thumb_grabber_state_t* state)
 {
-	struct SwsContext *sws_ctx = NULL;
+	struct SwsContext *sws_ctx;
 	AVFrame* input_frame = state->decoded_frame;
 	AVFrame* output_frame = NULL;
 	vod_status_t rc;
@@ -570,18 +924,26 @@ thumb_grabber_resize_frame(thumb_grabber_state_t* state)
 	output_frame->height = state->encoder->height;
 	output_frame->format = AV_PIX_FMT_YUV420P;
 
-	sws_ctx = sws_getContext(
+	// Note: sws_getCachedContext returns the cached scaler as is when the parameters match
+	sws_ctx = sws_getCachedContext(state->sws_ctx,
 		input_frame->width, input_frame->height, input_frame->format,
 		output_frame->width, output_frame->height, output_frame->format,
 		SWS_BICUBIC, NULL, NULL, NULL);
+	state->sws_ctx = sws_ctx;
 	if (sws_ctx == NULL)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_resize_frame: sws_getContext failed");
+			"thumb_grabber_resize_frame: sws_getCachedContext failed");
 		rc = VOD_UNEXPECTED;
 		goto end;
 	}
 
+	state->sws_key.values[0] = input_frame->width;
+	state->sws_key.values[1] = input_frame->height;
+	state->sws_key.values[2] = input_frame->format;
+	state->sws_key.values[3] = output_frame->width;
+	state->sws_key.values[4] = output_frame->height;
+
 	avrc = av_image_alloc(
 		output_frame->data, output_frame->linesize,
 		output_frame->width, output_frame->height, output_frame->format, 16);
@@ -606,93 +968,95 @@ thumb_grabber_resize_frame(thumb_grabber_state_t* state)
 
 end:
 
-	sws_freeContext(sws_ctx);
 	av_frame_free(&output_frame);
 	return rc;
 }
 #endif // VOD_HAVE_LIB_SW_SCALE
 
 static vod_status_t
-thumb_grabber_write_frame(thumb_grabber_state_t* state)
+thumb_grabber_encode_frame(thumb_grabber_state_t* state, AVFrame* frame)
 {
 	vod_status_t rc;
 	int avrc;
 
-	if (state->missing_frames > 0)
+	state->encoder_idle = FALSE;
+
+	avrc = avcodec_send_frame(state->encoder, frame);
+	if (avrc < 0)
 	{
-		rc = thumb_grabber_decode_flush(state);
-		if (rc != VOD_OK)
-		{
-			return rc;
-		}
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_encode_frame: avcodec_send_frame failed %d", avrc);
+		return VOD_UNEXPECTED;
 	}
 
-	if (!state->has_frame)
+	avrc = avcodec_receive_packet(state->encoder, &state->output_packet);
+	if (avrc < 0)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: no frames were decoded");
+			"thumb_grabber_encode_frame: avcodec_receive_packet failed %d", avrc);
 		return VOD_UNEXPECTED;
 	}
 
-#if (VOD_HAVE_LIB_SW_SCALE)
-	if (state->encoder->width != state->decoded_frame->width ||
-		state->encoder->height != state->decoded_frame->height)
+	state->encoder_idle = TRUE;
+
+	rc = state->write_callback(state->write_context, state->output_packet.data, state->output_packet.size);
+	if (rc != VOD_OK)
 	{
-		rc = thumb_grabber_resize_frame(state);
+		return rc;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_write_frame(thumb_grabber_state_t* state)
+{
+	vod_status_t rc;
+
+	if (state->missing_frames > 0)
+	{
+		rc = thumb_grabber_decode_flush(state);
 		if (rc != VOD_OK)
 		{
 			return rc;
 		}
 	}
-#endif // VOD_HAVE_LIB_SW_SCALE
-
-	avrc = avcodec_send_frame(state->encoder, state->decoded_frame);
-	if (avrc < 0)
-	{
-		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: avcodec_send_frame failed %d", avrc);
-		return VOD_UNEXPECTED;
-	}
 
-	avrc = avcodec_receive_packet(state->encoder, &state->output_packet);
-	if (avrc < 0)
+	if (!state->has_frame)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: avcodec_receive_packet failed %d", avrc);
+			"thumb_grabber_write_frame: no frames were decoded");
 		return VOD_UNEXPECTED;
 	}
 
-	rc = state->write_callback(state->write_context, state->output_packet.data, state->output_packet.size);
-	if (rc != VOD_OK)
+#if (VOD_HAVE_LIB_SW_SCALE)
+	if (state->encoder->width != state->decoded_frame->width ||
+		state->encoder->height != state->decoded_frame->height)
 	{
-		return rc;
+		rc = thumb_grabber_resize_frame(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
 	}
+#endif // VOD_HAVE_LIB_SW_SCALE
 
-	return VOD_OK;
+	return thumb_grabber_encode_frame(state, state->decoded_frame);
 }
 
-vod_status_t
-thumb_grabber_process(void* context)
+static vod_status_t
+thumb_grabber_read_frame(thumb_grabber_state_t* state, bool_t* processed_data, u_char** result)
 {
-	thumb_grabber_state_t* state = context;
 	u_char* read_buffer;
 	uint32_t read_size;
-	bool_t processed_data = FALSE;
 	vod_status_t rc;
 	bool_t frame_done;
 
 	for (;;)
 	{
-		// start a frame if needed
+		// start the frame if needed
 		if (!state->frame_started)
 		{
-			if (state->cur_frame >= state->cur_frame_part.last_frame)
-			{
-				state->cur_frame_part = *state->cur_frame_part.next;
-				state->cur_frame = state->cur_frame_part.first_frame;
-			}
-
-			// start the frame
 			rc = state->cur_frame_part.frames_source->start_frame(
 				state->cur_frame_part.frames_source_context,
 				state->cur_frame,
@@ -718,10 +1082,10 @@ thumb_grabber_process(void* context)
 				return rc;
 			}
 
-			if (!processed_data && !state->first_time)
+			if (!*processed_data && !state->first_time)
 			{
 				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-					"thumb_grabber_process: no data was handled, probably a truncated file");
+					"thumb_grabber_read_frame: no data was handled, probably a truncated file");
 				return VOD_BAD_DATA;
 			}
 
@@ -729,7 +1093,7 @@ thumb_grabber_process(void* context)
 			return VOD_AGAIN;
 		}
 
-		processed_data = TRUE;
+		*processed_data = TRUE;
 
 		if (!frame_done)
 		{
@@ -742,7 +1106,7 @@ thumb_grabber_process(void* context)
 				if (state->frame_buffer == NULL)
 				{
 					vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
-						"thumb_grabber_process: vod_alloc failed");
+						"thumb_grabber_read_frame: vod_alloc failed");
 					return VOD_ALLOC_FAILED;
 				}
 			}
@@ -760,6 +1124,36 @@ thumb_grabber_process(void* context)
 			read_buffer = state->frame_buffer;
 		}
 
+		state->frame_started = FALSE;
+
+		*result = read_buffer;
+		return VOD_OK;
+	}
+}
+
+vod_status_t
+thumb_grabber_process(void* context)
+{
+	thumb_grabber_state_t* state = context;
+	u_char* read_buffer;
+	bool_t processed_data = FALSE;
+	vod_status_t rc;
+
+	for (;;)
+	{
+		// move to the next part if needed
+		if (!state->frame_started && state->cur_frame >= state->cur_frame_part.last_frame)
+		{
+			state->cur_frame_part = *state->cur_frame_part.next;
+			state->cur_frame = state->cur_frame_part.first_frame;
+		}
+
+		rc = thumb_grabber_read_frame(state, &processed_data, &read_buffer);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
 		// decode the frame
 		rc = thumb_grabber_decode_frame(state, read_buffer);
 		if (rc != VOD_OK)
@@ -777,6 +1171,475 @@ thumb_grabber_process(void* context)
 
 		// move to the next frame
 		state->cur_frame++;
-		state->frame_started = FALSE;
 	}
 }
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+vod_status_t
+thumb_grabber_get_sprite_tile_size(
+	request_context_t* request_context,
+	media_info_t* media_info,
+	request_params_t* request_params,
+	uint32_t columns,
+	uint32_t rows,
+	uint32_t* tile_width,
+	uint32_t* tile_height)
+{
+	if (media_info->u.video.width <= 0 || media_info->u.video.height <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_get_sprite_tile_size: input width/height is zero");
+		return VOD_BAD_DATA;
+	}
+
+	thumb_grabber_get_output_size(media_info, request_params, tile_width, tile_height);
+
+	// the tiles must be aligned to the chroma planes of the canvas
+	*tile_width &= ~1;
+	*tile_height &= ~1;
+
+	if (*tile_width <= 0 || *tile_height <= 0 ||
+		(uint64_t)*tile_width * columns > THUMB_GRABBER_MAX_SPRITE_SIZE ||
+		(uint64_t)*tile_height * rows > THUMB_GRABBER_MAX_SPRITE_SIZE)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_get_sprite_tile_size: invalid tile size %uDx%uD", *tile_width, *tile_height);
+		return VOD_BAD_REQUEST;
+	}
+
+	return VOD_OK;
+}
+
+static uint32_t
+thumb_grabber_add_sprite_tile(
+	thumb_grabber_sprite_frame_t* frames,
+	uint32_t frame_count,
+	frame_list_part_t* part,
+	input_frame_t* frame,
+	uint64_t dts,
+	uint32_t tile_index)
+{
+	thumb_grabber_sprite_frame_t* cur;
+
+	if (frame_count > 0 && frames[frame_count - 1].frame == frame)
+	{
+		frames[frame_count - 1].tile_count++;
+		return frame_count;
+	}
+
+	cur = &frames[frame_count];
+	cur->part = part;
+	cur->frame = frame;
+	cur->dts = dts;
+	cur->first_tile = tile_index;
+	cur->tile_count = 1;
+
+	return frame_count + 1;
+}
+
+static vod_status_t
+thumb_grabber_get_sprite_frames(
+	request_context_t* request_context,
+	media_track_t* track,
+	uint64_t start_time,
+	uint32_t interval,
+	uint32_t tile_count,
+	thumb_grabber_sprite_frame_t** result,
+	uint32_t* result_count,
+	uint32_t* max_frame_size)
+{
+	thumb_grabber_sprite_frame_t* frames;
+	frame_list_part_t* prev_part = NULL;
+	frame_list_part_t* part;
+	input_frame_t* prev_frame = NULL;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	uint64_t dts = track->clip_start_time + track->first_frame_time_offset;
+	uint64_t prev_dts = 0;
+	uint64_t prev_pts = 0;
+	uint64_t tile_time;
+	uint64_t pts;
+	uint32_t frame_count = 0;
+	uint32_t tile_index = 0;
+	uint32_t i;
+
+	if (track->frame_count <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_get_sprite_frames: did not find any frames (1)");
+		return VOD_BAD_REQUEST;
+	}
+
+	frames = vod_alloc(request_context->pool, sizeof(frames[0]) * tile_count);
+	if (frames == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"thumb_grabber_get_sprite_frames: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	part = &track->frames;
+	last_frame = part->last_frame;
+	cur_frame = part->first_frame;
+
+	tile_time = start_time + cur_frame->pts_delay;
+
+	for (;; cur_frame++)
+	{
+		if (cur_frame >= last_frame)
+		{
+			if (part->next == NULL)
+			{
+				break;
+			}
+			part = part->next;
+			cur_frame = part->first_frame;
+			last_frame = part->last_frame;
+		}
+
+		if (cur_frame->key_frame)
+		{
+			// the tiles up to this frame use either the previous key frame or this one, whichever is closer
+			pts = dts + cur_frame->pts_delay;
+			for (; tile_index < tile_count && tile_time <= pts; tile_index++, tile_time += interval)
+			{
+				if (prev_frame != NULL && tile_time - prev_pts < pts - tile_time)
+				{
+					frame_count = thumb_grabber_add_sprite_tile(frames, frame_count, prev_part, prev_frame, prev_dts, tile_index);
+				}
+				else
+				{
+					frame_count = thumb_grabber_add_sprite_tile(frames, frame_count, part, cur_frame, dts, tile_index);
+				}
+			}
+
+			prev_part = part;
+			prev_frame = cur_frame;
+			prev_dts = dts;
+			prev_pts = pts;
+		}
+
+		dts += cur_frame->duration;
+	}
+
+	// the tiles after the last key frame use it, as long as they are within the loaded frames
+	if (prev_frame != NULL)
+	{
+		for (; tile_index < tile_count && tile_time < dts; tile_index++, tile_time += interval)
+		{
+			frame_count = thumb_grabber_add_sprite_tile(frames, frame_count, prev_part, prev_frame, prev_dts, tile_index);
+		}
+	}
+
+	if (frame_count <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_get_sprite_frames: did not find any frames (2)");
+		return VOD_BAD_REQUEST;
+	}
+
+	*max_frame_size = 0;
+	for (i = 0; i < frame_count; i++)
+	{
+		if (frames[i].frame->size > *max_frame_size)
+		{
+			*max_frame_size = frames[i].frame->size;
+		}
+	}
+
+	*result = frames;
+	*result_count = frame_count;
+
+	return VOD_OK;
+}
+
+vod_status_t
+thumb_grabber_init_sprite_state(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	uint32_t columns,
+	uint32_t rows,
+	uint32_t interval,
+	bool_t fast_decode,
+	uint32_t decoder_threads,
+	uint32_t max_decoder_threads,
+	write_callback_t write_callback,
+	void* write_context,
+	void** result)
+{
+	thumb_grabber_sprite_frame_t* frames;
+	thumb_grabber_state_t* state;
+	AVFrame* canvas;
+	vod_status_t rc;
+	uint32_t lowres = 0;
+	uint32_t max_frame_size;
+	uint32_t frame_count;
+	uint32_t tile_width;
+	uint32_t tile_height;
+	int avrc;
+
+	rc = thumb_grabber_validate_track(request_context, &track->media_info);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = thumb_grabber_get_sprite_tile_size(
+		request_context,
+		&track->media_info,
+		request_params,
+		columns,
+		rows,
+		&tile_width,
+		&tile_height);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = thumb_grabber_get_sprite_frames(
+		request_context,
+		track,
+		request_params->segment_time,
+		interval,
+		columns * rows,
+		&frames,
+		&frame_count,
+		&max_frame_size);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+		"thumb_grabber_init_sprite_state: decoding %uD key frames", frame_count);
+
+	// the sprite frames are always key frames
+	fast_decode = fast_decode &&
+		thumb_grabber_is_fast_decode_possible(&track->media_info, tile_width, tile_height, &lowres);
+
+	rc = thumb_grabber_init_common(
+		request_context,
+		&track->media_info,
+		tile_width * columns,
+		tile_height * rows,
+		fast_decode,
+		lowres,
+		decoder_threads,
+		max_decoder_threads,
+		write_callback,
+		write_context,
+		&state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// allocate the canvas, the tiles that have no frame remain black
+	canvas = av_frame_alloc();
+	if (canvas == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_sprite_state: av_frame_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	state->canvas = canvas;
+
+	canvas->width = tile_width * columns;
+	canvas->height = tile_height * rows;
+	canvas->format = AV_PIX_FMT_YUV420P;
+
+	avrc = av_image_alloc(
+		canvas->data, canvas->linesize,
+		canvas->width, canvas->height, canvas->format, 16);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_sprite_state: av_image_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memset(canvas->data[0], 0, canvas->linesize[0] * canvas->height);
+	vod_memset(canvas->data[1], 0x80, canvas->linesize[1] * canvas->height / 2);
+	vod_memset(canvas->data[2], 0x80, canvas->linesize[2] * canvas->height / 2);
+
+	vod_memzero(&state->sws_key, sizeof(state->sws_key));
+
+	state->sprite_cur_frame = frames;
+	state->sprite_output_frame = frames;
+	state->sprite_frames_end = frames + frame_count;
+	state->sprite_columns = columns;
+	state->tile_width = tile_width;
+	state->tile_height = tile_height;
+	state->max_frame_size = max_frame_size;
+
+	*result = state;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_draw_tiles(thumb_grabber_state_t* state)
+{
+	thumb_grabber_sprite_frame_t* sprite_frame;
+	struct SwsContext *sws_ctx;
+	AVFrame* input_frame = state->decoded_frame;
+	AVFrame* canvas = state->canvas;
+	uint8_t* dst[4];
+	uint32_t tile_end;
+	uint32_t tile;
+	uint32_t x;
+	uint32_t y;
+
+	// match the frame by its pts, frames that the decoder dropped are skipped
+	for (sprite_frame = state->sprite_output_frame; ; sprite_frame++)
+	{
+		if (sprite_frame >= state->sprite_frames_end)
+		{
+			vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+				"thumb_grabber_draw_tiles: ignoring frame with unexpected pts %L", input_frame->pts);
+			return VOD_OK;
+		}
+
+		if (input_frame->pts == AV_NOPTS_VALUE ||
+			input_frame->pts == (int64_t)(sprite_frame->dts + sprite_frame->frame->pts_delay))
+		{
+			break;
+		}
+	}
+
+	state->sprite_output_frame = sprite_frame + 1;
+
+	sws_ctx = sws_getCachedContext(state->sws_ctx,
+		input_frame->width, input_frame->height, input_frame->format,
+		state->tile_width, state->tile_height, AV_PIX_FMT_YUV420P,
+		SWS_BICUBIC, NULL, NULL, NULL);
+	state->sws_ctx = sws_ctx;
+	if (sws_ctx == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_draw_tiles: sws_getCachedContext failed");
+		return VOD_UNEXPECTED;
+	}
+
+	state->sws_key.values[0] = input_frame->width;
+	state->sws_key.values[1] = input_frame->height;
+	state->sws_key.values[2] = input_frame->format;
+	state->sws_key.values[3] = state->tile_width;
+	state->sws_key.values[4] = state->tile_height;
+
+	dst[3] = NULL;
+
+	tile_end = sprite_frame->first_tile + sprite_frame->tile_count;
+	for (tile = sprite_frame->first_tile; tile < tile_end; tile++)
+	{
+		x = (tile % state->sprite_columns) * state->tile_width;
+		y = (tile / state->sprite_columns) * state->tile_height;
+
+		dst[0] = canvas->data[0] + y * canvas->linesize[0] + x;
+		dst[1] = canvas->data[1] + (y / 2) * canvas->linesize[1] + x / 2;
+		dst[2] = canvas->data[2] + (y / 2) * canvas->linesize[2] + x / 2;
+
+		sws_scale(sws_ctx,
+			(const uint8_t* const*)input_frame->data, input_frame->linesize, 0, input_frame->height,
+			dst, canvas->linesize);
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_sprite_flush(thumb_grabber_state_t* state)
+{
+	vod_status_t rc;
+	int avrc;
+
+	avrc = avcodec_send_packet(state->decoder, NULL);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_sprite_flush: avcodec_send_packet failed %d", avrc);
+		return VOD_BAD_DATA;
+	}
+
+	for (;;)
+	{
+		av_frame_unref(state->decoded_frame);
+
+		avrc = avcodec_receive_frame(state->decoder, state->decoded_frame);
+		if (avrc == AVERROR_EOF)
+		{
+			break;
+		}
+
+		if (avrc < 0)
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"thumb_grabber_sprite_flush: avcodec_receive_frame failed %d", avrc);
+			return VOD_BAD_DATA;
+		}
+
+		rc = thumb_grabber_draw_tiles(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+thumb_grabber_process_sprite(void* context)
+{
+	thumb_grabber_state_t* state = context;
+	thumb_grabber_sprite_frame_t* sprite_frame;
+	u_char* read_buffer;
+	bool_t processed_data = FALSE;
+	vod_status_t rc;
+
+	// decode only the key frames of the tiles, in order
+	for (; state->sprite_cur_frame < state->sprite_frames_end; state->sprite_cur_frame++)
+	{
+		if (!state->frame_started)
+		{
+			sprite_frame = state->sprite_cur_frame;
+			state->cur_frame_part = *sprite_frame->part;
+			state->cur_frame = sprite_frame->frame;
+			state->dts = sprite_frame->dts;
+		}
+
+		rc = thumb_grabber_read_frame(state, &processed_data, &read_buffer);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		rc = thumb_grabber_decode_frame(state, read_buffer);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		if (state->has_frame)
+		{
+			rc = thumb_grabber_draw_tiles(state);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+	}
+
+	// draw the frames delayed by the decoder
+	rc = thumb_grabber_sprite_flush(state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	return thumb_grabber_encode_frame(state, state->canvas);
+}
+#endif // VOD_HAVE_LIB_SW_SCALE
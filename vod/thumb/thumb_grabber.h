@@ -13,10 +13,42 @@ vod_status_t thumb_grabber_init_state(
 	media_track_t* track,
 	request_params_t* request_params,
 	bool_t accurate,
+	bool_t fast_decode,
+	uint32_t decoder_threads,
+	uint32_t max_decoder_threads,
 	write_callback_t write_callback,
 	void* write_context,
 	void** result);
 
 vod_status_t thumb_grabber_process(void* context);
 
+#if (VOD_HAVE_LIB_SW_SCALE)
+vod_status_t thumb_grabber_get_sprite_tile_size(
+	request_context_t* request_context,
+	media_info_t* media_info,
+	request_params_t* request_params,
+	uint32_t columns,
+	uint32_t rows,
+	uint32_t* tile_width,
+	uint32_t* tile_height);
+
+// captures a thumbnail every interval starting from request_params->segment_time, 
+// using the closest key frames, and tiles them into a single jpeg of columns x rows
+vod_status_t thumb_grabber_init_sprite_state(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	uint32_t columns,
+	uint32_t rows,
+	uint32_t interval,
+	bool_t fast_decode,
+	uint32_t decoder_threads,
+	uint32_t max_decoder_threads,
+	write_callback_t write_callback,
+	void* write_context,
+	void** result);
+
+vod_status_t thumb_grabber_process_sprite(void* context);
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 #endif //__THUMB_GRABBER_H__